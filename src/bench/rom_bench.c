@@ -0,0 +1,466 @@
+/* nftw */
+#define _XOPEN_SOURCE 700
+
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+
+/* Linux specific */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "../includes/rom_management.h"
+#include "../includes/rom_generator.h"
+#include "../includes/hex_dump.h"
+#include "../includes/wdfw_context.h"
+
+/* Maximum number of results kept for one run and one baseline. */
+#define MAXIMUM_RESULTS         128
+
+/* Default minimum time spent measuring a single benchmark. */
+#define DEFAULT_MINIMUM_TIME    0.5
+
+/* Number of rounds a benchmark is measured in. */
+#define BENCH_ROUNDS            5
+
+/* Default allowed slow down before a result is flagged, in percent. */
+#define DEFAULT_THRESHOLD       10.0
+
+/* Result of a single benchmark. */
+typedef struct {
+    char name[64];
+    double ns_per_byte;
+    double ns_per_op;
+    double ops_per_second;
+} bench_result;
+
+/* Synthetic rom image and the files derived from it. */
+typedef struct {
+    uint8_t *rom;
+    unsigned int number_of_blocks;
+    unsigned int block_size;
+    char rom_file[512];
+    char header_file[512];
+    char packed_file[512];
+    wdfw_context context; /* Resolves the files in the work directory */
+} bench_image;
+
+/* Operation measured by a benchmark. */
+typedef int (*bench_operation)(bench_image *image);
+
+/* Build a valid rom image with number_of_blocks blocks of block_size bytes. */
+static void build_bench_image(bench_image *image,
+    unsigned int number_of_blocks, unsigned int block_size);
+
+/* Run operation until minimum_time has passed and record its speed. */
+static int run_benchmark(char *name, bench_operation operation,
+    bench_image *image, size_t bytes_per_op, double minimum_time,
+    bench_result *result);
+
+/* Measured operations. */
+static int bench_create_rom_block_table(bench_image *image);
+static int bench_block_checksums(bench_image *image);
+static int bench_line_checksums(bench_image *image);
+static int bench_unpack_rom_image(bench_image *image);
+static int bench_pack_rom_image(bench_image *image);
+static int bench_format_hex_dump(bench_image *image);
+
+/* Store results as baseline. */
+static int save_baseline(char *baseline_file, bench_result *results,
+    unsigned int number_of_results);
+
+/* Compare results to a baseline and report regressions. */
+static int compare_baseline(char *baseline_file, bench_result *results,
+    unsigned int number_of_results, double threshold);
+
+/* Monotonic time in seconds. */
+static double current_time(void);
+
+/* nftw callback removing the files of the work directory. */
+static int remove_work_file(const char *path, const struct stat *st,
+    int type, struct FTW *ftw);
+
+/* Block layouts measured: number of blocks and block size. */
+static const unsigned int bench_layouts[][2] = {
+    { 1, 4 * 1024 },
+    { 4, 4 * 1024 },
+    { 9, 4 * 1024 },
+    { 1, 24 * 1024 },
+    { 4, 24 * 1024 },
+    { 9, 24 * 1024 },
+};
+
+static void display_usage(char *app_name)
+{
+    printf("Usage: %s [--save <baseline>] [--compare <baseline>] " \
+        "[--threshold <percent>] [--time <seconds>]\n", app_name);
+}
+
+int main(int argc, char *argv[])
+{
+    char *save_file = NULL;
+    char *compare_file = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    double minimum_time = DEFAULT_MINIMUM_TIME;
+    bench_result results[MAXIMUM_RESULTS];
+    unsigned int number_of_results = 0;
+    char work_template[] = "/tmp/wd_firmware_bench_XXXXXX";
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_file = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            compare_file = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            minimum_time = strtod(argv[++i], NULL);
+        } else {
+            display_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Baselines are given relative to the directory the benchmark is
+     * started from, the images live in a temporary work directory. */
+    int work_directory = -1;
+
+    if (mkdtemp(work_template) == NULL ||
+        (work_directory = open(work_template, O_RDONLY | O_DIRECTORY)) == -1) {
+        perror("main: mkdtemp");
+        exit(1);
+    }
+
+    printf("%-44s %12s %12s %14s\n", "benchmark", "ns/byte", "ns/op",
+        "ops/s");
+
+    unsigned int layout;
+    for (layout = 0; layout < sizeof(bench_layouts) /
+        sizeof(bench_layouts[0]); ++layout) {
+        bench_image image = {0};
+        char suffix[32];
+        char name[64];
+
+        build_bench_image(&image, bench_layouts[layout][0],
+            bench_layouts[layout][1]);
+
+        snprintf(suffix, sizeof(suffix), "%ux%uk", image.number_of_blocks,
+            image.block_size / 1024);
+        snprintf(image.rom_file, sizeof(image.rom_file), "rom_%s.bin",
+            suffix);
+        snprintf(image.header_file, sizeof(image.header_file),
+            "rom_%s/formatted_header", suffix);
+        snprintf(image.packed_file, sizeof(image.packed_file),
+            "packed_%s.bin", suffix);
+
+        /* The library output is discarded so it does not skew the
+         * results. */
+        init_wdfw_context(&image.context);
+        image.context.directory_fd = work_directory;
+        image.context.output = NULL;
+
+        int rom_fd = openat(work_directory, image.rom_file,
+            O_CREAT | O_WRONLY | O_TRUNC, 0666);
+        if (rom_fd == -1 || write(rom_fd, image.rom, ROM_IMAGE_SIZE) !=
+            ROM_IMAGE_SIZE) {
+            fprintf(stderr, "main: Could not write %s\n", image.rom_file);
+            exit(1);
+        }
+        close(rom_fd);
+
+        struct {
+            char *name;
+            bench_operation operation;
+            size_t bytes_per_op;
+        } benchmarks[] = {
+            { "create_rom_block_table", bench_create_rom_block_table,
+                image.number_of_blocks * sizeof(rom_block) },
+            { "calculate_rom_block_checksum_8", bench_block_checksums,
+                image.number_of_blocks * image.block_size },
+            { "calculate_line_checksum", bench_line_checksums,
+                image.number_of_blocks * sizeof(rom_block) },
+            { "unpack_rom_image", bench_unpack_rom_image, ROM_IMAGE_SIZE },
+            { "pack_rom_image", bench_pack_rom_image, ROM_IMAGE_SIZE },
+            { "format_hex_dump", bench_format_hex_dump, ROM_IMAGE_SIZE },
+        };
+
+        unsigned int j;
+        for (j = 0; j < sizeof(benchmarks) / sizeof(benchmarks[0]) &&
+            number_of_results < MAXIMUM_RESULTS; ++j) {
+            snprintf(name, sizeof(name), "%s/%s", benchmarks[j].name, suffix);
+
+            if (run_benchmark(name, benchmarks[j].operation, &image,
+                benchmarks[j].bytes_per_op, minimum_time,
+                &results[number_of_results]) != 0) {
+                fprintf(stderr, "main: Benchmark %s failed: %s\n", name,
+                    image.context.message);
+                exit(1);
+            }
+
+            printf("%-44s %12.3f %12.1f %14.1f\n", name,
+                results[number_of_results].ns_per_byte,
+                results[number_of_results].ns_per_op,
+                results[number_of_results].ops_per_second);
+            number_of_results += 1;
+        }
+
+        free(image.rom);
+    }
+
+    close(work_directory);
+
+    nftw(work_template, remove_work_file, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (save_file != NULL && save_baseline(save_file, results,
+        number_of_results) != 0) {
+        exit(1);
+    }
+
+    if (compare_file != NULL && compare_baseline(compare_file, results,
+        number_of_results, threshold) != 0) {
+        exit(1);
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Fill the image with erased flash (0xff) */
+/* Place the block header table at the start of the image */
+/* Place the blocks directly after each other behind the table */
+/* Calculate the block and header line checksums */
+static void build_bench_image(bench_image *image,
+    unsigned int number_of_blocks, unsigned int block_size)
+{
+    rom_generator_config config;
+
+    init_rom_generator_config(&config);
+    config.seed = 0x1234567;
+    config.min_blocks = number_of_blocks;
+    config.max_blocks = number_of_blocks;
+    config.min_block_size = block_size;
+    config.max_block_size = block_size;
+    config.entropy = 100;
+
+    image->number_of_blocks = number_of_blocks;
+    image->block_size = block_size;
+    image->rom = malloc(ROM_IMAGE_SIZE);
+    if (image->rom == NULL) {
+        perror("build_bench_image: malloc");
+        exit(1);
+    }
+
+    generate_rom_image(&config, 0, image->rom);
+}
+
+/* The measuring time is split over BENCH_ROUNDS rounds and the fastest round
+ * is reported, which filters out most scheduling and page cache noise. */
+static int run_benchmark(char *name, bench_operation operation,
+    bench_image *image, size_t bytes_per_op, double minimum_time,
+    bench_result *result)
+{
+    double best_ns_per_op = 0;
+
+    unsigned int round;
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        unsigned long iterations = 0;
+        double start = current_time();
+        double elapsed;
+
+        do {
+            if (operation(image) != 0) {
+                return -1;
+            }
+            iterations += 1;
+            elapsed = current_time() - start;
+        } while (elapsed < minimum_time / BENCH_ROUNDS || iterations < 3);
+
+        double ns_per_op = (elapsed * 1e9) / iterations;
+        if (round == 0 || ns_per_op < best_ns_per_op) {
+            best_ns_per_op = ns_per_op;
+        }
+    }
+
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->ns_per_op = best_ns_per_op;
+    result->ns_per_byte = best_ns_per_op / (bytes_per_op ? bytes_per_op : 1);
+    result->ops_per_second = 1e9 / best_ns_per_op;
+
+    return 0;
+}
+
+static int bench_create_rom_block_table(bench_image *image)
+{
+    unsigned int number_of_blocks;
+    rom_block *table = create_rom_block_table(image->rom, &number_of_blocks);
+
+    if (table == NULL || number_of_blocks != image->number_of_blocks) {
+        destroy_rom_block_table(table);
+        return -1;
+    }
+
+    destroy_rom_block_table(table);
+    return 0;
+}
+
+static int bench_block_checksums(bench_image *image)
+{
+    rom_block *table = (rom_block *) image->rom;
+
+    unsigned int i;
+    for (i = 0; i < image->number_of_blocks; ++i) {
+        uint32_t start_address = le_32_to_be(table[i].start_address);
+        uint32_t size = le_32_to_be(table[i].size);
+
+        if (calculate_rom_block_checksum_8(&image->rom[start_address],
+            size) != image->rom[start_address + size]) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int bench_line_checksums(bench_image *image)
+{
+    unsigned int i;
+    for (i = 0; i < image->number_of_blocks; ++i) {
+        uint8_t *line = image->rom + i * sizeof(rom_block);
+
+        if ((uint8_t) calculate_line_checksum(line) !=
+            line[sizeof(rom_block) - 1]) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int bench_unpack_rom_image(bench_image *image)
+{
+    return unpack_rom_image(&image->context, image->rom_file);
+}
+
+static int bench_pack_rom_image(bench_image *image)
+{
+    return pack_rom_image(&image->context, image->header_file,
+        image->packed_file);
+}
+
+/* The dump goes to the discarded library output, so only the formatting is
+ * measured. */
+static int bench_format_hex_dump(bench_image *image)
+{
+    hex_dump dump;
+
+    if (init_hex_dump(&image->context, &dump, 0, 512, 1) != 0) {
+        return -1;
+    }
+
+    feed_hex_dump(&image->context, &dump, image->rom, ROM_IMAGE_SIZE);
+    return finish_hex_dump(&image->context, &dump);
+}
+
+static int save_baseline(char *baseline_file, bench_result *results,
+    unsigned int number_of_results)
+{
+    FILE *output_file = fopen(baseline_file, "w");
+    if (output_file == NULL) {
+        fprintf(stderr, "save_baseline: Could not create %s\n",
+            baseline_file);
+        return -1;
+    }
+
+    fprintf(output_file, "# benchmark ns/byte\n");
+
+    unsigned int i;
+    for (i = 0; i < number_of_results; ++i) {
+        fprintf(output_file, "%s %.6f\n", results[i].name,
+            results[i].ns_per_byte);
+    }
+
+    fclose(output_file);
+    printf("Saved baseline to %s\n", baseline_file);
+    return 0;
+}
+
+/* Operations: */
+/* Read every "name ns/byte" line of the baseline */
+/* Flag results that are more than threshold percent slower */
+static int compare_baseline(char *baseline_file, bench_result *results,
+    unsigned int number_of_results, double threshold)
+{
+    char name[64];
+    double baseline_ns_per_byte;
+    unsigned int number_of_regressions = 0;
+    char line[256];
+
+    FILE *input_file = fopen(baseline_file, "r");
+    if (input_file == NULL) {
+        printf("No baseline %s to compare with\n", baseline_file);
+        return 0;
+    }
+
+    printf("\nComparing with %s (threshold %.1f%%)\n", baseline_file,
+        threshold);
+
+    while (fgets(line, sizeof(line), input_file) != NULL) {
+        if (line[0] == '#' ||
+            sscanf(line, "%63s %lf", name, &baseline_ns_per_byte) != 2) {
+            continue;
+        }
+
+        unsigned int i;
+        for (i = 0; i < number_of_results; ++i) {
+            if (strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+
+            double change = (results[i].ns_per_byte - baseline_ns_per_byte) /
+                baseline_ns_per_byte * 100.0;
+
+            if (change > threshold) {
+                printf("REGRESSION %-44s %+7.1f%%\n", name, change);
+                number_of_regressions += 1;
+            } else {
+                printf("ok         %-44s %+7.1f%%\n", name, change);
+            }
+        }
+    }
+
+    fclose(input_file);
+
+    if (number_of_regressions > 0) {
+        fprintf(stderr, "compare_baseline: %u benchmarks regressed more " \
+            "than %.1f%%\n", number_of_regressions, threshold);
+        return -1;
+    }
+
+    return 0;
+}
+
+static double current_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int remove_work_file(const char *path, const struct stat *st,
+    int type, struct FTW *ftw)
+{
+    (void) st;
+    (void) type;
+    (void) ftw;
+    return remove(path);
+}
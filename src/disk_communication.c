@@ -19,49 +19,196 @@
 
 /* Application specific */
 #include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/disk_simulator.h"
+#include "includes/wdfw_context.h"
+#include "includes/rom_geometry.h"
 #include "includes/wd_info.h"
+#include "includes/wdfw_probes.h"
 
 /* Display the model number of the detected hard disk drive. */
-static void display_model(uint8_t *hard_disk_response);
+static void display_model(wdfw_context *context,
+    uint8_t *hard_disk_response);
 
 /* Display the firmware revision number of the detected hard disk drive. */
-static void display_firmware_revision(uint8_t *hard_disk_response);
+static void display_firmware_revision(wdfw_context *context,
+    uint8_t *hard_disk_response);
 
 /* Display the serial number of the detected hard disk drive. */
-static void display_serial_number(uint8_t *hard_disk_response);
+static void display_serial_number(wdfw_context *context,
+    uint8_t *hard_disk_response);
 
 /* Display the maximum LBA range entry number. */
-static void display_number_of_lba_entries(uint8_t *hard_disk_response);
+static void display_number_of_lba_entries(wdfw_context *context,
+    uint8_t *hard_disk_response);
 
-/* Display the sense buffer after an IOCTL fuction has been invoked. */
-static inline void display_sense_buffer(unsigned char sense_buffer[32]);
+/* Copy the identify string in bytes start - end of an identify reply to text
+   as C string, without the trailing spaces. */
+static void extract_identify_string(uint8_t *hard_disk_response, int start,
+    int end, char *text, size_t text_size);
+
+/* Fill in the sector count of a rom transfer of size bytes in cdb. */
+static int set_rom_transfer_size(wdfw_context *context, unsigned char *cdb,
+    size_t size);
+
+/* Fill in the 48-bit LBA and the sector count of a DMA transfer of size
+   bytes at lba_id in cdb. */
+static int set_lba48_transfer(wdfw_context *context, unsigned char *cdb,
+    uint64_t lba_id, size_t size);
+
+/* Keep the sense buffer of a failed command in the context and describe it
+   after the recorded error message. */
+static void record_sense_buffer(wdfw_context *context,
+    unsigned char sense_buffer[32]);
+
+/* Send an identify command and return the 512 byte reply in
+   identify_reply. */
+static int send_identify_command(wdfw_context *context,
+    int hard_disk_file_descriptor, uint8_t *identify_reply);
 
 /* Calculate the ID field of a sg_hdr based on the values of the cdb. */
 static inline int calculate_pack_id(unsigned char *cdb);
 
-int open_hard_disk_drive(char *hard_disk_dev_file)
+/* Pass a command to the drive, or to the simulator for a simulated drive. */
+static int transfer_command(wdfw_context *context, unsigned char *cdb,
+    int hard_disk_file_descriptor, void *response_buffer,
+    size_t response_buffer_size, int data_direction);
+
+int open_hard_disk_drive(wdfw_context *context, char *hard_disk_dev_file)
 {
+    if (is_simulated_drive_name(hard_disk_dev_file)) {
+        return open_simulated_drive(context, hard_disk_dev_file);
+    }
+
     if (strncmp(hard_disk_dev_file, "/dev/s", sizeof("/dev/s") - 1) != 0) {
-        fprintf(stderr, "open_hard_disk_drive: Invalid device file: %s.\n",
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "open_hard_disk_drive: Invalid device file: %s.",
             hard_disk_dev_file);
-        return -1;
     }
 
-    int fd = open(hard_disk_dev_file, O_RDWR);
+    int fd = open(hard_disk_dev_file, O_RDWR | O_CLOEXEC);
     if (fd == -1) {
-        perror("open:");
-        return -1;
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_hard_disk_drive: open %s", hard_disk_dev_file);
     }
 
     return fd;
 }
 
+void close_hard_disk_drive(int hard_disk_file_descriptor)
+{
+    close_simulated_drive(hard_disk_file_descriptor);
+    close(hard_disk_file_descriptor);
+}
+
 /*
 * For more info about cdb and sg_io:
 * http://www.t13.org/documents/uploadeddocuments/docs2006/d1699r3f-ata8-acs.pdf
 * http://www.tldp.org/HOWTO/SCSI-Generic-HOWTO/sg_io_hdr_t.html
 */
-int identify_hard_disk_drive(int hard_disk_file_descriptor)
+int identify_hard_disk_drive(wdfw_context *context,
+    int hard_disk_file_descriptor)
+{
+    uint8_t identify_reply_buffer[512 * 2];
+
+    if (send_identify_command(context, hard_disk_file_descriptor,
+        identify_reply_buffer) != 0) {
+        return chain_wdfw_error(context, "identify_hard_disk_drive: Could " \
+            "not send identify command to hard disk drive");
+    }
+
+    display_model(context, identify_reply_buffer);
+    display_firmware_revision(context, identify_reply_buffer);
+    display_serial_number(context, identify_reply_buffer);
+    display_number_of_lba_entries(context, identify_reply_buffer);
+
+    const drive_profile *profile;
+    if (verify_hard_disk_support(context, identify_reply_buffer,
+        &profile) != 0) {
+        return chain_wdfw_error(context, "identify_hard_disk_drive: " \
+            "Specified hard disk drive is not supported.");
+    }
+
+    if (context->detect_geometry) {
+        char model[IDENTIFY_MODEL_NUMBER_END - IDENTIFY_MODEL_NUMBER_START + 1];
+        const rom_geometry *geometry = profile->geometry;
+
+        extract_identify_string(identify_reply_buffer,
+            IDENTIFY_MODEL_NUMBER_START, IDENTIFY_MODEL_NUMBER_END, model,
+            sizeof(model));
+        if (geometry == NULL) {
+            geometry = match_rom_geometry(model);
+        }
+        if (geometry != NULL) {
+            /* A chunk size chosen by the caller is kept when it fits. */
+            uint32_t chunk_size = context->geometry.chunk_size;
+
+            context->geometry = *geometry;
+            if (verify_rom_chunk_size(geometry, chunk_size) == 0) {
+                context->geometry.chunk_size = chunk_size;
+            }
+        }
+        print_wdfw_output(context, "Rom geometry: %s (%u bytes, %u byte " \
+            "chunks)\n", context->geometry.name, context->geometry.image_size,
+            context->geometry.chunk_size);
+    }
+
+    return 0;
+}
+
+/* Operations that never displayed the drive keep their output unchanged. */
+int check_hard_disk_commands(wdfw_context *context,
+    int hard_disk_file_descriptor, uint32_t commands)
+{
+    FILE *output = context->output;
+
+    context->output = NULL;
+    int result = identify_hard_disk_drive(context, hard_disk_file_descriptor);
+    context->output = output;
+
+    if (result != 0 || check_drive_commands(context, commands) != 0) {
+        return chain_wdfw_error(context, "check_hard_disk_commands");
+    }
+
+    return 0;
+}
+
+int get_hard_disk_capacity(wdfw_context *context,
+    int hard_disk_file_descriptor, uint64_t *number_of_sectors)
+{
+    uint8_t identify_reply_buffer[512];
+
+    if (send_identify_command(context, hard_disk_file_descriptor,
+        identify_reply_buffer) != 0) {
+        return chain_wdfw_error(context, "get_hard_disk_capacity");
+    }
+
+    /* Words 100 - 103 hold the 48-bit capacity, drives without 48-bit
+     * addressing only fill in words 60 - 61. */
+    uint64_t sectors = 0;
+    int i;
+    for (i = 7; i >= 0; --i) {
+        sectors = (sectors << 8) |
+            identify_reply_buffer[MAXIMUM_LBA_ENTRY + i];
+    }
+    if (sectors == 0) {
+        for (i = 3; i >= 0; --i) {
+            sectors = (sectors << 8) |
+                identify_reply_buffer[IDENTIFY_LBA28_CAPACITY + i];
+        }
+    }
+
+    if (sectors == 0) {
+        return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+            "get_hard_disk_capacity: The drive reports no capacity");
+    }
+
+    *number_of_sectors = sectors;
+    return 0;
+}
+
+static int send_identify_command(wdfw_context *context,
+    int hard_disk_file_descriptor, uint8_t *identify_reply)
 {
     unsigned char identify_cdb[SG_ATA_16_LEN];
 
@@ -91,29 +238,41 @@ int identify_hard_disk_drive(int hard_disk_file_descriptor)
     /* Control: auto cotingent allegiance not established */
     identify_cdb[15]    = 0x00;
 
-    uint8_t identify_reply_buffer[512 * 2];
-    memset(identify_reply_buffer, 0, sizeof(identify_reply_buffer));
+    memset(identify_reply, 0, 512);
 
-    if (execute_command(identify_cdb, hard_disk_file_descriptor,
-        identify_reply_buffer, 512, SG_DXFER_FROM_DEV) == -1) {
-        fprintf(stderr, "identify_hard_disk_drive: Could not send identify " \
-            "command to hard disk drive.\n");
-        return -1;
+    if (execute_command(context, identify_cdb, hard_disk_file_descriptor,
+        identify_reply, 512, SG_DXFER_FROM_DEV) < 0) {
+        return context->error;
     }
 
-    display_model(identify_reply_buffer);
-    display_firmware_revision(identify_reply_buffer);
-    display_serial_number(identify_reply_buffer);
-    display_number_of_lba_entries(identify_reply_buffer);
+    return 0;
+}
+
+static void extract_identify_string(uint8_t *hard_disk_response, int start,
+    int end, char *text, size_t text_size)
+{
+    size_t length = 0;
+    int i;
 
-    return verify_hard_disk_support((uint8_t *) identify_reply_buffer);
+    /* Identify strings hold two characters per word, high byte first. */
+    for (i = start; i < end && length + 2 < text_size; i += 2) {
+        text[length++] = hard_disk_response[i + 1];
+        text[length++] = hard_disk_response[i];
+    }
+
+    while (length > 0 && (text[length - 1] == ' ' ||
+        text[length - 1] == '\0')) {
+        --length;
+    }
+    text[length] = '\0';
 }
 
 /* Source:
 http://www.t13.org/Documents/UploadedDocuments/docs2016/di529r14-ATAATAPI_Command_Set_-_4.pdf */
-static void display_model(uint8_t *hard_disk_response)
+static void display_model(wdfw_context *context,
+    uint8_t *hard_disk_response)
 {
-    printf("Detected hard disk: ");
+    print_wdfw_output(context, "Detected hard disk: ");
     int i;
 
     /* Range in which the the model number of the hard disk is stored. */
@@ -123,17 +282,18 @@ static void display_model(uint8_t *hard_disk_response)
             break;
         }
 
-        putchar(hard_disk_response[i+1]);
-        putchar(hard_disk_response[i]);
+        print_wdfw_output(context, "%c%c", hard_disk_response[i+1],
+            hard_disk_response[i]);
     }
-    printf("\n");
+    print_wdfw_output(context, "\n");
 }
 
 /* Source:
 http://www.t13.org/Documents/UploadedDocuments/docs2016/di529r14-ATAATAPI_Command_Set_-_4.pdf */
-static void display_firmware_revision(uint8_t *hard_disk_response)
+static void display_firmware_revision(wdfw_context *context,
+    uint8_t *hard_disk_response)
 {
-    printf("Firmeware revision: ");
+    print_wdfw_output(context, "Firmeware revision: ");
 
     int i;
     for (i = IDENTIFY_FIRMWARE_REVISION_START ;
@@ -142,17 +302,18 @@ static void display_firmware_revision(uint8_t *hard_disk_response)
             break;
         }
 
-        putchar(hard_disk_response[i+1]);
-        putchar(hard_disk_response[i]);
+        print_wdfw_output(context, "%c%c", hard_disk_response[i+1],
+            hard_disk_response[i]);
     }
-    printf("\n");
+    print_wdfw_output(context, "\n");
 }
 
 /* Source:
 http://www.t13.org/Documents/UploadedDocuments/docs2016/di529r14-ATAATAPI_Command_Set_-_4.pdf */
-static void display_serial_number(uint8_t *hard_disk_response)
+static void display_serial_number(wdfw_context *context,
+    uint8_t *hard_disk_response)
 {
-    printf("Serial number: ");
+    print_wdfw_output(context, "Serial number: ");
     int i;
 
     for (i = IDENTIFY_SERIAL_NUMBER_START;
@@ -162,46 +323,62 @@ static void display_serial_number(uint8_t *hard_disk_response)
         }
 
         if (hard_disk_response[i + 1] != ' ') {
-            putchar(hard_disk_response[i+1]);
+            print_wdfw_output(context, "%c", hard_disk_response[i+1]);
         }
 
         if (hard_disk_response[i] != ' ') {
-            putchar(hard_disk_response[i]);
+            print_wdfw_output(context, "%c", hard_disk_response[i]);
         }
     }
 
-    printf("\n");
+    print_wdfw_output(context, "\n");
 }
 
-static void display_number_of_lba_entries(uint8_t *hard_disk_response)
+static void display_number_of_lba_entries(wdfw_context *context,
+    uint8_t *hard_disk_response)
 {
-    printf("Maximum number of 512-byte blocks of LBA Range Entries: ");
-    printf("0x%lx\n", *(uint64_t *) (hard_disk_response + (MAXIMUM_LBA_ENTRY)));
+    print_wdfw_output(context, "Maximum number of 512-byte blocks of LBA " \
+        "Range Entries: ");
+    print_wdfw_output(context, "0x%lx\n",
+        *(uint64_t *) (hard_disk_response + (MAXIMUM_LBA_ENTRY)));
 }
 
 /* Source:
 http://www.t13.org/Documents/UploadedDocuments/docs2016/di529r14-ATAATAPI_Command_Set_-_4.pdf */
-int verify_hard_disk_support(uint8_t *hard_disk_response)
+int verify_hard_disk_support(wdfw_context *context,
+    uint8_t *hard_disk_response, const drive_profile **profile)
 {
-    if (hard_disk_response[54] != 'D' || hard_disk_response[55] != 'W'
-        || hard_disk_response[57] != 'C') {
-        return -1;
+    char model[DRIVE_MODEL_SIZE];
+    char firmware[DRIVE_FIRMWARE_SIZE];
+    char commands[64];
+
+    extract_identify_string(hard_disk_response, IDENTIFY_MODEL_NUMBER_START,
+        IDENTIFY_MODEL_NUMBER_END, model, sizeof(model));
+    extract_identify_string(hard_disk_response,
+        IDENTIFY_FIRMWARE_REVISION_START, IDENTIFY_FIRMWARE_REVISION_END,
+        firmware, sizeof(firmware));
+
+    *profile = lookup_drive_profile(context->drive_db, model, firmware);
+    if (*profile == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+            "verify_hard_disk_support: No drive profile for %s firmware %s",
+            model, firmware);
     }
 
-    if (!strncmp((char *) &hard_disk_response[IDENTIFY_MODEL_NUMBER_START],
-        MODEL_NUMBER, strlen(MODEL_NUMBER))) {
-        return -1;
-    }
+    context->drive_commands = (*profile)->commands;
+    context->drive_rom_type = (*profile)->rom_type;
 
-    if (!strncmp((char *) &hard_disk_response[IDENTIFY_FIRMWARE_REVISION_START],
-        FIRMWARE_REVISION, strlen(FIRMWARE_REVISION))) {
-        return -1;
-    }
+    format_drive_commands((*profile)->commands, commands, sizeof(commands));
+    print_wdfw_output(context, "Drive profile: %s%s firmware %s%s " \
+        "(commands: %s)\n", (*profile)->model,
+        (*profile)->model_prefix ? "*" : "", (*profile)->firmware,
+        (*profile)->firmware_prefix ? "*" : "", commands);
 
     return 0;
 }
 
-int enable_vendor_specific_commands(int hard_disk_file_descriptor)
+int enable_vendor_specific_commands(wdfw_context *context,
+    int hard_disk_file_descriptor)
 {
     unsigned char enable_vsc_cdb[SG_ATA_16_LEN];
 
@@ -229,17 +406,18 @@ int enable_vendor_specific_commands(int hard_disk_file_descriptor)
     enable_vsc_cdb[14]    = ATA_VENDOR_SPECIFIC_COMMAND;
     enable_vsc_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(enable_vsc_cdb, hard_disk_file_descriptor,
-        NULL, 0, SG_DXFER_NONE) == -1) {
-        fprintf(stderr, "enable_vendor_specific_commands: Could not send " \
-            "enable vcs command to hard disk drive.\n");
-        return -1;
+    if (execute_command(context, enable_vsc_cdb, hard_disk_file_descriptor,
+        NULL, 0, SG_DXFER_NONE) < 0) {
+        return chain_wdfw_error(context,
+            "enable_vendor_specific_commands: Could not send " \
+            "enable vcs command to hard disk drive");
     }
 
     return 0;
 }
 
-int disable_vendor_specific_commands(int hard_disk_file_descriptor)
+int disable_vendor_specific_commands(wdfw_context *context,
+    int hard_disk_file_descriptor)
 {
     unsigned char disable_vsc_cdb[SG_ATA_16_LEN];
 
@@ -267,66 +445,80 @@ int disable_vendor_specific_commands(int hard_disk_file_descriptor)
     disable_vsc_cdb[14]    = ATA_VENDOR_SPECIFIC_COMMAND;
     disable_vsc_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(disable_vsc_cdb, hard_disk_file_descriptor,
-        NULL, 0, SG_DXFER_NONE) == -1) {
-        fprintf(stderr, "disable_vendor_specific_commands: Could not send " \
-            "disable vcs command to hard disk drive.\n");
-        return -1;
+    if (execute_command(context, disable_vsc_cdb, hard_disk_file_descriptor,
+        NULL, 0, SG_DXFER_NONE) < 0) {
+        return chain_wdfw_error(context,
+            "disable_vendor_specific_commands: Could not send " \
+            "disable vcs command to hard disk drive");
     }
 
     return 0;
 }
 
-int get_rom_acces(int hard_disk_file_descriptor, int read_write)
+int get_rom_acces(wdfw_context *context, int hard_disk_file_descriptor,
+    int read_write)
 {
-    if (read_write != ROM_KEY_READ && read_write != ROM_KEY_WRTIE) {
-        fprintf(stderr, "get_rom_acces: Invallid read/write direction.\n");
-        return -1;
+    if (read_write != ROM_KEY_READ && read_write != ROM_KEY_WRTIE &&
+        read_write != ROM_KEY_ERASE) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "get_rom_acces: Invallid read/write direction.");
     }
 
-    unsigned char get_rom_access_cdb[SG_ATA_16_LEN];
-
-    get_rom_access_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
-
-    /* multiple count: 0 protocol: 4 extended: 0  */
-    /* protocol 4: PIO Data-In */
-    get_rom_access_cdb[1]     = 0x0a;
-
-    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
-    get_rom_access_cdb[2]     = 0x26;
-    get_rom_access_cdb[3]     = 0x00; /* Features (8:15): */
-    get_rom_access_cdb[4]     = 0xd6; /* Features (0:7): */
-    get_rom_access_cdb[5]     = 0x00; /* Sector Count (8:15): */
-    get_rom_access_cdb[6]     = 0x01; /* Sector Count (0:7): */
-    get_rom_access_cdb[7]     = 0x00; /* LBA Low (8:15): */
-    get_rom_access_cdb[8]     = 0xbe; /* LBA Low (0:7): */
-    get_rom_access_cdb[9]     = 0x00; /* LBA Mid (8:15): */
-    get_rom_access_cdb[10]    = 0x4f; /* LBA Mid (0:7): */
-    get_rom_access_cdb[11]    = 0x00; /* LBA High (8:15): */
-    get_rom_access_cdb[12]    = 0xc2; /* LBA High (0:7): */
-    get_rom_access_cdb[13]    = 0xa0; /* Device: */
-
-    get_rom_access_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
-    get_rom_access_cdb[15]    = 0x00; /* Control: */
-
     uint8_t command_buffer[512];
     memset(command_buffer, 0, sizeof(command_buffer));
 
     command_buffer[0] = 0x24; /* Command */
     command_buffer[2] = read_write;
 
-    if (execute_command(get_rom_access_cdb, hard_disk_file_descriptor,
-        command_buffer, 512, SG_DXFER_TO_DEV) == -1) {
-        fprintf(stderr, "get_rom_acces: Could not send " \
-            " smart log enable rom command to hard disk drive.\n");
-        return -1;
+    if (send_vendor_specific_key(context, hard_disk_file_descriptor,
+        command_buffer) != 0) {
+        return chain_wdfw_error(context,
+            "get_rom_acces: Could not send " \
+            " smart log enable rom command to hard disk drive");
     }
 
     return 0;
 }
 
-int read_rom_block(int hard_disk_file_descriptor, void *block,
-    size_t size)
+int send_vendor_specific_key(wdfw_context *context,
+    int hard_disk_file_descriptor, uint8_t *key_sector)
+{
+    unsigned char key_sector_cdb[SG_ATA_16_LEN];
+
+    key_sector_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
+
+    /* multiple count: 0 protocol: 4 extended: 0  */
+    /* protocol 4: PIO Data-In */
+    key_sector_cdb[1]     = 0x0a;
+
+    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
+    key_sector_cdb[2]     = 0x26;
+    key_sector_cdb[3]     = 0x00; /* Features (8:15): */
+    key_sector_cdb[4]     = 0xd6; /* Features (0:7): */
+    key_sector_cdb[5]     = 0x00; /* Sector Count (8:15): */
+    key_sector_cdb[6]     = 0x01; /* Sector Count (0:7): */
+    key_sector_cdb[7]     = 0x00; /* LBA Low (8:15): */
+    key_sector_cdb[8]     = 0xbe; /* LBA Low (0:7): */
+    key_sector_cdb[9]     = 0x00; /* LBA Mid (8:15): */
+    key_sector_cdb[10]    = 0x4f; /* LBA Mid (0:7): */
+    key_sector_cdb[11]    = 0x00; /* LBA High (8:15): */
+    key_sector_cdb[12]    = 0xc2; /* LBA High (0:7): */
+    key_sector_cdb[13]    = 0xa0; /* Device: */
+
+    key_sector_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
+    key_sector_cdb[15]    = 0x00; /* Control: */
+
+    if (execute_command(context, key_sector_cdb, hard_disk_file_descriptor,
+        key_sector, 512, SG_DXFER_TO_DEV) < 0) {
+        return chain_wdfw_error(context, "send_vendor_specific_key: Could " \
+            "not send smart log key sector to hard disk drive");
+    }
+
+    return 0;
+}
+
+int read_rom_block(wdfw_context *context, int hard_disk_file_descriptor,
+    void *block, size_t size)
 {
     unsigned char read_rom_block_cdb[SG_ATA_16_LEN];
 
@@ -352,18 +544,22 @@ int read_rom_block(int hard_disk_file_descriptor, void *block,
     read_rom_block_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
     read_rom_block_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(read_rom_block_cdb, hard_disk_file_descriptor,
-        block, size, SG_DXFER_FROM_DEV) == -1) {
-        fprintf(stderr, "read_rom_block: Could not send smart log " \
-            "read rom command to hard disk drive.\n");
-        return -1;
+    if (set_rom_transfer_size(context, read_rom_block_cdb, size) != 0) {
+        return context->error;
+    }
+
+    if (execute_command(context, read_rom_block_cdb, hard_disk_file_descriptor,
+        block, size, SG_DXFER_FROM_DEV) < 0) {
+        return chain_wdfw_error(context,
+            "read_rom_block: Could not send smart log " \
+            "read rom command to hard disk drive");
     }
 
     return 0;
 }
 
-int write_rom_block(int hard_disk_file_descriptor, void *block,
-    size_t size)
+int write_rom_block(wdfw_context *context, int hard_disk_file_descriptor,
+    void *block, size_t size)
 {
     unsigned char write_rom_block_cdb[SG_ATA_16_LEN];
 
@@ -389,92 +585,228 @@ int write_rom_block(int hard_disk_file_descriptor, void *block,
     write_rom_block_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
     write_rom_block_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(write_rom_block_cdb, hard_disk_file_descriptor,
-        block, size, SG_DXFER_TO_DEV) == -1) {
-        fprintf(stderr, "write_rom_block: Could not send smart log " \
-            "write rom command to hard disk drive.\n");
-        return -1;
+    if (set_rom_transfer_size(context, write_rom_block_cdb, size) != 0) {
+        return context->error;
+    }
+
+    if (execute_command(context, write_rom_block_cdb, hard_disk_file_descriptor,
+        block, size, SG_DXFER_TO_DEV) < 0) {
+        return chain_wdfw_error(context,
+            "write_rom_block: Could not send smart log " \
+            "write rom command to hard disk drive");
+    }
+
+    return 0;
+}
+
+/* The original tool always moved 0x80 sectors (64 KiB) with the extended
+ * bit cleared. Larger transfers set the extended bit so the high byte of the
+ * sector count is used as well. */
+static int set_rom_transfer_size(wdfw_context *context, unsigned char *cdb,
+    size_t size)
+{
+    size_t sectors = size / ROM_SECTOR_SIZE;
+
+    if (size == 0 || (size % ROM_SECTOR_SIZE) != 0 || sectors > 0xffff) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "set_rom_transfer_size: Invalid rom transfer size %zu", size);
+    }
+
+    if (sectors > 0xff) {
+        cdb[1] |= 0x01; /* extended: 1 */
     }
+    cdb[5] = (sectors >> 8) & 0xff; /* Sector Count (8:15): */
+    cdb[6] = sectors & 0xff; /* Sector Count (0:7): */
 
     return 0;
 }
 
-int read_dma_ext(int hard_disk_file_descriptor, unsigned long lba_id,
-	uint8_t * data_buffer, size_t size)
+int read_smart_data(wdfw_context *context, int hard_disk_file_descriptor,
+    uint8_t *smart_data)
+{
+    unsigned char smart_data_cdb[SG_ATA_16_LEN];
+
+    if (check_drive_commands(context, DRIVE_COMMAND_SMART) != 0) {
+        return chain_wdfw_error(context, "read_smart_data");
+    }
+
+    smart_data_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
+
+    /* multiple count: 0 protocol: 4 extended: 0  */
+    /* protocol 4: PIO Data-In */
+    smart_data_cdb[1]     = 0x08;
+
+    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
+    smart_data_cdb[2]     = 0x2e;
+    smart_data_cdb[3]     = 0x00; /* Features (8:15): */
+    smart_data_cdb[4]     = ATA_SMART_READ_DATA; /* Features (0:7): */
+    smart_data_cdb[5]     = 0x00; /* Sector Count (8:15): */
+    smart_data_cdb[6]     = 0x01; /* Sector Count (0:7): */
+    smart_data_cdb[7]     = 0x00; /* LBA Low (8:15): */
+    smart_data_cdb[8]     = 0x00; /* LBA Low (0:7): */
+    smart_data_cdb[9]     = 0x00; /* LBA Mid (8:15): */
+    smart_data_cdb[10]    = 0x4f; /* LBA Mid (0:7): */
+    smart_data_cdb[11]    = 0x00; /* LBA High (8:15): */
+    smart_data_cdb[12]    = 0xc2; /* LBA High (0:7): */
+    smart_data_cdb[13]    = 0xa0; /* Device: */
+    smart_data_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
+    smart_data_cdb[15]    = 0x00; /* Control: */
+
+    if (execute_command(context, smart_data_cdb, hard_disk_file_descriptor,
+        smart_data, 512, SG_DXFER_FROM_DEV) < 0) {
+        return chain_wdfw_error(context, "read_smart_data: Could not send " \
+            "smart read data command to hard disk drive");
+    }
+
+    return 0;
+}
+
+int read_smart_log(wdfw_context *context, int hard_disk_file_descriptor,
+    uint8_t log_address, uint8_t *log, size_t size)
+{
+    unsigned char smart_log_cdb[SG_ATA_16_LEN];
+    size_t sectors = size / ATA_SECTOR_SIZE;
+
+    if (check_drive_commands(context, DRIVE_COMMAND_SMART) != 0) {
+        return chain_wdfw_error(context, "read_smart_log");
+    }
+
+    if (size == 0 || (size % ATA_SECTOR_SIZE) != 0 ||
+        sectors > ATA_SMART_MAXIMUM_LOG_SECTORS) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "read_smart_log: Invalid log transfer size %zu", size);
+    }
+
+    smart_log_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
+
+    /* multiple count: 0 protocol: 4 extended: 0  */
+    /* protocol 4: PIO Data-In */
+    smart_log_cdb[1]     = 0x08;
+
+    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
+    smart_log_cdb[2]     = 0x2e;
+    smart_log_cdb[3]     = 0x00; /* Features (8:15): */
+    smart_log_cdb[4]     = ATA_SMART_READ_LOG; /* Features (0:7): */
+    smart_log_cdb[5]     = 0x00; /* Sector Count (8:15): */
+    smart_log_cdb[6]     = sectors; /* Sector Count (0:7): */
+    smart_log_cdb[7]     = 0x00; /* LBA Low (8:15): */
+    smart_log_cdb[8]     = log_address; /* LBA Low (0:7): */
+    smart_log_cdb[9]     = 0x00; /* LBA Mid (8:15): */
+    smart_log_cdb[10]    = 0x4f; /* LBA Mid (0:7): */
+    smart_log_cdb[11]    = 0x00; /* LBA High (8:15): */
+    smart_log_cdb[12]    = 0xc2; /* LBA High (0:7): */
+    smart_log_cdb[13]    = 0xa0; /* Device: */
+    smart_log_cdb[14]    = ATA_OP_SMART; /* Command: smart ata operation */
+    smart_log_cdb[15]    = 0x00; /* Control: */
+
+    if (execute_command(context, smart_log_cdb, hard_disk_file_descriptor,
+        log, size, SG_DXFER_FROM_DEV) < 0) {
+        return chain_wdfw_error(context, "read_smart_log: Could not send " \
+            "smart read log 0x%02x command to hard disk drive", log_address);
+    }
+
+    return 0;
+}
+
+int read_dma_ext(wdfw_context *context, int hard_disk_file_descriptor,
+    uint64_t lba_id, uint8_t *data_buffer, size_t size)
 {
     unsigned char read_dma_block_cdb[SG_ATA_16_LEN];
 
     read_dma_block_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
 
-    /* multiple count: 0 protocol: 4 extended: 0  */
-    /* protocol D: DMA Data-In */
+    /* multiple count: 0 protocol: 6 extended: 1 */
+    /* protocol 6: DMA */
     read_dma_block_cdb[1]     = 0x0D;
 
-    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
+    /* off.line:00 cc:1 t.dir:1 byt.blok:1 t.length:2 */
     read_dma_block_cdb[2]     = 0x2e;
     read_dma_block_cdb[3]     = 0x00; /* Features (8:15): */
     read_dma_block_cdb[4]     = 0x00; /* Features (0:7): */
-    read_dma_block_cdb[5]     = 0x00; /* Sector Count (8:15): */
-    read_dma_block_cdb[6]     = 0x01; /* Sector Count (0:7): */
-    read_dma_block_cdb[7]     = lba_id >> 8; /* LBA Low (8:15): */
-    read_dma_block_cdb[8]     = lba_id; /* LBA Low (0:7): */
-    read_dma_block_cdb[9]     = lba_id >> 24; /* LBA Mid (8:15): */
-    read_dma_block_cdb[10]    = lba_id >> 16; /* LBA Mid (0:7): */
-    read_dma_block_cdb[11]    = 0x00; /* LBA High (8:15): */
-    read_dma_block_cdb[12]    = 0x00; /* LBA High (0:7): */
-    read_dma_block_cdb[13]    = 0x40; /* Device: */
-
-    /* Command: smart ata operation */
+    read_dma_block_cdb[13]    = ATA_USING_LBA; /* Device: */
+
+    /* Command: read dma ext */
     read_dma_block_cdb[14]    = ATA_READ_DMA_EXT;
     read_dma_block_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(read_dma_block_cdb, hard_disk_file_descriptor,
-        data_buffer, size, SG_DXFER_FROM_DEV) == -1) {
-        fprintf(stderr, "read_dma_ext: Could not send read dma ext " \
-            "command to hard disk drive.\n");
-        return -1;
+    if (set_lba48_transfer(context, read_dma_block_cdb, lba_id, size) != 0) {
+        return context->error;
+    }
+
+    if (execute_command(context, read_dma_block_cdb, hard_disk_file_descriptor,
+        data_buffer, size, SG_DXFER_FROM_DEV) < 0) {
+        return chain_wdfw_error(context,
+            "read_dma_ext: Could not send read dma ext " \
+            "command to hard disk drive");
     }
 
     return 0;
 }
 
-/* Does not work as expected. Needs fixing. */
-int write_dma_ext(int hard_disk_file_descriptor, unsigned long lba_id,
-	uint8_t * data_buffer, size_t size)
+int write_dma_ext(wdfw_context *context, int hard_disk_file_descriptor,
+    uint64_t lba_id, uint8_t *data_buffer, size_t size)
 {
     unsigned char write_dma_block_cdb[SG_ATA_16_LEN];
 
     write_dma_block_cdb[0]     = SG_ATA_16; /* operation code: SG_ATA_16 */
 
-    /* multiple count: 0 protocol: 4 extended: 0  */
-    /* protocol D: DMA Data-In */
+    /* multiple count: 0 protocol: 6 extended: 1 */
+    /* protocol 6: DMA */
     write_dma_block_cdb[1]     = 0x0D;
 
-    /* off.line: cc: lh.en: ll.en: sc.en: f.en: */
+    /* off.line:00 cc:1 t.dir:0 byt.blok:1 t.length:2 */
     write_dma_block_cdb[2]     = 0x26;
     write_dma_block_cdb[3]     = 0x00; /* Features (8:15): */
     write_dma_block_cdb[4]     = 0x00; /* Features (0:7): */
-    write_dma_block_cdb[5]     = 0x00; /* Sector Count (8:15): */
-    write_dma_block_cdb[6]     = 0x01; /* Sector Count (0:7): */
-    write_dma_block_cdb[7]     = lba_id >> 8; /* LBA Low (8:15): */
-    write_dma_block_cdb[8]     = lba_id; /* LBA Low (0:7): */
-    write_dma_block_cdb[9]     = lba_id >> 24; /* LBA Mid (8:15): */
-    write_dma_block_cdb[10]    = lba_id >> 16; /* LBA Mid (0:7): */
-    write_dma_block_cdb[11]    = 0x00; /* LBA High (8:15): */
-    write_dma_block_cdb[12]    = 0x00; /* LBA High (0:7): */
-    write_dma_block_cdb[13]    = 0x40; /* Device: */
-
-    /* Command: smart ata operation */
+    write_dma_block_cdb[13]    = ATA_USING_LBA; /* Device: */
+
+    /* Command: write dma ext */
     write_dma_block_cdb[14]    = ATA_WRITE_DMA_EXT;
     write_dma_block_cdb[15]    = 0x00; /* Control: */
 
-    if (execute_command(write_dma_block_cdb, hard_disk_file_descriptor,
-        data_buffer, size, SG_DXFER_TO_DEV) == -1) {
-        fprintf(stderr, "write_dma_ext: Could not send write dma ext " \
-            "command to hard disk drive.\n");
-        return -1;
+    if (set_lba48_transfer(context, write_dma_block_cdb, lba_id, size) != 0) {
+        return context->error;
+    }
+
+    if (execute_command(context, write_dma_block_cdb, hard_disk_file_descriptor,
+        data_buffer, size, SG_DXFER_TO_DEV) < 0) {
+        return chain_wdfw_error(context,
+            "write_dma_ext: Could not send write dma ext " \
+            "command to hard disk drive");
+    }
+
+    return 0;
+}
+
+/* The 48 LBA bits are spread over the previous (8:15) and current (0:7)
+ * contents of the LBA low, mid and high registers: LBA low holds bits 0:7
+ * and 24:31, LBA mid 8:15 and 32:39, LBA high 16:23 and 40:47. */
+static int set_lba48_transfer(wdfw_context *context, unsigned char *cdb,
+    uint64_t lba_id, size_t size)
+{
+    size_t sectors = size / ATA_SECTOR_SIZE;
+
+    if (size == 0 || (size % ATA_SECTOR_SIZE) != 0 ||
+        sectors > ATA_MAXIMUM_DMA_EXT_SECTORS) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "set_lba48_transfer: Invalid dma transfer size %zu", size);
     }
 
+    if (lba_id + sectors > ATA_MAXIMUM_LBA48) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "set_lba48_transfer: LBA %llu is out of the 48-bit range",
+            (unsigned long long) lba_id);
+    }
+
+    cdb[5]  = (sectors >> 8) & 0xff; /* Sector Count (8:15): */
+    cdb[6]  = sectors & 0xff; /* Sector Count (0:7): */
+    cdb[7]  = (lba_id >> 24) & 0xff; /* LBA Low (8:15): */
+    cdb[8]  = lba_id & 0xff; /* LBA Low (0:7): */
+    cdb[9]  = (lba_id >> 32) & 0xff; /* LBA Mid (8:15): */
+    cdb[10] = (lba_id >> 8) & 0xff; /* LBA Mid (0:7): */
+    cdb[11] = (lba_id >> 40) & 0xff; /* LBA High (8:15): */
+    cdb[12] = (lba_id >> 16) & 0xff; /* LBA High (0:7): */
+
     return 0;
 }
 
@@ -489,13 +821,25 @@ static inline int calculate_pack_id(unsigned char *cdb)
     return (((uint64_t )lbah) << 24) | (uint64_t) lba24;
 }
 
-static inline void display_sense_buffer(unsigned char sense_buffer[32])
+static void record_sense_buffer(wdfw_context *context,
+    unsigned char sense_buffer[32])
 {
+    size_t length = strlen(context->message);
+
+    memcpy(context->sense, sense_buffer, WDFW_SENSE_SIZE);
+
     int i;
-    for (i = 0; i < 32; ++i) {
-        fprintf(stderr, "%hx ", (unsigned short) sense_buffer[i]);
+    for (i = 0; i < WDFW_SENSE_SIZE && length < sizeof(context->message); ++i) {
+        int written = snprintf(context->message + length,
+            sizeof(context->message) - length, "%s%hx",
+            (i == 0) ? " (sense: " : " ", (unsigned short) sense_buffer[i]);
+        length += (written > 0) ? written : 0;
+    }
+
+    if (length < sizeof(context->message)) {
+        snprintf(context->message + length, sizeof(context->message) - length,
+            ")");
     }
-    fprintf(stderr, "\n");
 }
 
 /* Sources:
@@ -503,14 +847,36 @@ static inline void display_sense_buffer(unsigned char sense_buffer[32])
     https://nl.wikipedia.org/wiki/SCSI
     https://www.tldp.org/HOWTO/SCSI-Generic-HOWTO/sg_io_hdr_t.html
 */
-int execute_command(unsigned char *cdb, int hard_disk_file_descriptor,
+int execute_command(wdfw_context *context, unsigned char *cdb,
+    int hard_disk_file_descriptor,
     void *response_buffer, size_t response_buffer_size,
     int data_direction)
+{
+    size_t data_size = response_buffer ? response_buffer_size : 0;
+
+    WDFW_PROBE5(command__submit, cdb[14], cdb[4], cdb[6], data_size,
+        data_direction);
+    int result = transfer_command(context, cdb, hard_disk_file_descriptor,
+        response_buffer, response_buffer_size, data_direction);
+    WDFW_PROBE3(command__complete, cdb[14], data_size, result);
+
+    return result;
+}
+
+static int transfer_command(wdfw_context *context, unsigned char *cdb,
+    int hard_disk_file_descriptor, void *response_buffer,
+    size_t response_buffer_size, int data_direction)
 {
     sg_io_hdr_t io_hdr;
     unsigned char sense_buffer[32] = {0};
     //memset(&sense_buffer, 0, sizeof(sense_buffer));
 
+    if (is_simulated_drive(hard_disk_file_descriptor)) {
+        return execute_simulated_command(context, cdb,
+            hard_disk_file_descriptor, response_buffer, response_buffer_size,
+            data_direction);
+    }
+
     memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
 
     io_hdr.interface_id = 'S';
@@ -530,16 +896,18 @@ int execute_command(unsigned char *cdb, int hard_disk_file_descriptor,
     io_hdr.pack_id = 0;
 
     if (ioctl(hard_disk_file_descriptor, SG_IO, &io_hdr) < 0) {
-        perror("ioctl: ");
-        display_sense_buffer(sense_buffer);
-        return -1;
+        report_wdfw_system_error(context, WDFW_ERROR_DEVICE,
+            "execute_command: ioctl");
+        record_sense_buffer(context, sense_buffer);
+        return WDFW_ERROR_DEVICE;
     }
 
     if (io_hdr.host_status || io_hdr.driver_status != SG_DRIVER_SENSE ||
         (io_hdr.status && io_hdr.status != SG_CHECK_CONDITION)) {
-        fprintf(stderr, "execute_command: Received error response\n");
-        display_sense_buffer(sense_buffer);
-        return -1;
+        report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "execute_command: Received error response");
+        record_sense_buffer(context, sense_buffer);
+        return WDFW_ERROR_DEVICE;
     }
 
     /*
@@ -548,18 +916,18 @@ int execute_command(unsigned char *cdb, int hard_disk_file_descriptor,
     */
     if (sense_buffer[0] != 0x72 || sense_buffer[7] < 14 ||
         sense_buffer[8] != 0x09 || sense_buffer[9] < 0x0c) {
-        fprintf(stderr, "execute_command: WARNING: Detected error in " \
-            "sense buffer\n");
-        display_sense_buffer(sense_buffer);
-        return -2;
+        memcpy(context->sense, sense_buffer, WDFW_SENSE_SIZE);
+        print_wdfw_output(context, "execute_command: WARNING: Detected " \
+            "error in sense buffer\n");
+        return COMMAND_SENSE_WARNING;
     }
 
     if (sense_buffer[21] & (ATA_STAT_ERR | ATA_STAT_DRQ)) {
-        fprintf(stderr, "execute_command: Detected I/O error\n");
-        fprintf(stderr, "ata operation: 0x%02x\n", cdb[14]);
-        fprintf(stderr, "ata status:    0x%02x\n", sense_buffer[21]);
-        fprintf(stderr, "ata error:     0x%02x\n", sense_buffer[11]);
-        return -1;
+        memcpy(context->sense, sense_buffer, WDFW_SENSE_SIZE);
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "execute_command: Detected I/O error (ata operation: 0x%02x " \
+            "ata status: 0x%02x ata error: 0x%02x)", cdb[14],
+            sense_buffer[21], sense_buffer[11]);
     }
 
     return 0;
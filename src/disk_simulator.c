@@ -0,0 +1,992 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+/* Linux specific */
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <scsi/sg.h>
+
+/* Application specific */
+#include "includes/disk_simulator.h"
+#include "includes/disk_communication.h"
+#include "includes/service_area.h"
+#include "includes/wdfw_context.h"
+#include "includes/wd_info.h"
+
+/* Transfer selected by the last key sector sent to a simulated drive. */
+enum {
+    SIMULATED_TRANSFER_NONE         = 0,
+    SIMULATED_TRANSFER_ROM_READ     = 1,
+    SIMULATED_TRANSFER_ROM_WRITE    = 2,
+    SIMULATED_TRANSFER_MODULE_READ  = 3
+};
+
+/* ATA status and error registers reported for rejected commands. */
+#define SIMULATED_ABORT_STATUS          0x51
+#define SIMULATED_ABORT_ERROR           0x04
+
+/* ATA error register reported for unreadable sectors (UNC). */
+#define SIMULATED_MEDIA_ERROR           0x40
+
+/* Serial number reported by every simulated drive. */
+#define SIMULATED_SERIAL_NUMBER         "SIMULATED00000001"
+
+/* State of an open simulated drive. */
+typedef struct {
+    int in_use;
+    int fd; /* Descriptor of the simulated drive directory */
+    int vendor_specific; /* Set while vendor specific commands are enabled */
+    int transfer; /* SIMULATED_TRANSFER_* */
+    uint32_t position; /* Offset of the next vendor data log transfer */
+    uint8_t *module; /* Module selected by the last key sector */
+    size_t module_size;
+} simulated_drive;
+
+static simulated_drive simulated_drives[MAXIMUM_SIMULATED_DRIVES];
+static pthread_mutex_t simulated_drives_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Look up the state of an open simulated drive. The caller holds
+   simulated_drives_lock. */
+static simulated_drive *find_simulated_drive(int hard_disk_file_descriptor);
+
+/* Record an aborted ATA command the way execute_command reports it. */
+static int report_simulated_abort(wdfw_context *context, unsigned char *cdb,
+    const char *reason);
+
+/* Record a failed ATA command with the given error register. */
+static int report_simulated_error(wdfw_context *context, unsigned char *cdb,
+    uint8_t error, const char *reason);
+
+/* Look up the damaged sectors a read touches: returns 1 when one of them is
+   unreadable and the delay of slow ones in *delay_ms. */
+static int find_simulated_bad_sectors(simulated_drive *drive, uint64_t lba_id,
+    size_t sectors, unsigned int *delay_ms);
+
+/* Return smart.bin, or a SMART data structure with attributes derived from
+   the sectors written to disk.bin. */
+static int simulate_smart_data(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *smart_data);
+
+/* Return a SMART log from its smart_log_XX.bin file, or the log directory
+   listing those files. */
+static int simulate_smart_log(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *log, size_t size);
+
+/* Fill in the identify reply of a simulated drive. */
+static void simulate_identify(uint8_t *identify_reply);
+
+/* Store an identify string, two characters per word with the high byte
+   first, padded with spaces. */
+static void store_identify_string(uint8_t *identify_reply, int start, int end,
+    const char *string);
+
+/* Handle a vendor key sector. */
+static int simulate_key_sector(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *key);
+
+/* Handle a vendor data log read. */
+static int simulate_data_read(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size);
+
+/* Handle a vendor data log write. */
+static int simulate_data_write(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size);
+
+/* Read or write the user data sectors addressed by a DMA EXT cdb. */
+static int simulate_dma_transfer(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size, int data_direction);
+
+/* Load a module file of a simulated drive, zero padded to whole sectors. */
+static int load_simulated_module(wdfw_context *context, simulated_drive *drive,
+    uint16_t module_id);
+
+/* Synthesise the module directory from the module files of a simulated
+   drive. */
+static int build_simulated_directory(wdfw_context *context,
+    simulated_drive *drive);
+
+/* Make the 32-bit word sum of a module zero. */
+static void seal_simulated_module(uint8_t *module, size_t size);
+
+/* Write size bytes of data to the file name in directory_fd. */
+static int write_simulated_file(wdfw_context *context, int directory_fd,
+    const char *name, const uint8_t *data, size_t size);
+
+/* Compare module ids for qsort. */
+static int compare_module_ids(const void *first, const void *second);
+
+int is_simulated_drive_name(const char *hard_disk_dev_file)
+{
+    return strncmp(hard_disk_dev_file, SIMULATED_DRIVE_PREFIX,
+        sizeof(SIMULATED_DRIVE_PREFIX) - 1) == 0;
+}
+
+int open_simulated_drive(wdfw_context *context, char *hard_disk_dev_file)
+{
+    char *directory = hard_disk_dev_file + sizeof(SIMULATED_DRIVE_PREFIX) - 1;
+
+    int fd = openat(context->directory_fd, directory,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_simulated_drive: open %s", directory);
+    }
+
+    pthread_mutex_lock(&simulated_drives_lock);
+
+    int i;
+    for (i = 0; i < MAXIMUM_SIMULATED_DRIVES; ++i) {
+        if (!simulated_drives[i].in_use) {
+            memset(&simulated_drives[i], 0, sizeof(simulated_drive));
+            simulated_drives[i].in_use = 1;
+            simulated_drives[i].fd = fd;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&simulated_drives_lock);
+
+    if (i == MAXIMUM_SIMULATED_DRIVES) {
+        close(fd);
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "open_simulated_drive: Too many open simulated drives");
+    }
+
+    return fd;
+}
+
+int is_simulated_drive(int hard_disk_file_descriptor)
+{
+    pthread_mutex_lock(&simulated_drives_lock);
+    int found = find_simulated_drive(hard_disk_file_descriptor) != NULL;
+    pthread_mutex_unlock(&simulated_drives_lock);
+
+    return found;
+}
+
+void close_simulated_drive(int hard_disk_file_descriptor)
+{
+    pthread_mutex_lock(&simulated_drives_lock);
+
+    simulated_drive *drive = find_simulated_drive(hard_disk_file_descriptor);
+    if (drive != NULL) {
+        free(drive->module);
+        memset(drive, 0, sizeof(simulated_drive));
+    }
+
+    pthread_mutex_unlock(&simulated_drives_lock);
+}
+
+static simulated_drive *find_simulated_drive(int hard_disk_file_descriptor)
+{
+    int i;
+    for (i = 0; i < MAXIMUM_SIMULATED_DRIVES; ++i) {
+        if (simulated_drives[i].in_use &&
+            simulated_drives[i].fd == hard_disk_file_descriptor) {
+            return &simulated_drives[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Operations: */
+/* Look up the simulated drive */
+/* Dispatch on the ATA command and the features and LBA low registers that
+ * select the vendor key sector and the vendor data log */
+int execute_simulated_command(wdfw_context *context, unsigned char *cdb,
+    int hard_disk_file_descriptor,
+    void *response_buffer, size_t response_buffer_size,
+    int data_direction)
+{
+    int result;
+
+    pthread_mutex_lock(&simulated_drives_lock);
+
+    simulated_drive *drive = find_simulated_drive(hard_disk_file_descriptor);
+    if (drive == NULL) {
+        pthread_mutex_unlock(&simulated_drives_lock);
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "execute_command: Descriptor %d is no simulated drive",
+            hard_disk_file_descriptor);
+    }
+
+    switch (cdb[14]) {
+    case ATA_IDENTIFY:
+        if (data_direction != SG_DXFER_FROM_DEV ||
+            response_buffer_size < 512) {
+            result = report_simulated_abort(context, cdb,
+                "identify needs a 512 byte buffer");
+            break;
+        }
+
+        simulate_identify(response_buffer);
+        result = 0;
+        break;
+
+    case ATA_VENDOR_SPECIFIC_COMMAND:
+        if (cdb[10] != 0x44 || cdb[12] != 0x57 ||
+            (cdb[4] != 0x45 && cdb[4] != 0x44)) {
+            result = report_simulated_abort(context, cdb,
+                "unknown vendor specific command");
+            break;
+        }
+
+        drive->vendor_specific = (cdb[4] == 0x45);
+        drive->transfer = SIMULATED_TRANSFER_NONE;
+        result = 0;
+        break;
+
+    case ATA_OP_SMART:
+        /* SMART data and the standard logs do not need the vendor specific
+         * commands, the vendor logs 0xbe and 0xbf do. */
+        if (cdb[4] == ATA_SMART_READ_DATA &&
+            data_direction == SG_DXFER_FROM_DEV &&
+            response_buffer_size == 512) {
+            result = simulate_smart_data(context, drive, cdb,
+                response_buffer);
+        } else if (cdb[4] == ATA_SMART_READ_LOG && cdb[8] != 0xbe &&
+            cdb[8] != 0xbf && data_direction == SG_DXFER_FROM_DEV) {
+            result = simulate_smart_log(context, drive, cdb, response_buffer,
+                response_buffer_size);
+        } else if (!drive->vendor_specific) {
+            result = report_simulated_abort(context, cdb,
+                "vendor specific commands are disabled");
+        } else if (cdb[4] == 0xd6 && cdb[8] == 0xbe &&
+            data_direction == SG_DXFER_TO_DEV &&
+            response_buffer_size == 512) {
+            result = simulate_key_sector(context, drive, cdb,
+                response_buffer);
+        } else if (cdb[4] == 0xd5 && cdb[8] == 0xbf &&
+            data_direction == SG_DXFER_FROM_DEV) {
+            result = simulate_data_read(context, drive, cdb, response_buffer,
+                response_buffer_size);
+        } else if (cdb[4] == 0xd6 && cdb[8] == 0xbf &&
+            data_direction == SG_DXFER_TO_DEV) {
+            result = simulate_data_write(context, drive, cdb, response_buffer,
+                response_buffer_size);
+        } else {
+            result = report_simulated_abort(context, cdb,
+                "unknown smart log");
+        }
+        break;
+
+    case ATA_READ_DMA_EXT:
+    case ATA_WRITE_DMA_EXT:
+        result = simulate_dma_transfer(context, drive, cdb, response_buffer,
+            response_buffer_size, data_direction);
+        break;
+
+    default:
+        result = report_simulated_abort(context, cdb,
+            "command is not simulated");
+        break;
+    }
+
+    pthread_mutex_unlock(&simulated_drives_lock);
+    return result;
+}
+
+static int report_simulated_abort(wdfw_context *context, unsigned char *cdb,
+    const char *reason)
+{
+    return report_simulated_error(context, cdb, SIMULATED_ABORT_ERROR,
+        reason);
+}
+
+static int report_simulated_error(wdfw_context *context, unsigned char *cdb,
+    uint8_t error, const char *reason)
+{
+    memset(context->sense, 0, sizeof(context->sense));
+    context->sense[0] = 0x72;
+    context->sense[11] = error;
+    context->sense[21] = SIMULATED_ABORT_STATUS;
+
+    return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+        "execute_command: Detected I/O error (ata operation: 0x%02x " \
+        "ata status: 0x%02x ata error: 0x%02x, simulated drive: %s)", cdb[14],
+        SIMULATED_ABORT_STATUS, error, reason);
+}
+
+static int simulate_smart_data(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *smart_data)
+{
+    struct stat disk_stat;
+
+    int smart_fd = openat(drive->fd, SIMULATED_SMART_FILE,
+        O_RDONLY | O_CLOEXEC);
+    if (smart_fd != -1) {
+        ssize_t bytes_read = pread(smart_fd, smart_data, 512, 0);
+        close(smart_fd);
+
+        if (bytes_read != 512) {
+            return report_simulated_abort(context, cdb,
+                "smart data is shorter than a sector");
+        }
+        return 0;
+    }
+
+    /* Sectors written so far, as Total_LBAs_Written. */
+    uint64_t written = 0;
+    if (fstatat(drive->fd, SIMULATED_DISK_FILE, &disk_stat, 0) == 0) {
+        written = disk_stat.st_blocks;
+    }
+
+    static const struct {
+        uint8_t id;
+        uint16_t flags;
+        uint8_t value;
+        uint8_t worst;
+        uint64_t raw;
+    } attributes[] = {
+        { 1, 0x002f, 200, 200, 0 },
+        { 5, 0x0033, 200, 200, 0 },
+        { 9, 0x0032, 99, 99, 1000 },
+        { 12, 0x0032, 100, 100, 10 },
+        { 194, 0x0022, 112, 105, 35 },
+        { 241, 0x0032, 200, 200, 0 }
+    };
+
+    memset(smart_data, 0, 512);
+    smart_data[0] = 0x10; /* Version */
+
+    size_t i;
+    for (i = 0; i < sizeof(attributes) / sizeof(attributes[0]); ++i) {
+        uint8_t *entry = smart_data + 2 + i * 12;
+        uint64_t raw = (attributes[i].id == 241) ? written :
+            attributes[i].raw;
+
+        entry[0] = attributes[i].id;
+        entry[1] = attributes[i].flags & 0xff;
+        entry[2] = attributes[i].flags >> 8;
+        entry[3] = attributes[i].value;
+        entry[4] = attributes[i].worst;
+
+        int j;
+        for (j = 0; j < 6; ++j) {
+            entry[5 + j] = raw >> (j * 8);
+        }
+    }
+
+    uint8_t checksum = 0;
+    for (i = 0; i < 511; ++i) {
+        checksum += smart_data[i];
+    }
+    smart_data[511] = -checksum;
+
+    return 0;
+}
+
+static int simulate_smart_log(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *log, size_t size)
+{
+    struct stat log_stat;
+    char name[sizeof(SIMULATED_SMART_LOG_FORMAT) + 8];
+    size_t sectors = cdb[6];
+
+    if (sectors == 0 || sectors * ATA_SECTOR_SIZE != size) {
+        return report_simulated_abort(context, cdb,
+            "sector count does not match the transfer size");
+    }
+
+    memset(log, 0, size);
+
+    if (cdb[8] == ATA_SMART_LOG_DIRECTORY) {
+        log[0] = 0x01; /* Version */
+
+        int log_address;
+        for (log_address = 1; log_address <= 0xff; ++log_address) {
+            snprintf(name, sizeof(name), SIMULATED_SMART_LOG_FORMAT,
+                log_address);
+            if (fstatat(drive->fd, name, &log_stat, 0) == 0) {
+                uint16_t pages = log_stat.st_size / ATA_SECTOR_SIZE;
+                log[log_address * 2] = pages & 0xff;
+                log[log_address * 2 + 1] = pages >> 8;
+            }
+        }
+        return 0;
+    }
+
+    snprintf(name, sizeof(name), SIMULATED_SMART_LOG_FORMAT, cdb[8]);
+    int log_fd = openat(drive->fd, name, O_RDONLY | O_CLOEXEC);
+    if (log_fd == -1) {
+        return report_simulated_abort(context, cdb, "no such smart log");
+    }
+
+    ssize_t bytes_read = pread(log_fd, log, size, 0);
+    close(log_fd);
+
+    if (bytes_read != (ssize_t) size) {
+        return report_simulated_abort(context, cdb,
+            "read beyond the end of the smart log");
+    }
+
+    return 0;
+}
+
+static void simulate_identify(uint8_t *identify_reply)
+{
+    memset(identify_reply, 0, 512);
+
+    store_identify_string(identify_reply, IDENTIFY_SERIAL_NUMBER_START,
+        IDENTIFY_SERIAL_NUMBER_END, SIMULATED_SERIAL_NUMBER);
+    store_identify_string(identify_reply, IDENTIFY_FIRMWARE_REVISION_START,
+        IDENTIFY_FIRMWARE_REVISION_END, FIRMWARE_REVISION);
+    store_identify_string(identify_reply, IDENTIFY_MODEL_NUMBER_START,
+        IDENTIFY_MODEL_NUMBER_END, MODEL_NUMBER);
+
+    /* Words 100 - 103: number of user addressable 48-bit LBAs. */
+    uint64_t sectors = SIMULATED_DISK_SECTORS;
+    int i;
+    for (i = 0; i < 8; ++i) {
+        identify_reply[MAXIMUM_LBA_ENTRY + i] = sectors >> (i * 8);
+    }
+}
+
+static void store_identify_string(uint8_t *identify_reply, int start, int end,
+    const char *string)
+{
+    size_t length = strlen(string);
+
+    int i;
+    for (i = 0; start + i < end; ++i) {
+        identify_reply[start + (i ^ 1)] = ((size_t) i < length) ?
+            string[i] : ' ';
+    }
+}
+
+/* The key sector starts with the command word followed by the action word.
+ * Rom access (0x0024) takes ROM_KEY_* actions, module access (0x0008) reads
+ * the module given by the third word. */
+static int simulate_key_sector(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *key)
+{
+    uint16_t command = key[0] | (key[1] << 8);
+    uint16_t action = key[2] | (key[3] << 8);
+
+    drive->transfer = SIMULATED_TRANSFER_NONE;
+    drive->position = 0;
+
+    if (command == 0x0024 && action == ROM_KEY_READ) {
+        drive->transfer = SIMULATED_TRANSFER_ROM_READ;
+    } else if (command == 0x0024 && action == ROM_KEY_WRTIE) {
+        drive->transfer = SIMULATED_TRANSFER_ROM_WRITE;
+    } else if (command == 0x0024 && action == ROM_KEY_ERASE) {
+        uint8_t erased[SA_SECTOR_SIZE];
+        struct stat rom_stat;
+
+        int rom_fd = openat(drive->fd, SIMULATED_ROM_FILE,
+            O_WRONLY | O_CLOEXEC);
+        if (rom_fd == -1 || fstat(rom_fd, &rom_stat) == -1) {
+            if (rom_fd != -1) {
+                close(rom_fd);
+            }
+            return report_simulated_abort(context, cdb, "no rom to erase");
+        }
+
+        memset(erased, 0xff, sizeof(erased));
+
+        off_t offset;
+        for (offset = 0; offset < rom_stat.st_size; offset += sizeof(erased)) {
+            if (pwrite(rom_fd, erased, sizeof(erased), offset) == -1) {
+                close(rom_fd);
+                return report_wdfw_system_error(context, WDFW_ERROR_DEVICE,
+                    "execute_command: Simulated rom erase failed");
+            }
+        }
+        close(rom_fd);
+    } else if (command == SA_KEY_MODULE_ACCESS &&
+        action == SA_KEY_MODULE_READ) {
+        uint16_t module_id = key[4] | (key[5] << 8);
+        char reason[WDFW_MESSAGE_SIZE];
+
+        if (load_simulated_module(context, drive, module_id) != 0) {
+            memcpy(reason, context->message, sizeof(reason));
+            return report_simulated_abort(context, cdb, reason);
+        }
+        drive->transfer = SIMULATED_TRANSFER_MODULE_READ;
+    } else {
+        return report_simulated_abort(context, cdb, "unknown key sector");
+    }
+
+    return 0;
+}
+
+static int simulate_data_read(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size)
+{
+    size_t sectors = cdb[6] | ((cdb[1] & 0x01) ? (cdb[5] << 8) : 0);
+
+    if (sectors * SA_SECTOR_SIZE != size) {
+        return report_simulated_abort(context, cdb,
+            "sector count does not match the transfer size");
+    }
+
+    if (drive->transfer == SIMULATED_TRANSFER_ROM_READ) {
+        int rom_fd = openat(drive->fd, SIMULATED_ROM_FILE,
+            O_RDONLY | O_CLOEXEC);
+        if (rom_fd == -1) {
+            return report_simulated_abort(context, cdb, "no rom");
+        }
+
+        ssize_t bytes_read = pread(rom_fd, data, size, drive->position);
+        close(rom_fd);
+
+        if (bytes_read != (ssize_t) size) {
+            return report_simulated_abort(context, cdb,
+                "read beyond the end of the rom");
+        }
+    } else if (drive->transfer == SIMULATED_TRANSFER_MODULE_READ) {
+        if (drive->position + size > drive->module_size) {
+            return report_simulated_abort(context, cdb,
+                "read beyond the end of the module");
+        }
+
+        memcpy(data, drive->module + drive->position, size);
+    } else {
+        return report_simulated_abort(context, cdb, "no read key sector");
+    }
+
+    drive->position += size;
+    return 0;
+}
+
+static int simulate_data_write(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size)
+{
+    size_t sectors = cdb[6] | ((cdb[1] & 0x01) ? (cdb[5] << 8) : 0);
+    struct stat rom_stat;
+
+    if (sectors * SA_SECTOR_SIZE != size) {
+        return report_simulated_abort(context, cdb,
+            "sector count does not match the transfer size");
+    }
+
+    if (drive->transfer != SIMULATED_TRANSFER_ROM_WRITE) {
+        return report_simulated_abort(context, cdb, "no write key sector");
+    }
+
+    int rom_fd = openat(drive->fd, SIMULATED_ROM_FILE, O_WRONLY | O_CLOEXEC);
+    if (rom_fd == -1 || fstat(rom_fd, &rom_stat) == -1) {
+        if (rom_fd != -1) {
+            close(rom_fd);
+        }
+        return report_simulated_abort(context, cdb, "no rom");
+    }
+
+    /* The flash chip does not grow. */
+    if (drive->position + size > (uint64_t) rom_stat.st_size ||
+        pwrite(rom_fd, data, size, drive->position) != (ssize_t) size) {
+        close(rom_fd);
+        return report_simulated_abort(context, cdb,
+            "write beyond the end of the rom");
+    }
+
+    close(rom_fd);
+    drive->position += size;
+    return 0;
+}
+
+static int simulate_dma_transfer(wdfw_context *context, simulated_drive *drive,
+    unsigned char *cdb, uint8_t *data, size_t size, int data_direction)
+{
+    int writing = (cdb[14] == ATA_WRITE_DMA_EXT);
+    size_t sectors = (cdb[5] << 8) | cdb[6];
+    uint64_t lba_id = ((uint64_t) cdb[11] << 40) | ((uint64_t) cdb[9] << 32) |
+        ((uint64_t) cdb[7] << 24) | ((uint64_t) cdb[12] << 16) |
+        ((uint64_t) cdb[10] << 8) | cdb[8];
+
+    if (data_direction != (writing ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV) ||
+        (cdb[1] & 0x01) == 0 || (cdb[13] & ATA_USING_LBA) == 0) {
+        return report_simulated_abort(context, cdb,
+            "dma ext needs an extended lba transfer");
+    }
+
+    if (sectors == 0 || sectors * ATA_SECTOR_SIZE != size) {
+        return report_simulated_abort(context, cdb,
+            "sector count does not match the transfer size");
+    }
+
+    if (lba_id + sectors > SIMULATED_DISK_SECTORS) {
+        return report_simulated_abort(context, cdb,
+            "transfer beyond the last lba");
+    }
+
+    /* The lock is held while a slow read waits, like a drive busy with
+     * retries. */
+    unsigned int delay_ms = 0;
+    if (!writing && find_simulated_bad_sectors(drive, lba_id, sectors,
+        &delay_ms)) {
+        return report_simulated_error(context, cdb, SIMULATED_MEDIA_ERROR,
+            "unreadable sector");
+    }
+    if (delay_ms > 0) {
+        usleep(delay_ms * 1000);
+    }
+
+    int disk_fd = openat(drive->fd, SIMULATED_DISK_FILE,
+        (writing ? O_WRONLY | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (disk_fd == -1 && (writing || errno != ENOENT)) {
+        return report_simulated_abort(context, cdb, "no disk");
+    }
+
+    off_t offset = lba_id * ATA_SECTOR_SIZE;
+    ssize_t transferred = 0;
+
+    if (writing) {
+        transferred = pwrite(disk_fd, data, size, offset);
+    } else if (disk_fd != -1) {
+        transferred = pread(disk_fd, data, size, offset);
+    }
+
+    if (disk_fd != -1) {
+        close(disk_fd);
+    }
+
+    if (transferred == -1 || (writing && transferred != (ssize_t) size)) {
+        return report_simulated_abort(context, cdb, "disk transfer failed");
+    }
+
+    /* Sectors that were never written read as zeros. */
+    if (!writing) {
+        memset(data + transferred, 0, size - transferred);
+    }
+
+    return 0;
+}
+
+static int find_simulated_bad_sectors(simulated_drive *drive, uint64_t lba_id,
+    size_t sectors, unsigned int *delay_ms)
+{
+    unsigned long long first;
+    unsigned long long count;
+    unsigned int delay;
+    char line[128];
+    int unreadable = 0;
+
+    int bad_sectors_fd = openat(drive->fd, SIMULATED_BAD_SECTORS_FILE,
+        O_RDONLY | O_CLOEXEC);
+    if (bad_sectors_fd == -1) {
+        return 0;
+    }
+
+    FILE *bad_sectors = fdopen(bad_sectors_fd, "r");
+    if (bad_sectors == NULL) {
+        close(bad_sectors_fd);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), bad_sectors) != NULL) {
+        int fields = sscanf(line, "%llu %llu %u", &first, &count, &delay);
+        if (fields < 2 || first >= lba_id + sectors ||
+            first + count <= lba_id) {
+            continue;
+        }
+
+        if (fields == 2) {
+            unreadable = 1;
+        } else if (delay > *delay_ms) {
+            *delay_ms = delay;
+        }
+    }
+
+    fclose(bad_sectors);
+    return unreadable;
+}
+
+static int load_simulated_module(wdfw_context *context, simulated_drive *drive,
+    uint16_t module_id)
+{
+    char name[sizeof(SIMULATED_MODULE_FILE_FORMAT) + 8];
+    struct stat module_stat;
+
+    free(drive->module);
+    drive->module = NULL;
+    drive->module_size = 0;
+
+    snprintf(name, sizeof(name), SIMULATED_MODULE_FILE_FORMAT, module_id);
+
+    int module_fd = openat(drive->fd, name, O_RDONLY | O_CLOEXEC);
+    if (module_fd == -1) {
+        if (errno == ENOENT && module_id == SA_DIRECTORY_MODULE) {
+            return build_simulated_directory(context, drive);
+        }
+
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "no module 0x%04x", module_id);
+    }
+
+    if (fstat(module_fd, &module_stat) == -1 || module_stat.st_size == 0) {
+        close(module_fd);
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "empty module 0x%04x", module_id);
+    }
+
+    size_t size = (module_stat.st_size + SA_SECTOR_SIZE - 1) /
+        SA_SECTOR_SIZE * SA_SECTOR_SIZE;
+
+    drive->module = calloc(size, 1);
+    if (drive->module == NULL) {
+        close(module_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "could not allocate module 0x%04x", module_id);
+    }
+
+    if (read(module_fd, drive->module, module_stat.st_size) !=
+        module_stat.st_size) {
+        close(module_fd);
+        free(drive->module);
+        drive->module = NULL;
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "could not read module 0x%04x", module_id);
+    }
+
+    close(module_fd);
+    drive->module_size = size;
+    return 0;
+}
+
+/* Operations: */
+/* Collect the module files of the drive directory */
+/* Sort them by module id */
+/* Build a directory module with an entry per module file */
+static int build_simulated_directory(wdfw_context *context,
+    simulated_drive *drive)
+{
+    sa_directory_entry *entries = NULL;
+    unsigned int number_of_entries = 0;
+    uint32_t location = 0x100;
+    struct dirent *file;
+
+    int directory_fd = dup(drive->fd);
+    DIR *directory = (directory_fd == -1) ? NULL : fdopendir(directory_fd);
+    if (directory == NULL) {
+        if (directory_fd != -1) {
+            close(directory_fd);
+        }
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "could not list the modules");
+    }
+    rewinddir(directory);
+
+    while ((file = readdir(directory)) != NULL) {
+        unsigned int module_id;
+        struct stat module_stat;
+        char suffix;
+
+        if (sscanf(file->d_name, "module_%4x.bi%c", &module_id,
+            &suffix) != 2 || suffix != 'n' || module_id > 0xffff ||
+            module_id == SA_DIRECTORY_MODULE ||
+            fstatat(drive->fd, file->d_name, &module_stat, 0) == -1) {
+            continue;
+        }
+
+        sa_directory_entry *grown = realloc(entries,
+            (number_of_entries + 1) * sizeof(sa_directory_entry));
+        if (grown == NULL) {
+            free(entries);
+            closedir(directory);
+            return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                "could not allocate the module directory");
+        }
+        entries = grown;
+
+        memset(&entries[number_of_entries], 0, sizeof(sa_directory_entry));
+        entries[number_of_entries].module_id = module_id;
+        entries[number_of_entries].size = (module_stat.st_size +
+            SA_SECTOR_SIZE - 1) / SA_SECTOR_SIZE;
+        entries[number_of_entries].copies = 2;
+        ++number_of_entries;
+    }
+    closedir(directory);
+
+    qsort(entries, number_of_entries, sizeof(sa_directory_entry),
+        compare_module_ids);
+
+    size_t size = sizeof(sa_directory_header) +
+        number_of_entries * sizeof(sa_directory_entry);
+    size = (size + SA_SECTOR_SIZE - 1) / SA_SECTOR_SIZE * SA_SECTOR_SIZE;
+
+    drive->module = calloc(size, 1);
+    if (drive->module == NULL) {
+        free(entries);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "could not allocate the module directory");
+    }
+
+    sa_directory_header *header = (sa_directory_header *) drive->module;
+    memcpy(header->module.signature, SA_MODULE_SIGNATURE,
+        sizeof(header->module.signature));
+    header->module.module_id = SA_DIRECTORY_MODULE;
+    header->module.size = size / SA_SECTOR_SIZE;
+    header->number_of_entries = number_of_entries;
+    header->entry_size = sizeof(sa_directory_entry);
+
+    /* Copies are laid out one after the other, like a freshly formatted
+     * service area. */
+    unsigned int i;
+    for (i = 0; i < number_of_entries; ++i) {
+        entries[i].location = location;
+        location += entries[i].size * entries[i].copies;
+    }
+
+    memcpy(drive->module + sizeof(sa_directory_header), entries,
+        number_of_entries * sizeof(sa_directory_entry));
+    seal_simulated_module(drive->module, size);
+
+    free(entries);
+    drive->module_size = size;
+    return 0;
+}
+
+static void seal_simulated_module(uint8_t *module, size_t size)
+{
+    sa_module_header *header = (sa_module_header *) module;
+
+    header->checksum = 0;
+    header->checksum = -calculate_sa_module_checksum(module, size);
+}
+
+static int compare_module_ids(const void *first, const void *second)
+{
+    const sa_directory_entry *a = first;
+    const sa_directory_entry *b = second;
+
+    return (int) a->module_id - (int) b->module_id;
+}
+
+/* Operations: */
+/* Create the drive directory */
+/* Copy the rom image */
+/* Write modules 0x0002 and up, sized 1 - 64 sectors, filled with a
+ * xorshift sequence seeded by the module id */
+int create_simulated_drive(wdfw_context *context, char *directory,
+    char *rom_image, unsigned int number_of_modules)
+{
+    struct stat rom_stat;
+
+    if (number_of_modules > 0xffff - SA_DIRECTORY_MODULE) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "create_simulated_drive: Too many modules: %u",
+            number_of_modules);
+    }
+
+    if (mkdirat(context->directory_fd, directory, 0755) == -1 &&
+        errno != EEXIST) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "create_simulated_drive: mkdir %s", directory);
+    }
+
+    int directory_fd = openat(context->directory_fd, directory,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "create_simulated_drive: open %s", directory);
+    }
+
+    int rom_fd = openat(context->directory_fd, rom_image,
+        O_RDONLY | O_CLOEXEC);
+    if (rom_fd == -1 || fstat(rom_fd, &rom_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "create_simulated_drive: open %s", rom_image);
+        if (rom_fd != -1) {
+            close(rom_fd);
+        }
+        close(directory_fd);
+        return context->error;
+    }
+
+    uint8_t *rom = malloc(rom_stat.st_size);
+    if (rom == NULL) {
+        close(rom_fd);
+        close(directory_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "create_simulated_drive: Could not allocate the rom image");
+    }
+
+    if (read(rom_fd, rom, rom_stat.st_size) != rom_stat.st_size) {
+        free(rom);
+        close(rom_fd);
+        close(directory_fd);
+        return report_wdfw_error(context, WDFW_ERROR_IO,
+            "create_simulated_drive: Could not read %s", rom_image);
+    }
+    close(rom_fd);
+
+    if (write_simulated_file(context, directory_fd, SIMULATED_ROM_FILE, rom,
+        rom_stat.st_size) != 0) {
+        free(rom);
+        close(directory_fd);
+        return chain_wdfw_error(context, "create_simulated_drive");
+    }
+    free(rom);
+
+    uint8_t module[64 * SA_SECTOR_SIZE];
+    unsigned int i;
+    for (i = 0; i < number_of_modules; ++i) {
+        uint16_t module_id = SA_DIRECTORY_MODULE + 1 + i;
+        uint32_t state = 0x9e3779b9 ^ (module_id * 0x85ebca6b);
+        char name[sizeof(SIMULATED_MODULE_FILE_FORMAT) + 8];
+
+        state = state ? state : 1;
+        size_t size = (1 + (state % 64)) * SA_SECTOR_SIZE;
+
+        size_t j;
+        for (j = 0; j < size; ++j) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            module[j] = state;
+        }
+
+        sa_module_header *header = (sa_module_header *) module;
+        memcpy(header->signature, SA_MODULE_SIGNATURE,
+            sizeof(header->signature));
+        header->module_id = module_id;
+        header->size = size / SA_SECTOR_SIZE;
+        seal_simulated_module(module, size);
+
+        snprintf(name, sizeof(name), SIMULATED_MODULE_FILE_FORMAT, module_id);
+        if (write_simulated_file(context, directory_fd, name, module,
+            size) != 0) {
+            close(directory_fd);
+            return chain_wdfw_error(context, "create_simulated_drive");
+        }
+    }
+
+    close(directory_fd);
+    return 0;
+}
+
+static int write_simulated_file(wdfw_context *context, int directory_fd,
+    const char *name, const uint8_t *data, size_t size)
+{
+    int output_file = openat(directory_fd, name,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output_file == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_simulated_file: open %s", name);
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = write(output_file, data + written, size - written);
+        if (result <= 0) {
+            close(output_file);
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "write_simulated_file: write %s", name);
+        }
+        written += result;
+    }
+
+    close(output_file);
+    return 0;
+}
@@ -0,0 +1,528 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "includes/drive_database.h"
+#include "includes/rom_geometry.h"
+#include "includes/rom_hash.h"
+#include "includes/wdfw_context.h"
+#include "includes/wd_info.h"
+
+/* Longest line of a database file. */
+#define DRIVE_DATABASE_LINE_SIZE        256
+
+/* Fields of a database line. */
+#define DRIVE_DATABASE_FIELDS           5
+
+/* Names of the DRIVE_COMMAND_* bits, lowest bit first. */
+static const char *command_names[] = { "rom", "sa", "smart", "dma" };
+
+/* Profiles used without a database, most specific first. The tool was
+ * written for MODEL_NUMBER and has always accepted other WDC drives; their
+ * geometry is picked by model. */
+static const drive_profile builtin_profiles[] = {
+    { MODEL_NUMBER, "", 0, 1, ROMTYPE_SPI, DRIVE_COMMAND_ALL, NULL },
+    { "WDC ", "", 1, 1, ROMTYPE_SPI, DRIVE_COMMAND_ALL, NULL }
+};
+
+/* Parse a line of a database file into profile. Returns 0 for a profile,
+   1 for an empty or comment line. */
+static int parse_drive_profile(wdfw_context *context, char *line,
+    unsigned int line_nr, drive_profile *profile);
+
+/* Store a pattern without its '*', setting *prefix when it had one. */
+static int parse_drive_pattern(char *pattern, char *text, size_t size,
+    uint8_t *prefix);
+
+/* Parse a comma separated list of command names. */
+static int parse_drive_commands(char *list, uint32_t *commands);
+
+/* Hash of a model and firmware pattern. */
+static uint64_t hash_drive_patterns(const char *model, size_t model_length,
+    uint8_t model_prefix, const char *firmware, size_t firmware_length,
+    uint8_t firmware_prefix);
+
+/* Find the profile with exactly these patterns in the hash table. */
+static const drive_profile *find_drive_profile(
+    const drive_database *database, const char *model, size_t model_length,
+    uint8_t model_prefix, const char *firmware, size_t firmware_length,
+    uint8_t firmware_prefix);
+
+/* Check whether a pattern matches an identify string. */
+static int match_drive_pattern(const char *pattern, uint8_t prefix,
+    const char *text);
+
+/* Remove leading and trailing white space in place. */
+static char *trim_drive_field(char *field);
+
+/* Operations: */
+/* Parse every line of the file into a profile */
+/* Size the hash table to at most half full and insert the profiles,
+ * rejecting a pattern pair that occurs twice */
+/* Note the prefix lengths used, they bound the probes of a lookup */
+int load_drive_database(wdfw_context *context, const char *database_file,
+    drive_database **database)
+{
+    char line[DRIVE_DATABASE_LINE_SIZE];
+    unsigned int capacity = 0;
+    unsigned int line_nr = 0;
+
+    FILE *file = NULL;
+    int file_fd = openat(context->directory_fd, database_file,
+        O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1 || (file = fdopen(file_fd, "r")) == NULL) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "load_drive_database: open %s", database_file);
+        if (file_fd != -1) {
+            close(file_fd);
+        }
+        return context->error;
+    }
+
+    drive_database *loaded = calloc(1, sizeof(drive_database));
+    if (loaded == NULL) {
+        fclose(file);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "load_drive_database: Could not allocate the database");
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++line_nr;
+
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fclose(file);
+            free_drive_database(loaded);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "load_drive_database: %s:%u: Line is too long",
+                database_file, line_nr);
+        }
+
+        if (loaded->number_of_profiles == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            drive_profile *grown = realloc(loaded->profiles,
+                capacity * sizeof(drive_profile));
+            if (grown == NULL) {
+                fclose(file);
+                free_drive_database(loaded);
+                return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                    "load_drive_database: Could not allocate %u profiles",
+                    capacity);
+            }
+            loaded->profiles = grown;
+        }
+
+        int result = parse_drive_profile(context, line, line_nr,
+            &loaded->profiles[loaded->number_of_profiles]);
+        if (result < 0) {
+            fclose(file);
+            free_drive_database(loaded);
+            return chain_wdfw_error(context, "load_drive_database: %s",
+                database_file);
+        }
+
+        if (result == 0) {
+            loaded->number_of_profiles += 1;
+        }
+    }
+    fclose(file);
+
+    loaded->table_size = 16;
+    while (loaded->table_size < loaded->number_of_profiles * 2) {
+        loaded->table_size *= 2;
+    }
+
+    loaded->table = calloc(loaded->table_size, sizeof(uint32_t));
+    if (loaded->table == NULL) {
+        report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "load_drive_database: Could not allocate %u slots",
+            loaded->table_size);
+        free_drive_database(loaded);
+        return context->error;
+    }
+
+    unsigned int i;
+    for (i = 0; i < loaded->number_of_profiles; ++i) {
+        drive_profile *profile = &loaded->profiles[i];
+        size_t model_length = strlen(profile->model);
+        size_t firmware_length = strlen(profile->firmware);
+
+        if (find_drive_profile(loaded, profile->model, model_length,
+            profile->model_prefix, profile->firmware, firmware_length,
+            profile->firmware_prefix) != NULL) {
+            report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "load_drive_database: %s: Profile %s%s | %s%s is listed " \
+                "twice", database_file, profile->model,
+                profile->model_prefix ? "*" : "", profile->firmware,
+                profile->firmware_prefix ? "*" : "");
+            free_drive_database(loaded);
+            return context->error;
+        }
+
+        uint32_t mask = loaded->table_size - 1;
+        uint32_t slot = hash_drive_patterns(profile->model, model_length,
+            profile->model_prefix, profile->firmware, firmware_length,
+            profile->firmware_prefix) & mask;
+        while (loaded->table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        loaded->table[slot] = i + 1;
+
+        if (profile->model_prefix) {
+            loaded->model_prefix_lengths |= 1ULL << model_length;
+        }
+        if (profile->firmware_prefix) {
+            loaded->firmware_prefix_lengths |= 1ULL << firmware_length;
+        }
+    }
+
+    *database = loaded;
+    return 0;
+}
+
+void free_drive_database(drive_database *database)
+{
+    if (database == NULL) {
+        return;
+    }
+
+    free(database->profiles);
+    free(database->table);
+    free(database);
+}
+
+/* Candidates are tried from the most specific pattern pair on: the exact
+ * model with the exact firmware and then its firmware prefixes, then the
+ * longest model prefix with every firmware pattern, and so on. */
+const drive_profile *lookup_drive_profile(const drive_database *database,
+    const char *model, const char *firmware)
+{
+    size_t model_length = strlen(model);
+    size_t firmware_length = strlen(firmware);
+
+    if (database == NULL) {
+        size_t i;
+        for (i = 0; i < sizeof(builtin_profiles) /
+            sizeof(builtin_profiles[0]); ++i) {
+            const drive_profile *profile = &builtin_profiles[i];
+
+            if (match_drive_pattern(profile->model, profile->model_prefix,
+                model) && match_drive_pattern(profile->firmware,
+                profile->firmware_prefix, firmware)) {
+                return profile;
+            }
+        }
+
+        return NULL;
+    }
+
+    if (model_length >= DRIVE_MODEL_SIZE ||
+        firmware_length >= DRIVE_FIRMWARE_SIZE) {
+        return NULL;
+    }
+
+    /* Length model_length + 1 stands for the exact model. */
+    int model_candidate;
+    for (model_candidate = model_length + 1; model_candidate >= 0;
+        --model_candidate) {
+        uint8_t model_prefix = (model_candidate <= (int) model_length);
+        size_t model_used = model_prefix ? (size_t) model_candidate :
+            model_length;
+        if (model_prefix &&
+            (database->model_prefix_lengths & (1ULL << model_used)) == 0) {
+            continue;
+        }
+
+        int firmware_candidate;
+        for (firmware_candidate = firmware_length + 1;
+            firmware_candidate >= 0; --firmware_candidate) {
+            uint8_t firmware_prefix =
+                (firmware_candidate <= (int) firmware_length);
+            size_t firmware_used = firmware_prefix ?
+                (size_t) firmware_candidate : firmware_length;
+            if (firmware_prefix && (database->firmware_prefix_lengths &
+                (1ULL << firmware_used)) == 0) {
+                continue;
+            }
+
+            const drive_profile *profile = find_drive_profile(database,
+                model, model_used, model_prefix, firmware, firmware_used,
+                firmware_prefix);
+            if (profile != NULL) {
+                return profile;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int check_drive_commands(wdfw_context *context, uint32_t commands)
+{
+    char missing[64];
+
+    /* The rom commands read and write the SPI flash, a rom inside the
+     * controller is out of their reach. */
+    if ((commands & DRIVE_COMMAND_ROM) != 0 &&
+        context->drive_rom_type != ROMTYPE_SPI) {
+        return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+            "check_drive_commands: The drive keeps its rom internally, " \
+            "only SPI flash roms can be dumped and written");
+    }
+
+    if ((context->drive_commands & commands) == commands) {
+        return 0;
+    }
+
+    format_drive_commands(commands & ~context->drive_commands, missing,
+        sizeof(missing));
+    return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+        "check_drive_commands: The drive profile does not allow %s commands",
+        missing);
+}
+
+void format_drive_commands(uint32_t commands, char *text, size_t size)
+{
+    size_t length = 0;
+
+    text[0] = '\0';
+
+    unsigned int i;
+    for (i = 0; i < sizeof(command_names) / sizeof(command_names[0]); ++i) {
+        if ((commands & (1U << i)) != 0 && length < size) {
+            length += snprintf(text + length, size - length, "%s%s",
+                length > 0 ? "," : "", command_names[i]);
+        }
+    }
+
+    if (length == 0) {
+        snprintf(text, size, "none");
+    }
+}
+
+int display_drive_profile(wdfw_context *context, const char *database_file,
+    const char *model, const char *firmware)
+{
+    drive_database *database;
+    char commands[64];
+
+    if (load_drive_database(context, database_file, &database) != 0) {
+        return chain_wdfw_error(context, "display_drive_profile");
+    }
+
+    print_wdfw_output(context, "%u profiles, %u hash table slots\n",
+        database->number_of_profiles, database->table_size);
+
+    if (model == NULL) {
+        free_drive_database(database);
+        return 0;
+    }
+
+    const drive_profile *profile = lookup_drive_profile(database, model,
+        firmware != NULL ? firmware : "");
+    if (profile == NULL) {
+        free_drive_database(database);
+        return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+            "display_drive_profile: No profile for %s %s", model,
+            firmware != NULL ? firmware : "");
+    }
+
+    format_drive_commands(profile->commands, commands, sizeof(commands));
+    print_wdfw_output(context, "Profile: %s%s | %s%s | %s | %s | %s\n",
+        profile->model, profile->model_prefix ? "*" : "", profile->firmware,
+        profile->firmware_prefix ? "*" : "",
+        profile->rom_type == ROMTYPE_SPI ? "spi" : "internal",
+        profile->geometry != NULL ? profile->geometry->name : "-", commands);
+
+    free_drive_database(database);
+    return 0;
+}
+
+static int parse_drive_profile(wdfw_context *context, char *line,
+    unsigned int line_nr, drive_profile *profile)
+{
+    char *fields[DRIVE_DATABASE_FIELDS];
+    unsigned int number_of_fields = 0;
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+
+    if (*trim_drive_field(line) == '\0') {
+        return 1;
+    }
+
+    char *field = line;
+    while (field != NULL && number_of_fields < DRIVE_DATABASE_FIELDS) {
+        char *separator = strchr(field, '|');
+        if (separator != NULL) {
+            *separator = '\0';
+        }
+        fields[number_of_fields++] = trim_drive_field(field);
+        field = (separator != NULL) ? separator + 1 : NULL;
+    }
+
+    if (field != NULL || number_of_fields != DRIVE_DATABASE_FIELDS) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_drive_profile: Line %u: Expected %u fields separated " \
+            "by |", line_nr, DRIVE_DATABASE_FIELDS);
+    }
+
+    memset(profile, 0, sizeof(*profile));
+
+    if (parse_drive_pattern(fields[0], profile->model,
+        sizeof(profile->model), &profile->model_prefix) != 0 ||
+        parse_drive_pattern(fields[1], profile->firmware,
+        sizeof(profile->firmware), &profile->firmware_prefix) != 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_drive_profile: Line %u: Patterns are limited to %u " \
+            "model and %u firmware characters", line_nr,
+            DRIVE_MODEL_SIZE - 1, DRIVE_FIRMWARE_SIZE - 1);
+    }
+
+    if (strcmp(fields[2], "spi") == 0) {
+        profile->rom_type = ROMTYPE_SPI;
+    } else if (strcmp(fields[2], "internal") == 0) {
+        profile->rom_type = ROMTYPE_INTERNAL;
+    } else {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_drive_profile: Line %u: Unknown rom type %s", line_nr,
+            fields[2]);
+    }
+
+    if (strcmp(fields[3], "-") != 0 &&
+        (profile->geometry = find_rom_geometry(fields[3])) == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_drive_profile: Line %u: Unknown geometry %s", line_nr,
+            fields[3]);
+    }
+
+    if (parse_drive_commands(fields[4], &profile->commands) != 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_drive_profile: Line %u: Unknown command in %s", line_nr,
+            fields[4]);
+    }
+
+    return 0;
+}
+
+static int parse_drive_pattern(char *pattern, char *text, size_t size,
+    uint8_t *prefix)
+{
+    size_t length = strlen(pattern);
+
+    *prefix = (length > 0 && pattern[length - 1] == '*');
+    if (*prefix) {
+        --length;
+    }
+
+    if (length >= size || memchr(pattern, '*', length) != NULL) {
+        return -1;
+    }
+
+    memcpy(text, pattern, length);
+    text[length] = '\0';
+    return 0;
+}
+
+static int parse_drive_commands(char *list, uint32_t *commands)
+{
+    char *saveptr;
+    char *name;
+
+    *commands = 0;
+    for (name = strtok_r(list, ",", &saveptr); name != NULL;
+        name = strtok_r(NULL, ",", &saveptr)) {
+        name = trim_drive_field(name);
+        if (strcmp(name, "all") == 0) {
+            *commands |= DRIVE_COMMAND_ALL;
+            continue;
+        }
+
+        unsigned int i;
+        for (i = 0; i < sizeof(command_names) / sizeof(command_names[0]);
+            ++i) {
+            if (strcmp(name, command_names[i]) == 0) {
+                break;
+            }
+        }
+
+        if (i == sizeof(command_names) / sizeof(command_names[0])) {
+            return -1;
+        }
+        *commands |= 1U << i;
+    }
+
+    return 0;
+}
+
+static uint64_t hash_drive_patterns(const char *model, size_t model_length,
+    uint8_t model_prefix, const char *firmware, size_t firmware_length,
+    uint8_t firmware_prefix)
+{
+    /* The prefix flags also separate the two strings. */
+    uint64_t hash = calculate_rom_hash((const uint8_t *) model, model_length);
+    hash = update_rom_hash(hash, &model_prefix, 1);
+    hash = update_rom_hash(hash, (const uint8_t *) firmware, firmware_length);
+    return update_rom_hash(hash, &firmware_prefix, 1);
+}
+
+static const drive_profile *find_drive_profile(
+    const drive_database *database, const char *model, size_t model_length,
+    uint8_t model_prefix, const char *firmware, size_t firmware_length,
+    uint8_t firmware_prefix)
+{
+    uint32_t mask = database->table_size - 1;
+    uint32_t slot = hash_drive_patterns(model, model_length, model_prefix,
+        firmware, firmware_length, firmware_prefix) & mask;
+
+    while (database->table[slot] != 0) {
+        const drive_profile *profile =
+            &database->profiles[database->table[slot] - 1];
+
+        if (profile->model_prefix == model_prefix &&
+            profile->firmware_prefix == firmware_prefix &&
+            strlen(profile->model) == model_length &&
+            strlen(profile->firmware) == firmware_length &&
+            memcmp(profile->model, model, model_length) == 0 &&
+            memcmp(profile->firmware, firmware, firmware_length) == 0) {
+            return profile;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+static int match_drive_pattern(const char *pattern, uint8_t prefix,
+    const char *text)
+{
+    if (prefix) {
+        return strncmp(text, pattern, strlen(pattern)) == 0;
+    }
+
+    return strcmp(text, pattern) == 0;
+}
+
+static char *trim_drive_field(char *field)
+{
+    while (*field == ' ' || *field == '\t') {
+        ++field;
+    }
+
+    size_t length = strlen(field);
+    while (length > 0 && (field[length - 1] == ' ' ||
+        field[length - 1] == '\t' || field[length - 1] == '\n' ||
+        field[length - 1] == '\r')) {
+        field[--length] = '\0';
+    }
+
+    return field;
+}
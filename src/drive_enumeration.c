@@ -0,0 +1,271 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+/* Application specific */
+#include "includes/drive_enumeration.h"
+#include "includes/wdfw_context.h"
+
+/* Check whether the block device name of the block_directory_fd directory
+   is a candidate drive, filling in candidate when it is. */
+static int check_drive_candidate(int sysfs_fd, int block_directory_fd,
+    const char *name, drive_candidate *candidate);
+
+/* Read the first line of a sysfs attribute, trimming surrounding spaces. */
+static int read_sysfs_attribute(int directory_fd, const char *attribute,
+    char *value, size_t value_size);
+
+/* Fill in the SCSI address and host driver of a candidate from the target
+   of its device link. */
+static void read_scsi_topology(int sysfs_fd, int block_fd,
+    drive_candidate *candidate);
+
+/* Order candidates by SCSI address, then by name. */
+static int compare_drive_candidates(const void *a, const void *b);
+
+/* Operations: */
+/* Open <sysfs root>/block */
+/* For every block device: */
+/* - Skip devices that are no SCSI disk (loop, dm, nvme, md, ...) */
+/* - Skip disks not behind libata or without a western digital model */
+/* - Record the SCSI address and host driver of the remaining candidates */
+/* Sort the candidates by SCSI address */
+int enumerate_drive_candidates(wdfw_context *context, const char *sysfs_root,
+    drive_candidate **candidates, unsigned int *number_of_candidates,
+    unsigned int *number_skipped)
+{
+    drive_candidate *candidate_array = NULL;
+    unsigned int capacity = 0;
+    struct dirent *entry;
+
+    *candidates = NULL;
+    *number_of_candidates = 0;
+    *number_skipped = 0;
+
+    int sysfs_fd = openat(context->directory_fd, sysfs_root,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sysfs_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "enumerate_drive_candidates: Could not open %s", sysfs_root);
+    }
+
+    int block_directory_fd = openat(sysfs_fd, "block",
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *block_directory = (block_directory_fd == -1) ? NULL :
+        fdopendir(block_directory_fd);
+    if (block_directory == NULL) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "enumerate_drive_candidates: Could not open %s/block",
+            sysfs_root);
+        if (block_directory_fd != -1) {
+            close(block_directory_fd);
+        }
+        close(sysfs_fd);
+        return WDFW_ERROR_IO;
+    }
+
+    while ((entry = readdir(block_directory)) != NULL) {
+        drive_candidate candidate;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        if (!check_drive_candidate(sysfs_fd, block_directory_fd,
+            entry->d_name, &candidate)) {
+            *number_skipped += 1;
+            continue;
+        }
+
+        if (*number_of_candidates == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            drive_candidate *resized = realloc(candidate_array,
+                capacity * sizeof(drive_candidate));
+            if (resized == NULL) {
+                closedir(block_directory);
+                close(sysfs_fd);
+                free(candidate_array);
+                return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                    "enumerate_drive_candidates: Could not allocate " \
+                    "candidates");
+            }
+            candidate_array = resized;
+        }
+
+        candidate_array[*number_of_candidates] = candidate;
+        *number_of_candidates += 1;
+    }
+
+    closedir(block_directory);
+    close(sysfs_fd);
+
+    if (*number_of_candidates > 1) {
+        qsort(candidate_array, *number_of_candidates,
+            sizeof(drive_candidate), compare_drive_candidates);
+    }
+
+    *candidates = candidate_array;
+    return 0;
+}
+
+int find_drive_candidate(wdfw_context *context, const char *sysfs_root,
+    const char *name, drive_candidate *candidate)
+{
+    int sysfs_fd = openat(context->directory_fd, sysfs_root,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sysfs_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "find_drive_candidate: Could not open %s", sysfs_root);
+    }
+
+    int block_directory_fd = openat(sysfs_fd, "block",
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (block_directory_fd == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "find_drive_candidate: Could not open %s/block", sysfs_root);
+        close(sysfs_fd);
+        return WDFW_ERROR_IO;
+    }
+
+    int result = check_drive_candidate(sysfs_fd, block_directory_fd, name,
+        candidate);
+
+    close(block_directory_fd);
+    close(sysfs_fd);
+    return result;
+}
+
+static int check_drive_candidate(int sysfs_fd, int block_directory_fd,
+    const char *name, drive_candidate *candidate)
+{
+    char vendor[32];
+    char model[48];
+
+    /* Partitions are not listed in /sys/block, so every sd* entry is a
+     * whole disk, whatever the length of its name. */
+    if (strncmp(name, "sd", 2) != 0 || strchr(name, '/') != NULL ||
+        strlen(name) >= sizeof(candidate->name)) {
+        return 0;
+    }
+
+    int block_fd = openat(block_directory_fd, name,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (block_fd == -1) {
+        return 0;
+    }
+
+    if (read_sysfs_attribute(block_fd, "device/vendor", vendor,
+        sizeof(vendor)) != 0 ||
+        read_sysfs_attribute(block_fd, "device/model", model,
+        sizeof(model)) != 0 ||
+        strcmp(vendor, CANDIDATE_DRIVE_VENDOR) != 0 ||
+        strncmp(model, CANDIDATE_MODEL_PREFIX,
+        sizeof(CANDIDATE_MODEL_PREFIX) - 1) != 0) {
+        close(block_fd);
+        return 0;
+    }
+
+    memset(candidate, 0, sizeof(drive_candidate));
+    strcpy(candidate->name, name);
+    snprintf(candidate->device_file, sizeof(candidate->device_file),
+        "/dev/%s", candidate->name);
+    strcpy(candidate->model, model);
+    read_scsi_topology(sysfs_fd, block_fd, candidate);
+
+    close(block_fd);
+    return 1;
+}
+
+static int read_sysfs_attribute(int directory_fd, const char *attribute,
+    char *value, size_t value_size)
+{
+    int fd = openat(directory_fd, attribute, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ssize_t size = read(fd, value, value_size - 1);
+    close(fd);
+    if (size < 0) {
+        return -1;
+    }
+    value[size] = '\0';
+    value[strcspn(value, "\n")] = '\0';
+
+    /* sysfs pads the SCSI inquiry strings with spaces. */
+    size_t end = strlen(value);
+    while (end > 0 && value[end - 1] == ' ') {
+        value[--end] = '\0';
+    }
+
+    size_t start = strspn(value, " ");
+    memmove(value, value + start, end - start + 1);
+    return 0;
+}
+
+/* The device link of a SCSI disk points to
+ * ../../devices/.../hostH/targetH:C:T/H:C:T:L */
+static void read_scsi_topology(int sysfs_fd, int block_fd,
+    drive_candidate *candidate)
+{
+    char link[512];
+    char driver_path[64];
+
+    candidate->host = -1;
+    candidate->channel = -1;
+    candidate->target = -1;
+    candidate->lun = -1;
+    strcpy(candidate->driver, "unknown");
+
+    ssize_t size = readlinkat(block_fd, "device", link, sizeof(link) - 1);
+    if (size <= 0) {
+        return;
+    }
+    link[size] = '\0';
+
+    char *address = strrchr(link, '/');
+    address = (address == NULL) ? link : address + 1;
+    if (sscanf(address, "%d:%d:%d:%d", &candidate->host, &candidate->channel,
+        &candidate->target, &candidate->lun) != 4) {
+        candidate->host = -1;
+        return;
+    }
+
+    snprintf(driver_path, sizeof(driver_path),
+        "class/scsi_host/host%d/proc_name", candidate->host);
+    if (read_sysfs_attribute(sysfs_fd, driver_path, candidate->driver,
+        sizeof(candidate->driver)) != 0 || candidate->driver[0] == '\0') {
+        strcpy(candidate->driver, "unknown");
+    }
+}
+
+/* Disks without SCSI address sort last; names sort as sda, ..., sdz, sdaa. */
+static int compare_drive_candidates(const void *a, const void *b)
+{
+    const drive_candidate *first = a;
+    const drive_candidate *second = b;
+    unsigned int first_host = first->host;
+    unsigned int second_host = second->host;
+
+    if (first_host != second_host) {
+        return (first_host < second_host) ? -1 : 1;
+    }
+    if (first->channel != second->channel) {
+        return (first->channel < second->channel) ? -1 : 1;
+    }
+    if (first->target != second->target) {
+        return (first->target < second->target) ? -1 : 1;
+    }
+    if (first->lun != second->lun) {
+        return (first->lun < second->lun) ? -1 : 1;
+    }
+    if (strlen(first->name) != strlen(second->name)) {
+        return (strlen(first->name) < strlen(second->name)) ? -1 : 1;
+    }
+    return strcmp(first->name, second->name);
+}
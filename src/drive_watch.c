@@ -0,0 +1,525 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+/* Linux specific */
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+
+/* Application specific */
+#include "includes/drive_watch.h"
+#include "includes/drive_enumeration.h"
+#include "includes/disk_communication.h"
+#include "includes/wdfw_context.h"
+
+/* Multicast group of the uevents sent by the kernel itself (udev rebroadcasts
+   them on group 2 after running its rules). */
+#define UEVENT_KERNEL_GROUP             1
+
+/* Interval in milliseconds at which finished jobs are collected. */
+#define WATCH_POLL_INTERVAL             500
+
+/* Drives and jobs of a running watch. */
+typedef struct {
+	wdfw_context *context;
+	drive_watch_options *options;
+	watched_drive drives[MAXIMUM_WATCHED_DRIVES];
+	unsigned int number_of_drives;
+	pid_t orphaned_jobs[MAXIMUM_WATCHED_DRIVES]; /* Jobs of removed drives */
+	unsigned int number_of_orphaned_jobs;
+} drive_watch;
+
+/* Open a netlink socket receiving the kernel uevents. */
+static int open_uevent_socket(wdfw_context *context);
+
+/* Act on a single uevent. */
+static void handle_drive_uevent(drive_watch *watch, drive_uevent *event,
+    struct timespec *received);
+
+/* Identify a newly added candidate drive and start the job for it. */
+static void add_watched_drive(drive_watch *watch,
+    drive_candidate *candidate, struct timespec *received);
+
+/* Forget a removed drive. */
+static void remove_watched_drive(drive_watch *watch, const char *name);
+
+/* Start the job of the watch for a drive. */
+static void start_drive_job(drive_watch *watch, watched_drive *drive);
+
+/* Collect finished jobs without blocking, or all of them when wait is set. */
+static void collect_drive_jobs(drive_watch *watch, int wait);
+
+/* Wait for a job of the watch, blocking when wait is set. Returns 1 with
+   *succeeded set once it has finished, 0 while it runs. */
+static int reap_drive_job(drive_watch *watch, pid_t job,
+    const char *device_file, int wait, int *succeeded);
+
+/* Display the inventory of the watch. */
+static void display_drive_inventory(drive_watch *watch);
+
+/* Replay the uevent records of an event file. */
+static int replay_drive_uevents(drive_watch *watch, const char *event_file);
+
+/* Milliseconds elapsed since start. */
+static double elapsed_milliseconds(struct timespec *start);
+
+int parse_drive_uevent(const char *message, size_t size,
+    drive_uevent *event)
+{
+    size_t offset = 0;
+
+    memset(event, 0, sizeof(drive_uevent));
+
+    while (offset < size) {
+        const char *field = message + offset;
+        size_t length = strnlen(field, size - offset);
+        const char *value = memchr(field, '=', length);
+
+        offset += length + 1;
+        if (value == NULL) {
+            /* "action@devpath" header or garbage */
+            continue;
+        }
+
+        size_t key_length = value - field;
+        size_t value_length = length - key_length - 1;
+        char *target = NULL;
+        size_t target_size = 0;
+        ++value;
+
+        if (key_length == 6 && strncmp(field, "ACTION", 6) == 0) {
+            target = event->action;
+            target_size = sizeof(event->action);
+        } else if (key_length == 9 && strncmp(field, "SUBSYSTEM", 9) == 0) {
+            target = event->subsystem;
+            target_size = sizeof(event->subsystem);
+        } else if (key_length == 7 && strncmp(field, "DEVTYPE", 7) == 0) {
+            target = event->devtype;
+            target_size = sizeof(event->devtype);
+        } else if (key_length == 7 && strncmp(field, "DEVNAME", 7) == 0) {
+            target = event->devname;
+            target_size = sizeof(event->devname);
+        }
+
+        if (target != NULL && value_length < target_size) {
+            memcpy(target, value, value_length);
+            target[value_length] = '\0';
+        }
+    }
+
+    /* DEVNAME is relative to /dev, but udev tools print it absolute. */
+    if (strncmp(event->devname, "/dev/", 5) == 0) {
+        memmove(event->devname, event->devname + 5,
+            strlen(event->devname + 5) + 1);
+    }
+
+    return (event->action[0] != '\0' && event->subsystem[0] != '\0') ? 0 :
+        WDFW_ERROR_FORMAT;
+}
+
+/* Operations: */
+/* Open the kernel uevent socket, or replay the event file */
+/* For every block disk event: */
+/* - add: check sysfs for a candidate, identify it and start its job */
+/* - remove: drop the drive from the inventory */
+/* Collect finished jobs between events */
+int watch_hard_disk_drives(wdfw_context *context,
+    drive_watch_options *options)
+{
+    char message[UEVENT_BUFFER_SIZE];
+    drive_watch *watch = calloc(1, sizeof(drive_watch));
+
+    if (watch == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "watch_hard_disk_drives: Could not allocate the inventory");
+    }
+    watch->context = context;
+    watch->options = options;
+
+    if (options->event_file != NULL) {
+        int result = replay_drive_uevents(watch, options->event_file);
+        collect_drive_jobs(watch, 1);
+        display_drive_inventory(watch);
+        free(watch);
+        return (result != 0) ? chain_wdfw_error(context,
+            "watch_hard_disk_drives") : 0;
+    }
+
+    int uevent_fd = open_uevent_socket(context);
+    if (uevent_fd < 0) {
+        free(watch);
+        return chain_wdfw_error(context, "watch_hard_disk_drives");
+    }
+
+    print_wdfw_output(context, "Watching for drives\n");
+
+    while (1) {
+        struct pollfd poll_fd = { .fd = uevent_fd, .events = POLLIN };
+        struct timespec received;
+
+        /* Output of a long running watch is followed live. */
+        if (context->output != NULL) {
+            fflush(context->output);
+        }
+
+        int ready = poll(&poll_fd, 1, WATCH_POLL_INTERVAL);
+        collect_drive_jobs(watch, 0);
+        if (ready == -1 && errno != EINTR) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "watch_hard_disk_drives: poll");
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        ssize_t size = recv(uevent_fd, message, sizeof(message), 0);
+        clock_gettime(CLOCK_MONOTONIC, &received);
+        if (size == -1) {
+            /* ENOBUFS: events were dropped, the inventory may be stale. */
+            if (errno == ENOBUFS) {
+                print_wdfw_output(context, "Missed uevents, rescan with -s " \
+                    "to refresh the inventory\n");
+            } else if (errno != EINTR) {
+                report_wdfw_system_error(context, WDFW_ERROR_IO,
+                    "watch_hard_disk_drives: recv");
+                break;
+            }
+            continue;
+        }
+
+        drive_uevent event;
+        if (parse_drive_uevent(message, size, &event) == 0) {
+            handle_drive_uevent(watch, &event, &received);
+        }
+    }
+
+    close(uevent_fd);
+    collect_drive_jobs(watch, 1);
+    free(watch);
+    return context->error;
+}
+
+static int open_uevent_socket(wdfw_context *context)
+{
+    struct sockaddr_nl address = {
+        .nl_family = AF_NETLINK,
+        .nl_pid = 0,
+        .nl_groups = UEVENT_KERNEL_GROUP
+    };
+
+    int uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+        NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_uevent_socket: socket");
+    }
+
+    if (bind(uevent_fd, (struct sockaddr *) &address,
+        sizeof(address)) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_uevent_socket: bind");
+        close(uevent_fd);
+        return WDFW_ERROR_IO;
+    }
+
+    return uevent_fd;
+}
+
+static void handle_drive_uevent(drive_watch *watch, drive_uevent *event,
+    struct timespec *received)
+{
+    drive_candidate candidate;
+
+    if (strcmp(event->subsystem, "block") != 0 ||
+        strcmp(event->devtype, "disk") != 0 || event->devname[0] == '\0') {
+        return;
+    }
+
+    if (strcmp(event->action, "remove") == 0) {
+        remove_watched_drive(watch, event->devname);
+    } else if (strcmp(event->action, "add") == 0) {
+        int result = find_drive_candidate(watch->context,
+            watch->options->sysfs_root, event->devname, &candidate);
+        if (result < 0) {
+            print_wdfw_output(watch->context, "%s: %s\n", event->devname,
+                watch->context->message);
+            clear_wdfw_error(watch->context);
+        } else if (result == 0) {
+            print_wdfw_output(watch->context, "%s: not a candidate drive\n",
+                event->devname);
+        } else {
+            add_watched_drive(watch, &candidate, received);
+        }
+    }
+}
+
+static void add_watched_drive(drive_watch *watch,
+    drive_candidate *candidate, struct timespec *received)
+{
+    wdfw_context *context = watch->context;
+    watched_drive *drive = NULL;
+
+    /* A drive added twice without a remove is identified again. */
+    unsigned int i;
+    for (i = 0; i < watch->number_of_drives && drive == NULL; ++i) {
+        if (strcmp(watch->drives[i].candidate.name, candidate->name) == 0) {
+            drive = &watch->drives[i];
+        }
+    }
+
+    if (drive == NULL) {
+        if (watch->number_of_drives == MAXIMUM_WATCHED_DRIVES) {
+            print_wdfw_output(context, "%s: inventory is full\n",
+                candidate->name);
+            return;
+        }
+        drive = &watch->drives[watch->number_of_drives++];
+    } else if (drive->job != 0) {
+        print_wdfw_output(context, "%s: added again while its job runs\n",
+            candidate->name);
+        return;
+    }
+
+    memset(drive, 0, sizeof(watched_drive));
+    drive->candidate = *candidate;
+    drive->added = *received;
+    snprintf(drive->device_file, sizeof(drive->device_file), "%s/%s",
+        watch->options->device_prefix, candidate->name);
+
+    print_wdfw_output(context, "%s added (%s, scsi %d:%d:%d:%d, %s):\n",
+        drive->device_file, candidate->model, candidate->host,
+        candidate->channel, candidate->target, candidate->lun,
+        candidate->driver);
+
+    drive->state = WATCHED_DRIVE_UNSUPPORTED;
+    int fd = open_hard_disk_drive(context, drive->device_file);
+    if (fd >= 0) {
+        if (identify_hard_disk_drive(context, fd) == 0) {
+            drive->state = WATCHED_DRIVE_IDENTIFIED;
+        }
+        close_hard_disk_drive(fd);
+    }
+
+    if (drive->state == WATCHED_DRIVE_UNSUPPORTED) {
+        print_wdfw_output(context, "%s: %s\n", drive->device_file,
+            context->message);
+        clear_wdfw_error(context);
+    } else {
+        print_wdfw_output(context, "%s identified %.1f ms after the add " \
+            "event\n", drive->device_file, elapsed_milliseconds(received));
+        if (watch->options->job != NULL) {
+            start_drive_job(watch, drive);
+        }
+    }
+
+    display_drive_inventory(watch);
+}
+
+static void remove_watched_drive(drive_watch *watch, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < watch->number_of_drives; ++i) {
+        if (strcmp(watch->drives[i].candidate.name, name) == 0) {
+            break;
+        }
+    }
+
+    if (i == watch->number_of_drives) {
+        return;
+    }
+
+    /* A running job notices the missing drive itself, it is only waited
+     * for. Without room the oldest such job is waited for first. */
+    print_wdfw_output(watch->context, "%s removed%s\n",
+        watch->drives[i].device_file, (watch->drives[i].job != 0) ?
+        " while its job runs" : "");
+
+    if (watch->drives[i].job != 0) {
+        if (watch->number_of_orphaned_jobs == MAXIMUM_WATCHED_DRIVES) {
+            int succeeded;
+            reap_drive_job(watch, watch->orphaned_jobs[0], "removed drive",
+                1, &succeeded);
+            --watch->number_of_orphaned_jobs;
+            memmove(&watch->orphaned_jobs[0], &watch->orphaned_jobs[1],
+                watch->number_of_orphaned_jobs * sizeof(pid_t));
+        }
+        watch->orphaned_jobs[watch->number_of_orphaned_jobs++] =
+            watch->drives[i].job;
+    }
+
+    --watch->number_of_drives;
+    memmove(&watch->drives[i], &watch->drives[i + 1],
+        (watch->number_of_drives - i) * sizeof(watched_drive));
+    display_drive_inventory(watch);
+}
+
+static void start_drive_job(drive_watch *watch, watched_drive *drive)
+{
+    if (watch->context->output != NULL) {
+        fflush(watch->context->output);
+    }
+
+    pid_t job = fork();
+    if (job == -1) {
+        report_wdfw_system_error(watch->context, WDFW_ERROR_IO,
+            "start_drive_job: fork");
+        print_wdfw_output(watch->context, "%s: %s\n", drive->device_file,
+            watch->context->message);
+        clear_wdfw_error(watch->context);
+        return;
+    }
+
+    if (job == 0) {
+        setenv("WDFW_DRIVE", drive->device_file, 1);
+        execl("/bin/sh", "sh", "-c", watch->options->job, (char *) NULL);
+        _exit(127);
+    }
+
+    drive->job = job;
+    drive->state = WATCHED_DRIVE_JOB_RUNNING;
+    print_wdfw_output(watch->context, "%s: started job %d\n",
+        drive->device_file, (int) job);
+}
+
+/* Only the jobs the watch started are waited for, other children of the
+ * process are left to their owners. */
+static void collect_drive_jobs(drive_watch *watch, int wait)
+{
+    int succeeded;
+    unsigned int i;
+
+    for (i = 0; i < watch->number_of_drives; ++i) {
+        watched_drive *drive = &watch->drives[i];
+
+        if (drive->job != 0 && reap_drive_job(watch, drive->job,
+            drive->device_file, wait, &succeeded)) {
+            drive->job = 0;
+            drive->state = succeeded ? WATCHED_DRIVE_JOB_DONE :
+                WATCHED_DRIVE_JOB_FAILED;
+        }
+    }
+
+    i = 0;
+    while (i < watch->number_of_orphaned_jobs) {
+        if (reap_drive_job(watch, watch->orphaned_jobs[i], "removed drive",
+            wait, &succeeded)) {
+            watch->orphaned_jobs[i] =
+                watch->orphaned_jobs[--watch->number_of_orphaned_jobs];
+        } else {
+            ++i;
+        }
+    }
+}
+
+static int reap_drive_job(drive_watch *watch, pid_t job,
+    const char *device_file, int wait, int *succeeded)
+{
+    int status;
+    pid_t result;
+
+    do {
+        result = waitpid(job, &status, wait ? 0 : WNOHANG);
+    } while (result == -1 && errno == EINTR);
+
+    if (result == 0) {
+        return 0;
+    }
+
+    /* A job that can not be waited for any more counts as failed. */
+    *succeeded = (result == job) && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0;
+    print_wdfw_output(watch->context, "%s: job %d %s\n", device_file,
+        (int) job, *succeeded ? "finished" : "failed");
+    return 1;
+}
+
+static void display_drive_inventory(drive_watch *watch)
+{
+    static const char *state_names[] = {
+        "identified", "unsupported", "job running", "job done", "job failed"
+    };
+
+    print_wdfw_output(watch->context, "Inventory: %u drives\n",
+        watch->number_of_drives);
+
+    unsigned int i;
+    for (i = 0; i < watch->number_of_drives; ++i) {
+        print_wdfw_output(watch->context, "  %-24s %-18s %s\n",
+            watch->drives[i].device_file, watch->drives[i].candidate.model,
+            state_names[watch->drives[i].state]);
+    }
+}
+
+static int replay_drive_uevents(drive_watch *watch, const char *event_file)
+{
+    char message[UEVENT_BUFFER_SIZE];
+    size_t message_size = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    int at_end = 0;
+
+    FILE *fp = NULL;
+    int event_fd = openat(watch->context->directory_fd, event_file,
+        O_RDONLY | O_CLOEXEC);
+    if (event_fd == -1 || (fp = fdopen(event_fd, "r")) == NULL) {
+        report_wdfw_system_error(watch->context, WDFW_ERROR_IO,
+            "replay_drive_uevents: Could not open %s", event_file);
+        if (event_fd != -1) {
+            close(event_fd);
+        }
+        return watch->context->error;
+    }
+
+    /* Records are turned into the NUL separated form the kernel sends. */
+    while (!at_end) {
+        length = getline(&line, &line_size, fp);
+        at_end = (length == -1);
+        if (!at_end) {
+            line[strcspn(line, "\r\n")] = '\0';
+            length = strlen(line);
+        }
+
+        if (!at_end && length > 0) {
+            if (message_size + length + 1 <= sizeof(message)) {
+                memcpy(message + message_size, line, length + 1);
+                message_size += length + 1;
+            }
+            continue;
+        }
+
+        if (message_size > 0) {
+            struct timespec received;
+            drive_uevent event;
+
+            clock_gettime(CLOCK_MONOTONIC, &received);
+            if (parse_drive_uevent(message, message_size, &event) == 0) {
+                handle_drive_uevent(watch, &event, &received);
+            }
+            collect_drive_jobs(watch, 0);
+            message_size = 0;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+static double elapsed_milliseconds(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 +
+        (now.tv_nsec - start->tv_nsec) / 1e6;
+}
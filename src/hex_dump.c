@@ -0,0 +1,237 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Application specific */
+#include "includes/hex_dump.h"
+#include "includes/wdfw_context.h"
+
+/* Two hex digits for every byte value, "000102...feff". */
+#define HEX_PAIR(high, low)     high low
+#define HEX_ROW(high) \
+    HEX_PAIR(high, "0") HEX_PAIR(high, "1") HEX_PAIR(high, "2") \
+    HEX_PAIR(high, "3") HEX_PAIR(high, "4") HEX_PAIR(high, "5") \
+    HEX_PAIR(high, "6") HEX_PAIR(high, "7") HEX_PAIR(high, "8") \
+    HEX_PAIR(high, "9") HEX_PAIR(high, "a") HEX_PAIR(high, "b") \
+    HEX_PAIR(high, "c") HEX_PAIR(high, "d") HEX_PAIR(high, "e") \
+    HEX_PAIR(high, "f")
+
+static const char hex_pairs[] =
+    HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+    HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+    HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+    HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Format a line of size bytes at the current address into the buffer. */
+static void format_hex_line(hex_dump *dump, const uint8_t *data,
+    unsigned int size);
+
+/* Format the current address into out, returns the number of characters. */
+static size_t format_hex_address(hex_dump *dump, char *out);
+
+/* Handle a complete line, collapsing it when it repeats the previous one. */
+static int add_hex_line(wdfw_context *context, hex_dump *dump,
+    const uint8_t *data);
+
+/* Write the formatted lines to the context output. */
+static int flush_hex_dump(wdfw_context *context, hex_dump *dump);
+
+int init_hex_dump(wdfw_context *context, hex_dump *dump, uint64_t address,
+    unsigned int unit, int collapse)
+{
+    if (unit == 0 || unit > 0x1000) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "init_hex_dump: Invalid address unit %u", unit);
+    }
+
+    memset(dump, 0, sizeof(hex_dump));
+    dump->address = address * unit;
+    dump->unit = unit;
+    dump->collapse = collapse;
+
+    dump->buffer = malloc(HEX_DUMP_BUFFER_SIZE);
+    if (dump->buffer == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "init_hex_dump: Could not allocate the output buffer");
+    }
+
+    return 0;
+}
+
+/* Whole lines are formatted straight from data, only the ends of pieces
+ * that do not fill a line are copied. */
+int feed_hex_dump(wdfw_context *context, hex_dump *dump, const uint8_t *data,
+    size_t size)
+{
+    if (dump->line_fill > 0) {
+        size_t part = HEX_DUMP_BYTES_PER_LINE - dump->line_fill;
+        part = (part < size) ? part : size;
+
+        memcpy(dump->line + dump->line_fill, data, part);
+        dump->line_fill += part;
+        data += part;
+        size -= part;
+
+        if (dump->line_fill < HEX_DUMP_BYTES_PER_LINE) {
+            return 0;
+        }
+
+        dump->line_fill = 0;
+        if (add_hex_line(context, dump, dump->line) != 0) {
+            return context->error;
+        }
+    }
+
+    while (size >= HEX_DUMP_BYTES_PER_LINE) {
+        if (add_hex_line(context, dump, data) != 0) {
+            return context->error;
+        }
+        data += HEX_DUMP_BYTES_PER_LINE;
+        size -= HEX_DUMP_BYTES_PER_LINE;
+    }
+
+    memcpy(dump->line, data, size);
+    dump->line_fill = size;
+
+    return 0;
+}
+
+int finish_hex_dump(wdfw_context *context, hex_dump *dump)
+{
+    int result = 0;
+
+    if (dump->line_fill > 0) {
+        format_hex_line(dump, dump->line, dump->line_fill);
+        dump->address += dump->line_fill;
+    }
+
+    if (dump->fill > HEX_DUMP_BUFFER_SIZE - HEX_DUMP_MAXIMUM_LINE &&
+        flush_hex_dump(context, dump) != 0) {
+        free(dump->buffer);
+        dump->buffer = NULL;
+        return context->error;
+    }
+
+    dump->fill += format_hex_address(dump, dump->buffer + dump->fill);
+    dump->buffer[dump->fill++] = '\n';
+
+    if (flush_hex_dump(context, dump) != 0) {
+        result = context->error;
+    }
+
+    free(dump->buffer);
+    dump->buffer = NULL;
+    return result;
+}
+
+static int add_hex_line(wdfw_context *context, hex_dump *dump,
+    const uint8_t *data)
+{
+    if (dump->collapse && dump->has_previous &&
+        memcmp(dump->previous, data, HEX_DUMP_BYTES_PER_LINE) == 0) {
+        if (!dump->repeating) {
+            dump->buffer[dump->fill++] = '*';
+            dump->buffer[dump->fill++] = '\n';
+            dump->repeating = 1;
+        }
+    } else {
+        format_hex_line(dump, data, HEX_DUMP_BYTES_PER_LINE);
+        memcpy(dump->previous, data, HEX_DUMP_BYTES_PER_LINE);
+        dump->has_previous = 1;
+        dump->repeating = 0;
+    }
+
+    dump->address += HEX_DUMP_BYTES_PER_LINE;
+
+    if (dump->fill > HEX_DUMP_BUFFER_SIZE - HEX_DUMP_MAXIMUM_LINE) {
+        return flush_hex_dump(context, dump);
+    }
+
+    return 0;
+}
+
+static void format_hex_line(hex_dump *dump, const uint8_t *data,
+    unsigned int size)
+{
+    char *out = dump->buffer + dump->fill;
+
+    out += format_hex_address(dump, out);
+    *out++ = ' ';
+
+    unsigned int i;
+    for (i = 0; i < HEX_DUMP_BYTES_PER_LINE; ++i) {
+        /* The two halves of the line are separated by an extra space. */
+        if ((i % 8) == 0) {
+            *out++ = ' ';
+        }
+
+        if (i < size) {
+            memcpy(out, &hex_pairs[data[i] * 2], 2);
+        } else {
+            out[0] = ' ';
+            out[1] = ' ';
+        }
+        out[2] = ' ';
+        out += 3;
+    }
+
+    *out++ = ' ';
+    *out++ = '|';
+    for (i = 0; i < size; ++i) {
+        *out++ = (data[i] >= 0x20 && data[i] < 0x7f) ? data[i] : '.';
+    }
+    *out++ = '|';
+    *out++ = '\n';
+
+    dump->fill = out - dump->buffer;
+}
+
+/* Byte addresses get at least 8 digits, unit numbers at least 12 (48-bit
+ * LBAs) followed by 3 digits of offset. */
+static size_t format_hex_address(hex_dump *dump, char *out)
+{
+    uint64_t number = dump->address / dump->unit;
+    unsigned int digits = (dump->unit == 1) ? 8 : 12;
+    size_t length = 0;
+
+    while (digits < 16 && (number >> (digits * 4)) != 0) {
+        ++digits;
+    }
+
+    while (digits > 0) {
+        --digits;
+        out[length++] = hex_digits[(number >> (digits * 4)) & 0x0f];
+    }
+
+    if (dump->unit != 1) {
+        unsigned int offset = dump->address % dump->unit;
+
+        out[length++] = ':';
+        out[length++] = hex_digits[(offset >> 8) & 0x0f];
+        out[length++] = hex_digits[(offset >> 4) & 0x0f];
+        out[length++] = hex_digits[offset & 0x0f];
+    }
+
+    return length;
+}
+
+static int flush_hex_dump(wdfw_context *context, hex_dump *dump)
+{
+    size_t fill = dump->fill;
+
+    dump->fill = 0;
+    if (context->output == NULL || fill == 0) {
+        return 0;
+    }
+
+    if (fwrite(dump->buffer, 1, fill, context->output) != fill) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "flush_hex_dump: Could not write the dump");
+    }
+
+    return 0;
+}
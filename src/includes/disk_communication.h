@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "drive_database.h"
+#include "wdfw_context.h"
+
 /*
  * Used sources:
  * - http://www.t13.org/Documents/UploadedDocuments/docs2016/di529r14-ATAATAPI_Command_Set_-_4.pdf
@@ -17,6 +20,19 @@
 #define ATA_READ_DMA_EXT 				0x25
 #define ATA_WRITE_DMA_EXT 				0x35
 
+/* READ/WRITE DMA EXT move 1 - 65535 sectors (a count of 0 would mean 65536,
+   which is not used) at a 48-bit LBA. */
+#define ATA_SECTOR_SIZE                 512
+#define ATA_MAXIMUM_DMA_EXT_SECTORS     0xffff
+#define ATA_MAXIMUM_LBA48               (1ULL << 48)
+
+/* Features of the SMART command. READ LOG moves 1 - 255 sectors; log 0x00
+   is the log directory, word n of which holds the sectors of log n. */
+#define ATA_SMART_READ_DATA             0xd0
+#define ATA_SMART_READ_LOG              0xd5
+#define ATA_SMART_LOG_DIRECTORY         0x00
+#define ATA_SMART_MAXIMUM_LOG_SECTORS   0xff
+
 #define SG_ATA_16                       0x85
 #define SG_ATA_16_LEN		            16
 
@@ -28,6 +44,8 @@
 #define IDENTIFY_FIRMWARE_REVISION_END      26 * 2
 #define MAXIMUM_LBA_ENTRY				100 * 2
 
+#define IDENTIFY_LBA28_CAPACITY         60 * 2
+
 #define IDENTIFY_MODEL_NUMBER_START     27 * 2
 #define IDENTIFY_MODEL_NUMBER_END       46 * 2
 
@@ -36,6 +54,10 @@
 #define SG_CHECK_CONDITION	            0x02
 #define SG_DRIVER_SENSE		            0x08
 
+/* Result of execute_command when the command completed but the sense data
+   holds unexpected descriptors. */
+#define COMMAND_SENSE_WARNING           1
+
 #define ROM_KEY_READ                    0x01
 #define ROM_KEY_WRTIE                   0x02
 #define ROM_KEY_ERASE                   0x03
@@ -49,44 +71,87 @@ enum {
 	ATA_STAT_ERR		= (1 << 0),
 };
 
-/* Opens a hard disk drive's device file. */
-int open_hard_disk_drive(char *hard_disk_dev_file);
-
-/* Identifies a hard disk drive by sending an inquiry packet. */
-int identify_hard_disk_drive(int hard_disk_file_descriptor);
+/* Opens a hard disk drive's device file, or a simulated drive for
+   "sim:<directory>". */
+int open_hard_disk_drive(wdfw_context *context, char *hard_disk_dev_file);
 
-/* Checks the output of an inquiry packet to determine if the disk is
-   supported. */
-int verify_hard_disk_support(uint8_t *hard_disk_response);
+/* Closes a hard disk drive opened by open_hard_disk_drive. */
+void close_hard_disk_drive(int hard_disk_file_descriptor);
 
-/* Send a packet that enables vendor specific command capabilities. */
-int enable_vendor_specific_commands(int hard_disk_file_descriptor);
-
-/* Send a packet that disables vendor specifc command capabilities. */
-int disable_vendor_specific_commands(int hard_disk_file_descriptor);
+/* Identifies a hard disk drive by sending an inquiry packet. When
+   context->detect_geometry is set the rom geometry profile of the drive model
+   is selected. */
+int identify_hard_disk_drive(wdfw_context *context,
+	int hard_disk_file_descriptor);
 
-/* Send a packet that enables rom access */
-int get_rom_acces(int hard_disk_file_descriptor, int read_write);
+/* Identify a hard disk drive without displaying it and check that its
+   profile allows commands (DRIVE_COMMAND_*). */
+int check_hard_disk_commands(wdfw_context *context,
+	int hard_disk_file_descriptor, uint32_t commands);
 
-/* Read a rom block from the hard disk drive. */
-int read_rom_block(int hard_disk_file_descriptor, void *block,
-    size_t size);
+/* Read the number of user addressable sectors of a hard disk drive from its
+   identify data. */
+int get_hard_disk_capacity(wdfw_context *context,
+	int hard_disk_file_descriptor, uint64_t *number_of_sectors);
 
-/* Write a rom block to the hard disk drive. */
-int write_rom_block(int hard_disk_file_descriptor, void *block,
-    size_t size);
+/* Look up the profile of the drive described by an identify reply in the
+   drive database of context and select the commands it allows. */
+int verify_hard_disk_support(wdfw_context *context,
+	uint8_t *hard_disk_response, const drive_profile **profile);
 
-/* Perform a ATA read dma ext command and return the result in data_buffer. */
-int read_dma_ext(int hard_disk_file_descriptor, unsigned long lba_id,
-	uint8_t * data_buffer, size_t size);
-
-/* Perform a ATA write dma ext command to write data_buffer to lba_id
-   on the disk specified by hard_disk_file_descriptor. */
-int write_dma_ext(int hard_disk_file_descriptor, unsigned long lba_id,
-	uint8_t * data_buffer, size_t size);
+/* Send a packet that enables vendor specific command capabilities. */
+int enable_vendor_specific_commands(wdfw_context *context,
+	int hard_disk_file_descriptor);
 
-/* Execute Linux SCSI command */
-int execute_command(unsigned char *cdb, int hard_disk_file_descriptor,
+/* Send a packet that disables vendor specifc command capabilities. */
+int disable_vendor_specific_commands(wdfw_context *context,
+	int hard_disk_file_descriptor);
+
+/* Send a packet that enables rom access (ROM_KEY_READ or ROM_KEY_WRTIE) or
+   erases the rom (ROM_KEY_ERASE). */
+int get_rom_acces(wdfw_context *context, int hard_disk_file_descriptor,
+	int read_write);
+
+/* Send a 512 byte key sector selecting the data returned or accepted by the
+   following vendor data log transfers. */
+int send_vendor_specific_key(wdfw_context *context,
+	int hard_disk_file_descriptor, uint8_t *key_sector);
+
+/* Read the next size bytes of the rom from the hard disk drive. size is a
+   multiple of ROM_SECTOR_SIZE. */
+int read_rom_block(wdfw_context *context, int hard_disk_file_descriptor,
+    void *block, size_t size);
+
+/* Write the next size bytes of the rom to the hard disk drive. size is a
+   multiple of ROM_SECTOR_SIZE. */
+int write_rom_block(wdfw_context *context, int hard_disk_file_descriptor,
+    void *block, size_t size);
+
+/* Read the 512 byte SMART data structure holding the attribute values.
+   Fails unless the profile of the identified drive allows SMART commands. */
+int read_smart_data(wdfw_context *context, int hard_disk_file_descriptor,
+	uint8_t *smart_data);
+
+/* Read size bytes, a multiple of ATA_SECTOR_SIZE, of SMART log
+   log_address. Fails unless the drive profile allows SMART commands. */
+int read_smart_log(wdfw_context *context, int hard_disk_file_descriptor,
+	uint8_t log_address, uint8_t *log, size_t size);
+
+/* Perform a ATA read dma ext command reading size bytes, a multiple of
+   ATA_SECTOR_SIZE, from lba_id and return the result in data_buffer. */
+int read_dma_ext(wdfw_context *context, int hard_disk_file_descriptor,
+	uint64_t lba_id, uint8_t *data_buffer, size_t size);
+
+/* Perform a ATA write dma ext command to write the size bytes, a multiple of
+   ATA_SECTOR_SIZE, of data_buffer to lba_id on the disk specified by
+   hard_disk_file_descriptor. */
+int write_dma_ext(wdfw_context *context, int hard_disk_file_descriptor,
+	uint64_t lba_id, uint8_t *data_buffer, size_t size);
+
+/* Execute Linux SCSI command. Returns 0 on success, COMMAND_SENSE_WARNING when
+   the sense data is unexpected and a negative WDFW_ERROR_* code on failure. */
+int execute_command(wdfw_context *context, unsigned char *cdb,
+    int hard_disk_file_descriptor,
     void *response_buffer, size_t response_buffer_size,
     int data_direction);
 
@@ -0,0 +1,69 @@
+#ifndef DISK_SIMULATOR_H
+#define DISK_SIMULATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "wdfw_context.h"
+
+/* Hard disk locations starting with this prefix name a simulated drive
+   directory instead of a device file ("sim:<directory>"). */
+#define SIMULATED_DRIVE_PREFIX          "sim:"
+
+/* Maximum number of simulated drives a process can have open. */
+#define MAXIMUM_SIMULATED_DRIVES        16
+
+/* Files of a simulated drive directory. */
+#define SIMULATED_ROM_FILE              "rom.bin"
+#define SIMULATED_MODULE_FILE_FORMAT    "module_%04x.bin"
+#define SIMULATED_DISK_FILE             "disk.bin"
+#define SIMULATED_BAD_SECTORS_FILE      "bad_sectors"
+#define SIMULATED_SMART_FILE            "smart.bin"
+#define SIMULATED_SMART_LOG_FORMAT      "smart_log_%02x.bin"
+
+/* Capacity in sectors reported by every simulated drive (8 GiB). */
+#define SIMULATED_DISK_SECTORS          (1ULL << 24)
+
+/*
+ * A simulated drive is a directory holding the SPI flash contents of the
+ * drive (rom.bin) and one file per service area module (module_XXXX.bin).
+ * The simulator answers the same ATA commands execute_command sends to a
+ * real drive: identify, the vendor specific command unlock, the vendor key
+ * sector, the vendor data log and READ/WRITE DMA EXT. The module directory
+ * is synthesised from the module files unless the directory holds
+ * module_0001.bin itself. Rom writes are stored in rom.bin, so uploads can be
+ * checked as well, and user data sectors in the sparse file disk.bin, which
+ * reads as zeros where nothing was written. Damaged media is described by
+ * bad_sectors, lines of "<first LBA> <number of sectors> [delay in ms]":
+ * reads touching a range with a delay take that much longer, reads touching
+ * one without fail with an uncorrectable data error. SMART READ DATA returns
+ * smart.bin, or attributes synthesised from disk.bin, and SMART READ LOG the
+ * smart_log_XX.bin files, listed in a synthesised log directory.
+ */
+
+/* Check whether a hard disk location names a simulated drive. */
+int is_simulated_drive_name(const char *hard_disk_dev_file);
+
+/* Open the simulated drive in the directory named by hard_disk_dev_file.
+   Returns the descriptor to pass to the disk communication functions. */
+int open_simulated_drive(wdfw_context *context, char *hard_disk_dev_file);
+
+/* Check whether a descriptor belongs to an open simulated drive. */
+int is_simulated_drive(int hard_disk_file_descriptor);
+
+/* Forget the state of a simulated drive. Does not close the descriptor. */
+void close_simulated_drive(int hard_disk_file_descriptor);
+
+/* Execute an ATA pass-through cdb on a simulated drive. Same results as
+   execute_command. */
+int execute_simulated_command(wdfw_context *context, unsigned char *cdb,
+	int hard_disk_file_descriptor,
+	void *response_buffer, size_t response_buffer_size,
+	int data_direction);
+
+/* Create a simulated drive in directory holding a copy of rom_image and
+   number_of_modules synthetic service area modules with valid checksums. */
+int create_simulated_drive(wdfw_context *context, char *directory,
+	char *rom_image, unsigned int number_of_modules);
+
+#endif
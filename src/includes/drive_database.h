@@ -0,0 +1,90 @@
+#ifndef DRIVE_DATABASE_H
+#define DRIVE_DATABASE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rom_geometry.h"
+#include "wdfw_context.h"
+
+/* Database loaded at startup when WDFW_DRIVE_DB names no other file. Without
+   either the built-in profiles of wd_info.h are used. */
+#define DRIVE_DATABASE_FILE             "/etc/wdfw/drives.db"
+
+/* Longest identify model number and firmware revision. */
+#define DRIVE_MODEL_SIZE                41
+#define DRIVE_FIRMWARE_SIZE             9
+
+/* Commands a profile allows. */
+enum {
+	DRIVE_COMMAND_ROM       = 0x01, /* Rom dump, upload and erase */
+	DRIVE_COMMAND_SA        = 0x02, /* Service area module reads */
+	DRIVE_COMMAND_SMART     = 0x04, /* SMART data and logs */
+	DRIVE_COMMAND_DMA       = 0x08, /* READ/WRITE DMA EXT */
+	DRIVE_COMMAND_ALL       = 0x0f
+};
+
+/*
+ * Compatibility profile of the drives matching a model and firmware
+ * pattern. A pattern is either the complete identify string or a prefix
+ * followed by '*'; "*" alone matches everything.
+ */
+typedef struct {
+	char model[DRIVE_MODEL_SIZE]; /* Model pattern without the '*' */
+	char firmware[DRIVE_FIRMWARE_SIZE]; /* Firmware pattern without '*' */
+	uint8_t model_prefix; /* Set when model ended in '*' */
+	uint8_t firmware_prefix; /* Set when firmware ended in '*' */
+	uint8_t rom_type; /* ROMTYPE_SPI or ROMTYPE_INTERNAL */
+	uint32_t commands; /* DRIVE_COMMAND_* */
+	const rom_geometry *geometry; /* NULL picks it by model (rom_geometry.h) */
+} drive_profile;
+
+/*
+ * Database file, one profile per line and '#' starting a comment:
+ *   <model> | <firmware> | <rom type> | <geometry> | <commands>
+ *   WDC WD800JD-75MSA3 | *   | spi | 256k | rom,sa,smart,dma
+ * The rom type is spi or internal, the geometry a profile name of
+ * rom_geometry.h or - and the commands a comma separated list of rom, sa,
+ * smart and dma, or all.
+ *
+ * The profiles are kept in an open addressing hash table keyed by both
+ * patterns. A lookup tries the exact model and firmware first and then
+ * their prefixes, longest first, but only prefix lengths that occur in the
+ * database, so it costs a bounded number of probes however many profiles
+ * there are. The most specific model wins, then the most specific firmware.
+ */
+typedef struct drive_database {
+	drive_profile *profiles;
+	unsigned int number_of_profiles;
+	uint32_t *table; /* Profile index + 1, 0 for an empty slot */
+	uint32_t table_size; /* Number of slots, a power of two */
+	uint64_t model_prefix_lengths; /* Bit n: a model prefix of n chars */
+	uint64_t firmware_prefix_lengths; /* Bit n: a firmware prefix of n */
+} drive_database;
+
+/* Load and index a database file. On success *database has to be released
+   with free_drive_database. */
+int load_drive_database(wdfw_context *context, const char *database_file,
+	drive_database **database);
+
+/* Release a database loaded by load_drive_database. */
+void free_drive_database(drive_database *database);
+
+/* Find the profile of a drive, in the built-in profiles when database is
+   NULL. Returns NULL for unsupported drives. */
+const drive_profile *lookup_drive_profile(const drive_database *database,
+	const char *model, const char *firmware);
+
+/* Check that the profile of the last identified drive allows commands. Rom
+   commands also need a drive with an SPI flash rom. */
+int check_drive_commands(wdfw_context *context, uint32_t commands);
+
+/* Describe the commands of a profile, e.g. "rom,smart". */
+void format_drive_commands(uint32_t commands, char *text, size_t size);
+
+/* Display the profile a database gives a model and firmware, or the number
+   of profiles when model is NULL. */
+int display_drive_profile(wdfw_context *context, const char *database_file,
+	const char *model, const char *firmware);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef DRIVE_ENUMERATION_H
+#define DRIVE_ENUMERATION_H
+
+#include "wdfw_context.h"
+
+/* Root of the sysfs tree describing the block devices of the system. */
+#define DEFAULT_SYSFS_ROOT              "/sys"
+
+/* sysfs vendor of disks attached through libata, and the prefix of the
+   model of western digital drives. */
+#define CANDIDATE_DRIVE_VENDOR          "ATA"
+#define CANDIDATE_MODEL_PREFIX          "WDC"
+
+/*
+ * Block devices are enumerated from <sysfs root>/block without opening them.
+ * A disk is a candidate when it is a SCSI disk (sd*) backed by libata whose
+ * model starts with CANDIDATE_MODEL_PREFIX; all other devices are skipped
+ * before a single command is sent. The sysfs model holds the first 16
+ * characters of the identify model number only, so candidates still have to
+ * be identified.
+ */
+typedef struct {
+	char name[32]; /* Block device name, e.g. "sdaa" */
+	char device_file[40]; /* Device file, e.g. "/dev/sdaa" */
+	char model[48]; /* sysfs model, spaces trimmed */
+	char driver[32]; /* Driver of the SCSI host, e.g. "ahci" */
+	int host; /* SCSI address host:channel:target:lun */
+	int channel;
+	int target;
+	int lun;
+} drive_candidate;
+
+/* List the candidate drives of the system described by the sysfs tree at
+   sysfs_root, in SCSI host topology order. On success *candidates has to be
+   freed by the caller. *number_skipped receives the number of block devices
+   that were not candidates. */
+int enumerate_drive_candidates(wdfw_context *context, const char *sysfs_root,
+	drive_candidate **candidates, unsigned int *number_of_candidates,
+	unsigned int *number_skipped);
+
+/* Check whether block device name is a candidate drive. Returns 1 and fills
+   in candidate when it is, 0 when it is not. */
+int find_drive_candidate(wdfw_context *context, const char *sysfs_root,
+	const char *name, drive_candidate *candidate);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef DRIVE_WATCH_H
+#define DRIVE_WATCH_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "drive_enumeration.h"
+#include "wdfw_context.h"
+
+/* Maximum number of drives kept in the inventory of a watch. */
+#define MAXIMUM_WATCHED_DRIVES          64
+
+/* Size of the largest uevent message. */
+#define UEVENT_BUFFER_SIZE              8192
+
+/* Fields of a kernel uevent used by the watch. */
+typedef struct {
+	char action[16]; /* ACTION: "add", "remove", "change", ... */
+	char subsystem[16]; /* SUBSYSTEM: "block", "scsi", ... */
+	char devtype[16]; /* DEVTYPE: "disk", "partition", ... */
+	char devname[32]; /* DEVNAME: "sda", "sdaa", ... */
+} drive_uevent;
+
+/* State of a drive in the inventory. */
+typedef enum {
+	WATCHED_DRIVE_IDENTIFIED    = 0, /* Identified as a supported drive */
+	WATCHED_DRIVE_UNSUPPORTED   = 1, /* Could not be opened or identified */
+	WATCHED_DRIVE_JOB_RUNNING   = 2, /* The job of the watch is running */
+	WATCHED_DRIVE_JOB_DONE      = 3, /* The job finished successfully */
+	WATCHED_DRIVE_JOB_FAILED    = 4  /* The job failed */
+} watched_drive_state;
+
+typedef struct {
+	drive_candidate candidate;
+	char device_file[256]; /* Location the drive was opened as */
+	watched_drive_state state;
+	pid_t job; /* Process of the running job, 0 when none runs */
+	struct timespec added; /* Arrival of the add event */
+} watched_drive;
+
+/*
+ * A watch listens for block device uevents, from the kernel netlink socket
+ * or replayed from event_file, and identifies candidate drives as soon as
+ * they are added. When job is set it is run by /bin/sh for every identified
+ * drive, with the location of the drive in WDFW_DRIVE. Event files hold
+ * records of KEY=VALUE lines separated by empty lines, the text form of the
+ * kernel messages (udevadm monitor --kernel --property prints them).
+ */
+typedef struct {
+	const char *event_file; /* NULL listens to the kernel */
+	const char *sysfs_root; /* Checked for candidate drives */
+	const char *device_prefix; /* Drives are opened as prefix/DEVNAME */
+	const char *job; /* Shell command started per drive, NULL for none */
+} drive_watch_options;
+
+/* Parse a uevent message: NUL separated "KEY=VALUE" strings, optionally
+   preceded by an "action@devpath" header. */
+int parse_drive_uevent(const char *message, size_t size,
+	drive_uevent *event);
+
+/* Watch for drives until the event file ends, or forever on the kernel
+   socket. */
+int watch_hard_disk_drives(wdfw_context *context,
+	drive_watch_options *options);
+
+#endif
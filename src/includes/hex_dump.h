@@ -0,0 +1,55 @@
+#ifndef HEX_DUMP_H
+#define HEX_DUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "wdfw_context.h"
+
+#define HEX_DUMP_BYTES_PER_LINE         16
+
+/* Formatted lines are collected in a buffer of this size and written to the
+   context output in one go. */
+#define HEX_DUMP_BUFFER_SIZE            (256 * 1024)
+
+/* Longest formatted line: address, 16 hex bytes, ASCII column. */
+#define HEX_DUMP_MAXIMUM_LINE           96
+
+/*
+ * Hex and ASCII dump in the layout of hexdump -C, written to the context
+ * output:
+ *   000000000005:000  68 65 6c 6c 6f 00 00 00  00 00 00 00 00 00 00 00  |hello...........|
+ *   *
+ *   000000000006:000
+ * With an address unit of 1 addresses are byte offsets, otherwise they are
+ * "<unit number>:<offset in the unit>", e.g. LBA:offset for a unit of
+ * ATA_SECTOR_SIZE. With collapse set, lines equal to the line before them
+ * are replaced by a single "*". The address following the last byte ends the
+ * dump. Data can be fed in pieces of any size.
+ */
+typedef struct {
+	uint64_t address; /* Address of the next line */
+	unsigned int unit; /* Bytes per address unit, 1 - 0x1000 */
+	int collapse;
+	uint8_t line[HEX_DUMP_BYTES_PER_LINE]; /* Partially fed line */
+	unsigned int line_fill;
+	uint8_t previous[HEX_DUMP_BYTES_PER_LINE]; /* Last complete line */
+	int has_previous;
+	int repeating; /* Set while lines equal to previous are skipped */
+	char *buffer; /* HEX_DUMP_BUFFER_SIZE bytes of formatted lines */
+	size_t fill;
+} hex_dump;
+
+/* Start a dump of data at address, counted in units of unit bytes. */
+int init_hex_dump(wdfw_context *context, hex_dump *dump, uint64_t address,
+	unsigned int unit, int collapse);
+
+/* Format the next size bytes of the dump. */
+int feed_hex_dump(wdfw_context *context, hex_dump *dump, const uint8_t *data,
+	size_t size);
+
+/* Format a last partial line and the end address, write out everything and
+   release the dump. */
+int finish_hex_dump(wdfw_context *context, hex_dump *dump);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef LBA_TRANSFER_H
+#define LBA_TRANSFER_H
+
+#include <stdint.h>
+
+#include "wdfw_context.h"
+
+/* Sectors moved by one WRITE DMA EXT command unless chosen otherwise
+   (128 KiB, within the default transfer limit of every Linux host). */
+#define LBA_TRANSFER_DEFAULT_SECTORS    256
+
+/* Commands kept in flight unless chosen otherwise. */
+#define LBA_TRANSFER_DEFAULT_QUEUE      4
+#define LBA_TRANSFER_MAXIMUM_QUEUE      32
+
+typedef struct {
+	uint32_t sectors_per_command; /* 1 - ATA_MAXIMUM_DMA_EXT_SECTORS */
+	unsigned int queue_depth; /* Commands in flight, 1 - maximum */
+	int verify; /* Read every command back and compare it */
+} lba_write_options;
+
+/* Set the default options of an LBA range write. */
+void init_lba_write_options(lba_write_options *options);
+
+/*
+ * Write image_file to the sectors starting at first_lba with WRITE DMA EXT
+ * commands. Up to queue_depth commands are in flight at once, each sent by a
+ * worker of its own; the last sector is padded with zeros. With verify set
+ * every command is read back with READ DMA EXT and compared before it counts
+ * as done. On a failure no further commands are started and the lowest
+ * failing LBA is reported.
+ */
+int write_lba_range(wdfw_context *context, char *hard_disk_dev_file,
+	uint64_t first_lba, char *image_file, lba_write_options *options);
+
+#endif
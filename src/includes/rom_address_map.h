@@ -0,0 +1,53 @@
+#ifndef ROM_ADDRESS_MAP_H
+#define ROM_ADDRESS_MAP_H
+
+#include <stdint.h>
+
+#include "rom_management.h"
+
+/* Load address range of a single rom block and its location in the file. */
+typedef struct {
+	uint32_t load_address; /* First CPU address of the block */
+	uint32_t file_offset; /* Offset of the block contents in the rom file */
+	uint32_t size; /* Number of bytes covered by the range */
+	uint64_t max_end; /* Highest range end up to this entry (sorted order) */
+	uint8_t block_nr; /* Number of the rom block the range belongs to */
+	uint8_t flag; /* Compression flag of the rom block */
+} rom_address_range;
+
+/*
+ * Interval index over the rom block table. The ranges are kept sorted twice,
+ * once on load address and once on file offset, so translations in both
+ * directions are a binary search.
+ */
+typedef struct {
+	rom_address_range *by_load;
+	rom_address_range *by_file;
+	unsigned int number_of_ranges;
+	unsigned int number_of_overlaps; /* Overlapping load ranges detected */
+	unsigned int number_of_file_overlaps; /* Overlapping file ranges */
+} rom_address_map;
+
+/* Build an address map from a rom block table. */
+rom_address_map *create_rom_address_map(rom_block *rom_block_table,
+	unsigned int number_of_blocks);
+
+/* Destroy an address map created by create_rom_address_map. */
+void destroy_rom_address_map(rom_address_map *map);
+
+/* Translate a CPU load address to an offset in the rom file. Returns
+   WDFW_ERROR_ADDRESS when the address is not part of a block and
+   WDFW_ERROR_COMPRESSED when it is part of a compressed block. */
+int load_address_to_file_offset(rom_address_map *map, uint32_t load_address,
+	uint32_t *file_offset);
+
+/* Translate an offset in the rom file to a CPU load address, with the same
+   results as load_address_to_file_offset. */
+int file_offset_to_load_address(rom_address_map *map, uint32_t file_offset,
+	uint32_t *load_address);
+
+/* Find the block a file offset belongs to, NULL when it is not in a block. */
+rom_address_range *find_file_range(rom_address_map *map,
+	uint32_t file_offset);
+
+#endif
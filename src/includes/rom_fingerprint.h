@@ -0,0 +1,120 @@
+#ifndef ROM_FINGERPRINT_H
+#define ROM_FINGERPRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rom_stream.h"
+#include "wdfw_context.h"
+
+/* Hashes of a rom image and of the contents of its blocks (rom_hash.h),
+   the same values unpack_rom_image stores in block_hashes. */
+typedef struct {
+	uint64_t image_hash;
+	unsigned int number_of_blocks;
+	uint8_t block_nr[ROM_STREAM_MAX_BLOCKS];
+	uint64_t block_hash[ROM_STREAM_MAX_BLOCKS];
+} rom_fingerprint;
+
+/*
+ * Fingerprint database file (native endian):
+ *   rom_fingerprint_db_header
+ *   number_of_builds rom_fingerprint_build records
+ *   number_of_entries rom_fingerprint_entry records, an image entry and an
+ *     entry per block for every build
+ *   table_size uint32_t slots of an open addressing hash table holding
+ *     entry index + 1 (0 is an empty slot), keyed by the entry hash
+ *   bloom_size bytes of a Bloom filter over all entry hashes
+ * A hash lookup costs a few filter bits and a probe sequence as long as the
+ * number of builds sharing the hash.
+ */
+#define FINGERPRINT_DB_MAGIC            "WDFP"
+#define FINGERPRINT_DB_VERSION          1
+
+/* Bloom filter bits per entry and bits set per hash. */
+#define FINGERPRINT_BLOOM_BITS          16
+#define FINGERPRINT_BLOOM_HASHES        4
+
+/* block_nr of the entry holding the hash of a complete image. */
+#define FINGERPRINT_IMAGE_ENTRY         0xffff
+
+#define FINGERPRINT_NAME_SIZE           48
+
+typedef struct __attribute__((packed)) {
+	char magic[4]; /* FINGERPRINT_DB_MAGIC */
+	uint32_t version; /* FINGERPRINT_DB_VERSION */
+	uint32_t number_of_builds;
+	uint32_t number_of_entries;
+	uint32_t table_size; /* Number of slots, a power of two */
+	uint32_t bloom_size; /* Size of the Bloom filter in bytes, a power of 2 */
+} rom_fingerprint_db_header;
+
+typedef struct __attribute__((packed)) {
+	char name[FINGERPRINT_NAME_SIZE]; /* Name of the build, 0 terminated */
+	uint64_t image_hash;
+	uint32_t number_of_blocks;
+	uint32_t first_entry; /* Index of the first block entry of the build */
+} rom_fingerprint_build;
+
+typedef struct __attribute__((packed)) {
+	uint64_t hash;
+	uint32_t build; /* Index of the build */
+	uint16_t block_nr; /* FINGERPRINT_IMAGE_ENTRY for the image hash */
+	uint16_t unk1; /* Reserved, 0 */
+} rom_fingerprint_entry;
+
+/* An opened fingerprint database. */
+typedef struct {
+	uint8_t *memory; /* Mapped database file */
+	size_t size;
+	rom_fingerprint_db_header *header;
+	rom_fingerprint_build *builds;
+	rom_fingerprint_entry *entries;
+	uint32_t *table;
+	uint8_t *bloom;
+} rom_fingerprint_db;
+
+/* Result of looking up the fingerprint of a rom image. */
+typedef struct {
+	int found; /* Set when at least one block belongs to a known build */
+	int exact; /* Set when the image hash belongs to build */
+	uint32_t build; /* Index of the best matching build */
+	unsigned int matching_blocks; /* Blocks shared with build */
+	unsigned int rejected; /* Hashes rejected by the Bloom filter */
+	int differs[ROM_STREAM_MAX_BLOCKS]; /* Blocks not found in build */
+} rom_fingerprint_match;
+
+/* Calculate the fingerprint of a rom image file, or read it from a
+   block_hashes file written by unpack_rom_image. */
+int load_rom_fingerprint(wdfw_context *context, char *file_name,
+	rom_fingerprint *fingerprint);
+
+/* Open a fingerprint database for lookups. */
+int open_rom_fingerprint_db(wdfw_context *context, char *db_file,
+	rom_fingerprint_db *db);
+
+/* Close a database opened by open_rom_fingerprint_db. */
+void close_rom_fingerprint_db(rom_fingerprint_db *db);
+
+/* Check whether hash may be in the database. A 0 result is definite. */
+int test_rom_fingerprint_bloom(rom_fingerprint_db *db, uint64_t hash);
+
+/* Find the build a fingerprint belongs to and the blocks that differ. Every
+   build sharing a block is counted, so a block common to many builds costs
+   a probe per build. */
+int match_rom_fingerprint(wdfw_context *context, rom_fingerprint_db *db,
+	rom_fingerprint *fingerprint, rom_fingerprint_match *match);
+
+/* Add the fingerprint of a rom image or block_hashes file to a database,
+   creating the database when it does not exist. */
+int add_rom_fingerprint(wdfw_context *context, char *db_file, char *name,
+	char *file_name);
+
+/* Display which known build a rom image is and which blocks differ. */
+int identify_rom_fingerprint(wdfw_context *context, char *db_file,
+	char *file_name);
+
+/* Display the builds of a database. */
+int list_rom_fingerprints(wdfw_context *context, char *db_file);
+
+#endif
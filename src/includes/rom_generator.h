@@ -0,0 +1,43 @@
+#ifndef ROM_GENERATOR_H
+#define ROM_GENERATOR_H
+
+#include <stdint.h>
+
+#include "rom_management.h"
+#include "wdfw_context.h"
+
+/* Maximum number of blocks in a generated image: every block number accepted
+   by create_rom_block_table (0x00 - 0x0a and 0x5a) used once. */
+#define GENERATOR_MAXIMUM_BLOCKS    12
+
+/* Alignment of the start address of generated blocks. */
+#define GENERATOR_BLOCK_ALIGNMENT   16
+
+/* Parameters of a series of synthetic rom images. */
+typedef struct {
+	uint64_t seed; /* Image n is generated from seed and n only */
+	unsigned int min_blocks;
+	unsigned int max_blocks;
+	uint32_t min_block_size;
+	uint32_t max_block_size;
+	unsigned int entropy; /* Percentage of random contents (0 - 100) */
+} rom_generator_config;
+
+/* Fill in the default generator parameters. */
+void init_rom_generator_config(rom_generator_config *config);
+
+/* Parse a "seed=", "blocks=<min>[-<max>]", "size=<min>[-<max>]" or
+   "entropy=" option into config. */
+int parse_rom_generator_option(wdfw_context *context,
+	rom_generator_config *config, char *option);
+
+/* Generate image image_index of a series into rom (ROM_IMAGE_SIZE bytes). */
+int generate_rom_image(rom_generator_config *config, uint64_t image_index,
+	uint8_t *rom);
+
+/* Generate number_of_images images as <output_prefix>_<index>.bin files, or
+   as one concatenated stream on stdout when output_prefix is "-". */
+int generate_rom_images(wdfw_context *context, rom_generator_config *config,
+	char *output_prefix, uint64_t number_of_images);
+
+#endif
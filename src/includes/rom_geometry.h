@@ -0,0 +1,41 @@
+#ifndef ROM_GEOMETRY_H
+#define ROM_GEOMETRY_H
+
+#include <stdint.h>
+
+/* Size of the sectors the rom is transferred in. */
+#define ROM_SECTOR_SIZE             512
+
+/* Transfer chunk sizes tried by the calibration. */
+#define ROM_MINIMUM_CHUNK_SIZE      (8 * 1024)
+#define ROM_MAXIMUM_CHUNK_SIZE      (1024 * 1024)
+
+/*
+ * Flash layout of a drive model and the number of bytes moved by a single
+ * rom read or write command. Drives are matched by the first profile whose
+ * model_prefix starts their identify model number; profiles without prefix
+ * are only selected by name.
+ */
+typedef struct {
+	const char *name;
+	const char *model_prefix;
+	uint32_t image_size; /* Size of the SPI flash (rom image) */
+	uint32_t chunk_size; /* Bytes per rom transfer command */
+} rom_geometry;
+
+/* Default profile, used for rom files and drives that match no profile. */
+const rom_geometry *default_rom_geometry(void);
+
+/* Look up a profile by name ("256k", "512k", "1m"). Returns NULL when there
+   is no such profile. */
+const rom_geometry *find_rom_geometry(const char *name);
+
+/* Look up the profile of a drive by its identify model number. Returns NULL
+   when no profile matches. */
+const rom_geometry *match_rom_geometry(const char *model);
+
+/* Check that chunk_size can be transferred by a rom command and divides the
+   image of geometry. */
+int verify_rom_chunk_size(const rom_geometry *geometry, uint32_t chunk_size);
+
+#endif
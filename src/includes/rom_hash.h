@@ -0,0 +1,31 @@
+#ifndef ROM_HASH_H
+#define ROM_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 64-bit FNV-1a parameters.
+ * Source: http://www.isthe.com/chongo/tech/comp/fnv/index.html */
+#define ROM_HASH_INIT       0xcbf29ce484222325ULL
+#define ROM_HASH_PRIME      0x00000100000001b3ULL
+
+/* Continue a 64-bit FNV-1a hash over size bytes of data. */
+static inline uint64_t update_rom_hash(uint64_t hash, const uint8_t *data,
+	size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= ROM_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+/* Calculate the 64-bit FNV-1a hash of size bytes of data. */
+static inline uint64_t calculate_rom_hash(const uint8_t *data, size_t size)
+{
+	return update_rom_hash(ROM_HASH_INIT, data, size);
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "wdfw_context.h"
+
 /* Size of the ROM eeprom used on a WD hard disk drive. */
 #define ROM_IMAGE_SIZE          256 * 1024
 #define ROM_IMAGE_BLOCK_SIZE    64  * 1024
@@ -38,25 +40,147 @@ typedef struct __attribute__((packed)) {
 	uint32_t fstw_plus_cs; /* 8-bit Checksum of the block */
 } rom_block;
 
+/* Address space in which a patch or search address is expressed. */
+typedef enum {
+	ADDRESS_SPACE_FILE = 0, /* Offset in the rom image file */
+	ADDRESS_SPACE_LOAD = 1  /* CPU load address of a rom block */
+} address_space;
+
+/* A single modification of a rom image, as read from a patch set file. */
+typedef struct {
+	address_space space; /* Address space of address */
+	uint32_t address; /* Address of the first byte to replace */
+	uint32_t value; /* Replacement bytes, stored little-endian */
+	uint32_t size; /* Number of bytes of value to write (1 - 4) */
+} rom_patch;
+
+/* Little endian to big endian.
+ * Source:
+ * https://stackoverflow.com/questions/19275955/convert-little-endian-to-big-endian/19276193 */
+static inline uint32_t le_32_to_be(uint32_t integer)
+{
+	unsigned char *p=(unsigned char*)&integer;
+	return p[0]+(p[1]<<8)+(p[2]<<16)+(p[3]<<24);
+}
+
+/* Big endian to little endian.
+ * Source:
+ * https://stackoverflow.com/questions/2182002/convert-big-endian-to-little-endian-in-c-without-using-provided-func
+ */
+static inline uint32_t be_32_to_le(uint32_t integer)
+{
+	uint32_t ret;
+	unsigned char *p=(unsigned char *)&ret;
+	p[0]=(integer)&0xff;
+	p[1]=(integer>>8)&0xff;
+	p[2]=(integer>>16)&0xff;
+	p[3]=(integer>>24)&0xff;
+	return ret;
+}
+
+/* Create rom block table from an in memory representation rom_file. */
+rom_block *create_rom_block_table(uint8_t *rom_file,
+	unsigned int *number_of_blocks);
+
+/* Destrom rom block table. */
+void destroy_rom_block_table(rom_block *rom_block_table);
+
+/* Calculates the checksum (8 or 16 bit) of a code block in the rom file. */
+unsigned int calculate_rom_block_checksum_8(uint8_t *block,
+	unsigned int size);
+
+/* Calculates the checksum for a single line of a code block. */
+unsigned int calculate_line_checksum(uint8_t *block);
+
+/* Recalculate the contents checksum stored after a rom block and the
+   checksum of its header line. */
+void update_rom_block_checksums(uint8_t *rom, rom_block *block);
+
+/* Result of reading the rom of a drive with one transfer chunk size. */
+typedef struct {
+	uint32_t chunk_size;
+	int valid; /* The image read matched the reference image */
+	double bytes_per_second;
+} rom_chunk_measurement;
+
+/* Measure the rom read throughput of a drive for every usable chunk size and
+   select the fastest valid one as context->geometry.chunk_size. On input
+   *number_of_measurements holds the size of measurements. */
+int calibrate_rom_chunk_size(wdfw_context *context, char *hard_disk_dev_file,
+	rom_chunk_measurement *measurements,
+	unsigned int *number_of_measurements);
+
 /* Dumps the rom image from a wd hard disk drive. */
-int dump_rom_image(char *hard_disk_dev_file, char *out_file);
+int dump_rom_image(wdfw_context *context, char *hard_disk_dev_file,
+	char *out_file);
+
+/* Dumps the rom image from a wd hard disk drive and verifies and unpacks it
+   while the remaining chunks are still being transferred. */
+int dump_and_unpack_rom_image(wdfw_context *context,
+	char *hard_disk_dev_file, char *out_file);
 
 /* Upload the rom image to a wd hard disk drive. */
-int upload_rom_image(char *hard_disk_dev_file, char *in_file);
+int upload_rom_image(wdfw_context *context, char *hard_disk_dev_file,
+	char *in_file);
 
 /* Unpacks a packed rom image. */
-int unpack_rom_image(char *rom_image);
+int unpack_rom_image(wdfw_context *context, char *rom_image);
 
 /* Packs a rom image based with the name specified by out_file based on
-   the init file specified by rom_image. */
-int pack_rom_image(char *rom_image, char *out_file);
+   the init file specified by rom_image. The image has the size of the
+   context geometry. When the context has a pack cache, an image packed
+   before from the same rom block table and block contents is copied from
+   the cache instead. */
+int pack_rom_image(wdfw_context *context, char *rom_image, char *out_file);
+
+/* Packs out_file like pack_rom_image, but when out_file was packed before
+   from the same formatted header only the block files that changed since are
+   reloaded and patched into out_file in place. The state of the packed files
+   is kept in a pack_manifest file next to the formatted header. */
+int repack_rom_image(wdfw_context *context, char *rom_image, char *out_file);
 
 /* Replaces an instruction at memory_address with new_instruction in the rom
-   image specified by the rom_image init file. */
-int modify_instruction(char *rom_image, uint32_t memory_adress,
-	uint32_t new_instruction, uint32_t instruction_byte_size);
+   image specified by the rom_image init file. The memory address is either a
+   file offset or a CPU load address, depending on space. */
+int modify_instruction(wdfw_context *context, char *rom_image,
+	address_space space, uint32_t memory_adress, uint32_t new_instruction,
+	uint32_t instruction_byte_size);
+
+/* Read a patch set file. Each line holds "<file|load> <address> <value>
+   [size]". The caller frees *patches. */
+int load_rom_patch_set(wdfw_context *context, char *patch_file,
+	rom_patch **patches, unsigned int *number_of_patches);
+
+/* Apply all patches of the patch_file patch set to the rom_image file. The
+   file is edited in place and the replaced bytes are kept in an undo journal
+   (rom_image + ".undo"). */
+int apply_rom_patch_set(wdfw_context *context, char *rom_image,
+	char *patch_file);
+
+/* Build the variants listed in variant_file ("<output file> <patch file>"
+   lines) from the rom_image base image. Every variant is built in a private
+   copy-on-write mapping of the base, gets the checksums of the blocks its
+   patches touch recalculated and is written by one of number_of_workers
+   threads (0 uses one per CPU). The base image is not modified. Patches may
+   not write checksum bytes, those are recalculated. */
+int build_rom_variants(wdfw_context *context, char *rom_image,
+	char *variant_file, unsigned int number_of_workers);
+
+/* Undo the last modification of rom_image using its undo journal. */
+int revert_rom_modification(wdfw_context *context, char *rom_image);
+
+/* Search a byte pattern (hex string) in a rom image and report every match as
+   file offset and CPU load address. */
+int search_rom_image(wdfw_context *context, char *rom_image,
+	char *hex_pattern);
+
+/* Display information about the blocks found in a rom image. Pipes and "-"
+   (stdin) are parsed as a stream. */
+int display_rom_info(wdfw_context *context, char *rom_image);
 
-/* Display information about the blocks found in a rom image. */
-int display_rom_info(char *rom_image);
+/* Display information about a rom image read from input_fd while it arrives,
+   optionally storing a copy of the image in copy_file. */
+int display_rom_stream_info(wdfw_context *context, int input_fd,
+	char *copy_file);
 
 #endif
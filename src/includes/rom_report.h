@@ -0,0 +1,93 @@
+#ifndef ROM_REPORT_H
+#define ROM_REPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rom_management.h"
+#include "wdfw_context.h"
+#include "rom_stream.h"
+
+/* Size of the output buffer of a report writer. */
+#define REPORT_BUFFER_SIZE          (256 * 1024)
+
+/* Output formats of a rom info report. */
+enum {
+	REPORT_FORMAT_JSON      = 0, /* One JSON object per line and image */
+	REPORT_FORMAT_BINARY    = 1  /* Packed rom_info_image/block records */
+};
+
+#define REPORT_IMAGE_MAGIC      0x4d495744 /* "DWIM" little-endian */
+#define REPORT_BLOCK_MAGIC      0x4b425744 /* "DWBK" little-endian */
+
+/* Image status reported in a rom info record. */
+enum {
+	REPORT_STATUS_OK        = 0, /* All headers and blocks verified */
+	REPORT_STATUS_CORRUPT   = 1, /* At least one checksum failed */
+	REPORT_STATUS_ERROR     = 2  /* Image could not be read */
+};
+
+/*
+ * Binary report layout (native endian, all rom_block fields converted with
+ * le_32_to_be): one rom_info_image record followed by name_length bytes of
+ * image name and number_of_blocks rom_info_block records.
+ */
+typedef struct __attribute__((packed)) {
+	uint32_t magic; /* REPORT_IMAGE_MAGIC */
+	uint32_t image_id; /* Position of the image in the batch */
+	uint64_t image_size; /* Number of bytes read from the image */
+	uint32_t number_of_blocks;
+	uint32_t number_of_failures; /* Failed header and contents checks */
+	uint16_t status;
+	uint16_t name_length;
+} rom_info_image;
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic; /* REPORT_BLOCK_MAGIC */
+	uint8_t block_nr;
+	uint8_t flag;
+	uint8_t unk1;
+	uint8_t unk2;
+	uint32_t length_plus_cs;
+	uint32_t size;
+	uint32_t start_address;
+	uint32_t load_address;
+	uint32_t execution_address;
+	uint32_t unk3;
+	uint32_t fstw_plus_cs;
+	uint8_t header_checksum; /* Calculated header line checksum */
+	uint8_t header_state; /* ROM_CHECK_* */
+	uint8_t contents_checksum; /* Calculated contents checksum */
+	uint8_t stored_contents_checksum; /* Checksum byte after the block */
+	uint8_t contents_state; /* ROM_CHECK_* */
+	uint8_t reserved[3];
+} rom_info_block;
+
+/* Buffered writer shared by all records of a report. */
+typedef struct {
+	int fd;
+	size_t fill;
+	int failed; /* errno of the first failed write to fd, 0 otherwise */
+	uint8_t buffer[REPORT_BUFFER_SIZE];
+} report_writer;
+
+/* Prepare a report writer that outputs to fd. */
+void init_report_writer(report_writer *writer, int fd);
+
+/* Append size bytes of data to the report. */
+int write_report(report_writer *writer, const void *data, size_t size);
+
+/* Write all buffered report data to the output file descriptor. */
+int flush_report_writer(report_writer *writer);
+
+/* Append the report of a single parsed rom image. A NULL stream reports an
+   image that could not be read. */
+int write_rom_report(report_writer *writer, int format, uint32_t image_id,
+	char *rom_image, rom_stream *stream);
+
+/* Parse every rom image of rom_images (one file name per line on stdin when
+   it holds only "-") and report them to output_fd. */
+int report_rom_info(wdfw_context *context, int format, char **rom_images,
+	unsigned int number_of_images, int output_fd);
+
+#endif
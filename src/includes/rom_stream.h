@@ -0,0 +1,67 @@
+#ifndef ROM_STREAM_H
+#define ROM_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rom_management.h"
+
+/* Upper bound on the number of rom block headers accepted from a stream. */
+#define ROM_STREAM_MAX_BLOCKS       64
+
+/* Verification state of a rom block seen by the stream parser. */
+enum {
+	ROM_CHECK_PENDING   = 0, /* Not all bytes have arrived yet */
+	ROM_CHECK_OK        = 1, /* Checksum matches */
+	ROM_CHECK_FAIL      = 2, /* Checksum mismatch */
+	ROM_CHECK_IRREGULAR = 3  /* Block layout can not be verified */
+};
+
+/*
+ * Incremental rom image parser. Bytes are fed in arbitrary chunks in file
+ * order; the header table is parsed line by line and the contents checksum
+ * of every block is accumulated while its bytes pass by, so nothing of the
+ * image has to be kept in memory.
+ */
+typedef struct {
+	rom_block table[ROM_STREAM_MAX_BLOCKS]; /* Headers parsed so far */
+	unsigned int number_of_blocks;
+	int table_complete; /* End of the header table has been seen */
+	uint64_t offset; /* Number of bytes consumed */
+
+	uint8_t line[sizeof(rom_block)]; /* Partially received header line */
+	unsigned int line_fill;
+
+	uint8_t header_checksum[ROM_STREAM_MAX_BLOCKS]; /* Calculated */
+	uint8_t contents_checksum[ROM_STREAM_MAX_BLOCKS]; /* Running sum */
+	uint8_t stored_checksum[ROM_STREAM_MAX_BLOCKS]; /* Byte after block */
+	int header_state[ROM_STREAM_MAX_BLOCKS];
+	int contents_state[ROM_STREAM_MAX_BLOCKS];
+
+	/* Hash the image and the contents of every block in the same pass as
+	   the checksums (rom_hash.h) when hash_contents is set. */
+	int hash_contents;
+	uint64_t contents_hash[ROM_STREAM_MAX_BLOCKS];
+	uint64_t image_hash;
+
+	/* Called once the contents of a block have been verified. */
+	void (*block_verified)(void *context, unsigned int block_index);
+	void *context;
+} rom_stream;
+
+/* Prepare a stream parser for a new image. */
+void init_rom_stream(rom_stream *stream);
+
+/* Feed the next size bytes of the image to the parser. */
+int feed_rom_stream(rom_stream *stream, const uint8_t *data, size_t size);
+
+/* Feed everything read from input_fd to the parser, using chunk as read
+   buffer. Returns -1 when input_fd could not be read. */
+int read_rom_stream(rom_stream *stream, int input_fd, uint8_t *chunk,
+	size_t chunk_size);
+
+/* Mark the end of the image. Blocks that did not arrive completely are
+   returned as irregular; the number of failed checks is returned. */
+int finish_rom_stream(rom_stream *stream);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef SERVICE_AREA_H
+#define SERVICE_AREA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "wdfw_context.h"
+
+/*
+ * Firmware modules stored in the service area on the platters. They are
+ * read through the vendor specific commands used for the rom: a key sector
+ * selects the module and the vendor data log returns its sectors. The
+ * header and directory layouts follow the ROYL family; fields marked ? are
+ * not understood yet and are kept as read.
+ */
+#define SA_SECTOR_SIZE                  512
+#define SA_MODULE_SIGNATURE             "ROYL"
+#define SA_DIRECTORY_MODULE             0x0001
+
+/* Words of the key sector that selects a module. */
+#define SA_KEY_MODULE_ACCESS            0x0008
+#define SA_KEY_MODULE_READ              0x0001
+
+/* Size of the module directory read before its real size is known. */
+#define SA_DIRECTORY_PROBE_SECTORS      1
+
+/* Header found at the start of every service area module. */
+typedef struct __attribute__((packed)) {
+	char signature[4]; /* SA_MODULE_SIGNATURE */
+	uint16_t unk1; /* ? */
+	uint16_t unk2; /* ? */
+	uint16_t module_id; /* Number of the module */
+	uint16_t size; /* Size of the module in sectors */
+	uint32_t checksum; /* Makes the 32-bit word sum of the module zero */
+} sa_module_header;
+
+/* Header of the module directory (module 0x0001). */
+typedef struct __attribute__((packed)) {
+	sa_module_header module;
+	uint16_t number_of_entries; /* Number of directory entries */
+	uint16_t entry_size; /* Size of a directory entry in bytes */
+	uint8_t unk1[12]; /* ? */
+} sa_directory_header;
+
+/* Entry of the module directory. */
+typedef struct __attribute__((packed)) {
+	uint16_t module_id; /* Number of the module */
+	uint16_t size; /* Size of the module in sectors */
+	uint32_t location; /* Service area sector of the first copy */
+	uint8_t copies; /* Number of copies kept in the service area */
+	uint8_t flags; /* ? */
+	uint16_t unk1; /* ? */
+} sa_directory_entry;
+
+/* Indexed file holding the modules of a bulk dump. The module data follows
+   the header, every module starting at a sector boundary, and the index of
+   number_of_modules entries is stored at index_offset. */
+#define SA_ARCHIVE_MAGIC                "WDSA"
+#define SA_ARCHIVE_VERSION              1
+
+typedef struct __attribute__((packed)) {
+	char magic[4]; /* SA_ARCHIVE_MAGIC */
+	uint32_t version; /* SA_ARCHIVE_VERSION */
+	uint32_t number_of_modules; /* Number of index entries */
+	uint32_t unk1; /* Reserved, 0 */
+	uint64_t index_offset; /* File offset of the index */
+} sa_archive_header;
+
+/* State of a module stored in an archive. */
+enum {
+	SA_MODULE_VERIFIED      = 0x01, /* Header and checksum are valid */
+	SA_MODULE_UNREADABLE    = 0x02  /* The drive did not return the module */
+};
+
+typedef struct __attribute__((packed)) {
+	uint16_t module_id; /* Number of the module */
+	uint16_t flags; /* SA_MODULE_* */
+	uint32_t size; /* Size of the stored module in bytes */
+	uint64_t offset; /* File offset of the module data */
+	uint64_t hash; /* FNV-1a hash of the module data */
+} sa_archive_entry;
+
+/* Calculate the 32-bit word sum of a module, 0 for an intact module. */
+uint32_t calculate_sa_module_checksum(const uint8_t *module, size_t size);
+
+/* Check the header and checksum of a module read as module_id. */
+int verify_sa_module(const uint8_t *module, size_t size, uint16_t module_id);
+
+/* Read size bytes of module module_id. Vendor specific commands have to be
+   enabled. */
+int read_sa_module(wdfw_context *context, int hard_disk_file_descriptor,
+	uint16_t module_id, uint8_t *module, size_t size);
+
+/* Read the module directory. On success *entries holds *number_of_entries
+   entries and has to be freed by the caller. Vendor specific commands have
+   to be enabled. */
+int read_sa_directory(wdfw_context *context, int hard_disk_file_descriptor,
+	sa_directory_entry **entries, unsigned int *number_of_entries);
+
+/* Display the module directory of a hard disk drive. */
+int display_sa_directory(wdfw_context *context, char *hard_disk_dev_file);
+
+/* Dump the modules listed in module_ids, or every module of the directory
+   when number_of_modules is 0, to the indexed archive_file. */
+int dump_sa_modules(wdfw_context *context, char *hard_disk_dev_file,
+	char *archive_file, uint16_t *module_ids, unsigned int number_of_modules);
+
+/* Display the index of a module archive and verify the stored modules. */
+int display_sa_archive(wdfw_context *context, char *archive_file);
+
+/* Write module module_id of a module archive to out_file. */
+int extract_sa_module(wdfw_context *context, char *archive_file,
+	uint16_t module_id, char *out_file);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SMART_ATTRIBUTES_H
+#define SMART_ATTRIBUTES_H
+
+#include <stdint.h>
+
+#include "wdfw_context.h"
+
+/*
+ * SMART data structure returned by SMART READ DATA: a version word followed
+ * by 30 attribute entries of 12 bytes, and a checksum byte at the end that
+ * makes the sum of all 512 bytes zero. Entries with id 0 are unused.
+ */
+#define SMART_DATA_SIZE                 512
+#define SMART_DATA_ATTRIBUTES           2
+#define SMART_MAXIMUM_ATTRIBUTES        30
+
+typedef struct __attribute__((packed)) {
+	uint8_t id; /* Attribute number, 0 for an unused entry */
+	uint16_t flags; /* Bit 0: pre-failure, bit 1: updated online */
+	uint8_t value; /* Normalised value, usually 1 - 253 */
+	uint8_t worst; /* Lowest normalised value seen */
+	uint8_t raw[6]; /* Vendor specific raw value, little endian */
+	uint8_t unk1; /* Reserved */
+} smart_attribute_entry;
+
+/* A parsed attribute. */
+typedef struct {
+	uint8_t id;
+	uint16_t flags;
+	uint8_t value;
+	uint8_t worst;
+	uint64_t raw;
+} smart_attribute;
+
+typedef struct {
+	uint16_t version; /* Revision of the data structure */
+	unsigned int number_of_attributes;
+	smart_attribute attributes[SMART_MAXIMUM_ATTRIBUTES];
+} smart_attributes;
+
+/* Check the checksum of a SMART data structure and parse its attributes. */
+int parse_smart_data(wdfw_context *context, const uint8_t *smart_data,
+	smart_attributes *attributes);
+
+/* Name of a commonly used attribute, NULL for unknown ones. */
+const char *get_smart_attribute_name(uint8_t id);
+
+/* Read and parse the SMART attributes of a hard disk drive. */
+int read_smart_attributes(wdfw_context *context,
+	int hard_disk_file_descriptor, smart_attributes *attributes);
+
+/* Display the SMART attributes of a hard disk drive. */
+int display_smart_attributes(wdfw_context *context, char *hard_disk_dev_file);
+
+/* Dump SMART log log_address of a hard disk drive, as long as the log
+   directory says it is. */
+int display_smart_log(wdfw_context *context, char *hard_disk_dev_file,
+	uint8_t log_address);
+
+#endif
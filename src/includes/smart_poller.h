@@ -0,0 +1,67 @@
+#ifndef SMART_POLLER_H
+#define SMART_POLLER_H
+
+#include <stdint.h>
+
+#include "wdfw_context.h"
+
+/* Seconds between two polls of every drive unless chosen otherwise. */
+#define SMART_POLL_DEFAULT_INTERVAL     60
+
+/* Drives polled at once unless chosen otherwise. */
+#define SMART_POLL_DEFAULT_WORKERS      16
+#define SMART_POLL_MAXIMUM_WORKERS      64
+
+typedef struct {
+	unsigned int interval_s; /* Seconds from the start of a poll to the next */
+	unsigned int number_of_polls; /* 0 polls until the process is killed */
+	unsigned int number_of_workers; /* 1 - SMART_POLL_MAXIMUM_WORKERS */
+} smart_poll_options;
+
+/*
+ * Time series file, only ever appended to: SMART_SERIES_MAGIC followed by
+ * records of a type byte, the payload length and the payload. Lengths and
+ * the integers in payloads are LEB128 varints, signed ones zigzag encoded.
+ *   SMART_RECORD_SESSION  start (ms since the epoch), interval in ms
+ *   SMART_RECORD_DRIVE    drive number, name
+ *   SMART_RECORD_SAMPLE   drive number, ms since the last record of the
+ *                         drive (since the session start for the first),
+ *                         number of attributes, per attribute its id byte
+ *                         and the signed differences of flags, value, worst
+ *                         and raw value
+ *   SMART_RECORD_FAILURE  drive number, ms since the last record of the
+ *                         drive, WDFW_ERROR_* code
+ * Every poller run starts a session. Differences are taken against the
+ * previous sample of the same drive in the session, or against zeros, and
+ * attributes that did not change are left out, so a sample of an idle drive
+ * costs a few bytes. All records of a poll are appended with one write; a
+ * record cut short by a crash ends the series.
+ */
+#define SMART_SERIES_MAGIC              "WDSM"
+
+enum {
+	SMART_RECORD_SESSION    = 1,
+	SMART_RECORD_DRIVE      = 2,
+	SMART_RECORD_SAMPLE     = 3,
+	SMART_RECORD_FAILURE    = 4
+};
+
+/* Set the default options of a poller. */
+void init_smart_poll_options(smart_poll_options *options);
+
+/*
+ * Poll the SMART attributes of number_of_drives drives every interval_s
+ * seconds and append them to series_file. Drives stay open between polls;
+ * a drive that cannot be opened, is not supported or whose profile does not
+ * allow SMART commands is recorded as a failure and tried again at the next
+ * poll.
+ */
+int poll_smart_attributes(wdfw_context *context, char *series_file,
+	char **drives, unsigned int number_of_drives,
+	smart_poll_options *options);
+
+/* Display the samples of a time series file, one line per changed
+   attribute. */
+int display_smart_series(wdfw_context *context, char *series_file);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SURFACE_SCAN_H
+#define SURFACE_SCAN_H
+
+#include <stdint.h>
+
+#include "wdfw_context.h"
+
+/* Zones the LBA space is divided into unless chosen otherwise. */
+#define SURFACE_SCAN_DEFAULT_ZONES      256
+#define SURFACE_SCAN_MAXIMUM_ZONES      65536
+
+/* Sectors read by one READ DMA EXT command unless chosen otherwise
+   (512 KiB, long enough to run at the media rate). */
+#define SURFACE_SCAN_DEFAULT_SECTORS    1024
+
+/* Reads slower than this count as slow unless chosen otherwise. */
+#define SURFACE_SCAN_DEFAULT_SLOW_MS    200
+
+/* The scan gives up after this many failed reads in a row. */
+#define SURFACE_SCAN_MAXIMUM_FAILURES   64
+
+/* Upper bounds of the latency buckets in microseconds; reads above the last
+   bound go to the last bucket. */
+#define SURFACE_SCAN_BUCKETS            6
+#define SURFACE_SCAN_BUCKET_BOUNDS      \
+	{ 5000, 20000, 50000, 200000, 600000 }
+
+typedef struct {
+	uint32_t number_of_zones; /* 1 - SURFACE_SCAN_MAXIMUM_ZONES */
+	uint32_t sectors_per_read; /* 1 - ATA_MAXIMUM_DMA_EXT_SECTORS */
+	uint32_t samples_per_zone; /* Random reads per zone, 0 reads every zone
+	                              completely */
+	uint32_t slow_ms; /* Latency of a read reported as slow */
+} surface_scan_options;
+
+/*
+ * Heatmap file (little endian on every supported host):
+ *   surface_scan_header
+ *   number_of_zones surface_scan_zone records, lowest LBA first
+ */
+#define SURFACE_SCAN_MAGIC              "WDSS"
+#define SURFACE_SCAN_VERSION            1
+
+typedef struct __attribute__((packed)) {
+	char magic[4]; /* SURFACE_SCAN_MAGIC */
+	uint32_t version; /* SURFACE_SCAN_VERSION */
+	uint32_t number_of_zones;
+	uint32_t sectors_per_read;
+	uint64_t number_of_sectors; /* Capacity of the drive */
+	uint64_t sectors_per_zone; /* The last zone may be shorter */
+	uint32_t samples_per_zone; /* 0 for a complete scan */
+	uint32_t slow_ms;
+} surface_scan_header;
+
+typedef struct __attribute__((packed)) {
+	uint32_t reads; /* Reads sent, failed ones included */
+	uint32_t errors; /* Failed reads */
+	uint32_t histogram[SURFACE_SCAN_BUCKETS]; /* Successful reads per
+	                                             latency bucket */
+	uint32_t max_latency_us; /* Slowest successful read */
+	uint64_t total_latency_us; /* Sum over the successful reads */
+	uint64_t error_lba; /* First sector of the first failed read */
+	uint8_t status; /* ATA status of the first failed read */
+	uint8_t error; /* ATA error of the first failed read */
+	uint16_t unk1; /* Reserved, 0 */
+} surface_scan_zone;
+
+/* Set the default options of a surface scan. */
+void init_surface_scan_options(surface_scan_options *options);
+
+/*
+ * Read the surface of a hard disk drive with READ DMA EXT and record the
+ * latency of every read in a histogram of its zone. Either every sector is
+ * read, one command after the other, or samples_per_zone reads land on
+ * random positions of every zone for a quick overview. The zones are written
+ * to heatmap_file and displayed as a map, followed by the slow and failed
+ * zones with the ATA status and error of their first failure.
+ */
+int scan_drive_surface(wdfw_context *context, char *hard_disk_dev_file,
+	char *heatmap_file, surface_scan_options *options);
+
+#endif
@@ -9,6 +9,7 @@
  * rom use 0x02
  */
 #define ROMTYPE_SPI 0x03
+#define ROMTYPE_INTERNAL 0x02
 
 #define MODEL_NUMBER "WDC WD800JD-75MSA3"
 #define FIRMWARE_REVISION "1001.0E.1E41s"
@@ -0,0 +1,83 @@
+#ifndef WDFW_CONTEXT_H
+#define WDFW_CONTEXT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rom_geometry.h"
+
+/* Size of the description of the last failure kept in a context. */
+#define WDFW_MESSAGE_SIZE       512
+
+/* Size of the SCSI sense buffer kept from the last failed drive command. */
+#define WDFW_SENSE_SIZE         32
+
+/* Error codes returned by the library functions. */
+enum {
+	WDFW_OK                 = 0,
+	WDFW_ERROR_IO           = -1, /* A file could not be read or written */
+	WDFW_ERROR_MEMORY       = -2, /* Out of memory */
+	WDFW_ERROR_FORMAT       = -3, /* Invalid rom image, header or patch file */
+	WDFW_ERROR_ARGUMENT     = -4, /* Invalid argument */
+	WDFW_ERROR_ADDRESS      = -5, /* Address is not part of a rom block */
+	WDFW_ERROR_COMPRESSED   = -6, /* Address is part of a compressed block */
+	WDFW_ERROR_DEVICE       = -7, /* The drive rejected or failed a command */
+	WDFW_ERROR_UNSUPPORTED  = -8, /* The drive is not supported */
+	WDFW_ERROR_THREAD       = -9, /* A worker thread could not be started */
+	WDFW_ERROR_VERIFY       = -10 /* Data read back does not match */
+};
+
+/*
+ * State of a single user of the library. Every operation takes the context it
+ * runs in, so a host process can run operations concurrently by giving each
+ * thread its own context. Nothing is printed by the library itself: failures
+ * are recorded in the context and progress and display output is written to
+ * output. Long device operations also write machine readable progress
+ * records to progress_fd (wdfw_progress.h).
+ */
+typedef struct {
+	int directory_fd; /* Relative file names are opened relative to this */
+	FILE *output; /* Progress and display output, NULL discards it */
+	int error; /* WDFW_ERROR_* code of the last failure */
+	int system_error; /* errno of the last failure, 0 when not applicable */
+	char message[WDFW_MESSAGE_SIZE]; /* Description of the last failure */
+	uint8_t sense[WDFW_SENSE_SIZE]; /* Sense data of the last drive failure */
+	rom_geometry geometry; /* Flash layout and transfer chunk size */
+	int detect_geometry; /* Replace geometry by the profile of the drive */
+	char *pack_cache; /* Directory of packed images, NULL disables caching */
+	int progress_fd; /* Receives progress records, -1 disables them */
+	const struct drive_database *drive_db; /* NULL for the built-in drives */
+	uint32_t drive_commands; /* DRIVE_COMMAND_* of the identified drive */
+	uint8_t drive_rom_type; /* ROMTYPE_* of the identified drive */
+} wdfw_context;
+
+/* Prepare a context that resolves file names relative to the current working
+   directory, writes its output to stdout and uses the geometry profile of the
+   drive it talks to. */
+void init_wdfw_context(wdfw_context *context);
+
+/* Forget the last failure recorded in context. */
+void clear_wdfw_error(wdfw_context *context);
+
+/* Record a failure in context and return its error code. */
+int report_wdfw_error(wdfw_context *context, int error,
+	const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/* Record a failed system call in context, appending the description of errno,
+   and return its error code. */
+int report_wdfw_system_error(wdfw_context *context, int error,
+	const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/* Prefix the failure recorded in context with the description of the failed
+   outer operation, returning the recorded error code. */
+int chain_wdfw_error(wdfw_context *context, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Write progress or display output to the output stream of context. */
+void print_wdfw_output(wdfw_context *context, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Short description of a WDFW_ERROR_* code. */
+const char *describe_wdfw_error(int error);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef WDFW_PROBES_H
+#define WDFW_PROBES_H
+
+/*
+ * Static user space tracepoints (USDT) of the "wdfw" provider. With
+ * <sys/sdt.h> (systemtap-sdt-dev) available at build time every probe is a
+ * single nop plus an ELF note that perf, bpftrace or systemtap attach to at
+ * run time, e.g.
+ *   bpftrace -e 'usdt:./wd_firmware_tool:wdfw:command__complete
+ *       { @[arg0, arg2] = count(); }'
+ * Without it, or when built with -DWDFW_NO_PROBES, the probes compile to
+ * nothing. Arguments are integers:
+ *
+ *   command__submit    ata command, features, sector count, data size,
+ *                      sg data direction
+ *   command__complete  ata command, data size, result (WDFW_ERROR_* or
+ *                      COMMAND_SENSE_WARNING)
+ *   dump__access__done result of getting rom read access
+ *   dump__read__start  image size, chunk size
+ *   dump__read__done   result
+ *   dump__write__done  result of writing the image file
+ *   upload__erase__start / upload__erase__done  result
+ *   upload__stage__done   result of loading and verifying the image
+ *   upload__write__start  image size, chunk size
+ *   upload__write__done   result
+ *   unpack__start      image size, number of blocks
+ *   unpack__block      block number, block size, result
+ *   unpack__done       result
+ *   pack__cache        cache hit (1) or miss (0)
+ *   pack__load__start  number of blocks
+ *   pack__load__done   result
+ *   pack__write__done  result
+ *   lba__write__start  first lba, number of sectors
+ *   lba__write__done   result
+ *   scan__start        number of zones, samples per zone (0 for all)
+ *   scan__read         lba, number of sectors, latency in us, result
+ *   scan__done         result
+ *   smart__poll__done  number of drives, failed drives, bytes appended
+ */
+#if !defined(WDFW_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WDFW_PROBES_ENABLED
+#endif
+#endif
+
+#ifdef WDFW_PROBES_ENABLED
+#define WDFW_PROBE0(name)                   DTRACE_PROBE(wdfw, name)
+#define WDFW_PROBE1(name, a)                DTRACE_PROBE1(wdfw, name, a)
+#define WDFW_PROBE2(name, a, b)             DTRACE_PROBE2(wdfw, name, a, b)
+#define WDFW_PROBE3(name, a, b, c)          DTRACE_PROBE3(wdfw, name, a, b, c)
+#define WDFW_PROBE4(name, a, b, c, d)       \
+	DTRACE_PROBE4(wdfw, name, a, b, c, d)
+#define WDFW_PROBE5(name, a, b, c, d, e)    \
+	DTRACE_PROBE5(wdfw, name, a, b, c, d, e)
+#else
+/* The arguments are still evaluated, so variables that only feed a probe
+ * do not become unused. */
+#define WDFW_PROBE0(name)                   do { } while (0)
+#define WDFW_PROBE1(name, a)                do { (void) (a); } while (0)
+#define WDFW_PROBE2(name, a, b)             \
+	do { (void) (a); (void) (b); } while (0)
+#define WDFW_PROBE3(name, a, b, c)          \
+	do { (void) (a); (void) (b); (void) (c); } while (0)
+#define WDFW_PROBE4(name, a, b, c, d)       \
+	do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+#define WDFW_PROBE5(name, a, b, c, d, e)    \
+	do { (void) (a); (void) (b); (void) (c); (void) (d); (void) (e); } \
+	while (0)
+#endif
+
+#endif
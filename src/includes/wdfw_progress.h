@@ -0,0 +1,50 @@
+#ifndef WDFW_PROGRESS_H
+#define WDFW_PROGRESS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "wdfw_context.h"
+
+/*
+ * Progress of a long device operation, written as newline delimited JSON
+ * records to the progress_fd of its context:
+ *   {"op":"dump","event":"start","total":262144}
+ *   {"op":"dump","event":"chunk","offset":0,"bytes":65536,"done":65536,
+ *    "total":262144,"latency_us":8123,"mbps":8.068,"avg_mbps":8.068,
+ *    "eta_s":0.024}
+ *   {"op":"dump","event":"end","result":0,"done":262144,"elapsed_s":0.032,
+ *    "avg_mbps":8.192}
+ * MB/s are 10^6 bytes per second, mbps over the last chunk and avg_mbps
+ * since the start. Nothing is measured when progress_fd is -1. A pipe
+ * progress_fd needs SIGPIPE ignored, so that a reader going away ends the
+ * records instead of the process.
+ */
+
+/* Size of the longest progress record. */
+#define WDFW_PROGRESS_RECORD_SIZE       256
+
+typedef struct {
+	int fd; /* Copy of the context progress_fd, -1 when disabled */
+	const char *operation; /* Name of the operation ("dump", "upload", ...) */
+	uint64_t total; /* Bytes the operation moves, 0 when unknown */
+	uint64_t done; /* Bytes moved so far */
+	struct timespec start; /* Start of the operation */
+	struct timespec chunk_start; /* Start of the current chunk */
+} wdfw_progress;
+
+/* Start reporting the progress of operation, which moves total bytes. */
+void start_wdfw_progress(wdfw_progress *progress, wdfw_context *context,
+	const char *operation, uint64_t total);
+
+/* Mark the start of the next chunk, used for its latency. */
+void begin_wdfw_progress_chunk(wdfw_progress *progress);
+
+/* Report a chunk of bytes at offset as done. */
+void update_wdfw_progress(wdfw_progress *progress, uint64_t offset,
+	uint64_t bytes);
+
+/* Report the end of the operation with its WDFW_ERROR_* result. */
+void finish_wdfw_progress(wdfw_progress *progress, int result);
+
+#endif
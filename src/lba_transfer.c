@@ -0,0 +1,289 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Linux specific */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "includes/lba_transfer.h"
+#include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/wdfw_context.h"
+#include "includes/wdfw_progress.h"
+#include "includes/wdfw_probes.h"
+
+/* LBA range shared by the workers of a write. */
+typedef struct {
+    wdfw_context *context;
+    int hard_disk_fd;
+    int image_fd;
+    uint64_t image_size;
+    uint64_t first_lba;
+    uint64_t number_of_commands;
+    size_t command_size; /* Bytes moved by every command but the last */
+    int verify;
+
+    pthread_mutex_t lock;
+    uint64_t next_command; /* Next command to send, under lock */
+    int failed; /* Set by the first failure, under lock */
+    uint64_t failed_lba; /* Lowest LBA of a failed command, under lock */
+    int error; /* Error of the command at failed_lba */
+    char message[WDFW_MESSAGE_SIZE];
+    uint64_t verified; /* Commands read back and compared */
+    wdfw_progress progress; /* Under lock */
+} lba_writer;
+
+/* Send commands of a write until none are left or one failed. */
+static void *write_lba_worker(void *writer_pointer);
+
+/* Write, and verify, a single command of a write. */
+static int write_lba_command(wdfw_context *context, lba_writer *writer,
+    uint64_t command, uint8_t *buffer, uint8_t *verify_buffer);
+
+void init_lba_write_options(lba_write_options *options)
+{
+    options->sectors_per_command = LBA_TRANSFER_DEFAULT_SECTORS;
+    options->queue_depth = LBA_TRANSFER_DEFAULT_QUEUE;
+    options->verify = 0;
+}
+
+/* Operations: */
+/* Check the options and the range against the 48-bit LBA limit */
+/* Open the image and the hard disk drive */
+/* Start queue_depth workers, each taking the next command of the range:
+ * read its part of the image, WRITE DMA EXT, optionally READ DMA EXT and
+ * compare */
+/* Report the lowest failing LBA when a command failed */
+int write_lba_range(wdfw_context *context, char *hard_disk_dev_file,
+    uint64_t first_lba, char *image_file, lba_write_options *options)
+{
+    struct stat image_stat;
+    lba_writer writer;
+
+    if (options->sectors_per_command == 0 ||
+        options->sectors_per_command > ATA_MAXIMUM_DMA_EXT_SECTORS ||
+        options->queue_depth == 0 ||
+        options->queue_depth > LBA_TRANSFER_MAXIMUM_QUEUE) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "write_lba_range: Invalid sectors per command %u or queue " \
+            "depth %u", options->sectors_per_command, options->queue_depth);
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.context = context;
+    writer.first_lba = first_lba;
+    writer.command_size = (size_t) options->sectors_per_command *
+        ATA_SECTOR_SIZE;
+    writer.verify = options->verify;
+
+    writer.image_fd = openat(context->directory_fd, image_file,
+        O_RDONLY | O_CLOEXEC);
+    if (writer.image_fd == -1 || fstat(writer.image_fd, &image_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_lba_range: open %s", image_file);
+        if (writer.image_fd != -1) {
+            close(writer.image_fd);
+        }
+        return context->error;
+    }
+
+    writer.image_size = image_stat.st_size;
+    uint64_t number_of_sectors = (writer.image_size + ATA_SECTOR_SIZE - 1) /
+        ATA_SECTOR_SIZE;
+    writer.number_of_commands = (number_of_sectors +
+        options->sectors_per_command - 1) / options->sectors_per_command;
+
+    if (number_of_sectors == 0 || first_lba >= ATA_MAXIMUM_LBA48 ||
+        number_of_sectors > ATA_MAXIMUM_LBA48 - first_lba) {
+        close(writer.image_fd);
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "write_lba_range: %s does not fit at LBA %llu", image_file,
+            (unsigned long long) first_lba);
+    }
+
+    writer.hard_disk_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (writer.hard_disk_fd < 0) {
+        close(writer.image_fd);
+        return chain_wdfw_error(context, "write_lba_range: Could not " \
+            "handle hard disk drive");
+    }
+
+    if (check_hard_disk_commands(context, writer.hard_disk_fd,
+        DRIVE_COMMAND_DMA) != 0) {
+        close_hard_disk_drive(writer.hard_disk_fd);
+        close(writer.image_fd);
+        return chain_wdfw_error(context, "write_lba_range");
+    }
+
+    unsigned int number_of_workers = options->queue_depth;
+    if (number_of_workers > writer.number_of_commands) {
+        number_of_workers = writer.number_of_commands;
+    }
+
+    print_wdfw_output(context, "Writing %llu sectors at LBA %llu with " \
+        "%llu commands, %u in flight%s\n",
+        (unsigned long long) number_of_sectors,
+        (unsigned long long) first_lba,
+        (unsigned long long) writer.number_of_commands, number_of_workers,
+        writer.verify ? ", verifying" : "");
+
+    WDFW_PROBE2(lba__write__start, first_lba, number_of_sectors);
+    start_wdfw_progress(&writer.progress, context, "lba_write",
+        number_of_sectors * ATA_SECTOR_SIZE);
+
+    pthread_t workers[LBA_TRANSFER_MAXIMUM_QUEUE];
+    unsigned int started = 0;
+
+    pthread_mutex_init(&writer.lock, NULL);
+    while (started < number_of_workers && pthread_create(&workers[started],
+        NULL, write_lba_worker, &writer) == 0) {
+        ++started;
+    }
+
+    /* Whatever the started workers leave is written here. */
+    if (started < number_of_workers) {
+        write_lba_worker(&writer);
+    }
+
+    unsigned int i;
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&writer.lock);
+
+    close_hard_disk_drive(writer.hard_disk_fd);
+    close(writer.image_fd);
+
+    finish_wdfw_progress(&writer.progress, writer.failed ? writer.error : 0);
+    WDFW_PROBE1(lba__write__done, writer.failed ? writer.error : 0);
+
+    if (writer.failed) {
+        context->error = writer.error;
+        memcpy(context->message, writer.message, WDFW_MESSAGE_SIZE);
+        return chain_wdfw_error(context, "write_lba_range: Failed at LBA " \
+            "%llu", (unsigned long long) writer.failed_lba);
+    }
+
+    if (writer.verify) {
+        print_wdfw_output(context, "Verified %llu of %llu commands\n",
+            (unsigned long long) writer.verified,
+            (unsigned long long) writer.number_of_commands);
+    }
+
+    return 0;
+}
+
+static void *write_lba_worker(void *writer_pointer)
+{
+    lba_writer *writer = writer_pointer;
+
+    /* Every worker records its failures in a context of its own. */
+    wdfw_context context = *writer->context;
+
+    uint8_t *buffer = malloc(writer->command_size);
+    uint8_t *verify_buffer = writer->verify ?
+        malloc(writer->command_size) : NULL;
+
+    while (1) {
+        pthread_mutex_lock(&writer->lock);
+        uint64_t command = writer->next_command;
+        int done = writer->failed || command >= writer->number_of_commands;
+        if (!done) {
+            writer->next_command += 1;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        if (done) {
+            break;
+        }
+
+        clear_wdfw_error(&context);
+        if (buffer == NULL || (writer->verify && verify_buffer == NULL)) {
+            report_wdfw_error(&context, WDFW_ERROR_MEMORY,
+                "write_lba_worker: Could not allocate the command buffers");
+        } else {
+            write_lba_command(&context, writer, command, buffer,
+                verify_buffer);
+        }
+
+        if (context.error != WDFW_OK) {
+            uint64_t lba_id = writer->first_lba + command *
+                (writer->command_size / ATA_SECTOR_SIZE);
+
+            pthread_mutex_lock(&writer->lock);
+            if (!writer->failed || lba_id < writer->failed_lba) {
+                writer->failed = 1;
+                writer->failed_lba = lba_id;
+                writer->error = context.error;
+                memcpy(writer->message, context.message, WDFW_MESSAGE_SIZE);
+            }
+            pthread_mutex_unlock(&writer->lock);
+        }
+    }
+
+    free(verify_buffer);
+    free(buffer);
+    return NULL;
+}
+
+static int write_lba_command(wdfw_context *context, lba_writer *writer,
+    uint64_t command, uint8_t *buffer, uint8_t *verify_buffer)
+{
+    uint64_t offset = command * writer->command_size;
+    uint64_t lba_id = writer->first_lba + offset / ATA_SECTOR_SIZE;
+    size_t image_bytes = writer->command_size;
+
+    /* The last command ends at the sector holding the last image byte. */
+    if (offset + image_bytes > writer->image_size) {
+        image_bytes = writer->image_size - offset;
+    }
+    size_t size = (image_bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE *
+        ATA_SECTOR_SIZE;
+    memset(buffer + image_bytes, 0, size - image_bytes);
+
+    size_t bytes_read = 0;
+    while (bytes_read < image_bytes) {
+        ssize_t result = pread(writer->image_fd, buffer + bytes_read,
+            image_bytes - bytes_read, offset + bytes_read);
+        if (result <= 0) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "write_lba_command: Could not read the image at %llu",
+                (unsigned long long) (offset + bytes_read));
+        }
+        bytes_read += result;
+    }
+
+    if (write_dma_ext(context, writer->hard_disk_fd, lba_id, buffer,
+        size) != 0) {
+        return chain_wdfw_error(context, "write_lba_command");
+    }
+
+    if (writer->verify) {
+        if (read_dma_ext(context, writer->hard_disk_fd, lba_id,
+            verify_buffer, size) != 0) {
+            return chain_wdfw_error(context, "write_lba_command: Read back");
+        }
+
+        if (memcmp(buffer, verify_buffer, size) != 0) {
+            return report_wdfw_error(context, WDFW_ERROR_VERIFY,
+                "write_lba_command: Sectors %llu - %llu read back " \
+                "differently", (unsigned long long) lba_id,
+                (unsigned long long) (lba_id + size / ATA_SECTOR_SIZE - 1));
+        }
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->verified += writer->verify ? 1 : 0;
+    update_wdfw_progress(&writer->progress, offset, size);
+    pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+}
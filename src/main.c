@@ -8,37 +8,106 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <dirent.h>
+#include <signal.h>
 
 /* Application specific */
 #include "includes/rom_management.h"
+#include "includes/rom_report.h"
+#include "includes/rom_generator.h"
+#include "includes/rom_fingerprint.h"
 #include "includes/disk_communication.h"
+#include "includes/disk_simulator.h"
+#include "includes/drive_enumeration.h"
+#include "includes/drive_watch.h"
+#include "includes/lba_transfer.h"
+#include "includes/surface_scan.h"
+#include "includes/smart_attributes.h"
+#include "includes/smart_poller.h"
+#include "includes/drive_database.h"
+#include "includes/hex_dump.h"
+#include "includes/service_area.h"
+#include "includes/wdfw_context.h"
+#include "includes/wdfw_progress.h"
 
 /* Function prototypes: */
 
- /* Scan for all connected hard disk drive */
-static void scan_hard_disk_drives(void);
+ /* Scan for all connected western digital hard disk drives */
+static void scan_hard_disk_drives(wdfw_context *context,
+	const char *sysfs_root);
 
 /* Display the application's options */
 static void display_options(char *app_name);
 
-/* Read a LBA block from the specified hard disk drive. */
-int read_lba_block(char *hard_disk_dev_file, unsigned long lba_id);
+/* Read and dump number_of_blocks LBA blocks from the specified hard disk
+   drive. */
+int read_lba_block(wdfw_context *context, char *hard_disk_dev_file,
+	uint64_t lba_id, uint64_t number_of_blocks, int collapse);
 
 /* Write a LBA block from the specified hard disk drive. */
-int write_lba_block(char *hard_disk_dev_file, unsigned long lba_id,
-	uint8_t *data_buffer, size_t size);
+int write_lba_block(wdfw_context *context, char *hard_disk_dev_file,
+	unsigned long lba_id, uint8_t *data_buffer, size_t size);
+
+/* Parse a rom address, prefixed with "load:" for CPU load addresses. */
+static uint32_t parse_rom_address(char *address, address_space *space);
+
+/* Parse the "geometry=<name>", "chunk=<bytes|auto>" and "cache=<directory>"
+   options in argv from first on into context. Sets calibrate for
+   "chunk=auto". */
+static int parse_geometry_options(wdfw_context *context, int argc,
+	char *argv[], int first, int *calibrate);
+
+/* Calibrate the rom transfer chunk size of a hard disk drive. */
+static int calibrate_chunk_size(wdfw_context *context,
+	char *hard_disk_dev_file);
 
 int main(int argc, char *argv[])
 {
+    wdfw_context context;
+    int calibrate = 0;
+    init_wdfw_context(&context);
+
     if (argc < 2) {
         display_options(argv[0]);
         exit(1);
     }
 
+    /* Progress records of device operations go to an inherited file
+     * descriptor, e.g. WDFW_PROGRESS_FD=3 ... 3>progress.ndjson */
+    char *progress_fd = getenv("WDFW_PROGRESS_FD");
+    if (progress_fd != NULL) {
+        context.progress_fd = strtol(progress_fd, NULL, 10);
+        if (context.progress_fd < 0 ||
+            fcntl(context.progress_fd, F_GETFD) == -1) {
+            fprintf(stderr, "main: WDFW_PROGRESS_FD %s is not an open file " \
+                "descriptor\n", progress_fd);
+            exit(1);
+        }
+
+        /* A reader of the records that goes away must not kill the process
+         * halfway through an upload; the write fails with EPIPE instead and
+         * the records stop. */
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    /* Supported drives are read once and looked up by hash on every
+     * identify. Without a database file the built-in profiles apply. */
+    drive_database *drive_db = NULL;
+    char *drive_db_file = getenv("WDFW_DRIVE_DB");
+    if (drive_db_file == NULL && access(DRIVE_DATABASE_FILE, R_OK) == 0) {
+        drive_db_file = DRIVE_DATABASE_FILE;
+    }
+    if (drive_db_file != NULL && drive_db_file[0] != '\0') {
+        if (load_drive_database(&context, drive_db_file, &drive_db) != 0) {
+            fprintf(stderr, "main: %s\n", context.message);
+            exit(1);
+        }
+        context.drive_db = drive_db;
+    }
+
     /* Option: Dump rom contents from hard disk drive */
     if (strcmp(argv[1], "-d") == 0) {
-        if (argc != 4) {
+        if (argc < 4 ||
+            parse_geometry_options(&context, argc, argv, 4, &calibrate) != 0) {
             display_options(argv[0]);
             exit(1);
         }
@@ -50,17 +119,58 @@ int main(int argc, char *argv[])
         }
 
         /* argv[2] = hard disk location */
-        /* argv[3] = output file */
-        if (dump_rom_image(argv[2], argv[3]) == -1) {
+        /* argv[3] = output file, "-" writes the image to stdout */
+        char *out_file = argv[3];
+
+        if (strcmp(out_file, "-") == 0) {
+            /* Keep the image on stdout and move the progress messages to
+             * stderr. */
+            context.output = stderr;
+            out_file = "/dev/stdout";
+        }
+
+        if (calibrate && calibrate_chunk_size(&context, argv[2]) != 0) {
+            exit(1);
+        }
+
+        if (dump_rom_image(&context, argv[2], out_file) != 0) {
             fprintf(stderr, "main: Could not dump rom image from the hard " \
-                "disk drive.\n");
+                "disk drive: %s\n", context.message);
+            exit(1);
+        }
+
+        fprintf(context.output, "Finished dumping rom from %s\n", argv[3]);
+	/* Option: Dump, verify and unpack rom in one pass */
+    } else if (strcmp(argv[1], "-D") == 0) {
+        if (argc < 4 ||
+            parse_geometry_options(&context, argc, argv, 4, &calibrate) != 0) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        /* argv[2] = hard disk location */
+        /* argv[3] = output file */
+        if (calibrate && calibrate_chunk_size(&context, argv[2]) != 0) {
+            exit(1);
+        }
+
+        if (dump_and_unpack_rom_image(&context, argv[2], argv[3]) != 0) {
+            fprintf(stderr, "main: Could not dump and unpack rom image from " \
+                "the hard disk drive: %s\n", context.message);
             exit(1);
         }
 
-        printf("Finished dumping rom from %s\n", argv[3]);
+        printf("Finished dumping and unpacking rom to %s\n", argv[3]);
 	/* Option: Load rom file to hard disk drive */
     } else if (strcmp(argv[1], "-l") == 0) {
-		if (argc != 4) {
+		if (argc < 4 ||
+			parse_geometry_options(&context, argc, argv, 4, &calibrate) != 0) {
 			display_options(argv[0]);
 			exit(1);
 		}
@@ -73,59 +183,238 @@ int main(int argc, char *argv[])
 
 		/* argv[2] = hard disk location */
 		/* argv[3] = input file */
-		if (upload_rom_image(argv[2], argv[3]) == -1) {
+		if (calibrate && calibrate_chunk_size(&context, argv[2]) != 0) {
+			exit(1);
+		}
+
+		if (upload_rom_image(&context, argv[2], argv[3]) != 0) {
 			fprintf(stderr, "main: Could not upload rom image to the hard " \
-				"disk drive.\n");
+				"disk drive: %s\n", context.message);
 			exit(1);
 		}
 
 		printf("Finished uploading rom from %s\n", argv[3]);
 	/* Option: print info rom blocks */
     } else if (strcmp(argv[1], "-i") == 0) {
-		if (argc != 3) {
+		if (argc != 3 && argc != 4) {
 			display_options(argv[0]);
 			exit(1);
 		}
 
-		if (display_rom_info(argv[2]) != 0) {
+		/* argv[3] = optional copy of a streamed rom image */
+		if (argc == 4) {
+			int input_file = (strcmp(argv[2], "-") == 0) ? STDIN_FILENO :
+				open(argv[2], O_RDONLY);
+
+			if (input_file == -1) {
+				perror("main: open");
+				exit(1);
+			}
+
+			int result = display_rom_stream_info(&context, input_file,
+				argv[3]);
+			if (input_file != STDIN_FILENO) {
+				close(input_file);
+			}
+
+			if (result != 0) {
+				fprintf(stderr, "main: Could not display information about " \
+					"the provided stream: %s\n", context.message);
+				exit(1);
+			}
+		} else if (display_rom_info(&context, argv[2]) != 0) {
 			fprintf(stderr, "main: Could not display information about the " \
-				"provided binary file.\n");
+				"provided binary file: %s\n", context.message);
+			exit(1);
+		}
+	/* Option: Machine readable rom info of a batch of images */
+    } else if (strcmp(argv[1], "-R") == 0) {
+		if (argc < 4 || (strcmp(argv[2], "json") != 0 &&
+			strcmp(argv[2], "binary") != 0)) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = report format */
+		/* argv[3..] = rom files, "-" reads file names from stdin */
+		int format = (strcmp(argv[2], "json") == 0) ? REPORT_FORMAT_JSON :
+			REPORT_FORMAT_BINARY;
+
+		if (report_rom_info(&context, format, &argv[3], argc - 3,
+			STDOUT_FILENO) != 0) {
+			fprintf(stderr, "main: Could not report rom info: %s\n",
+				context.message);
+			exit(1);
+		}
+	/* Option: Fingerprint database of known firmware builds */
+    } else if (strcmp(argv[1], "-F") == 0) {
+		/* argv[2] = add, identify or list */
+		/* argv[3] = database file */
+		if (argc == 6 && strcmp(argv[2], "add") == 0) {
+			/* argv[4] = build name */
+			/* argv[5] = rom file or block_hashes file */
+			if (add_rom_fingerprint(&context, argv[3], argv[4],
+				argv[5]) != 0) {
+				fprintf(stderr, "main: Could not add %s to %s: %s\n",
+					argv[5], argv[3], context.message);
+				exit(1);
+			}
+		} else if (argc == 5 && strcmp(argv[2], "identify") == 0) {
+			/* argv[4] = rom file or block_hashes file */
+			if (identify_rom_fingerprint(&context, argv[3], argv[4]) != 0) {
+				fprintf(stderr, "main: Could not identify %s: %s\n",
+					argv[4], context.message);
+				exit(1);
+			}
+		} else if (argc == 4 && strcmp(argv[2], "list") == 0) {
+			if (list_rom_fingerprints(&context, argv[3]) != 0) {
+				fprintf(stderr, "main: Could not list %s: %s\n", argv[3],
+					context.message);
+				exit(1);
+			}
+		} else {
+			display_options(argv[0]);
+			exit(1);
+		}
+	/* Option: Generate synthetic rom images */
+    } else if (strcmp(argv[1], "-G") == 0) {
+		if (argc < 4) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = output file prefix, "-" writes all images to stdout */
+		/* argv[3] = number of images */
+		/* argv[4..] = seed=, blocks=, size= and entropy= options */
+		rom_generator_config config;
+		init_rom_generator_config(&config);
+
+		int i;
+		for (i = 4; i < argc; ++i) {
+			if (parse_rom_generator_option(&context, &config, argv[i]) != 0) {
+				fprintf(stderr, "main: %s\n", context.message);
+				display_options(argv[0]);
+				exit(1);
+			}
+		}
+
+		if (generate_rom_images(&context, &config, argv[2],
+			strtoull(argv[3], NULL, 0)) != 0) {
+			fprintf(stderr, "main: Could not generate rom images: %s\n",
+				context.message);
 			exit(1);
 		}
 	/* Option: Pack a rom image based on a rom block table file */
     } else if (strcmp(argv[1], "-p") == 0) {
-		if (argc != 4) {
+		if (argc < 4 ||
+			parse_geometry_options(&context, argc, argv, 4, &calibrate) != 0 ||
+			calibrate) {
 			display_options(argv[0]);
 			exit(1);
 		}
 
-		if (pack_rom_image(argv[3], argv[4]) != 0) {
+		/* argv[2] = formatted header of an unpacked rom image */
+		/* argv[3] = output file */
+		if (pack_rom_image(&context, argv[2], argv[3]) != 0) {
 			fprintf(stderr, "main: Could not pack rom image %s using rom " \
-				"header %s \n", argv[3], argv[4]);
+				"header %s: %s\n", argv[3], argv[2], context.message);
 			exit(1);
 		}
 
 		printf("Successfully packed rom image %s using the %s rom header " \
-			"file \n", argv[4], argv[3]);
+			"file \n", argv[3], argv[2]);
+	/* Option: Repack only the blocks changed since the last pack */
+	} else if (strcmp(argv[1], "-I") == 0) {
+		if (argc < 4 ||
+			parse_geometry_options(&context, argc, argv, 4, &calibrate) != 0 ||
+			calibrate) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = formatted header of an unpacked rom image */
+		/* argv[3] = previously packed output file */
+		if (repack_rom_image(&context, argv[2], argv[3]) != 0) {
+			fprintf(stderr, "main: Could not repack rom image %s using rom " \
+				"header %s: %s\n", argv[3], argv[2], context.message);
+			exit(1);
+		}
+
+		printf("Successfully repacked rom image %s using the %s rom header " \
+			"file \n", argv[3], argv[2]);
 	/* Modify instruction in a file */
 	} else if (strcmp(argv[1], "-m") == 0) {
-		if (argc != 4) {
+		if (argc != 5) {
 			display_options(argv[0]);
 			exit(1);
 		}
 
-		uint32_t address = strtol(argv[3], NULL, 16);
+		address_space space;
+		uint32_t address = parse_rom_address(argv[3], &space);
 		uint32_t instruction = strtol(argv[4], NULL, 16);
 		uint32_t instruction_length = strnlen(argv[4], 4);
 
-		if (modify_instruction(argv[2], address, instruction,
+		if (modify_instruction(&context, argv[2], space, address, instruction,
 			instruction_length) != 0) {
-			fprintf(stderr, "main: Could not modify an instruction in %s\n",
-				argv[2]);
+			fprintf(stderr, "main: Could not modify an instruction in %s: " \
+				"%s\n", argv[2], context.message);
 			exit(1);
 		}
 
 		printf("Successfully modified an instruction in %s\n", argv[2]);
+	/* Option: Apply a patch set to a rom image */
+	} else if (strcmp(argv[1], "-P") == 0) {
+		if (argc != 4) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		if (apply_rom_patch_set(&context, argv[2], argv[3]) != 0) {
+			fprintf(stderr, "main: Could not apply patch set %s to %s: %s\n",
+				argv[3], argv[2], context.message);
+			exit(1);
+		}
+	/* Option: Build patched variants of a base rom image */
+	} else if (strcmp(argv[1], "-V") == 0) {
+		if (argc != 4 && argc != 5) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = base rom image */
+		/* argv[3] = variant list */
+		/* argv[4] = number of worker threads, default one per CPU */
+		unsigned int workers = (argc == 5) ? strtoul(argv[4], NULL, 0) : 0;
+
+		if (build_rom_variants(&context, argv[2], argv[3], workers) != 0) {
+			fprintf(stderr, "main: Could not build the variants of %s: %s\n",
+				argv[2], context.message);
+			exit(1);
+		}
+	/* Option: Revert the last modification of a rom image */
+	} else if (strcmp(argv[1], "-U") == 0) {
+		if (argc != 3) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		if (revert_rom_modification(&context, argv[2]) != 0) {
+			fprintf(stderr, "main: Could not revert the last modification " \
+				"of %s: %s\n", argv[2], context.message);
+			exit(1);
+		}
+	/* Option: Search a byte pattern in a rom image */
+	} else if (strcmp(argv[1], "-f") == 0) {
+		if (argc != 4) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		if (search_rom_image(&context, argv[2], argv[3]) != 0) {
+			fprintf(stderr, "main: Could not search %s: %s\n", argv[2],
+				context.message);
+			exit(1);
+		}
 	/* Option: Unpack a rom image */
 	} else if (strcmp(argv[1], "-u") == 0) {
 		if (argc != 3) {
@@ -134,12 +423,107 @@ int main(int argc, char *argv[])
 		}
 
 		printf("Unpacking rom image\n");
-		if (unpack_rom_image(argv[2]) != 0) {
-			fprintf(stderr, "main: Could not unpack rom image\n");
+		if (unpack_rom_image(&context, argv[2]) != 0) {
+			fprintf(stderr, "main: Could not unpack rom image: %s\n",
+				context.message);
 			exit(1);
 		}
 
 		printf("Finished extracting %s rom image\n", argv[2]);
+	/* Option: Calibrate the rom transfer chunk size */
+    } else if (strcmp(argv[1], "-C") == 0) {
+		if (argc < 3 ||
+			parse_geometry_options(&context, argc, argv, 3, &calibrate) != 0) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		if (getuid() != 0) {
+			fprintf(stderr, "main: Application should be run as root for " \
+				"this operation.\n");
+			exit(1);
+		}
+
+		if (calibrate_chunk_size(&context, argv[2]) != 0) {
+			exit(1);
+		}
+	/* Option: Display the service area module directory */
+    } else if (strcmp(argv[1], "-M") == 0) {
+		if (argc != 3) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		if (display_sa_directory(&context, argv[2]) != 0) {
+			fprintf(stderr, "main: Could not read the module directory of %s: " \
+				"%s\n", argv[2], context.message);
+			exit(1);
+		}
+	/* Option: Dump service area modules to an indexed archive */
+    } else if (strcmp(argv[1], "-B") == 0) {
+		if (argc < 4) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = hard disk location */
+		/* argv[3] = archive file */
+		/* argv[4..] = module ids, every module of the directory when absent */
+		unsigned int number_of_modules = argc - 4;
+		uint16_t module_ids[number_of_modules + 1];
+
+		unsigned int i;
+		for (i = 0; i < number_of_modules; ++i) {
+			module_ids[i] = strtoul(argv[4 + i], NULL, 16);
+		}
+
+		if (dump_sa_modules(&context, argv[2], argv[3], module_ids,
+			number_of_modules) != 0) {
+			fprintf(stderr, "main: Could not dump the modules of %s: %s\n",
+				argv[2], context.message);
+			exit(1);
+		}
+	/* Option: List or extract the modules of an archive */
+    } else if (strcmp(argv[1], "-A") == 0) {
+		if (argc != 3 && argc != 5) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = archive file */
+		/* argv[3] = optional module id to extract */
+		/* argv[4] = output file of the extracted module */
+		if (argc == 5) {
+			if (extract_sa_module(&context, argv[2],
+				strtoul(argv[3], NULL, 16), argv[4]) != 0) {
+				fprintf(stderr, "main: Could not extract module %s: %s\n",
+					argv[3], context.message);
+				exit(1);
+			}
+		} else if (display_sa_archive(&context, argv[2]) != 0) {
+			fprintf(stderr, "main: Could not display module archive %s: %s\n",
+				argv[2], context.message);
+			exit(1);
+		}
+	/* Option: Create a simulated drive */
+    } else if (strcmp(argv[1], "-S") == 0) {
+		if (argc != 4 && argc != 5) {
+			display_options(argv[0]);
+			exit(1);
+		}
+
+		/* argv[2] = simulated drive directory */
+		/* argv[3] = rom file */
+		/* argv[4] = optional number of service area modules */
+		if (create_simulated_drive(&context, argv[2], argv[3],
+			(argc == 5) ? strtoul(argv[4], NULL, 0) : 16) != 0) {
+			fprintf(stderr, "main: Could not create simulated drive %s: %s\n",
+				argv[2], context.message);
+			exit(1);
+		}
+
+		printf("Created simulated drive %s%s\n", SIMULATED_DRIVE_PREFIX,
+			argv[2]);
 	/* Option: Scan connected hard disk drives */
     } else if (strcmp(argv[1], "-s") == 0) {
         if (getuid() != 0) {
@@ -148,10 +532,47 @@ int main(int argc, char *argv[])
             exit(1);
         }
 
-        scan_hard_disk_drives();
+        /* argv[2] = sysfs root, /sys unless given */
+        scan_hard_disk_drives(&context, (argc > 2) ? argv[2] :
+            DEFAULT_SYSFS_ROOT);
+	/* Option: Watch for added and removed hard disk drives */
+    } else if (strcmp(argv[1], "-W") == 0) {
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        drive_watch_options watch_options = {
+            .event_file = NULL,
+            .sysfs_root = DEFAULT_SYSFS_ROOT,
+            .device_prefix = "/dev",
+            .job = NULL
+        };
+
+        int i;
+        for (i = 2; i < argc; ++i) {
+            if (strncmp(argv[i], "events=", sizeof("events=") - 1) == 0) {
+                watch_options.event_file = argv[i] + sizeof("events=") - 1;
+            } else if (strncmp(argv[i], "sysfs=", sizeof("sysfs=") - 1) == 0) {
+                watch_options.sysfs_root = argv[i] + sizeof("sysfs=") - 1;
+            } else if (strncmp(argv[i], "dev=", sizeof("dev=") - 1) == 0) {
+                watch_options.device_prefix = argv[i] + sizeof("dev=") - 1;
+            } else if (strncmp(argv[i], "job=", sizeof("job=") - 1) == 0) {
+                watch_options.job = argv[i] + sizeof("job=") - 1;
+            } else {
+                display_options(argv[0]);
+                exit(1);
+            }
+        }
+
+        if (watch_hard_disk_drives(&context, &watch_options) != 0) {
+            fprintf(stderr, "main: %s\n", context.message);
+            exit(1);
+        }
 	/* Read LBA from a hard disk drive */
     } else if (strcmp(argv[1], "-r") == 0) {
-        if (argc != 4) {
+        if (argc < 4 || argc > 6) {
             display_options(argv[0]);
             exit(1);
         }
@@ -169,9 +590,26 @@ int main(int argc, char *argv[])
             block_id = strtol(argv[3], NULL, 10);
         }
 
-        if (read_lba_block(argv[2], block_id) == -1) {
-            fprintf(stderr, "main: Could not read lba block %s from %s\n",
-                argv[3], argv[0]);
+        /* argv[4] = number of blocks, argv[4] or argv[5] = "full" to show
+           repeated lines */
+        uint64_t number_of_blocks = 1;
+        int collapse = 1;
+        int i;
+        for (i = 4; i < argc; ++i) {
+            if (strcmp(argv[i], "full") == 0) {
+                collapse = 0;
+            } else if (i == 4) {
+                number_of_blocks = strtoull(argv[i], NULL, 0);
+            } else {
+                display_options(argv[0]);
+                exit(1);
+            }
+        }
+
+        if (read_lba_block(&context, argv[2], block_id, number_of_blocks,
+            collapse) != 0) {
+            fprintf(stderr, "main: Could not read lba block %s from %s: %s\n",
+                argv[3], argv[2], context.message);
             exit(1);
         }
 	/* Write LBA to a hard disk drive */
@@ -184,7 +622,7 @@ int main(int argc, char *argv[])
 
         unsigned int size;
 
-        if ((size = strlen(argv[2])) > 512) {
+        if ((size = strlen(argv[4])) > 512) {
             fprintf(stderr, "main: LBA input must be equal to or shorter " \
                 "than 512 bytes.\n");
             exit(1);
@@ -203,10 +641,220 @@ int main(int argc, char *argv[])
             block_id = strtol(argv[3], NULL, 10);
         }
 
-        if (write_lba_block(argv[2], block_id, (uint8_t *) argv[4],
-            size) == -1) {
-            fprintf(stderr, "main: Could not write lba block %s to %s\n",
-                argv[2], argv[0]);
+        if (write_lba_block(&context, argv[2], block_id, (uint8_t *) argv[4],
+            size) != 0) {
+            fprintf(stderr, "main: Could not write lba block %s to %s: %s\n",
+                argv[3], argv[2], context.message);
+            exit(1);
+        }
+	/* Option: Write a file to a range of LBAs */
+    } else if (strcmp(argv[1], "-L") == 0) {
+        if (argc < 5) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        lba_write_options write_options;
+        init_lba_write_options(&write_options);
+
+        int i;
+        for (i = 5; i < argc; ++i) {
+            if (strncmp(argv[i], "queue=", sizeof("queue=") - 1) == 0) {
+                write_options.queue_depth = strtoul(argv[i] +
+                    sizeof("queue=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "sectors=",
+                sizeof("sectors=") - 1) == 0) {
+                write_options.sectors_per_command = strtoul(argv[i] +
+                    sizeof("sectors=") - 1, NULL, 0);
+            } else if (strcmp(argv[i], "verify") == 0) {
+                write_options.verify = 1;
+            } else {
+                display_options(argv[0]);
+                exit(1);
+            }
+        }
+
+        /* argv[2] = hard disk location, argv[3] = first LBA,
+           argv[4] = image file */
+        if (write_lba_range(&context, argv[2], strtoull(argv[3], NULL, 0),
+            argv[4], &write_options) != 0) {
+            fprintf(stderr, "main: Could not write %s to %s: %s\n", argv[4],
+                argv[2], context.message);
+            exit(1);
+        }
+	/* Option: Scan the surface for slow and unreadable zones */
+    } else if (strcmp(argv[1], "-H") == 0) {
+        if (argc < 4) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        surface_scan_options scan_options;
+        init_surface_scan_options(&scan_options);
+
+        int i;
+        for (i = 4; i < argc; ++i) {
+            if (strncmp(argv[i], "zones=", sizeof("zones=") - 1) == 0) {
+                scan_options.number_of_zones = strtoul(argv[i] +
+                    sizeof("zones=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "sectors=",
+                sizeof("sectors=") - 1) == 0) {
+                scan_options.sectors_per_read = strtoul(argv[i] +
+                    sizeof("sectors=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "samples=",
+                sizeof("samples=") - 1) == 0) {
+                scan_options.samples_per_zone = strtoul(argv[i] +
+                    sizeof("samples=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "slow=", sizeof("slow=") - 1) == 0) {
+                scan_options.slow_ms = strtoul(argv[i] +
+                    sizeof("slow=") - 1, NULL, 0);
+            } else {
+                display_options(argv[0]);
+                exit(1);
+            }
+        }
+
+        /* argv[2] = hard disk location, argv[3] = heatmap file */
+        if (scan_drive_surface(&context, argv[2], argv[3],
+            &scan_options) != 0) {
+            fprintf(stderr, "main: Could not scan the surface of %s: %s\n",
+                argv[2], context.message);
+            exit(1);
+        }
+	/* Option: Display the SMART attributes or a SMART log */
+    } else if (strcmp(argv[1], "-T") == 0) {
+        if (argc < 3) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        /* argv[2] = hard disk location, argv[3] = log address */
+        int result = (argc > 3) ? display_smart_log(&context, argv[2],
+            strtoul(argv[3], NULL, 0)) :
+            display_smart_attributes(&context, argv[2]);
+        if (result != 0) {
+            fprintf(stderr, "main: Could not read SMART data of %s: %s\n",
+                argv[2], context.message);
+            exit(1);
+        }
+	/* Option: Poll the SMART attributes of many drives into a time series */
+    } else if (strcmp(argv[1], "-t") == 0) {
+        if (argc < 3) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        if (getuid() != 0) {
+            fprintf(stderr, "main: Application should be run as root for " \
+                "this operation.\n");
+            exit(1);
+        }
+
+        smart_poll_options poll_options;
+        init_smart_poll_options(&poll_options);
+        const char *sysfs_root = DEFAULT_SYSFS_ROOT;
+
+        /* Arguments without an option name are drives, the rest of argv
+           is reused for them. */
+        char **drives = argv + 3;
+        unsigned int number_of_drives = 0;
+
+        int i;
+        for (i = 3; i < argc; ++i) {
+            if (strncmp(argv[i], "interval=", sizeof("interval=") - 1) == 0) {
+                poll_options.interval_s = strtoul(argv[i] +
+                    sizeof("interval=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "polls=",
+                sizeof("polls=") - 1) == 0) {
+                poll_options.number_of_polls = strtoul(argv[i] +
+                    sizeof("polls=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "workers=",
+                sizeof("workers=") - 1) == 0) {
+                poll_options.number_of_workers = strtoul(argv[i] +
+                    sizeof("workers=") - 1, NULL, 0);
+            } else if (strncmp(argv[i], "sysfs=",
+                sizeof("sysfs=") - 1) == 0) {
+                sysfs_root = argv[i] + sizeof("sysfs=") - 1;
+            } else {
+                drives[number_of_drives++] = argv[i];
+            }
+        }
+
+        /* Without drives every candidate drive of the system is polled. */
+        drive_candidate *candidates = NULL;
+        if (number_of_drives == 0) {
+            unsigned int number_skipped;
+            if (enumerate_drive_candidates(&context, sysfs_root, &candidates,
+                &number_of_drives, &number_skipped) != 0) {
+                fprintf(stderr, "main: %s\n", context.message);
+                exit(1);
+            }
+
+            drives = malloc((number_of_drives + 1) * sizeof(char *));
+            if (drives == NULL) {
+                fprintf(stderr, "main: Could not allocate the drive list\n");
+                exit(1);
+            }
+            unsigned int j;
+            for (j = 0; j < number_of_drives; ++j) {
+                drives[j] = candidates[j].device_file;
+            }
+        }
+
+        /* argv[2] = time series file */
+        if (poll_smart_attributes(&context, argv[2], drives, number_of_drives,
+            &poll_options) != 0) {
+            fprintf(stderr, "main: Could not poll SMART attributes into " \
+                "%s: %s\n", argv[2], context.message);
+            exit(1);
+        }
+
+        if (candidates != NULL) {
+            free(drives);
+            free(candidates);
+        }
+	/* Option: Check a drive database and look up a drive */
+    } else if (strcmp(argv[1], "-K") == 0) {
+        if (argc < 3) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        /* argv[2] = database file, argv[3] = model, argv[4] = firmware */
+        if (display_drive_profile(&context, argv[2],
+            (argc > 3) ? argv[3] : NULL, (argc > 4) ? argv[4] : NULL) != 0) {
+            fprintf(stderr, "main: %s\n", context.message);
+            exit(1);
+        }
+	/* Option: Display a SMART time series */
+    } else if (strcmp(argv[1], "-y") == 0) {
+        if (argc < 3) {
+            display_options(argv[0]);
+            exit(1);
+        }
+
+        /* argv[2] = time series file */
+        if (display_smart_series(&context, argv[2]) != 0) {
+            fprintf(stderr, "main: Could not display %s: %s\n", argv[2],
+                context.message);
             exit(1);
         }
     } else {
@@ -214,135 +862,333 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    free_drive_database(drive_db);
     return 0;
 }
 
-void scan_hard_disk_drives(void)
+/* Only the candidates found in sysfs are opened and identified, other
+ * devices never see a command. */
+void scan_hard_disk_drives(wdfw_context *context, const char *sysfs_root)
 {
-    DIR *dev_directory;
-    struct dirent *directory;
-    int fd;
-
-    char dev_prefix[] = "/dev/";
-
-    dev_directory = opendir(dev_prefix);
-    if (dev_directory) {
-        while ((directory = readdir(dev_directory)) != NULL) {
-            if (!(directory->d_type == DT_BLK ||
-                directory->d_type == DT_UNKNOWN)) {
-                continue;
-            }
+    drive_candidate *candidates;
+    unsigned int number_of_candidates;
+    unsigned int number_skipped;
 
-            /* Used to exclude partitions (example sda1, sda2, ..., sdaN). */
-            if (strlen(directory->d_name) != 3) {
-                continue;
-            }
-
-            if (strncmp("sd", directory->d_name, 2) == 0) {
-                char filename[strlen(dev_prefix) +
-                    strlen(directory->d_name) + 1];
+    if (enumerate_drive_candidates(context, sysfs_root, &candidates,
+        &number_of_candidates, &number_skipped) != 0) {
+        fprintf(stderr, "%s\n", context->message);
+        return;
+    }
 
-                memcpy(filename, dev_prefix, strlen(dev_prefix));
-                memcpy(filename + strlen(dev_prefix), directory->d_name,
-                    strlen(directory->d_name) + 1);
+    unsigned int i;
+    for (i = 0; i < number_of_candidates; ++i) {
+        drive_candidate *candidate = &candidates[i];
+        int fd;
 
-                printf("%s:\n", filename);
-                fd = open_hard_disk_drive(filename);
-                identify_hard_disk_drive(fd);
+        printf("%s (%s, scsi %d:%d:%d:%d, %s):\n", candidate->device_file,
+            candidate->model, candidate->host, candidate->channel,
+            candidate->target, candidate->lun, candidate->driver);
+        fd = open_hard_disk_drive(context, candidate->device_file);
+        if (fd < 0) {
+            fprintf(stderr, "%s\n", context->message);
+            continue;
+        }
 
-                if (fd != -1) {
-                    close(fd);
-                }
-            }
+        if (identify_hard_disk_drive(context, fd) != 0) {
+            fprintf(stderr, "%s\n", context->message);
         }
-        closedir(dev_directory);
+        close_hard_disk_drive(fd);
     }
+
+    printf("Found %u candidate drives, skipped %u other block devices" \
+        "\n", number_of_candidates, number_skipped);
+    free(candidates);
 }
 
 /* Should be called only when DMA is supported */
 /* LBA_ID should be less then MAXIMUM LBA RANGE ENTRY */
-int read_lba_block(char *hard_disk_dev_file, unsigned long lba_id)
+/* Sectors are read in LBA_TRANSFER_DEFAULT_SECTORS commands and every command
+ * is formatted while the output buffer of the dump fills up. */
+int read_lba_block(wdfw_context *context, char *hard_disk_dev_file,
+	uint64_t lba_id, uint64_t number_of_blocks, int collapse)
 {
-    uint8_t lba_data_buffer[512] = {0};
+    size_t buffer_size = LBA_TRANSFER_DEFAULT_SECTORS * ATA_SECTOR_SIZE;
+    hex_dump dump;
 
-    int hdd_fd = open_hard_disk_drive(hard_disk_dev_file);
-    if (hdd_fd == -1) {
-        fprintf(stderr, "read_lba_block: Could not handle hard disk drive.\n");
-        return -1;
+    if (number_of_blocks == 0) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "read_lba_block: No blocks to read");
     }
 
-    if (read_dma_ext(hdd_fd, lba_id, lba_data_buffer,
-        sizeof(lba_data_buffer)) != 0) {
-        fprintf(stderr, "read_lba_block: Could not display LBA block %ld\n",
-            lba_id);
-        return -1;
+    uint8_t *lba_data_buffer = malloc(buffer_size);
+    if (lba_data_buffer == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "read_lba_block: Could not allocate the read buffer");
     }
 
-    close(hdd_fd);
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        free(lba_data_buffer);
+        return chain_wdfw_error(context, "read_lba_block: Could not handle " \
+            "hard disk drive");
+    }
 
-    printf("Read the following from LBA block %ld:\n", lba_id);
+    if (check_hard_disk_commands(context, hdd_fd,
+        DRIVE_COMMAND_DMA) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        free(lba_data_buffer);
+        return chain_wdfw_error(context, "read_lba_block");
+    }
 
-    int i;
-    for (i = 0; i < sizeof(lba_data_buffer); ++i) {
-        if (i > 0 && (i % 16) == 0) {
-            printf("\n");
+    if (init_hex_dump(context, &dump, lba_id, ATA_SECTOR_SIZE,
+        collapse) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        free(lba_data_buffer);
+        return chain_wdfw_error(context, "read_lba_block");
+    }
+
+    wdfw_progress progress;
+    start_wdfw_progress(&progress, context, "lba_read",
+        number_of_blocks * ATA_SECTOR_SIZE);
+
+    printf("Read the following from LBA block %llu:\n",
+        (unsigned long long) lba_id);
+
+    uint64_t done = 0;
+    while (done < number_of_blocks) {
+        uint64_t blocks = number_of_blocks - done;
+        if (blocks > LBA_TRANSFER_DEFAULT_SECTORS) {
+            blocks = LBA_TRANSFER_DEFAULT_SECTORS;
         }
-        printf("0x%-4x ", lba_data_buffer[i]);
+
+        begin_wdfw_progress_chunk(&progress);
+        if (read_dma_ext(context, hdd_fd, lba_id + done, lba_data_buffer,
+            blocks * ATA_SECTOR_SIZE) < 0) {
+            chain_wdfw_error(context, "read_lba_block: Could not read LBA " \
+                "block %llu", (unsigned long long) (lba_id + done));
+            finish_wdfw_progress(&progress, context->error);
+            finish_hex_dump(context, &dump);
+            close_hard_disk_drive(hdd_fd);
+            free(lba_data_buffer);
+            return context->error;
+        }
+        update_wdfw_progress(&progress, (lba_id + done) * ATA_SECTOR_SIZE,
+            blocks * ATA_SECTOR_SIZE);
+
+        if (feed_hex_dump(context, &dump, lba_data_buffer,
+            blocks * ATA_SECTOR_SIZE) != 0) {
+            chain_wdfw_error(context, "read_lba_block");
+            finish_wdfw_progress(&progress, context->error);
+            finish_hex_dump(context, &dump);
+            close_hard_disk_drive(hdd_fd);
+            free(lba_data_buffer);
+            return context->error;
+        }
+        done += blocks;
+    }
+
+    finish_wdfw_progress(&progress, 0);
+    close_hard_disk_drive(hdd_fd);
+    free(lba_data_buffer);
+
+    if (finish_hex_dump(context, &dump) != 0) {
+        return chain_wdfw_error(context, "read_lba_block");
     }
-    printf("\n");
 
     return 0;
 }
 
-int write_lba_block(char *hard_disk_dev_file, unsigned long lba_id,
-	uint8_t *data_buffer, size_t size)
+int write_lba_block(wdfw_context *context, char *hard_disk_dev_file,
+	unsigned long lba_id, uint8_t *data_buffer, size_t size)
 {
     uint8_t lba_data_buffer[512] = {0};
     memcpy(lba_data_buffer, data_buffer, size);
 
     printf("Writing the following to LBA block %ld:\n", lba_id);
 
+    hex_dump dump;
+    if (init_hex_dump(context, &dump, lba_id, ATA_SECTOR_SIZE, 1) != 0) {
+        return chain_wdfw_error(context, "write_lba_block");
+    }
+
+    feed_hex_dump(context, &dump, lba_data_buffer, sizeof(lba_data_buffer));
+    if (finish_hex_dump(context, &dump) != 0) {
+        return chain_wdfw_error(context, "write_lba_block");
+    }
+
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "write_lba_block: Could not " \
+            "handle hard disk drive");
+    }
+
+    if (check_hard_disk_commands(context, hdd_fd,
+        DRIVE_COMMAND_DMA) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "write_lba_block");
+    }
+
+    wdfw_progress progress;
+    start_wdfw_progress(&progress, context, "lba_write",
+        sizeof(lba_data_buffer));
+
+    if (write_dma_ext(context, hdd_fd, lba_id, lba_data_buffer,
+        sizeof(lba_data_buffer)) < 0) {
+        close_hard_disk_drive(hdd_fd);
+        chain_wdfw_error(context, "write_lba_block: Could not write LBA " \
+            "block %ld", lba_id);
+        finish_wdfw_progress(&progress, context->error);
+        return context->error;
+    }
+
+    update_wdfw_progress(&progress, lba_id * sizeof(lba_data_buffer),
+        sizeof(lba_data_buffer));
+    finish_wdfw_progress(&progress, 0);
+
+    close_hard_disk_drive(hdd_fd);
+
+    return 0;
+}
+
+static int parse_geometry_options(wdfw_context *context, int argc,
+	char *argv[], int first, int *calibrate)
+{
+    unsigned long chunk_size = 0;
+
     int i;
-    for (i = 0; i < sizeof(lba_data_buffer); ++i) {
-        if (i > 0 && (i % 16) == 0) {
-            printf("\n");
+    for (i = first; i < argc; ++i) {
+        if (strncmp(argv[i], "geometry=", sizeof("geometry=") - 1) == 0) {
+            const rom_geometry *geometry =
+                find_rom_geometry(argv[i] + sizeof("geometry=") - 1);
+            if (geometry == NULL) {
+                fprintf(stderr, "main: Unknown rom geometry %s\n", argv[i]);
+                return -1;
+            }
+            context->geometry = *geometry;
+            context->detect_geometry = 0;
+        } else if (strncmp(argv[i], "cache=", sizeof("cache=") - 1) == 0) {
+            context->pack_cache = argv[i] + sizeof("cache=") - 1;
+        } else if (strcmp(argv[i], "chunk=auto") == 0) {
+            *calibrate = 1;
+        } else if (strncmp(argv[i], "chunk=", sizeof("chunk=") - 1) == 0) {
+            chunk_size = strtoul(argv[i] + sizeof("chunk=") - 1, NULL, 0);
+        } else {
+            fprintf(stderr, "main: Invalid option %s\n", argv[i]);
+            return -1;
         }
-        printf("0x%-4x ", lba_data_buffer[i]);
     }
-    printf("\n");
 
-    int hdd_fd = open_hard_disk_drive(hard_disk_dev_file);
-    if (hdd_fd == -1) {
-        fprintf(stderr, "write_lba_block: Could not handle hard disk " \
-            "drive.\n");
-        return -1;
+    /* The chunk size overrides the one of the geometry profile. */
+    if (chunk_size != 0) {
+        context->geometry.chunk_size = chunk_size;
     }
 
-    if (write_dma_ext(hdd_fd, lba_id, lba_data_buffer, size) != 0) {
-        fprintf(stderr, "write_lba_block: Could not display LBA block " \
-            "%ld\n", lba_id);
+    return 0;
+}
+
+static int calibrate_chunk_size(wdfw_context *context,
+	char *hard_disk_dev_file)
+{
+    rom_chunk_measurement measurements[16];
+    unsigned int number_of_measurements = sizeof(measurements) /
+        sizeof(measurements[0]);
+
+    if (calibrate_rom_chunk_size(context, hard_disk_dev_file, measurements,
+        &number_of_measurements) != 0) {
+        fprintf(stderr, "main: Could not calibrate the rom chunk size: %s\n",
+            context->message);
         return -1;
     }
 
-    close(hdd_fd);
-
+    fprintf(context->output, "Using %u byte rom chunks\n",
+        context->geometry.chunk_size);
     return 0;
 }
 
+static uint32_t parse_rom_address(char *address, address_space *space)
+{
+    *space = ADDRESS_SPACE_FILE;
+
+    if (strncmp(address, "load:", sizeof("load:") - 1) == 0) {
+        *space = ADDRESS_SPACE_LOAD;
+        address += sizeof("load:") - 1;
+    } else if (strncmp(address, "file:", sizeof("file:") - 1) == 0) {
+        address += sizeof("file:") - 1;
+    }
+
+    return strtoul(address, NULL, 16);
+}
+
 void display_options(char *app_name)
 {
     printf("Usage:\n");
-    printf("Dump ROM image: %s -d <hard disk location> <filename>\n",
+    printf("Dump ROM image: %s -d <hard disk location> <filename|-> " \
+        "[geometry options]\n", app_name);
+    printf("Dump and unpack ROM image: %s -D <hard disk location> " \
+        "<filename> [geometry options]\n", app_name);
+    printf("Print info blocks: %s -i <rom file|-> [copy file]\n", app_name);
+    printf("Report rom info: %s -R <json|binary> <rom file...|->\n",
         app_name);
-    printf("Print info blocks: %s -i <rom file>\n", app_name);
-    printf("Load ROM image: %s -l <hard disk location> <rom file>\n",
-		app_name);
+    printf("Fingerprint database: %s -F add <database> <build name> " \
+        "<rom file|block_hashes>\n", app_name);
+    printf("                      %s -F identify <database> " \
+        "<rom file|block_hashes>\n", app_name);
+    printf("                      %s -F list <database>\n", app_name);
+    printf("Generate rom images: %s -G <output prefix|-> <count> " \
+        "[seed=<n>] [blocks=<min>[-<max>]] [size=<min>[-<max>]] " \
+        "[entropy=<0-100>]\n", app_name);
+    printf("Load ROM image: %s -l <hard disk location> <rom file> " \
+		"[geometry options]\n", app_name);
 	printf("Unpack rom image: %s -u <rom file> \n", app_name);
-    printf("Pack image: %s -p <rom file> <output file>\n", app_name);
-	printf("Modify rom: %s -m <rom file>\n", app_name);
-    printf("Hard disk scan: %s -s\n", app_name);
-    printf("Read specific LBA: %s -r <hard disk location> <block number>\n",
+    printf("Pack image: %s -p <formatted header> <output file> " \
+        "[geometry=<name>] [cache=<directory>]\n", app_name);
+    printf("Repack changed blocks: %s -I <formatted header> <output file> " \
+        "[geometry=<name>] [cache=<directory>]\n", app_name);
+	printf("Modify rom: %s -m <rom file> <[load:]address> <instruction>\n",
+		app_name);
+	printf("Apply patch set: %s -P <rom file> <patch file>\n", app_name);
+	printf("Build patched variants: %s -V <base rom file> <variant list> " \
+		"[workers]\n", app_name);
+	printf("Undo last modification: %s -U <rom file>\n", app_name);
+	printf("Search rom: %s -f <rom file> <hex bytes>\n", app_name);
+    printf("Calibrate rom chunk size: %s -C <hard disk location> " \
+        "[geometry options]\n", app_name);
+    printf("Module directory: %s -M <hard disk location>\n", app_name);
+    printf("Dump modules: %s -B <hard disk location> <archive file> " \
+        "[module id...]\n", app_name);
+    printf("List or extract archived modules: %s -A <archive file> " \
+        "[module id] [output file]\n", app_name);
+    printf("Create simulated drive: %s -S <directory> <rom file> " \
+        "[number of modules]\n", app_name);
+    printf("Hard disk scan: %s -s [sysfs root]\n", app_name);
+    printf("Watch for hard disks: %s -W [events=<uevent file>] " \
+        "[sysfs=<sysfs root>] [dev=<device directory>] [job=<command>]\n",
         app_name);
+    printf("Read LBAs: %s -r <hard disk location> <block number> " \
+        "[number of blocks] [full]\n", app_name);
     printf("Write specifc LBA: %s -w <hard disk location> <block number> " \
         "<data> (MUST be equal or less to 512 bytes)\n", app_name);
+    printf("Write file to LBAs: %s -L <hard disk location> <first LBA> " \
+        "<image file> [queue=<1-32>] [sectors=<per command>] [verify]\n",
+        app_name);
+    printf("Surface scan: %s -H <hard disk location> <heatmap file> " \
+        "[zones=<number>] [sectors=<per read>] [samples=<per zone>] " \
+        "[slow=<ms>]\n", app_name);
+    printf("SMART attributes or log: %s -T <hard disk location> " \
+        "[log address]\n", app_name);
+    printf("Poll SMART attributes: %s -t <time series file> " \
+        "[interval=<s>] [polls=<number>] [workers=<1-64>] " \
+        "[sysfs=<sysfs root>] [hard disk location ...]\n", app_name);
+    printf("Display SMART time series: %s -y <time series file>\n",
+        app_name);
+    printf("Check drive database: %s -K <database file> [model " \
+        "[firmware]]\n", app_name);
+    printf("Drive database: set WDFW_DRIVE_DB=<file> to replace %s, an " \
+        "empty value uses the built-in drives\n", DRIVE_DATABASE_FILE);
+    printf("Geometry options: [geometry=<256k|512k|1m>] " \
+        "[chunk=<bytes>|chunk=auto]\n");
+    printf("Hard disk locations: /dev/sdX, or sim:<directory> for a " \
+        "simulated drive\n");
+    printf("Progress records: set WDFW_PROGRESS_FD=<fd> to write JSON lines " \
+        "with the progress of device operations to fd\n");
 }
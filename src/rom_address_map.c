@@ -0,0 +1,204 @@
+/* Generic libraries */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Application specific */
+#include "includes/rom_address_map.h"
+#include "includes/rom_management.h"
+#include "includes/wdfw_context.h"
+
+/* Order two address ranges on their load address. */
+static int compare_range_load_address(const void *a, const void *b);
+
+/* Order two address ranges on their file offset. */
+static int compare_range_file_offset(const void *a, const void *b);
+
+/* Calculate the running maximum range end of a sorted range array. */
+static unsigned int calculate_max_ends(rom_address_range *ranges,
+    unsigned int number_of_ranges, int use_load_address);
+
+/* Binary search the range containing address in a sorted range array. */
+static rom_address_range *find_range(rom_address_range *ranges,
+    unsigned int number_of_ranges, uint32_t address, int use_load_address);
+
+/* Operations: */
+/* Convert every rom block to a load/file address range */
+/* Sort a copy of the ranges on load address and one on file offset */
+/* Calculate the running maximum end of both arrays */
+/* Count the ranges that overlap a preceding range */
+rom_address_map *create_rom_address_map(rom_block *rom_block_table,
+    unsigned int number_of_blocks)
+{
+    rom_address_map *map = calloc(1, sizeof(rom_address_map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    map->by_load = calloc(number_of_blocks + 1, sizeof(rom_address_range));
+    map->by_file = calloc(number_of_blocks + 1, sizeof(rom_address_range));
+    if (map->by_load == NULL || map->by_file == NULL) {
+        destroy_rom_address_map(map);
+        return NULL;
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        rom_address_range *range = &map->by_load[map->number_of_ranges];
+
+        range->size = le_32_to_be(rom_block_table[i].size);
+        if (range->size == 0) {
+            continue;
+        }
+
+        range->load_address = le_32_to_be(rom_block_table[i].load_address);
+        range->file_offset = le_32_to_be(rom_block_table[i].start_address);
+        range->block_nr = rom_block_table[i].block_nr;
+        range->flag = rom_block_table[i].flag;
+        map->number_of_ranges += 1;
+    }
+
+    memcpy(map->by_file, map->by_load,
+        map->number_of_ranges * sizeof(rom_address_range));
+
+    qsort(map->by_load, map->number_of_ranges, sizeof(rom_address_range),
+        compare_range_load_address);
+    qsort(map->by_file, map->number_of_ranges, sizeof(rom_address_range),
+        compare_range_file_offset);
+
+    map->number_of_overlaps = calculate_max_ends(map->by_load,
+        map->number_of_ranges, 1);
+    map->number_of_file_overlaps = calculate_max_ends(map->by_file,
+        map->number_of_ranges, 0);
+
+    return map;
+}
+
+void destroy_rom_address_map(rom_address_map *map)
+{
+    if (map != NULL) {
+        free(map->by_load);
+        free(map->by_file);
+        free(map);
+    }
+}
+
+int load_address_to_file_offset(rom_address_map *map, uint32_t load_address,
+    uint32_t *file_offset)
+{
+    rom_address_range *range = find_range(map->by_load, map->number_of_ranges,
+        load_address, 1);
+
+    if (range == NULL) {
+        return WDFW_ERROR_ADDRESS;
+    }
+
+    /* The load address describes decompressed code, which does not have a
+     * one to one relation with the bytes stored in the rom file. */
+    if (range->flag != FLAG_UNENCRYPTED) {
+        return WDFW_ERROR_COMPRESSED;
+    }
+
+    *file_offset = range->file_offset + (load_address - range->load_address);
+    return 0;
+}
+
+int file_offset_to_load_address(rom_address_map *map, uint32_t file_offset,
+    uint32_t *load_address)
+{
+    rom_address_range *range = find_file_range(map, file_offset);
+
+    if (range == NULL) {
+        return WDFW_ERROR_ADDRESS;
+    }
+
+    if (range->flag != FLAG_UNENCRYPTED) {
+        return WDFW_ERROR_COMPRESSED;
+    }
+
+    *load_address = range->load_address + (file_offset - range->file_offset);
+    return 0;
+}
+
+rom_address_range *find_file_range(rom_address_map *map, uint32_t file_offset)
+{
+    return find_range(map->by_file, map->number_of_ranges, file_offset, 0);
+}
+
+static int compare_range_load_address(const void *a, const void *b)
+{
+    uint32_t address_a = ((rom_address_range *) a)->load_address;
+    uint32_t address_b = ((rom_address_range *) b)->load_address;
+
+    return (address_a > address_b) - (address_a < address_b);
+}
+
+static int compare_range_file_offset(const void *a, const void *b)
+{
+    uint32_t address_a = ((rom_address_range *) a)->file_offset;
+    uint32_t address_b = ((rom_address_range *) b)->file_offset;
+
+    return (address_a > address_b) - (address_a < address_b);
+}
+
+/* Returns the number of ranges that start before the end of a preceding
+ * range. */
+static unsigned int calculate_max_ends(rom_address_range *ranges,
+    unsigned int number_of_ranges, int use_load_address)
+{
+    unsigned int number_of_overlaps = 0;
+    uint64_t max_end = 0;
+
+    unsigned int i;
+    for (i = 0; i < number_of_ranges; ++i) {
+        uint64_t start = use_load_address ? ranges[i].load_address :
+            ranges[i].file_offset;
+
+        if (i > 0 && start < max_end) {
+            number_of_overlaps += 1;
+        }
+
+        if (start + ranges[i].size > max_end) {
+            max_end = start + ranges[i].size;
+        }
+
+        ranges[i].max_end = max_end;
+    }
+
+    return number_of_overlaps;
+}
+
+/* Operations: */
+/* Binary search the last range starting at or before address */
+/* Walk back while a preceding range can still contain address (only happens
+   for overlapping ranges) */
+static rom_address_range *find_range(rom_address_range *ranges,
+    unsigned int number_of_ranges, uint32_t address, int use_load_address)
+{
+    unsigned int low = 0;
+    unsigned int high = number_of_ranges;
+
+    while (low < high) {
+        unsigned int middle = low + (high - low) / 2;
+        uint32_t start = use_load_address ? ranges[middle].load_address :
+            ranges[middle].file_offset;
+
+        if (start <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    int i;
+    for (i = (int) low - 1; i >= 0 && ranges[i].max_end > address; --i) {
+        uint64_t start = use_load_address ? ranges[i].load_address :
+            ranges[i].file_offset;
+
+        if (address < start + ranges[i].size) {
+            return &ranges[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,698 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Linux specific */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "includes/rom_fingerprint.h"
+#include "includes/rom_management.h"
+#include "includes/rom_hash.h"
+#include "includes/wdfw_context.h"
+
+/* Votes of a build while matching the blocks of an image. */
+typedef struct {
+    unsigned int matching_blocks;
+    uint64_t matched; /* Bit per block of the image found in build */
+} rom_fingerprint_candidate;
+
+/* Calculate the fingerprint of a mapped rom image the way unpack_rom_image
+   hashes it. */
+static int fingerprint_rom_memory(wdfw_context *context, uint8_t *rom_memory,
+    size_t file_size, rom_fingerprint *fingerprint);
+
+/* Parse a block_hashes file. */
+static int parse_rom_block_hashes(wdfw_context *context, int input_file,
+    char *file_name, rom_fingerprint *fingerprint);
+
+/* Index of the first Bloom filter bit or table slot of hash, for the power
+   of two size. */
+static inline uint32_t fingerprint_slot(uint64_t hash, uint32_t size);
+
+/* Set the Bloom filter bits of hash. */
+static void add_rom_fingerprint_bloom(uint8_t *bloom, uint32_t bloom_size,
+    uint64_t hash);
+
+/* Write a database file holding builds and entries, replacing db_file. */
+static int write_rom_fingerprint_db(wdfw_context *context, char *db_file,
+    rom_fingerprint_build *builds, uint32_t number_of_builds,
+    rom_fingerprint_entry *entries, uint32_t number_of_entries);
+
+/* Write size bytes of data to fd. */
+static int write_fingerprint_data(wdfw_context *context, int fd,
+    const void *data, size_t size);
+
+int load_rom_fingerprint(wdfw_context *context, char *file_name,
+    rom_fingerprint *fingerprint)
+{
+    struct stat file_stat;
+    char start[6] = {0};
+
+    int input_file = openat(context->directory_fd, file_name,
+        O_RDONLY | O_CLOEXEC);
+    if (input_file == -1 || fstat(input_file, &file_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "load_rom_fingerprint: open %s", file_name);
+        if (input_file != -1) {
+            close(input_file);
+        }
+        return context->error;
+    }
+
+    /* Rom images start with a block number (0x00 - 0x0a or 0x5a), never
+     * with the text of a block_hashes file. */
+    if (pread(input_file, start, sizeof(start), 0) == sizeof(start) &&
+        (memcmp(start, "block_", 6) == 0 || memcmp(start, "image ", 6) == 0)) {
+        return parse_rom_block_hashes(context, input_file, file_name,
+            fingerprint);
+    }
+
+    if (file_stat.st_size < (off_t) sizeof(rom_block)) {
+        close(input_file);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "load_rom_fingerprint: %s is no rom image", file_name);
+    }
+
+    uint8_t *rom_memory = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED,
+        input_file, 0);
+    close(input_file);
+    if (rom_memory == MAP_FAILED) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "load_rom_fingerprint: mmap %s", file_name);
+    }
+
+    int result = fingerprint_rom_memory(context, rom_memory,
+        file_stat.st_size, fingerprint);
+    munmap(rom_memory, file_stat.st_size);
+
+    if (result != 0) {
+        return chain_wdfw_error(context, "load_rom_fingerprint: %s",
+            file_name);
+    }
+
+    return 0;
+}
+
+static int fingerprint_rom_memory(wdfw_context *context, uint8_t *rom_memory,
+    size_t file_size, rom_fingerprint *fingerprint)
+{
+    unsigned int number_of_blocks = 0;
+
+    rom_block *rom_header_table = create_rom_block_table(rom_memory,
+        &number_of_blocks);
+    if (rom_header_table == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "fingerprint_rom_memory: Could not create rom header table");
+    }
+
+    if (number_of_blocks > ROM_STREAM_MAX_BLOCKS ||
+        number_of_blocks * sizeof(rom_block) > file_size) {
+        destroy_rom_block_table(rom_header_table);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "fingerprint_rom_memory: Invalid rom block table");
+    }
+
+    memset(fingerprint, 0, sizeof(rom_fingerprint));
+    fingerprint->number_of_blocks = number_of_blocks;
+    fingerprint->image_hash = calculate_rom_hash(rom_memory, file_size);
+
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        uint32_t start_address = le_32_to_be(rom_header_table[i].start_address);
+        uint32_t size = le_32_to_be(rom_header_table[i].size);
+
+        if ((uint64_t) start_address + size > file_size) {
+            destroy_rom_block_table(rom_header_table);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "fingerprint_rom_memory: rom block %#x exceeds the image",
+                rom_header_table[i].block_nr);
+        }
+
+        fingerprint->block_nr[i] = rom_header_table[i].block_nr;
+        fingerprint->block_hash[i] = calculate_rom_hash(
+            rom_memory + start_address, size);
+    }
+
+    destroy_rom_block_table(rom_header_table);
+    return 0;
+}
+
+static int parse_rom_block_hashes(wdfw_context *context, int input_file,
+    char *file_name, rom_fingerprint *fingerprint)
+{
+    char line[128];
+    int image_hash_found = 0;
+
+    FILE *fp = fdopen(input_file, "r");
+    if (fp == NULL) {
+        close(input_file);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "parse_rom_block_hashes: fdopen %s", file_name);
+    }
+
+    memset(fingerprint, 0, sizeof(rom_fingerprint));
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned int block_nr;
+        unsigned long long hash;
+
+        if (sscanf(line, "block_%x %llx", &block_nr, &hash) == 2 &&
+            block_nr <= 0xff &&
+            fingerprint->number_of_blocks < ROM_STREAM_MAX_BLOCKS) {
+            fingerprint->block_nr[fingerprint->number_of_blocks] = block_nr;
+            fingerprint->block_hash[fingerprint->number_of_blocks] = hash;
+            ++fingerprint->number_of_blocks;
+        } else if (sscanf(line, "image %llx", &hash) == 1) {
+            fingerprint->image_hash = hash;
+            image_hash_found = 1;
+        } else {
+            fclose(fp);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "parse_rom_block_hashes: Invalid line in %s: %s", file_name,
+                line);
+        }
+    }
+
+    fclose(fp);
+
+    if (!image_hash_found) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_rom_block_hashes: %s holds no image hash", file_name);
+    }
+
+    return 0;
+}
+
+int open_rom_fingerprint_db(wdfw_context *context, char *db_file,
+    rom_fingerprint_db *db)
+{
+    struct stat db_stat;
+
+    memset(db, 0, sizeof(rom_fingerprint_db));
+
+    int db_fd = openat(context->directory_fd, db_file, O_RDONLY | O_CLOEXEC);
+    if (db_fd == -1 || fstat(db_fd, &db_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_rom_fingerprint_db: open %s", db_file);
+        if (db_fd != -1) {
+            close(db_fd);
+        }
+        return context->error;
+    }
+
+    if (db_stat.st_size < (off_t) sizeof(rom_fingerprint_db_header)) {
+        close(db_fd);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "open_rom_fingerprint_db: %s is no fingerprint database",
+            db_file);
+    }
+
+    db->size = db_stat.st_size;
+    db->memory = mmap(NULL, db->size, PROT_READ, MAP_SHARED, db_fd, 0);
+    close(db_fd);
+    if (db->memory == MAP_FAILED) {
+        db->memory = NULL;
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_rom_fingerprint_db: mmap %s", db_file);
+    }
+
+    rom_fingerprint_db_header *header =
+        (rom_fingerprint_db_header *) db->memory;
+    uint64_t expected_size = sizeof(rom_fingerprint_db_header) +
+        (uint64_t) header->number_of_builds * sizeof(rom_fingerprint_build) +
+        (uint64_t) header->number_of_entries * sizeof(rom_fingerprint_entry) +
+        (uint64_t) header->table_size * sizeof(uint32_t) + header->bloom_size;
+
+    if (memcmp(header->magic, FINGERPRINT_DB_MAGIC,
+        sizeof(header->magic)) != 0 ||
+        header->version != FINGERPRINT_DB_VERSION ||
+        header->table_size == 0 ||
+        (header->table_size & (header->table_size - 1)) != 0 ||
+        header->table_size <= header->number_of_entries ||
+        header->bloom_size == 0 ||
+        (header->bloom_size & (header->bloom_size - 1)) != 0 ||
+        expected_size != db->size) {
+        close_rom_fingerprint_db(db);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "open_rom_fingerprint_db: %s is no fingerprint database",
+            db_file);
+    }
+
+    db->header = header;
+    db->builds = (rom_fingerprint_build *) (db->memory +
+        sizeof(rom_fingerprint_db_header));
+    db->entries = (rom_fingerprint_entry *) (db->builds +
+        header->number_of_builds);
+    db->table = (uint32_t *) (db->entries + header->number_of_entries);
+    db->bloom = (uint8_t *) (db->table + header->table_size);
+
+    unsigned int i;
+    for (i = 0; i < header->number_of_entries; ++i) {
+        if (db->entries[i].build >= header->number_of_builds) {
+            close_rom_fingerprint_db(db);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "open_rom_fingerprint_db: Entry %u of %s has no build", i,
+                db_file);
+        }
+    }
+
+    for (i = 0; i < header->table_size; ++i) {
+        if (db->table[i] > header->number_of_entries) {
+            close_rom_fingerprint_db(db);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "open_rom_fingerprint_db: Slot %u of %s has no entry", i,
+                db_file);
+        }
+    }
+
+    return 0;
+}
+
+void close_rom_fingerprint_db(rom_fingerprint_db *db)
+{
+    if (db->memory != NULL) {
+        munmap(db->memory, db->size);
+    }
+    memset(db, 0, sizeof(rom_fingerprint_db));
+}
+
+static inline uint32_t fingerprint_slot(uint64_t hash, uint32_t size)
+{
+    return (uint32_t) hash & (size - 1);
+}
+
+/* Double hashing (Kirsch and Mitzenmacher): bit i is h1 + i * h2, with both
+ * halves taken from the 64-bit FNV-1a hash. */
+int test_rom_fingerprint_bloom(rom_fingerprint_db *db, uint64_t hash)
+{
+    uint32_t bits = db->header->bloom_size * 8;
+    uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+
+    unsigned int i;
+    for (i = 0; i < FINGERPRINT_BLOOM_HASHES; ++i) {
+        uint32_t bit = fingerprint_slot(hash + (uint64_t) i * h2, bits);
+        if (!(db->bloom[bit / 8] & (1 << (bit % 8)))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void add_rom_fingerprint_bloom(uint8_t *bloom, uint32_t bloom_size,
+    uint64_t hash)
+{
+    uint32_t bits = bloom_size * 8;
+    uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+
+    unsigned int i;
+    for (i = 0; i < FINGERPRINT_BLOOM_HASHES; ++i) {
+        uint32_t bit = fingerprint_slot(hash + (uint64_t) i * h2, bits);
+        bloom[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+/* Operations: */
+/* Look up the image hash, an exact match ends the search */
+/* Look up every block hash and count the blocks each build shares */
+/* Select the build sharing the most blocks, the others differ */
+int match_rom_fingerprint(wdfw_context *context, rom_fingerprint_db *db,
+    rom_fingerprint *fingerprint, rom_fingerprint_match *match)
+{
+    rom_fingerprint_candidate *candidates = NULL;
+    uint32_t mask = db->header->table_size - 1;
+    uint32_t slot;
+    unsigned int probes;
+
+    memset(match, 0, sizeof(rom_fingerprint_match));
+
+    if (!test_rom_fingerprint_bloom(db, fingerprint->image_hash)) {
+        ++match->rejected;
+    } else {
+        slot = fingerprint_slot(fingerprint->image_hash, mask + 1);
+        for (probes = 0; probes <= mask && db->table[slot] != 0; ++probes) {
+            rom_fingerprint_entry *entry = &db->entries[db->table[slot] - 1];
+
+            if (entry->hash == fingerprint->image_hash &&
+                entry->block_nr == FINGERPRINT_IMAGE_ENTRY) {
+                match->found = 1;
+                match->exact = 1;
+                match->build = entry->build;
+                match->matching_blocks = fingerprint->number_of_blocks;
+                return 0;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    /* A block shared by many builds, such as the loader, votes for every
+     * one of them. */
+    candidates = calloc(db->header->number_of_builds ?
+        db->header->number_of_builds : 1, sizeof(rom_fingerprint_candidate));
+    if (candidates == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "match_rom_fingerprint: Could not allocate %u builds",
+            db->header->number_of_builds);
+    }
+
+    unsigned int i;
+    for (i = 0; i < fingerprint->number_of_blocks; ++i) {
+        uint64_t hash = fingerprint->block_hash[i];
+
+        if (!test_rom_fingerprint_bloom(db, hash)) {
+            ++match->rejected;
+            continue;
+        }
+
+        slot = fingerprint_slot(hash, mask + 1);
+        for (probes = 0; probes <= mask && db->table[slot] != 0; ++probes) {
+            rom_fingerprint_entry *entry = &db->entries[db->table[slot] - 1];
+            slot = (slot + 1) & mask;
+
+            if (entry->hash != hash ||
+                entry->block_nr != fingerprint->block_nr[i]) {
+                continue;
+            }
+
+            rom_fingerprint_candidate *candidate = &candidates[entry->build];
+            if (!(candidate->matched & (1ULL << i))) {
+                candidate->matched |= 1ULL << i;
+                ++candidate->matching_blocks;
+            }
+        }
+    }
+
+    uint64_t matched = 0;
+    uint32_t build;
+    for (build = 0; build < db->header->number_of_builds; ++build) {
+        if (candidates[build].matching_blocks > match->matching_blocks) {
+            match->found = 1;
+            match->build = build;
+            match->matching_blocks = candidates[build].matching_blocks;
+            matched = candidates[build].matched;
+        }
+    }
+    free(candidates);
+
+    for (i = 0; i < fingerprint->number_of_blocks; ++i) {
+        match->differs[i] = !(matched & (1ULL << i));
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Calculate the fingerprint of the new build */
+/* Open the existing database, a missing database is empty */
+/* Reject builds whose name or image is already known */
+/* Append the build and its image and block entries */
+/* Write the database with a new hash table and Bloom filter */
+int add_rom_fingerprint(wdfw_context *context, char *db_file, char *name,
+    char *file_name)
+{
+    rom_fingerprint fingerprint;
+    rom_fingerprint_db db = {0};
+    struct stat db_stat;
+    uint32_t number_of_builds = 0;
+    uint32_t number_of_entries = 0;
+
+    if (strlen(name) >= FINGERPRINT_NAME_SIZE) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "add_rom_fingerprint: Build name %s is longer than %d characters",
+            name, FINGERPRINT_NAME_SIZE - 1);
+    }
+
+    if (load_rom_fingerprint(context, file_name, &fingerprint) != 0) {
+        return chain_wdfw_error(context, "add_rom_fingerprint");
+    }
+
+    if (fstatat(context->directory_fd, db_file, &db_stat, 0) == 0) {
+        if (open_rom_fingerprint_db(context, db_file, &db) != 0) {
+            return chain_wdfw_error(context, "add_rom_fingerprint");
+        }
+        number_of_builds = db.header->number_of_builds;
+        number_of_entries = db.header->number_of_entries;
+    } else if (errno != ENOENT) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "add_rom_fingerprint: stat %s", db_file);
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_builds; ++i) {
+        if (strncmp(db.builds[i].name, name, FINGERPRINT_NAME_SIZE) == 0 ||
+            db.builds[i].image_hash == fingerprint.image_hash) {
+            report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+                "add_rom_fingerprint: %s is already known as build %.*s",
+                file_name, FINGERPRINT_NAME_SIZE, db.builds[i].name);
+            close_rom_fingerprint_db(&db);
+            return context->error;
+        }
+    }
+
+    rom_fingerprint_build *builds = calloc(number_of_builds + 1,
+        sizeof(rom_fingerprint_build));
+    rom_fingerprint_entry *entries = calloc(number_of_entries + 1 +
+        fingerprint.number_of_blocks, sizeof(rom_fingerprint_entry));
+    if (builds == NULL || entries == NULL) {
+        free(builds);
+        free(entries);
+        close_rom_fingerprint_db(&db);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "add_rom_fingerprint: Could not allocate the database");
+    }
+
+    if (number_of_builds > 0) {
+        memcpy(builds, db.builds,
+            number_of_builds * sizeof(rom_fingerprint_build));
+        memcpy(entries, db.entries,
+            number_of_entries * sizeof(rom_fingerprint_entry));
+    }
+    close_rom_fingerprint_db(&db);
+
+    rom_fingerprint_build *build = &builds[number_of_builds];
+    strncpy(build->name, name, FINGERPRINT_NAME_SIZE - 1);
+    build->image_hash = fingerprint.image_hash;
+    build->number_of_blocks = fingerprint.number_of_blocks;
+    build->first_entry = number_of_entries + 1;
+
+    entries[number_of_entries].hash = fingerprint.image_hash;
+    entries[number_of_entries].build = number_of_builds;
+    entries[number_of_entries].block_nr = FINGERPRINT_IMAGE_ENTRY;
+    ++number_of_entries;
+
+    for (i = 0; i < fingerprint.number_of_blocks; ++i) {
+        entries[number_of_entries].hash = fingerprint.block_hash[i];
+        entries[number_of_entries].build = number_of_builds;
+        entries[number_of_entries].block_nr = fingerprint.block_nr[i];
+        ++number_of_entries;
+    }
+    ++number_of_builds;
+
+    int result = write_rom_fingerprint_db(context, db_file, builds,
+        number_of_builds, entries, number_of_entries);
+    free(builds);
+    free(entries);
+
+    if (result != 0) {
+        return chain_wdfw_error(context, "add_rom_fingerprint");
+    }
+
+    print_wdfw_output(context, "Added build %s (image %016llx, %u blocks) " \
+        "to %s\n", name, (unsigned long long) fingerprint.image_hash,
+        fingerprint.number_of_blocks, db_file);
+    return 0;
+}
+
+/* The database is written to a temporary file and renamed over db_file, so
+ * readers always see a complete database. */
+static int write_rom_fingerprint_db(wdfw_context *context, char *db_file,
+    rom_fingerprint_build *builds, uint32_t number_of_builds,
+    rom_fingerprint_entry *entries, uint32_t number_of_entries)
+{
+    rom_fingerprint_db_header header;
+    uint32_t table_size = 16;
+    uint32_t bloom_size = 64;
+
+    /* At most half of the slots are used, keeping probe sequences short. */
+    while (table_size < number_of_entries * 2) {
+        table_size *= 2;
+    }
+    while (bloom_size * 8 < number_of_entries * FINGERPRINT_BLOOM_BITS) {
+        bloom_size *= 2;
+    }
+
+    uint32_t *table = calloc(table_size, sizeof(uint32_t));
+    uint8_t *bloom = calloc(bloom_size, 1);
+    if (table == NULL || bloom == NULL) {
+        free(table);
+        free(bloom);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "write_rom_fingerprint_db: Could not allocate the hash table");
+    }
+
+    uint32_t i;
+    for (i = 0; i < number_of_entries; ++i) {
+        uint32_t slot = fingerprint_slot(entries[i].hash, table_size);
+
+        while (table[slot] != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        table[slot] = i + 1;
+        add_rom_fingerprint_bloom(bloom, bloom_size, entries[i].hash);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FINGERPRINT_DB_MAGIC, sizeof(header.magic));
+    header.version = FINGERPRINT_DB_VERSION;
+    header.number_of_builds = number_of_builds;
+    header.number_of_entries = number_of_entries;
+    header.table_size = table_size;
+    header.bloom_size = bloom_size;
+
+    size_t temporary_name_size = strlen(db_file) + sizeof(".tmp");
+    char temporary_name[temporary_name_size];
+    snprintf(temporary_name, temporary_name_size, "%s.tmp", db_file);
+
+    int db_fd = openat(context->directory_fd, temporary_name,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (db_fd == -1) {
+        free(table);
+        free(bloom);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_rom_fingerprint_db: open %s", temporary_name);
+    }
+
+    if (write_fingerprint_data(context, db_fd, &header, sizeof(header)) != 0 ||
+        write_fingerprint_data(context, db_fd, builds,
+        number_of_builds * sizeof(rom_fingerprint_build)) != 0 ||
+        write_fingerprint_data(context, db_fd, entries,
+        number_of_entries * sizeof(rom_fingerprint_entry)) != 0 ||
+        write_fingerprint_data(context, db_fd, table,
+        table_size * sizeof(uint32_t)) != 0 ||
+        write_fingerprint_data(context, db_fd, bloom, bloom_size) != 0) {
+        close(db_fd);
+        unlinkat(context->directory_fd, temporary_name, 0);
+        free(table);
+        free(bloom);
+        return chain_wdfw_error(context, "write_rom_fingerprint_db: %s",
+            db_file);
+    }
+
+    free(table);
+    free(bloom);
+
+    if (close(db_fd) == -1 || renameat(context->directory_fd, temporary_name,
+        context->directory_fd, db_file) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_rom_fingerprint_db: Could not replace %s", db_file);
+        unlinkat(context->directory_fd, temporary_name, 0);
+        return context->error;
+    }
+
+    return 0;
+}
+
+static int write_fingerprint_data(wdfw_context *context, int fd,
+    const void *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = write(fd, (const uint8_t *) data + written,
+            size - written);
+        if (result <= 0) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "write_fingerprint_data: write");
+        }
+        written += result;
+    }
+
+    return 0;
+}
+
+int identify_rom_fingerprint(wdfw_context *context, char *db_file,
+    char *file_name)
+{
+    rom_fingerprint fingerprint;
+    rom_fingerprint_match match;
+    rom_fingerprint_db db;
+
+    if (load_rom_fingerprint(context, file_name, &fingerprint) != 0 ||
+        open_rom_fingerprint_db(context, db_file, &db) != 0) {
+        return chain_wdfw_error(context, "identify_rom_fingerprint");
+    }
+
+    if (match_rom_fingerprint(context, &db, &fingerprint, &match) != 0) {
+        close_rom_fingerprint_db(&db);
+        return chain_wdfw_error(context, "identify_rom_fingerprint");
+    }
+
+    print_wdfw_output(context, "Image hash: %016llx\n",
+        (unsigned long long) fingerprint.image_hash);
+
+    if (!match.found) {
+        print_wdfw_output(context, "Unknown firmware: no block belongs to " \
+            "a known build (%u of %u hashes rejected by the Bloom filter)\n",
+            match.rejected, fingerprint.number_of_blocks + 1);
+        close_rom_fingerprint_db(&db);
+        return 0;
+    }
+
+    rom_fingerprint_build *build = &db.builds[match.build];
+
+    if (match.exact) {
+        print_wdfw_output(context, "Build: %.*s (identical image)\n",
+            FINGERPRINT_NAME_SIZE, build->name);
+        close_rom_fingerprint_db(&db);
+        return 0;
+    }
+
+    print_wdfw_output(context, "Closest build: %.*s (%u of %u blocks match, " \
+        "build has %u blocks)\n", FINGERPRINT_NAME_SIZE, build->name,
+        match.matching_blocks, fingerprint.number_of_blocks,
+        build->number_of_blocks);
+
+    unsigned int i;
+    for (i = 0; i < fingerprint.number_of_blocks; ++i) {
+        if (match.differs[i]) {
+            print_wdfw_output(context, "Block %#x differs (hash %016llx)\n",
+                fingerprint.block_nr[i],
+                (unsigned long long) fingerprint.block_hash[i]);
+        }
+    }
+
+    close_rom_fingerprint_db(&db);
+    return 0;
+}
+
+int list_rom_fingerprints(wdfw_context *context, char *db_file)
+{
+    rom_fingerprint_db db;
+
+    if (open_rom_fingerprint_db(context, db_file, &db) != 0) {
+        return chain_wdfw_error(context, "list_rom_fingerprints");
+    }
+
+    print_wdfw_output(context, "%u builds, %u hashes, %u table slots, %u " \
+        "byte Bloom filter\n", db.header->number_of_builds,
+        db.header->number_of_entries, db.header->table_size,
+        db.header->bloom_size);
+
+    unsigned int i;
+    for (i = 0; i < db.header->number_of_builds; ++i) {
+        print_wdfw_output(context, "%.*s: image %016llx, %u blocks\n",
+            FINGERPRINT_NAME_SIZE, db.builds[i].name,
+            (unsigned long long) db.builds[i].image_hash,
+            db.builds[i].number_of_blocks);
+    }
+
+    close_rom_fingerprint_db(&db);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "includes/rom_generator.h"
+#include "includes/rom_management.h"
+
+/* Observed block numbers in the extracted (rom) firmware images. */
+static const uint8_t generator_block_numbers[GENERATOR_MAXIMUM_BLOCKS] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x5a
+};
+
+/* Derive the generator state of a single image from the series seed. */
+static uint64_t splitmix64(uint64_t *state);
+
+/* Next number of a xorshift64* generator. */
+static inline uint64_t next_random(uint64_t *state);
+
+/* Random number in the range minimum - maximum (inclusive). */
+static uint64_t random_range(uint64_t *state, uint64_t minimum,
+    uint64_t maximum);
+
+/* Fill a block with contents of the configured entropy. */
+static void fill_block_contents(uint64_t *state, uint8_t *block,
+    uint32_t size, unsigned int entropy);
+
+/* Write size bytes of data to fd. */
+static int write_all(int fd, uint8_t *data, size_t size);
+
+void init_rom_generator_config(rom_generator_config *config)
+{
+    config->seed = 1;
+    config->min_blocks = 1;
+    config->max_blocks = NUMBER_OF_HEADERS;
+    config->min_block_size = 0x400;
+    config->max_block_size = 0x6000;
+    config->entropy = 75;
+}
+
+int parse_rom_generator_option(wdfw_context *context,
+    rom_generator_config *config, char *option)
+{
+    char *value = strchr(option, '=');
+    char *end;
+
+    if (value == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "parse_rom_generator_option: Invalid option %s", option);
+    }
+    value += 1;
+
+    unsigned long long minimum = strtoull(value, &end, 0);
+    unsigned long long maximum = (*end == '-') ?
+        strtoull(end + 1, &end, 0) : minimum;
+
+    if (*end != '\0' || maximum < minimum) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "parse_rom_generator_option: Invalid value in %s", option);
+    }
+
+    if (strncmp(option, "seed=", sizeof("seed=") - 1) == 0) {
+        config->seed = minimum;
+    } else if (strncmp(option, "blocks=", sizeof("blocks=") - 1) == 0 &&
+        minimum >= 1 && maximum <= GENERATOR_MAXIMUM_BLOCKS) {
+        config->min_blocks = minimum;
+        config->max_blocks = maximum;
+    } else if (strncmp(option, "size=", sizeof("size=") - 1) == 0 &&
+        maximum < ROM_IMAGE_SIZE / 2) {
+        config->min_block_size = minimum;
+        config->max_block_size = maximum;
+    } else if (strncmp(option, "entropy=", sizeof("entropy=") - 1) == 0 &&
+        maximum <= 100) {
+        config->entropy = minimum;
+    } else {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "parse_rom_generator_option: Invalid option %s", option);
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Seed the random generator from the series seed and the image index */
+/* Fill the image with erased flash (0xff) */
+/* Pick the number of blocks and shrink the block sizes so they all fit */
+/* For each block: */
+/* - Fill in the rom block header, using the next observed block number */
+/* - Generate the block contents behind the previous block */
+/* - Calculate the contents checksum and the header line checksum */
+int generate_rom_image(rom_generator_config *config, uint64_t image_index,
+    uint8_t *rom)
+{
+    uint64_t seed_state = config->seed ^ (image_index * 0x9e3779b97f4a7c15ULL);
+    uint64_t state = splitmix64(&seed_state) | 1;
+
+    memset(rom, 0xff, ROM_IMAGE_SIZE);
+
+    unsigned int number_of_blocks = random_range(&state, config->min_blocks,
+        config->max_blocks);
+    uint32_t table_end = (number_of_blocks + 1) * sizeof(rom_block);
+    uint32_t start_address = (table_end + GENERATOR_BLOCK_ALIGNMENT - 1) &
+        ~(GENERATOR_BLOCK_ALIGNMENT - 1);
+
+    /* Every block needs room for its checksum byte and alignment. */
+    uint32_t maximum_block_size = (ROM_IMAGE_SIZE - start_address) /
+        number_of_blocks - GENERATOR_BLOCK_ALIGNMENT;
+
+    /* Spread the block numbers over the observed ones in ascending order. */
+    unsigned int skip_budget = GENERATOR_MAXIMUM_BLOCKS - number_of_blocks;
+    unsigned int number_index = 0;
+
+    rom_block *table = (rom_block *) rom;
+    uint32_t load_address = 0x00200000 + (next_random(&state) & 0xff000);
+
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        uint32_t size = random_range(&state, config->min_block_size,
+            config->max_block_size);
+        if (size > maximum_block_size) {
+            size = maximum_block_size;
+        }
+
+        unsigned int skip = random_range(&state, 0, skip_budget);
+        skip_budget -= skip;
+        number_index += skip;
+
+        memset(&table[i], 0, sizeof(rom_block));
+        table[i].block_nr = generator_block_numbers[number_index++];
+        table[i].flag = FLAG_UNENCRYPTED;
+        table[i].size = be_32_to_le(size);
+        table[i].start_address = be_32_to_le(start_address);
+        table[i].load_address = be_32_to_le(load_address);
+        table[i].execution_address = be_32_to_le(load_address);
+
+        fill_block_contents(&state, rom + start_address, size,
+            config->entropy);
+        update_rom_block_checksums(rom, &table[i]);
+
+        load_address += (size + 0xfff) & ~0xfff;
+        start_address = (start_address + size + 1 +
+            GENERATOR_BLOCK_ALIGNMENT - 1) & ~(GENERATOR_BLOCK_ALIGNMENT - 1);
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Allocate a single image buffer for the whole series */
+/* For each image: */
+/* - Generate the image */
+/* - Write it to its own file, or append it to stdout */
+int generate_rom_images(wdfw_context *context, rom_generator_config *config,
+    char *output_prefix, uint64_t number_of_images)
+{
+    int to_stdout = (strcmp(output_prefix, "-") == 0);
+
+    uint8_t *rom = malloc(ROM_IMAGE_SIZE);
+    if (rom == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "generate_rom_images: Could not allocate the rom image");
+    }
+
+    size_t file_name_size = strlen(output_prefix) + sizeof("_.bin") + 20;
+    char file_name[file_name_size];
+
+    uint64_t i;
+    for (i = 0; i < number_of_images; ++i) {
+        generate_rom_image(config, i, rom);
+
+        if (to_stdout) {
+            if (write_all(STDOUT_FILENO, rom, ROM_IMAGE_SIZE) != 0) {
+                free(rom);
+                return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                    "generate_rom_images: write");
+            }
+            continue;
+        }
+
+        snprintf(file_name, file_name_size, "%s_%08llu.bin", output_prefix,
+            (unsigned long long) i);
+
+        int output_file = openat(context->directory_fd, file_name,
+            O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
+        if (output_file == -1 ||
+            write_all(output_file, rom, ROM_IMAGE_SIZE) != 0) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "generate_rom_images: Could not write %s", file_name);
+            if (output_file != -1) {
+                close(output_file);
+            }
+            free(rom);
+            return WDFW_ERROR_IO;
+        }
+        close(output_file);
+    }
+
+    free(rom);
+    return 0;
+}
+
+/* Source: http://prng.di.unimi.it/splitmix64.c */
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Source: https://en.wikipedia.org/wiki/Xorshift#xorshift* */
+static inline uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t random_range(uint64_t *state, uint64_t minimum,
+    uint64_t maximum)
+{
+    return minimum + next_random(state) % (maximum - minimum + 1);
+}
+
+/* Contents are generated in 64 byte runs: a run is random with a chance of
+ * entropy percent and a repeated filler byte otherwise, which resembles code
+ * interleaved with tables and padding. */
+static void fill_block_contents(uint64_t *state, uint8_t *block,
+    uint32_t size, unsigned int entropy)
+{
+    uint32_t offset = 0;
+
+    while (offset < size) {
+        uint32_t run = (size - offset < 64) ? size - offset : 64;
+        uint64_t choice = next_random(state);
+
+        if ((choice % 100) < entropy) {
+            uint32_t i;
+            for (i = 0; i + sizeof(uint64_t) <= run; i += sizeof(uint64_t)) {
+                uint64_t value = next_random(state);
+                memcpy(block + offset + i, &value, sizeof(value));
+            }
+            for (; i < run; ++i) {
+                block[offset + i] = next_random(state);
+            }
+        } else {
+            memset(block + offset, (choice >> 32) & 0x01 ? 0xff : 0x00, run);
+        }
+
+        offset += run;
+    }
+}
+
+static int write_all(int fd, uint8_t *data, size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t result = write(fd, data + written, size - written);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += result;
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Application specific */
+#include "includes/rom_geometry.h"
+#include "includes/rom_management.h"
+#include "includes/wd_info.h"
+
+/* Known flash layouts. The first entry is the default profile. 64 KiB chunks
+ * (0x80 sectors) are the transfer size of the original tool and work on
+ * every drive seen so far. */
+static const rom_geometry rom_geometries[] = {
+    { "256k", MODEL_NUMBER, ROM_IMAGE_SIZE, ROM_IMAGE_BLOCK_SIZE },
+    { "512k", NULL, 512 * 1024, ROM_IMAGE_BLOCK_SIZE },
+    { "1m", NULL, 1024 * 1024, ROM_IMAGE_BLOCK_SIZE },
+};
+
+const rom_geometry *default_rom_geometry(void)
+{
+    return &rom_geometries[0];
+}
+
+const rom_geometry *find_rom_geometry(const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(rom_geometries) / sizeof(rom_geometries[0]); ++i) {
+        if (strcmp(rom_geometries[i].name, name) == 0) {
+            return &rom_geometries[i];
+        }
+    }
+
+    return NULL;
+}
+
+const rom_geometry *match_rom_geometry(const char *model)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(rom_geometries) / sizeof(rom_geometries[0]); ++i) {
+        const char *prefix = rom_geometries[i].model_prefix;
+
+        if (prefix != NULL && strncmp(model, prefix, strlen(prefix)) == 0) {
+            return &rom_geometries[i];
+        }
+    }
+
+    return NULL;
+}
+
+int verify_rom_chunk_size(const rom_geometry *geometry, uint32_t chunk_size)
+{
+    if (chunk_size < ROM_SECTOR_SIZE || chunk_size > ROM_MAXIMUM_CHUNK_SIZE ||
+        (chunk_size % ROM_SECTOR_SIZE) != 0 ||
+        (geometry->image_size % chunk_size) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
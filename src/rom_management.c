@@ -1,3 +1,6 @@
+/* copy_file_range */
+#define _GNU_SOURCE
+
 /* Generic libraries */
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +11,8 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 /* Linux specific */
 #include <sys/mman.h>
@@ -20,65 +25,290 @@
 
 /* Application specific */
 #include "includes/rom_management.h"
+#include "includes/rom_address_map.h"
+#include "includes/rom_stream.h"
+#include "includes/rom_hash.h"
 #include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/wdfw_context.h"
+#include "includes/rom_geometry.h"
+#include "includes/wdfw_progress.h"
+#include "includes/wdfw_probes.h"
+
+/* Ways in which a rom binary file can be memory mapped. */
+enum {
+    ROM_MAP_READ_ONLY   = 0, /* Shared read only mapping */
+    ROM_MAP_PRIVATE     = 1, /* Private copy-on-write mapping */
+    ROM_MAP_WRITE       = 2  /* Shared writable mapping, edits the file */
+};
+
+/* State shared between the device reader thread and the host thread of a
+ * fused dump and unpack. */
+typedef struct {
+    wdfw_context context; /* Context of the reader thread */
+    int hdd_fd;
+    uint8_t *rom_image_buffer;
+    unsigned int bytes_read; /* Number of bytes received from the drive */
+    int failed; /* Set when the drive could not be read */
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_ready;
+} rom_dump_pipeline;
+
+/* Image of an upload, loaded and verified before the drive is unlocked. */
+typedef struct {
+    char *in_file;
+    int input_file;
+    uint64_t file_size;
+    uint32_t image_size;
+    uint8_t *rom_image_buffer;
+    unsigned int number_of_blocks; /* Verified rom blocks */
+} rom_upload_stage;
 
-/* Little-endian to native endian */
-static inline uint32_t le_32_to_be(uint32_t integer);
-
-/* Native endian to little-endian */
-static uint32_t be_32_to_le(uint32_t integer);
-
-/* Calculates the checksum (8 or 16 bit) of a code block in the rom file. */
-static unsigned int calculate_rom_block_checksum_8(uint8_t *block,
-    unsigned int size);
-
-/* Calculates the checksum for a single line of a code block. */
-static unsigned int calculate_line_checksum(uint8_t *block);
+/* Destination of the rom blocks extracted while a dump streams in. */
+typedef struct {
+    wdfw_context *context;
+    int directory_fd; /* Unpack directory */
+    uint8_t *rom_image_buffer;
+    rom_stream *stream;
+    int extracted[ROM_STREAM_MAX_BLOCKS];
+    int failed;
+} rom_unpack_target;
+
+/* A rom image variant: the base image with a patch set applied. */
+typedef struct {
+    char *out_file;
+    char *patch_file;
+    rom_patch *patches; /* Resolved to file offsets in the base image */
+    unsigned int number_of_patches;
+    int error; /* WDFW_ERROR_* code of the failed build, WDFW_OK otherwise */
+    char message[WDFW_MESSAGE_SIZE]; /* Description of the failure */
+} rom_variant;
+
+/* Variants built from one base image by a pool of worker threads. */
+typedef struct {
+    wdfw_context *context;
+    int base_fd; /* Base image, mapped privately for every variant */
+    uint32_t image_size;
+    rom_block *rom_block_table; /* Rom block table of the base image */
+    unsigned int number_of_blocks;
+    rom_variant *variants;
+    unsigned int number_of_variants;
+    unsigned int next_variant; /* Next variant to build, under lock */
+    pthread_mutex_t lock;
+} rom_variant_farm;
+
+/* Extension of the undo journal stored next to a modified rom file. */
+#define ROM_UNDO_JOURNAL_EXTENSION ".undo"
+
+/* Journal record holding the original bytes replaced by a single patch. All
+ * records written by one modification share the same sequence number. */
+typedef struct __attribute__((packed)) {
+    uint32_t sequence; /* Modification the record belongs to */
+    uint32_t offset; /* File offset of the replaced bytes */
+    uint32_t size; /* Number of replaced bytes */
+    uint8_t original[4]; /* Bytes found at offset before the modification */
+} rom_undo_record;
+
+/* Manifest an incremental pack keeps next to the formatted header. */
+#define ROM_PACK_MANIFEST "pack_manifest"
+
+/* Identity of a file when a rom image was last packed from it. */
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    uint64_t inode;
+    uint64_t hash; /* Hash of the loaded block, block files only */
+} rom_file_state;
+
+/* Files a rom image was packed from and the packed image itself. */
+typedef struct {
+    int valid; /* Cleared when the image can not be described */
+    uint32_t image_size;
+    char output_name[255];
+    rom_file_state output;
+    rom_file_state header;
+    unsigned int number_of_blocks;
+    uint8_t block_nr[ROM_STREAM_MAX_BLOCKS];
+    rom_file_state blocks[ROM_STREAM_MAX_BLOCKS];
+    uint8_t loaded[ROM_STREAM_MAX_BLOCKS]; /* Block is in the image buffer */
+} rom_pack_manifest;
 
 /* Open and memory map a rom binary file from a file location. */
-static uint8_t *memory_map_rom_file(char *file_location, int *file_size);
+static uint8_t *memory_map_rom_file(wdfw_context *context,
+    char *file_location, int *file_size, int map_mode);
 
 /* Unload a rom binary file from memory. */
 static inline void unmmap_rom_file(uint8_t *rom_file, unsigned int rom_size);
 
-/* Create rom block table from an in memory representation rom_file. */
-static rom_block *create_rom_block_table(uint8_t *rom_file,
-    unsigned int *number_of_blocks);
-
-/* Destrom rom block table. */
-static inline void destroy_rom_block_table(rom_block *rom_block_table);
-
 /* Display information about a rom block. */
-static void display_rom_block(rom_block *block);
+static void display_rom_block(wdfw_context *context, rom_block *block);
+
+/* Display the verification results of a block parsed by a rom stream. */
+static void display_rom_stream_block(wdfw_context *context,
+    rom_stream *stream, unsigned int block_index);
 
 /* Verify the integrity of a rom block header. */
-static int verify_rom_block_header(rom_block *block);
+static int verify_rom_block_header(wdfw_context *context, rom_block *block);
 
 /* Verify the integrity of a rom block contents. */
-static int verify_rom_block_contents(uint8_t *rom, rom_block *rom_block);
+static int verify_rom_block_contents(wdfw_context *context, uint8_t *rom,
+    rom_block *rom_block);
+
+/* Open a text file relative to directory_fd as stdio stream ("r" or "w"). */
+static FILE *open_text_file(wdfw_context *context, int directory_fd,
+    char *file_name, const char *mode);
 
 /* Serialise rom block header array. */
-static int serialise_formatted_rom_block_header(char *rom_header_output_file,
+static int serialise_formatted_rom_block_header(wdfw_context *context,
+    int directory_fd, char *rom_header_output_file,
     rom_block *rom_block_table, unsigned int number_of_blocks);
 
-/* Serialise a raw chunk of data to an output file. */
-static int serialise_raw_data(char *output_file_name, uint8_t *data,
-    unsigned int size_in_bytes);
+/* Serialise a raw chunk of data to an output file relative to directory_fd. */
+static int serialise_raw_data(wdfw_context *context, int directory_fd,
+    char *output_file_name, uint8_t *data, unsigned int size_in_bytes);
+
+/* Copy size bytes at offset of source_fd to a new file relative to
+   directory_fd, writing data (the same bytes, mapped) when the kernel can not
+   copy them. */
+static int copy_rom_data(wdfw_context *context, int source_fd, off_t offset,
+    int directory_fd, char *output_file_name, uint8_t *data, size_t size);
+
+/* Serialise the hashes of the rom blocks and the complete image. */
+static int serialise_rom_block_hashes(wdfw_context *context,
+    int directory_fd, char *rom_hash_output_file,
+    rom_block *rom_block_table, unsigned int number_of_blocks,
+    uint64_t *block_hashes, uint64_t image_hash);
+
+/* Derive the unpack directory and image copy name from a rom file name. */
+static int derive_unpack_names(wdfw_context *context, char *rom_image,
+    char *rom_image_dir, char *copy_file_name, size_t name_size);
+
+/* Create (when needed) and open the unpack directory rom_image_dir. */
+static int open_unpack_directory(wdfw_context *context, char *rom_image_dir);
+
+/* Check that the transfer chunk size of the context geometry can be used. */
+static int check_rom_geometry(wdfw_context *context);
+
+/* Read the complete rom of the drive in chunk_size transfers. */
+static int read_rom_image(wdfw_context *context, int hdd_fd,
+    uint8_t *rom_image_buffer, uint32_t chunk_size);
+
+/* Device side of a fused dump: read the rom in chunks and publish them. */
+static void *read_rom_chunks(void *pipeline);
+
+/* Host side of an upload: load the image, check its header table and block
+   checksums. */
+static int stage_rom_upload(wdfw_context *context, rom_upload_stage *stage);
+
+/* Stream callback that extracts a rom block as soon as it is verified. */
+static void extract_verified_block(void *target, unsigned int block_index);
 
 /* Output information of a specified rom_block to a provided file descriptor. */
 static int output_rom_block_to_fd(rom_block *block, FILE *fd);
 
 /* Desirialise formatted rom header file. */
-static uint32_t desirialise_rom_table(char *rom_header_file, uint8_t *rom_mem,
-    size_t *number_of_blocks);
+static int desirialise_rom_table(wdfw_context *context, char *rom_header_file,
+    uint8_t *rom_mem, size_t *number_of_blocks);
 
 /* Load a single block of rom from a provided rom_file.*/
-static uint32_t load_rom_block_from_file(char *rom_file, uint8_t *rom_buffer,
-    rom_block *block);
-
-/* Create a rom image based on a provided rom_block_table array. */
-static uint32_t create_rom_image(uint8_t *rom_image_buffer,
-    size_t number_of_blocks);
+static int load_rom_block_from_file(wdfw_context *context, int directory_fd,
+    char *rom_file, uint8_t *rom_buffer, rom_block *block);
+
+/* Create a rom image of image_size bytes based on a provided rom_block_table
+   array, loading the block files from the block_directory_fd directory. The
+   loaded block files are recorded in manifest unless it is NULL, blocks the
+   manifest marks as loaded already are not read again. */
+static int create_rom_image(wdfw_context *context, uint8_t *rom_image_buffer,
+    uint32_t image_size, size_t number_of_blocks, int block_directory_fd,
+    rom_pack_manifest *manifest);
+
+/* Open the directory holding a formatted header and its block files. */
+static int open_block_directory(wdfw_context *context, char *rom_header_file);
+
+/* Record the identity of a file relative to directory_fd. */
+static int stat_rom_file(int directory_fd, char *file_name,
+    rom_file_state *state);
+
+/* Check whether a file still has the identity recorded in state. */
+static int same_rom_file(rom_file_state *state, rom_file_state *current);
+
+/* Read the pack manifest of a block directory. Returns -1 without a usable
+   manifest, which is not an error. */
+static int read_pack_manifest(int directory_fd, rom_pack_manifest *manifest);
+
+/* Replace the pack manifest of a block directory. */
+static int write_pack_manifest(wdfw_context *context, int directory_fd,
+    rom_pack_manifest *manifest);
+
+/* Create (when needed) and open the pack cache directory of context. */
+static int open_pack_cache(wdfw_context *context);
+
+/* Record the block files of a rom block table in manifest with the hash of
+   their contents, taken from previous for files that did not change since
+   the previous pack and loaded into rom_image_buffer otherwise. Loaded blocks
+   are marked in manifest, so a cache miss does not read them again. */
+static int hash_rom_block_files(wdfw_context *context,
+    uint8_t *rom_image_buffer, uint32_t image_size, size_t number_of_blocks,
+    int block_directory_fd, rom_pack_manifest *previous,
+    rom_pack_manifest *manifest);
+
+/* Derive the pack cache key of a rom image from the hash of its rom block
+   table and the block hashes recorded in manifest. */
+static uint64_t calculate_pack_key(uint64_t table_hash,
+    rom_pack_manifest *manifest);
+
+/* Copy the cached image of pack_key to out_file. Returns 1 when the cache
+   holds the image and 0 when it does not. */
+static int copy_cached_rom_image(wdfw_context *context, int cache_fd,
+    uint64_t pack_key, char *out_file, uint32_t image_size);
+
+/* Add a packed rom image to the pack cache. */
+static int store_cached_rom_image(wdfw_context *context, int cache_fd,
+    uint64_t pack_key, uint8_t *rom_image, uint32_t image_size);
+
+/* Translate the addresses of a list of patches to file offsets. */
+static int resolve_rom_patches(wdfw_context *context, uint8_t *rom_memory,
+    int file_size, rom_patch *patches, unsigned int number_of_patches);
+
+/* Apply a list of patches to a rom file. */
+static int apply_rom_patches(wdfw_context *context, char *rom_image,
+    rom_patch *patches, unsigned int number_of_patches);
+
+/* Open the undo journal of rom_image. */
+static int open_rom_undo_journal(wdfw_context *context, char *rom_image,
+    int flags);
+
+/* Append the bytes replaced by a list of patches to the undo journal. */
+static int journal_rom_patches(wdfw_context *context, char *rom_image,
+    uint8_t *rom_memory, rom_patch *patches, unsigned int number_of_patches);
+
+/* Read a variant list file, loading the patch set of every variant. */
+static int load_rom_variants(wdfw_context *context, char *variant_file,
+    rom_variant **variants, unsigned int *number_of_variants);
+
+/* Free the variants read by load_rom_variants. */
+static void destroy_rom_variants(rom_variant *variants,
+    unsigned int number_of_variants);
+
+/* Worker thread building variants until none are left. */
+static void *build_rom_variant_worker(void *farm);
+
+/* Build a single variant in a private copy-on-write mapping of the base. */
+static int build_rom_variant(wdfw_context *context, rom_variant_farm *farm,
+    rom_variant *variant);
+
+/* Check that no patch of a variant writes a checksum byte of the base
+   blocks, which build_rom_variant recalculates. */
+static int check_rom_variant_patches(wdfw_context *context,
+    rom_variant_farm *farm, rom_variant *variant);
+
+/* Flush the pages of a mapping touched by the range offset-offset + size. */
+static int sync_rom_range(wdfw_context *context, uint8_t *rom_memory,
+    uint32_t offset, uint32_t size);
+
+/* Parse a hexadecimal byte string into a newly allocated buffer. */
+static uint8_t *parse_hex_pattern(char *hex_pattern, size_t *pattern_size);
 
 /* Operations: */
 /* Open the hard disk device file */
@@ -90,629 +320,2745 @@ static uint32_t create_rom_image(uint8_t *rom_image_buffer,
 /* Write rom contents to rom image file */
 /* Close rom image file */
 /* Disable vendor specif commands */
-int dump_rom_image(char *hard_disk_dev_file, char *out_file)
+int dump_rom_image(wdfw_context *context, char *hard_disk_dev_file,
+    char *out_file)
 {
     uint8_t *rom_image_buffer;
-    int output_file;
 
-    int hdd_fd = open_hard_disk_drive(hard_disk_dev_file);
-    if (hdd_fd == -1) {
-        fprintf(stderr, "dump_rom_image: Could not handle hard disk drive.\n");
-        return -1;
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "dump_rom_image: Could not handle " \
+            "hard disk drive");
     }
 
-    if (identify_hard_disk_drive(hdd_fd) == -1) {
-        fprintf(stderr, "dump_rom_image: Specified hard disk drive is " \
-            "not supported\n");
-        close(hdd_fd);
-        return -1;
+    if (identify_hard_disk_drive(context, hdd_fd) != 0 ||
+        check_drive_commands(context, DRIVE_COMMAND_ROM) != 0 ||
+        check_rom_geometry(context) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "dump_rom_image");
     }
 
-    printf("Allocating memory for rom image\n");
-    rom_image_buffer = calloc(ROM_IMAGE_SIZE, 1);
+    print_wdfw_output(context, "Allocating memory for rom image\n");
+    rom_image_buffer = calloc(context->geometry.image_size, 1);
     if (rom_image_buffer == NULL) {
-        perror("calloc:");
-        close(hdd_fd);
-        return -1;
+        close_hard_disk_drive(hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "dump_rom_image: Could not allocate the rom image");
     }
 
-    printf("Enabling vendor specific commands\n");
-    if (enable_vendor_specific_commands(hdd_fd) == -1) {
-        fprintf(stderr, "dump_rom_image: Could not enable " \
-            "vendor specific commands.\n");
+    print_wdfw_output(context, "Enabling vendor specific commands\n");
+    if (enable_vendor_specific_commands(context, hdd_fd) != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "dump_rom_image: Could not enable " \
+            "vendor specific commands");
     }
 
-    printf("Getting access to the rom.\n");
-    if (get_rom_acces(hdd_fd, ROM_KEY_READ) == -1) {
-        fprintf(stderr, "dump_rom_image: Could not get rom read access.\n");
+    print_wdfw_output(context, "Getting access to the rom.\n");
+    int result = get_rom_acces(context, hdd_fd, ROM_KEY_READ);
+    WDFW_PROBE1(dump__access__done, result);
+    if (result != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "dump_rom_image: Could not get rom " \
+            "read access");
     }
 
-    unsigned int i;
+    print_wdfw_output(context, "Dumping rom\n");
+    WDFW_PROBE2(dump__read__start, context->geometry.image_size,
+        context->geometry.chunk_size);
+    result = read_rom_image(context, hdd_fd, rom_image_buffer,
+        context->geometry.chunk_size);
+    WDFW_PROBE1(dump__read__done, result);
+    if (result != 0) {
+        free(rom_image_buffer);
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "dump_rom_image");
+    }
 
-    printf("Dumping rom\n");
-    /* Request the ROM image using four 64 KiB block requests. */
-    for (i = 0; i < ROM_IMAGE_SIZE; i += ROM_IMAGE_BLOCK_SIZE) {
-        printf("Dumping ROM block from offset: %d\n", i);
-        if (read_rom_block(hdd_fd, &rom_image_buffer[i], ROM_IMAGE_BLOCK_SIZE)
-            == -1) {
-            fprintf(stderr, "dump_rom_image: Could not read rom block: %d\n",
-                (i / ROM_IMAGE_BLOCK_SIZE));
-            free(rom_image_buffer);
-            close(hdd_fd);
-            return -1;
-        }
+    print_wdfw_output(context, "Disabling vendor specific commands\n");
+    if (disable_vendor_specific_commands(context, hdd_fd) != 0) {
+        free(rom_image_buffer);
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "dump_rom_image: Could not disable " \
+            "vendor specific commands");
     }
 
-    printf("Disabling vendor specific commands\n");
-    if (disable_vendor_specific_commands(hdd_fd) == -1) {
-        fprintf(stderr, "dump_rom_image: Could not disable " \
-            "vendor specific commands.\n");
+    close_hard_disk_drive(hdd_fd);
+
+    result = serialise_raw_data(context, context->directory_fd, out_file,
+        rom_image_buffer, context->geometry.image_size);
+    WDFW_PROBE1(dump__write__done, result);
+    if (result != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        return chain_wdfw_error(context, "dump_rom_image: Could not write " \
+            "extracted rom to the disk");
     }
 
-    close(hdd_fd);
+    free(rom_image_buffer);
+    return 0;
+}
 
-    /* Can potentially be replaced by serialise_raw_data */
-    /*
-    output_file = open(out_file, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-    if (output_file == -1) {
-        fprintf(stderr, "dump_rom_image: Could not create %s\n", out_file);
-        return -1;
+/* Operations: */
+/* Open the hard disk device file */
+/* Check if device is a supported western digital disk*/
+/* Enable vendor specific command */
+/* Read a reference image in the transfer size of the original tool */
+/* For every chunk size (doubling from ROM_MINIMUM_CHUNK_SIZE): */
+/* - Get rom access again, which restarts the transfer at the rom start */
+/* - Time reading the complete rom and compare it with the reference */
+/* Select the fastest chunk size that returned the reference image */
+/* Disable vendor specif commands */
+int calibrate_rom_chunk_size(wdfw_context *context, char *hard_disk_dev_file,
+    rom_chunk_measurement *measurements, unsigned int *number_of_measurements)
+{
+    unsigned int maximum_measurements = *number_of_measurements;
+    unsigned int best = 0;
+
+    *number_of_measurements = 0;
+
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "calibrate_rom_chunk_size: Could " \
+            "not handle hard disk drive");
     }
 
-    printf("Writing rom image to file\n");
-    if (write(output_file, rom_image_buffer, ROM_IMAGE_SIZE) == -1) {
-        fprintf(stderr, "dump_rom_image: Could not write to %s file\n",
-            out_file);
-        close(output_file);
-        return -1;
+    if (identify_hard_disk_drive(context, hdd_fd) != 0 ||
+        check_drive_commands(context, DRIVE_COMMAND_ROM) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "calibrate_rom_chunk_size");
     }
 
-    close(output_file);
-    */
+    uint32_t image_size = context->geometry.image_size;
+    FILE *output = context->output;
+    uint8_t *reference = malloc(image_size);
+    uint8_t *trial = malloc(image_size);
+    if (reference == NULL || trial == NULL) {
+        free(reference);
+        free(trial);
+        close_hard_disk_drive(hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "calibrate_rom_chunk_size: Could not allocate the rom images");
+    }
 
-    /* Alternative to above ^^ */
-    if (serialise_raw_data(out_file, rom_image_buffer, ROM_IMAGE_SIZE) != 0) {
-        fprintf(stderr, "dump_rom_image: Could not write extracted rom to " \
-            "the disk.\n");
-        return -1;
+    /* The progress of the individual transfers is not shown. */
+    context->output = NULL;
+
+    if (enable_vendor_specific_commands(context, hdd_fd) != 0 ||
+        get_rom_acces(context, hdd_fd, ROM_KEY_READ) != 0 ||
+        read_rom_image(context, hdd_fd, reference,
+        ROM_IMAGE_BLOCK_SIZE) != 0) {
+        context->output = output;
+        chain_wdfw_error(context, "calibrate_rom_chunk_size: Could not " \
+            "read the reference image");
+        disable_vendor_specific_commands(context, hdd_fd);
+        free(reference);
+        free(trial);
+        close_hard_disk_drive(hdd_fd);
+        return context->error;
+    }
+
+    uint32_t chunk_size;
+    for (chunk_size = ROM_MINIMUM_CHUNK_SIZE; chunk_size <= image_size &&
+        chunk_size <= ROM_MAXIMUM_CHUNK_SIZE &&
+        *number_of_measurements < maximum_measurements; chunk_size *= 2) {
+        rom_chunk_measurement *measurement =
+            &measurements[*number_of_measurements];
+        struct timespec start, end;
+
+        if (verify_rom_chunk_size(&context->geometry, chunk_size) != 0) {
+            continue;
+        }
+
+        /* Drives that reject a transfer size fail the command, which does
+         * not end the calibration. */
+        memset(trial, 0, image_size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = get_rom_acces(context, hdd_fd, ROM_KEY_READ);
+        if (result == 0) {
+            result = read_rom_image(context, hdd_fd, trial, chunk_size);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        context->output = output;
+
+        double elapsed = (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        measurement->chunk_size = chunk_size;
+        measurement->valid = (result == 0 &&
+            memcmp(trial, reference, image_size) == 0);
+        measurement->bytes_per_second = (elapsed > 0) ?
+            image_size / elapsed : 0;
+
+        print_wdfw_output(context, "Chunk size %7u: %10.1f KiB/s %s\n",
+            chunk_size, measurement->bytes_per_second / 1024,
+            measurement->valid ? "ok" : "failed");
+
+        if (measurement->valid && (!measurements[best].valid ||
+            measurement->bytes_per_second >
+            measurements[best].bytes_per_second)) {
+            best = *number_of_measurements;
+        }
+        *number_of_measurements += 1;
+        clear_wdfw_error(context);
+        context->output = NULL;
+    }
+
+    context->output = output;
+
+    if (disable_vendor_specific_commands(context, hdd_fd) != 0) {
+        free(reference);
+        free(trial);
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "calibrate_rom_chunk_size: Could " \
+            "not disable vendor specific commands");
+    }
+
+    free(reference);
+    free(trial);
+    close_hard_disk_drive(hdd_fd);
+
+    if (*number_of_measurements == 0 || !measurements[best].valid) {
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "calibrate_rom_chunk_size: No chunk size returned the rom image");
+    }
+
+    context->geometry.chunk_size = measurements[best].chunk_size;
+    return 0;
+}
+
+/* Operations: */
+/* Open the hard disk device file */
+/* Check if device is a supported western digital disk*/
+/* Enable vendor specific command */
+/* Get rom access */
+/* Create the unpack directory */
+/* Start a thread that reads the rom in chunks of the geometry chunk size */
+/* For each chunk that arrives: */
+/* - Feed the chunk to the rom stream to verify checksums and hash blocks */
+/* - Extract every block whose checksum byte has arrived */
+/* Wait for the reader and disable vendor specific commands */
+/* Extract the blocks that could not be verified */
+/* Write the rom image, block headers and block hashes */
+/* Display the verification results */
+int dump_and_unpack_rom_image(wdfw_context *context, char *hard_disk_dev_file,
+    char *out_file)
+{
+    rom_dump_pipeline pipeline = {0};
+    rom_unpack_target target = {0};
+    rom_stream stream;
+    pthread_t reader;
+    char rom_image_dir[255] = {0};
+    char copy_file_name[255] = {0};
+    unsigned int bytes_processed = 0;
+
+    if (derive_unpack_names(context, out_file, rom_image_dir, copy_file_name,
+        sizeof(rom_image_dir)) != 0) {
+        return context->error;
+    }
+
+    int directory_fd = open_unpack_directory(context, rom_image_dir);
+    if (directory_fd < 0) {
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image");
+    }
+
+    pipeline.hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (pipeline.hdd_fd < 0) {
+        close(directory_fd);
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image: Could " \
+            "not handle hard disk drive");
+    }
+
+    if (identify_hard_disk_drive(context, pipeline.hdd_fd) != 0 ||
+        check_drive_commands(context, DRIVE_COMMAND_ROM) != 0 ||
+        check_rom_geometry(context) != 0) {
+        close_hard_disk_drive(pipeline.hdd_fd);
+        close(directory_fd);
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image");
+    }
+
+    uint32_t image_size = context->geometry.image_size;
+
+    pipeline.rom_image_buffer = calloc(image_size, 1);
+    if (pipeline.rom_image_buffer == NULL) {
+        close_hard_disk_drive(pipeline.hdd_fd);
+        close(directory_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "dump_and_unpack_rom_image: Could not allocate the rom image");
+    }
+
+    print_wdfw_output(context, "Enabling vendor specific commands\n");
+    if (enable_vendor_specific_commands(context, pipeline.hdd_fd) != 0 ||
+        get_rom_acces(context, pipeline.hdd_fd, ROM_KEY_READ) != 0) {
+        free(pipeline.rom_image_buffer);
+        close_hard_disk_drive(pipeline.hdd_fd);
+        close(directory_fd);
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image: Could " \
+            "not get rom read access");
+    }
+
+    init_rom_stream(&stream);
+    stream.hash_contents = 1;
+    stream.block_verified = extract_verified_block;
+    stream.context = &target;
+
+    target.context = context;
+    target.directory_fd = directory_fd;
+    target.rom_image_buffer = pipeline.rom_image_buffer;
+    target.stream = &stream;
+
+    /* The reader thread records its failures in a context of its own. */
+    pipeline.context = *context;
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.chunk_ready, NULL);
+
+    if (pthread_create(&reader, NULL, read_rom_chunks, &pipeline) != 0) {
+        disable_vendor_specific_commands(context, pipeline.hdd_fd);
+        free(pipeline.rom_image_buffer);
+        close_hard_disk_drive(pipeline.hdd_fd);
+        close(directory_fd);
+        return report_wdfw_error(context, WDFW_ERROR_THREAD,
+            "dump_and_unpack_rom_image: Could not start the rom reader");
+    }
+
+    /* Verify and extract every chunk while the drive transfers the next. */
+    while (bytes_processed < image_size) {
+        unsigned int bytes_available;
+
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.bytes_read == bytes_processed && !pipeline.failed) {
+            pthread_cond_wait(&pipeline.chunk_ready, &pipeline.lock);
+        }
+        bytes_available = pipeline.bytes_read;
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (bytes_available == bytes_processed) {
+            break;
+        }
+
+        feed_rom_stream(&stream, pipeline.rom_image_buffer + bytes_processed,
+            bytes_available - bytes_processed);
+        bytes_processed = bytes_available;
+    }
+
+    pthread_join(reader, NULL);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.chunk_ready);
+
+    if (pipeline.failed) {
+        context->error = pipeline.context.error;
+        context->system_error = pipeline.context.system_error;
+        memcpy(context->message, pipeline.context.message,
+            sizeof(context->message));
+        memcpy(context->sense, pipeline.context.sense, sizeof(context->sense));
+    }
+
+    print_wdfw_output(context, "Disabling vendor specific commands\n");
+    if (disable_vendor_specific_commands(context, pipeline.hdd_fd) != 0) {
+        chain_wdfw_error(context, "Could not disable vendor specific " \
+            "commands");
+        pipeline.failed = 1;
+    }
+
+    close_hard_disk_drive(pipeline.hdd_fd);
+
+    if (pipeline.failed || target.failed) {
+        free(pipeline.rom_image_buffer);
+        close(directory_fd);
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image: Could " \
+            "not dump and unpack the rom image");
+    }
+
+    finish_rom_stream(&stream);
+
+    /* Blocks with an irregular layout are never reported by the stream but
+     * are extracted all the same, like unpack_rom_image does. */
+    unsigned int i;
+    for (i = 0; i < stream.number_of_blocks; ++i) {
+        if (!target.extracted[i]) {
+            extract_verified_block(&target, i);
+        }
+    }
+
+    size_t header_name_size = sizeof("_block_header") + strlen(rom_image_dir);
+    char block_header_name[header_name_size];
+    snprintf(block_header_name, header_name_size, "%s_block_header",
+        rom_image_dir);
+
+    size_t path_size = strlen(rom_image_dir) + strlen(copy_file_name) + 2;
+    char copy_path[path_size];
+    snprintf(copy_path, path_size, "%s/%s", rom_image_dir, copy_file_name);
+
+    unlinkat(directory_fd, copy_file_name, 0);
+    if (target.failed || serialise_raw_data(context, context->directory_fd,
+        out_file, pipeline.rom_image_buffer, image_size) != 0 ||
+        (linkat(context->directory_fd, out_file, context->directory_fd,
+        copy_path, 0) == -1 && serialise_raw_data(context, directory_fd,
+        copy_file_name, pipeline.rom_image_buffer, image_size) != 0) ||
+        serialise_formatted_rom_block_header(context, directory_fd,
+        "formatted_header", stream.table, stream.number_of_blocks) != 0 ||
+        serialise_raw_data(context, directory_fd, block_header_name,
+        pipeline.rom_image_buffer,
+        stream.number_of_blocks * sizeof(rom_block)) != 0 ||
+        serialise_rom_block_hashes(context, directory_fd, "block_hashes",
+        stream.table, stream.number_of_blocks, stream.contents_hash,
+        stream.image_hash) != 0) {
+        free(pipeline.rom_image_buffer);
+        close(directory_fd);
+        return chain_wdfw_error(context, "dump_and_unpack_rom_image: Could " \
+            "not write the unpacked rom image");
+    }
+
+    for (i = 0; i < stream.number_of_blocks; ++i) {
+        display_rom_stream_block(context, &stream, i);
+        print_wdfw_output(context, "\n");
+    }
+
+    free(pipeline.rom_image_buffer);
+    close(directory_fd);
+    return 0;
+}
+
+static int check_rom_geometry(wdfw_context *context)
+{
+    if (verify_rom_chunk_size(&context->geometry,
+        context->geometry.chunk_size) != 0) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "check_rom_geometry: Chunk size %u does not fit the %s rom",
+            context->geometry.chunk_size, context->geometry.name);
+    }
+
+    return 0;
+}
+
+static int read_rom_image(wdfw_context *context, int hdd_fd,
+    uint8_t *rom_image_buffer, uint32_t chunk_size)
+{
+    wdfw_progress progress;
+
+    start_wdfw_progress(&progress, context, "dump",
+        context->geometry.image_size);
+
+    unsigned int i;
+    for (i = 0; i < context->geometry.image_size; i += chunk_size) {
+        print_wdfw_output(context, "Dumping ROM block from offset: %d\n", i);
+        begin_wdfw_progress_chunk(&progress);
+        if (read_rom_block(context, hdd_fd, &rom_image_buffer[i],
+            chunk_size) != 0) {
+            chain_wdfw_error(context, "read_rom_image: Could not read rom " \
+                "block: %d", (i / chunk_size));
+            finish_wdfw_progress(&progress, context->error);
+            return context->error;
+        }
+        update_wdfw_progress(&progress, i, chunk_size);
     }
 
+    finish_wdfw_progress(&progress, 0);
     return 0;
 }
 
+static void *read_rom_chunks(void *pipeline)
+{
+    rom_dump_pipeline *dump = pipeline;
+    uint32_t chunk_size = dump->context.geometry.chunk_size;
+    wdfw_progress progress;
+    int result = 0;
+
+    start_wdfw_progress(&progress, &dump->context, "dump",
+        dump->context.geometry.image_size);
+
+    unsigned int i;
+    for (i = 0; i < dump->context.geometry.image_size; i += chunk_size) {
+        print_wdfw_output(&dump->context, "Dumping ROM block from offset: " \
+            "%d\n", i);
+        begin_wdfw_progress_chunk(&progress);
+        result = read_rom_block(&dump->context, dump->hdd_fd,
+            &dump->rom_image_buffer[i], chunk_size);
+        if (result == 0) {
+            update_wdfw_progress(&progress, i, chunk_size);
+        }
+
+        pthread_mutex_lock(&dump->lock);
+        if (result != 0) {
+            chain_wdfw_error(&dump->context, "read_rom_chunks: Could not " \
+                "read rom block: %d", (i / chunk_size));
+            dump->failed = 1;
+        } else {
+            dump->bytes_read = i + chunk_size;
+        }
+        pthread_cond_signal(&dump->chunk_ready);
+        pthread_mutex_unlock(&dump->lock);
+
+        if (result != 0) {
+            break;
+        }
+    }
+
+    finish_wdfw_progress(&progress, result != 0 ? dump->context.error : 0);
+    return NULL;
+}
+
+static void extract_verified_block(void *target, unsigned int block_index)
+{
+    rom_unpack_target *unpack = target;
+    rom_block *block = &unpack->stream->table[block_index];
+    char rom_block_file_name[] = "block_xx"; /* Placeholder name */
+
+    uint32_t start_address = le_32_to_be(block->start_address);
+    uint32_t size = le_32_to_be(block->size);
+
+    unpack->extracted[block_index] = 1;
+
+    /* Keep the first failure. */
+    if (unpack->failed) {
+        return;
+    }
+
+    if ((uint64_t) start_address + size >
+        unpack->context->geometry.image_size) {
+        report_wdfw_error(unpack->context, WDFW_ERROR_FORMAT,
+            "extract_verified_block: rom block %#x exceeds the rom image",
+            block->block_nr);
+        unpack->failed = 1;
+        return;
+    }
+
+    /* Blocks that were not verified by the stream have not been hashed. */
+    if (unpack->stream->contents_state[block_index] == ROM_CHECK_IRREGULAR) {
+        unpack->stream->contents_hash[block_index] = calculate_rom_hash(
+            unpack->rom_image_buffer + start_address, size);
+    }
+
+    snprintf(rom_block_file_name + 6, 3, "%x", block->block_nr);
+
+    print_wdfw_output(unpack->context, "Extracting rom block %#x\n",
+        block->block_nr);
+    if (serialise_raw_data(unpack->context, unpack->directory_fd,
+        rom_block_file_name, unpack->rom_image_buffer + start_address,
+        size) != 0) {
+        unpack->failed = 1;
+    }
+}
+
 /* Operations: */
 /* Open the hard disk device file */
 /* Check if device is a supported western digital disk*/
-/* Open in_file */
-/* Read in_file to rom buffer memory */
-/* Close in_file*/
+/* Open in_file and check its size before anything is erased */
+/* Load and verify in_file, only a verified image is erased and written */
 /* Enable vendor specific command */
+/* Erase the rom */
 /* Get rom access */
 /* Loop and write contents of rom buffer to hard disk drive */
 /* Disable vendor specif commands */
-int upload_rom_image(char *hard_disk_dev_file, char *in_file)
+int upload_rom_image(wdfw_context *context, char *hard_disk_dev_file,
+    char *in_file)
 {
-    uint8_t *rom_image_buffer;
-    int input_file;
+    rom_upload_stage stage;
+    struct stat input_stat;
 
-    int hdd_fd = open_hard_disk_drive(hard_disk_dev_file);
-    if (hdd_fd == -1) {
-        fprintf(stderr, "upload_rom_image: Could not handle hard disk " \
-            "drive.\n");
-        return -1;
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "upload_rom_image: Could not " \
+            "handle hard disk drive");
     }
 
-    if (identify_hard_disk_drive(hdd_fd) == -1) {
-        fprintf(stderr, "upload_rom_image: Specified hard disk drive is " \
-            "not supported\n");
-        close(hdd_fd);
-        return -1;
+    if (identify_hard_disk_drive(context, hdd_fd) != 0 ||
+        check_drive_commands(context, DRIVE_COMMAND_ROM) != 0 ||
+        check_rom_geometry(context) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "upload_rom_image");
     }
 
-    printf("Allocating memory for rom image\n");
-    rom_image_buffer = calloc(ROM_IMAGE_SIZE, 1);
-    if (rom_image_buffer == NULL) {
-        perror("calloc:");
-        close(hdd_fd);
-        return -1;
+    uint32_t image_size = context->geometry.image_size;
+    uint32_t chunk_size = context->geometry.chunk_size;
+
+    memset(&stage, 0, sizeof(stage));
+    stage.in_file = in_file;
+    stage.image_size = image_size;
+
+    stage.input_file = openat(context->directory_fd, in_file,
+        O_RDONLY | O_CLOEXEC);
+    if (stage.input_file < 0 || fstat(stage.input_file, &input_stat) != 0) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "upload_rom_image: open %s", in_file);
+        if (stage.input_file >= 0) {
+            close(stage.input_file);
+        }
+        close_hard_disk_drive(hdd_fd);
+        return WDFW_ERROR_IO;
     }
 
-    input_file = open(in_file, O_RDONLY);
-    if (input_file < 0) {
-        perror("open");
-        return -1;
+    if (input_stat.st_size == 0 || input_stat.st_size > image_size) {
+        close(stage.input_file);
+        close_hard_disk_drive(hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "upload_rom_image: %s is %lld bytes, the rom %u bytes", in_file,
+            (long long) input_stat.st_size, image_size);
+    }
+    stage.file_size = input_stat.st_size;
+
+    print_wdfw_output(context, "Allocating memory for rom image\n");
+    stage.rom_image_buffer = malloc(image_size);
+    if (stage.rom_image_buffer == NULL) {
+        close(stage.input_file);
+        close_hard_disk_drive(hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "upload_rom_image: Could not allocate the rom image");
     }
 
-    if (read(input_file, rom_image_buffer, ROM_IMAGE_SIZE) != 0) {
-        perror("read");
-        close(input_file);
-        return -1;
+    /* Only an image whose header table and checksums passed is worth
+     * unlocking the drive and erasing its rom for. */
+    int result = stage_rom_upload(context, &stage);
+    close(stage.input_file);
+    WDFW_PROBE1(upload__stage__done, result);
+    if (result != 0) {
+        free(stage.rom_image_buffer);
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "upload_rom_image: %s was not " \
+            "written, the rom is unchanged", in_file);
     }
 
-    printf("Enabling vendor specific commands\n");
-    if (enable_vendor_specific_commands(hdd_fd) == -1) {
-        fprintf(stderr, "upload_rom_image: Could not enable " \
-            "vendor specific commands.\n");
+    print_wdfw_output(context, "Staged %s: %u rom blocks verified\n",
+        in_file, stage.number_of_blocks);
+
+    uint8_t *rom_image_buffer = stage.rom_image_buffer;
+
+    print_wdfw_output(context, "Enabling vendor specific commands\n");
+    if (enable_vendor_specific_commands(context, hdd_fd) != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "upload_rom_image: Could not " \
+            "enable vendor specific commands");
     }
 
-    printf("Errasing rom from disk.\n");
-    if (get_rom_acces(hdd_fd, ROM_KEY_ERASE) == -1) {
-        fprintf(stderr, "upload_rom_image: Could not get rom erase access.\n");
+    print_wdfw_output(context, "Errasing rom from disk.\n");
+    WDFW_PROBE0(upload__erase__start);
+    result = get_rom_acces(context, hdd_fd, ROM_KEY_ERASE);
+    WDFW_PROBE1(upload__erase__done, result);
+    if (result != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        chain_wdfw_error(context, "upload_rom_image: Could not get rom " \
+            "erase access");
+        disable_vendor_specific_commands(context, hdd_fd);
+        close_hard_disk_drive(hdd_fd);
+        return context->error;
     }
 
-    printf("Getting access to rom.\n");
-    if (get_rom_acces(hdd_fd, ROM_KEY_WRTIE) == -1) {
-        fprintf(stderr, "upload_rom_image: Could not get rom write eaccess.\n");
+    print_wdfw_output(context, "Getting access to rom.\n");
+    if (get_rom_acces(context, hdd_fd, ROM_KEY_WRTIE) != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        chain_wdfw_error(context, "upload_rom_image: Could not get rom " \
+            "write eaccess");
+        disable_vendor_specific_commands(context, hdd_fd);
+        close_hard_disk_drive(hdd_fd);
+        return context->error;
     }
 
     unsigned int i;
-
-    printf("Uploading rom image\n");
-    /* Request the ROM image using 64KiB block requests. */
-    for (i = 0; i < ROM_IMAGE_SIZE; i += ROM_IMAGE_BLOCK_SIZE) {
-        printf("Writing ROM block to offset: %d\n", i);
-        if (write_rom_block(hdd_fd, &rom_image_buffer[i], ROM_IMAGE_BLOCK_SIZE)
-            == -1) {
-            fprintf(stderr, "upload_rom_image: Could not write rom block: %d\n",
-                (i / ROM_IMAGE_BLOCK_SIZE));
+    wdfw_progress progress;
+
+    print_wdfw_output(context, "Uploading rom image\n");
+    start_wdfw_progress(&progress, context, "upload", image_size);
+    WDFW_PROBE2(upload__write__start, image_size, chunk_size);
+    /* Write the ROM image using chunk_size block requests. */
+    for (i = 0; i < image_size; i += chunk_size) {
+        print_wdfw_output(context, "Writing ROM block to offset: %d\n", i);
+        begin_wdfw_progress_chunk(&progress);
+        if (write_rom_block(context, hdd_fd, &rom_image_buffer[i],
+            chunk_size) != 0) {
             free(rom_image_buffer);
-            close(hdd_fd);
-            return -1;
+            chain_wdfw_error(context, "upload_rom_image: Could not write " \
+                "rom block: %d", (i / chunk_size));
+            WDFW_PROBE1(upload__write__done, context->error);
+            finish_wdfw_progress(&progress, context->error);
+            disable_vendor_specific_commands(context, hdd_fd);
+            close_hard_disk_drive(hdd_fd);
+            return context->error;
         }
+        update_wdfw_progress(&progress, i, chunk_size);
     }
+    WDFW_PROBE1(upload__write__done, 0);
+    finish_wdfw_progress(&progress, 0);
 
-    printf("Disabling vendor specific commands\n");
-    if (disable_vendor_specific_commands(hdd_fd) == -1) {
-        fprintf(stderr, "upload_rom_image: Could not disable " \
-            "vendor specific commands.\n");
+    print_wdfw_output(context, "Disabling vendor specific commands\n");
+    if (disable_vendor_specific_commands(context, hdd_fd) != 0) {
         free(rom_image_buffer);
-        close(hdd_fd);
-        return -1;
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "upload_rom_image: Could not " \
+            "disable vendor specific commands");
+    }
+
+    free(rom_image_buffer);
+    close_hard_disk_drive(hdd_fd);
+    return 0;
+}
+
+/* Flash beyond the end of a short image stays erased (0xff). Blocks whose
+ * layout can not be verified are accepted, as they are by unpacking; a
+ * failing header line or contents checksum rejects the image. */
+static int stage_rom_upload(wdfw_context *context, rom_upload_stage *stage)
+{
+    rom_stream stream;
+    uint64_t loaded = 0;
+
+    while (loaded < stage->file_size) {
+        ssize_t result = read(stage->input_file,
+            stage->rom_image_buffer + loaded, stage->file_size - loaded);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "stage_rom_upload: read %s", stage->in_file);
+        }
+        loaded += result;
+    }
+    memset(stage->rom_image_buffer + loaded, 0xff,
+        stage->image_size - loaded);
+
+    init_rom_stream(&stream);
+    feed_rom_stream(&stream, stage->rom_image_buffer, stage->image_size);
+    finish_rom_stream(&stream);
+
+    if (!stream.table_complete || stream.number_of_blocks == 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "stage_rom_upload: %s holds no rom block header table",
+            stage->in_file);
+    }
+
+    unsigned int i;
+    for (i = 0; i < stream.number_of_blocks; ++i) {
+        if (stream.header_state[i] == ROM_CHECK_FAIL ||
+            stream.contents_state[i] == ROM_CHECK_FAIL) {
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "stage_rom_upload: Checksum of rom block %#x in %s fails",
+                stream.table[i].block_nr, stage->in_file);
+        }
     }
 
-    close(hdd_fd);
+    stage->number_of_blocks = stream.number_of_blocks;
     return 0;
 }
 
 /* Operations: */
 /* Map contents of rom_image to memory */
 /* Create array of rom header structures */
-/* Create a directory to store extracted data */
+/* Create a directory to store extracted data and open it */
 /* Store a copy of the rom file in the created directory*/
 /* Create a human readble header file that is used for making rom adjustments */
 /* Serialise rom header array to output file */
 /* Use rom header array to extract and save rom blocks to the disk */
 /* Destroy array of rom header structures */
 /* Free contents of rom_image from memory */
-int unpack_rom_image(char *rom_image)
+int unpack_rom_image(wdfw_context *context, char *rom_image)
 {
     uint8_t *rom_memory;
     rom_block *rom_header_table;
     int file_size;
     unsigned int number_of_blocks = 0;
-    struct stat st = {0};
     char rom_block_file_name[] = "block_xx"; /* Placeholder name */
-    char *string_parse_temp;
     char temp_string[255] = {0};
     char copy_file_name[255] = {0};
     char *rom_image_dir;
-    uint8_t *temp_rom_block;
-
-    memcpy(temp_string, rom_image, strlen(rom_image));
-
-    /* Define a name for the upper directory by using the name of the rom
-    *  file whilst ommiting the file type specifier. */
-    if ((string_parse_temp = strrchr(temp_string, '/')) != NULL) {
-        if (strlen(string_parse_temp) >= 255) {
-            fprintf(stderr, "unpack_rom_image: File name of %s is to long\n",
-                string_parse_temp);
-            return -1;
-        }
-        strncpy(copy_file_name, string_parse_temp + 1,
-            strlen(string_parse_temp));
 
-        rom_image_dir = strtok(string_parse_temp + 1, ".");
-    } else {
-        rom_image_dir = strtok(temp_string, ".");
+    if (derive_unpack_names(context, rom_image, temp_string, copy_file_name,
+        sizeof(temp_string)) != 0) {
+        return context->error;
     }
+    rom_image_dir = temp_string;
 
-    printf("Output directory is: %s\n", temp_string);
-    printf("Output file is: %s\n", copy_file_name);
+    print_wdfw_output(context, "Output directory is: %s\n", rom_image_dir);
+    print_wdfw_output(context, "Output file is: %s\n", copy_file_name);
 
-    printf("Mapping %s to memory\n", rom_image);
-    if ((rom_memory = memory_map_rom_file(rom_image, &file_size)) == NULL) {
-        fprintf(stderr, "unpack_rom_image: Could not load rom " \
-            "image: %s\n", rom_image);
-        return -1;
+    print_wdfw_output(context, "Mapping %s to memory\n", rom_image);
+    if ((rom_memory = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_READ_ONLY)) == NULL) {
+        return chain_wdfw_error(context, "unpack_rom_image: Could not load " \
+            "rom image");
     }
 
-    printf("Identifying the rom block header table\n");
+    print_wdfw_output(context, "Identifying the rom block header table\n");
     if ((rom_header_table =
         create_rom_block_table(rom_memory, &number_of_blocks)) == NULL) {
-        fprintf(stderr, "unpack_rom_image: Could not create rom header " \
-            "table.\n");
         unmmap_rom_file(rom_memory, file_size);
-        return -1;
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "unpack_rom_image: Could not create rom header table");
+    }
+
+    /* Every file below is created relative to the unpack directory, which
+     * leaves the working directory of the process untouched. */
+    int directory_fd = open_unpack_directory(context, rom_image_dir);
+    if (directory_fd < 0) {
+        unmmap_rom_file(rom_memory, file_size);
+        destroy_rom_block_table(rom_header_table);
+        return chain_wdfw_error(context, "unpack_rom_image");
+    }
+
+    /* The copy and the blocks are copied by the kernel when possible, a
+     * source that can not be opened again falls back to the mapping. */
+    int source_fd = openat(context->directory_fd, rom_image,
+        O_RDONLY | O_CLOEXEC);
+
+    WDFW_PROBE2(unpack__start, file_size, number_of_blocks);
+
+    print_wdfw_output(context, "Making copy of %s\n", rom_image);
+    if (copy_rom_data(context, source_fd, 0, directory_fd, copy_file_name,
+        rom_memory, file_size) != 0) {
+        chain_wdfw_error(context, "unpack_rom_image: Could not make a copy " \
+            "of %s", rom_image);
+        close(source_fd);
+        close(directory_fd);
+        unmmap_rom_file(rom_memory, file_size);
+        destroy_rom_block_table(rom_header_table);
+        return context->error;
+    }
+
+    print_wdfw_output(context, "Writing rom block header to disk.\n");
+    if (serialise_formatted_rom_block_header(context, directory_fd,
+        "formatted_header", rom_header_table, number_of_blocks) != 0) {
+        chain_wdfw_error(context, "unpack_rom_image: Could not serialise " \
+            "formatted rom block header");
+        close(source_fd);
+        close(directory_fd);
+        unmmap_rom_file(rom_memory, file_size);
+        destroy_rom_block_table(rom_header_table);
+        return context->error;
+    }
+
+    size_t header_name_size = sizeof("_block_header") + strlen(rom_image_dir);
+    char block_header_name[header_name_size];
+    snprintf(block_header_name, header_name_size, "%s_block_header", rom_image_dir);
+
+    if (serialise_raw_data(context, directory_fd, block_header_name,
+        rom_memory, number_of_blocks * sizeof(rom_block)) != 0) {
+        chain_wdfw_error(context, "unpack_rom_image: Could not serialise " \
+            "rom block header");
+        close(source_fd);
+        close(directory_fd);
+        unmmap_rom_file(rom_memory, file_size);
+        destroy_rom_block_table(rom_header_table);
+        return context->error;
     }
 
-    if (stat(rom_image_dir, &st) == -1) {
-        if (mkdir(rom_image_dir, 0777) == -1) {
-            perror("unpack_rom_image: mkdir");
+    uint64_t block_hashes[number_of_blocks + 1];
+
+    print_wdfw_output(context, "Extracting and writing rom blocks to disk.\n");
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        snprintf(rom_block_file_name + 6, 3, "%x",
+            rom_header_table[i].block_nr);
+
+        print_wdfw_output(context, "Extracting rom block %#x from %s\n",
+            rom_header_table[i].block_nr, rom_image);
+
+        /* Blocks are hashed and written straight from the mapping. */
+        uint32_t start_address = le_32_to_be(rom_header_table[i].start_address);
+        uint32_t size = le_32_to_be(rom_header_table[i].size);
 
+        if ((uint64_t) start_address + size > (uint64_t) file_size) {
+            report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "unpack_rom_image: rom block %#x exceeds %s",
+                rom_header_table[i].block_nr, rom_image);
+            close(source_fd);
+            close(directory_fd);
             unmmap_rom_file(rom_memory, file_size);
             destroy_rom_block_table(rom_header_table);
-            return -1;
+            return context->error;
+        }
+
+        block_hashes[i] = calculate_rom_hash(rom_memory + start_address, size);
+
+        print_wdfw_output(context, "Writing %s to disk.\n",
+            rom_block_file_name);
+        int result = copy_rom_data(context, source_fd, start_address,
+            directory_fd, rom_block_file_name, rom_memory + start_address,
+            size);
+        WDFW_PROBE3(unpack__block, rom_header_table[i].block_nr, size,
+            result);
+        if (result != 0) {
+            chain_wdfw_error(context, "unpack_rom_image: Could not " \
+                "serialise rom block %#x", rom_header_table[i].block_nr);
+            close(source_fd);
+            close(directory_fd);
+            unmmap_rom_file(rom_memory, file_size);
+            destroy_rom_block_table(rom_header_table);
+            return context->error;
         }
     }
 
-    /* Used to remove the requirement of specifying rom_image_dir before each
-     * file that is created after this call. */
-    if (chdir(rom_image_dir) == -1) {
-        perror("unpack_rom_image: chdir");
+    if (serialise_rom_block_hashes(context, directory_fd, "block_hashes",
+        rom_header_table, number_of_blocks, block_hashes,
+        calculate_rom_hash(rom_memory, file_size)) != 0) {
+        chain_wdfw_error(context, "unpack_rom_image: Could not serialise " \
+            "rom block hashes");
+        close(source_fd);
+        close(directory_fd);
         unmmap_rom_file(rom_memory, file_size);
         destroy_rom_block_table(rom_header_table);
-        return -1;
+        return context->error;
     }
 
-    printf("Making copy of %s\n", rom_image);
-    if (serialise_raw_data(copy_file_name, rom_memory, file_size) == -1) {
-        fprintf(stderr, "unpack_rom_image: Could not make a copy of %s\n",
-            rom_image);
-        unmmap_rom_file(rom_memory, file_size);
-        destroy_rom_block_table(rom_header_table);
-        return -1;
+    close(source_fd);
+    close(directory_fd);
+    unmmap_rom_file(rom_memory, file_size);
+    destroy_rom_block_table(rom_header_table);
+
+    WDFW_PROBE1(unpack__done, 0);
+    return 0;
+}
+
+static FILE *open_text_file(wdfw_context *context, int directory_fd,
+    char *file_name, const char *mode)
+{
+    int flags = (mode[0] == 'w') ? O_CREAT | O_WRONLY | O_TRUNC : O_RDONLY;
+    FILE *file;
+
+    int fd = openat(directory_fd, file_name, flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_text_file: open %s", file_name);
+        return NULL;
+    }
+
+    if ((file = fdopen(fd, mode)) == NULL) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_text_file: fdopen %s", file_name);
+        close(fd);
     }
 
-    printf("Writing rom block header to disk.\n");
-    if (serialise_formatted_rom_block_header("formatted_header",
-        rom_header_table, number_of_blocks) == -1) {
-        fprintf(stderr, "unpack_rom_image: Could not serialise formatted rom " \
-            "block header.\n");
-        unmmap_rom_file(rom_memory, file_size);
-        destroy_rom_block_table(rom_header_table);
-        return -1;
+    return file;
+}
+
+/* Should this be a ini like file or just a text version of the -i option? */
+static int serialise_formatted_rom_block_header(wdfw_context *context,
+    int directory_fd, char *rom_header_output_file,
+    rom_block *rom_block_table, unsigned int number_of_blocks)
+{
+    FILE *output_file = open_text_file(context, directory_fd,
+        rom_header_output_file, "w");
+    if (output_file == NULL) {
+        return chain_wdfw_error(context, "serialise_formatted_rom_block_" \
+            "header: Could not create %s", rom_header_output_file);
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        output_rom_block_to_fd(&rom_block_table[i], output_file);
+
+        if (i + 1 != number_of_blocks) {
+            /* Line seperation used to identify new blocks */
+            fprintf(output_file, "\n");
+        }
+    }
+
+    if (fclose(output_file) != 0) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "serialise_formatted_rom_block_header: Could not write %s",
+            rom_header_output_file);
+    }
+    return 0;
+}
+
+static int output_rom_block_to_fd(rom_block *block, FILE *fd)
+{
+    fprintf(fd, "Block number:               %#x\n", block->block_nr);
+    fprintf(fd, "Encryption flag:            %#x\n", block->flag);
+    fprintf(fd, "Unkown 1:                   %#x\n", block->unk1);
+    fprintf(fd, "Unkown 2:                   %#x\n", block->unk2);
+    fprintf(fd, "Block length plus checksum: %#x\n",
+        le_32_to_be(block->length_plus_cs));
+    fprintf(fd, "Block size:                 %#x\n", le_32_to_be(block->size));
+    fprintf(fd, "Block start address:        %#x\n",
+        le_32_to_be(block->start_address));
+    fprintf(fd, "Block load address:         %#x\n",
+        le_32_to_be(block->load_address));
+    fprintf(fd, "Block execution address:    %#x\n",
+        le_32_to_be(block->execution_address));
+    fprintf(fd, "Unkown 3:                   %#x\n", block->unk3);
+    fprintf(fd, "Block checksum:             %#x\n", block->fstw_plus_cs);
+    return 0;
+}
+
+
+static int serialise_raw_data(wdfw_context *context, int directory_fd,
+    char *output_file_name, uint8_t *data, unsigned int size_in_bytes)
+{
+    int output_file = openat(directory_fd, output_file_name, O_CREAT |
+        O_WRONLY | O_TRUNC | O_CLOEXEC, 0777);
+    if (output_file == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "serialise_raw_data: Could not create %s", output_file_name);
+    }
+
+    size_t written = 0;
+    while (written < size_in_bytes) {
+        ssize_t result = write(output_file, data + written,
+            size_in_bytes - written);
+        if (result == -1 && errno != EINTR) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "serialise_raw_data: Could not write to %s file",
+                output_file_name);
+            close(output_file);
+            return WDFW_ERROR_IO;
+        }
+        written += (result > 0) ? result : 0;
+    }
+
+    close(output_file);
+    return 0;
+}
+
+/* copy_file_range keeps the data in the kernel and shares the extents on
+ * file systems with reflink support. It is not available across file systems
+ * on older kernels, in which case the remainder is written from data. */
+static int copy_rom_data(wdfw_context *context, int source_fd, off_t offset,
+    int directory_fd, char *output_file_name, uint8_t *data, size_t size)
+{
+    int output_file = openat(directory_fd, output_file_name, O_CREAT |
+        O_WRONLY | O_TRUNC | O_CLOEXEC, 0777);
+    if (output_file == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "copy_rom_data: Could not create %s", output_file_name);
+    }
+
+    size_t copied = 0;
+    while (source_fd != -1 && copied < size) {
+        loff_t source_offset = offset + copied;
+        ssize_t result = copy_file_range(source_fd, &source_offset,
+            output_file, NULL, size - copied, 0);
+        if (result <= 0) {
+            break;
+        }
+        copied += result;
+    }
+
+    while (copied < size) {
+        ssize_t result = write(output_file, data + copied, size - copied);
+        if (result == -1 && errno != EINTR) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "copy_rom_data: Could not write to %s", output_file_name);
+            close(output_file);
+            return WDFW_ERROR_IO;
+        }
+        copied += (result > 0) ? result : 0;
+    }
+
+    close(output_file);
+    return 0;
+}
+
+static int serialise_rom_block_hashes(wdfw_context *context,
+    int directory_fd, char *rom_hash_output_file,
+    rom_block *rom_block_table, unsigned int number_of_blocks,
+    uint64_t *block_hashes, uint64_t image_hash)
+{
+    FILE *output_file = open_text_file(context, directory_fd,
+        rom_hash_output_file, "w");
+    if (output_file == NULL) {
+        return chain_wdfw_error(context, "serialise_rom_block_hashes: Could " \
+            "not create %s", rom_hash_output_file);
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        fprintf(output_file, "block_%x %016llx\n",
+            rom_block_table[i].block_nr, (unsigned long long) block_hashes[i]);
+    }
+    fprintf(output_file, "image %016llx\n", (unsigned long long) image_hash);
+
+    if (fclose(output_file) != 0) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "serialise_rom_block_hashes: Could not write %s",
+            rom_hash_output_file);
+    }
+    return 0;
+}
+
+/* Define a name for the upper directory by using the name of the rom file
+ * whilst ommiting the file type specifier. */
+static int derive_unpack_names(wdfw_context *context, char *rom_image,
+    char *rom_image_dir, char *copy_file_name, size_t name_size)
+{
+    char *base_name = strrchr(rom_image, '/');
+    base_name = (base_name != NULL) ? base_name + 1 : rom_image;
+
+    if (strlen(base_name) >= name_size || *base_name == '\0') {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "derive_unpack_names: File name of %s is to long", rom_image);
+    }
+
+    strcpy(copy_file_name, base_name);
+    strcpy(rom_image_dir, base_name);
+
+    char *extension = strchr(rom_image_dir, '.');
+    if (extension != NULL && extension != rom_image_dir) {
+        *extension = '\0';
+    }
+
+    return 0;
+}
+
+static int open_unpack_directory(wdfw_context *context, char *rom_image_dir)
+{
+    if (mkdirat(context->directory_fd, rom_image_dir, 0777) == -1 &&
+        errno != EEXIST) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_unpack_directory: mkdir %s", rom_image_dir);
+    }
+
+    int directory_fd = openat(context->directory_fd, rom_image_dir,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_unpack_directory: open %s", rom_image_dir);
+    }
+
+    return directory_fd;
+}
+
+/* Operations: */
+/* Open rom_header_file */
+/* Itterate: */
+/* - Read contents of block header description */
+/* - Write block to rom_mom */
+/* - Increase number_of_blocks */
+/* Close rom_header_file */
+static int desirialise_rom_table(wdfw_context *context, char *rom_header_file,
+    uint8_t *rom_mem, size_t *number_of_blocks)
+{
+    *number_of_blocks = 0;
+    rom_block block = {0};
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t write_offset = 0;
+    int block_started = 0;
+
+    fp = open_text_file(context, context->directory_fd, rom_header_file, "r");
+    if (fp == NULL) {
+        return chain_wdfw_error(context, "desirialise_rom_table: Could not " \
+            "open formatted header");
+    }
+
+    /* Address fields are stored converted to native endian (le_32_to_be) in
+     * the formatted header; the remaining fields are stored as is. */
+    while (getline(&line, &line_size, fp) != -1) {
+        if (strncmp(line, "Block number:", sizeof("Block number:") - 1) == 0) {
+            block.block_nr  = strtol(line + 28, NULL, 16);
+        }else if (strncmp(line, "Encryption flag:",
+            sizeof("Encryption flag:") - 1) == 0) {
+            block.flag  = strtol(line + 28, NULL, 16);
+        }  else if (strncmp(line, "Unkown 1:", sizeof("Unkown 1:") - 1) == 0) {
+            block.unk1  = strtol(line + 28, NULL, 16);
+        } else if (strncmp(line, "Unkown 2:",
+            sizeof("Unkown 2:") - 1) == 0) {
+            block.unk2  = strtol(line + 28, NULL, 16);
+        } else if (strncmp(line, "Block length plus checksum:",
+            sizeof("Block length plus checksum:") - 1) == 0) {
+            block.length_plus_cs  = be_32_to_le(strtoul(line + 28, NULL, 16));
+        } else if (strncmp(line, "Block size:",
+            sizeof("Block size:") - 1) == 0) {
+            block.size  = be_32_to_le(strtoul(line + 28, NULL, 16));
+        } else if (strncmp(line, "Block start address:",
+            sizeof("Block start address:") - 1) == 0) {
+            block.start_address  = be_32_to_le(strtoul(line + 28, NULL, 16));
+        } else if (strncmp(line, "Block load address:",
+            sizeof("Block load address:") - 1) == 0) {
+            block.load_address  = be_32_to_le(strtoul(line + 28, NULL, 16));
+        } else if (strncmp(line, "Block execution address:",
+            sizeof("Block execution address:") - 1) == 0) {
+            block.execution_address  = be_32_to_le(strtoul(line + 28, NULL,
+                16));
+        } else if (strncmp(line, "Unkown 3:", sizeof("Unkown 3:") - 1) == 0) {
+            block.unk3  = strtoul(line + 28, NULL, 16);
+        } else if (strncmp(line, "Block checksum:",
+            sizeof("Block checksum:") - 1) == 0) {
+            block.fstw_plus_cs  = strtoul(line + 28, NULL, 16);
+        }
+
+        if (line[0] != '\n') {
+            block_started = 1;
+            continue;
+        }
+
+        if (block_started) {
+            if (write_offset + sizeof(rom_block) >= ROM_IMAGE_SIZE) {
+                free(line);
+                fclose(fp);
+                return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                    "desirialise_rom_table: Too many rom blocks in %s",
+                    rom_header_file);
+            }
+
+            memcpy(rom_mem + write_offset, &block, sizeof(rom_block));
+            memset(&block, 0, sizeof(block));
+            write_offset += sizeof(rom_block);
+            *number_of_blocks += 1;
+            block_started = 0;
+        }
+    }
+
+    if (block_started && write_offset + sizeof(rom_block) < ROM_IMAGE_SIZE) {
+        memcpy(rom_mem + write_offset, &block, sizeof(rom_block));
+        *number_of_blocks += 1;
+    }
+
+    fclose(fp);
+    if (line != NULL) {
+        free(line);
+    }
+
+    return 0;
+}
+
+int modify_instruction(wdfw_context *context, char *rom_image,
+    address_space space, uint32_t memory_adress, uint32_t new_instruction,
+    uint32_t instruction_byte_size)
+{
+    rom_patch patch = {
+        .space = space,
+        .address = memory_adress,
+        .value = new_instruction,
+        .size = instruction_byte_size
+    };
+
+    if (apply_rom_patches(context, rom_image, &patch, 1) != 0) {
+        return chain_wdfw_error(context, "modify_instruction: Could not " \
+            "save modifications");
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Open patch_file */
+/* Itterate: */
+/* - Skip empty lines and comments */
+/* - Parse address space, address, value and optional size */
+/* - Append patch to the patch array */
+/* Close patch_file */
+int load_rom_patch_set(wdfw_context *context, char *patch_file,
+    rom_patch **patches, unsigned int *number_of_patches)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int line_number = 0;
+    unsigned int capacity = 0;
+    rom_patch *patch_array = NULL;
+
+    *patches = NULL;
+    *number_of_patches = 0;
+
+    fp = open_text_file(context, context->directory_fd, patch_file, "r");
+    if (fp == NULL) {
+        return chain_wdfw_error(context, "load_rom_patch_set");
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        char space[8] = {0};
+        unsigned long address, value, size = 4;
+        int fields;
+
+        line_number += 1;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' ||
+            line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        fields = sscanf(line, "%7s %li %li %li", space, &address, &value,
+            &size);
+        if (fields < 3 || size < 1 || size > sizeof(uint32_t) ||
+            (strcmp(space, "file") != 0 && strcmp(space, "load") != 0)) {
+            free(patch_array);
+            free(line);
+            fclose(fp);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "load_rom_patch_set: Invalid patch on line %u of %s",
+                line_number, patch_file);
+        }
+
+        if (*number_of_patches == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            rom_patch *resized = realloc(patch_array,
+                capacity * sizeof(rom_patch));
+            if (resized == NULL) {
+                free(patch_array);
+                free(line);
+                fclose(fp);
+                return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                    "load_rom_patch_set: Could not allocate patches");
+            }
+            patch_array = resized;
+        }
+
+        patch_array[*number_of_patches].space = (space[0] == 'l') ?
+            ADDRESS_SPACE_LOAD : ADDRESS_SPACE_FILE;
+        patch_array[*number_of_patches].address = address;
+        patch_array[*number_of_patches].value = value;
+        patch_array[*number_of_patches].size = size;
+        *number_of_patches += 1;
+    }
+
+    free(line);
+    fclose(fp);
+
+    *patches = patch_array;
+    return 0;
+}
+
+int apply_rom_patch_set(wdfw_context *context, char *rom_image,
+    char *patch_file)
+{
+    rom_patch *patches;
+    unsigned int number_of_patches;
+
+    if (load_rom_patch_set(context, patch_file, &patches,
+        &number_of_patches) != 0) {
+        return chain_wdfw_error(context, "apply_rom_patch_set: Could not " \
+            "load patch set %s", patch_file);
+    }
+
+    if (apply_rom_patches(context, rom_image, patches,
+        number_of_patches) != 0) {
+        free(patches);
+        return chain_wdfw_error(context, "apply_rom_patch_set: Could not " \
+            "apply patch set %s to %s", patch_file, rom_image);
+    }
+
+    print_wdfw_output(context, "Applied %u patches to %s\n",
+        number_of_patches, rom_image);
+    free(patches);
+    return 0;
+}
+
+/* Operations: */
+/* Read the variant list and the patch set of every variant */
+/* Map the base image and resolve every patch set against it */
+/* Start the worker threads, each building variants until none are left: */
+/* - Map the base image privately, copy-on-write */
+/* - Apply the patches and fix the checksums of the touched blocks */
+/* - Write the variant and drop the mapping with its dirty pages */
+/* Report the variants that could not be built */
+int build_rom_variants(wdfw_context *context, char *rom_image,
+    char *variant_file, unsigned int number_of_workers)
+{
+    rom_variant_farm farm = {0};
+    uint8_t *base_memory;
+    int file_size;
+    struct stat base_stat;
+
+    farm.context = context;
+
+    if (load_rom_variants(context, variant_file, &farm.variants,
+        &farm.number_of_variants) != 0) {
+        return chain_wdfw_error(context, "build_rom_variants: Could not " \
+            "load variant list %s", variant_file);
+    }
+
+    farm.base_fd = openat(context->directory_fd, rom_image,
+        O_RDONLY | O_CLOEXEC);
+    if (farm.base_fd == -1 || fstat(farm.base_fd, &base_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "build_rom_variants: Could not open %s", rom_image);
+        if (farm.base_fd != -1) {
+            close(farm.base_fd);
+        }
+        destroy_rom_variants(farm.variants, farm.number_of_variants);
+        return context->error;
+    }
+    farm.image_size = base_stat.st_size;
+
+    /* The variants only share the clean pages of this mapping when it is
+     * backed by the page cache of the same file. */
+    if ((base_memory = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_READ_ONLY)) == NULL) {
+        close(farm.base_fd);
+        destroy_rom_variants(farm.variants, farm.number_of_variants);
+        return chain_wdfw_error(context, "build_rom_variants");
+    }
+
+    farm.rom_block_table = create_rom_block_table(base_memory,
+        &farm.number_of_blocks);
+    if (farm.rom_block_table == NULL || (uint32_t) file_size !=
+        farm.image_size) {
+        unmmap_rom_file(base_memory, file_size);
+        close(farm.base_fd);
+        destroy_rom_variants(farm.variants, farm.number_of_variants);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "build_rom_variants: Could not read the rom block table of %s",
+            rom_image);
+    }
+
+    unsigned int i;
+    for (i = 0; i < farm.number_of_variants; ++i) {
+        rom_variant *variant = &farm.variants[i];
+
+        if (resolve_rom_patches(context, base_memory, file_size,
+            variant->patches, variant->number_of_patches) != 0 ||
+            check_rom_variant_patches(context, &farm, variant) != 0) {
+            chain_wdfw_error(context, "build_rom_variants: Invalid patch " \
+                "set %s", variant->patch_file);
+            destroy_rom_block_table(farm.rom_block_table);
+            unmmap_rom_file(base_memory, file_size);
+            close(farm.base_fd);
+            destroy_rom_variants(farm.variants, farm.number_of_variants);
+            return context->error;
+        }
+    }
+
+    unmmap_rom_file(base_memory, file_size);
+
+    if (number_of_workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_workers = (online > 0) ? online : 1;
+    }
+    if (number_of_workers > farm.number_of_variants) {
+        number_of_workers = farm.number_of_variants;
+    }
+
+    pthread_t workers[number_of_workers > 0 ? number_of_workers : 1];
+    unsigned int started = 0;
+
+    pthread_mutex_init(&farm.lock, NULL);
+    while (started < number_of_workers && pthread_create(&workers[started],
+        NULL, build_rom_variant_worker, &farm) == 0) {
+        ++started;
+    }
+
+    /* Whatever the started workers leave is built here. */
+    if (started < number_of_workers) {
+        build_rom_variant_worker(&farm);
+    }
+
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&farm.lock);
+
+    destroy_rom_block_table(farm.rom_block_table);
+    close(farm.base_fd);
+
+    unsigned int failed = 0;
+    int error = WDFW_OK;
+    for (i = 0; i < farm.number_of_variants; ++i) {
+        if (farm.variants[i].error != WDFW_OK) {
+            print_wdfw_output(context, "Could not build %s: %s\n",
+                farm.variants[i].out_file, farm.variants[i].message);
+            error = (error == WDFW_OK) ? farm.variants[i].error : error;
+            ++failed;
+        }
+    }
+
+    destroy_rom_variants(farm.variants, farm.number_of_variants);
+
+    if (failed > 0) {
+        return report_wdfw_error(context, error, "build_rom_variants: %u " \
+            "of %u variants failed", failed, farm.number_of_variants);
+    }
+
+    print_wdfw_output(context, "Built %u variants of %s\n",
+        farm.number_of_variants, rom_image);
+    return 0;
+}
+
+/* Variant list lines: "<output file> <patch file>". Empty lines and lines
+ * starting with # are skipped. */
+static int load_rom_variants(wdfw_context *context, char *variant_file,
+    rom_variant **variants, unsigned int *number_of_variants)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int line_number = 0;
+    unsigned int capacity = 0;
+    rom_variant *variant_array = NULL;
+
+    *variants = NULL;
+    *number_of_variants = 0;
+
+    fp = open_text_file(context, context->directory_fd, variant_file, "r");
+    if (fp == NULL) {
+        return chain_wdfw_error(context, "load_rom_variants");
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        char *out_file, *patch_file, *saveptr;
+
+        line_number += 1;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' ||
+            line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        out_file = strtok_r(line, " \t\r\n", &saveptr);
+        patch_file = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (patch_file == NULL || strtok_r(NULL, " \t\r\n", &saveptr)) {
+            report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "load_rom_variants: Invalid variant on line %u of %s",
+                line_number, variant_file);
+            destroy_rom_variants(variant_array, *number_of_variants);
+            free(line);
+            fclose(fp);
+            return context->error;
+        }
+
+        if (*number_of_variants == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            rom_variant *resized = realloc(variant_array,
+                capacity * sizeof(rom_variant));
+            if (resized == NULL) {
+                report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                    "load_rom_variants: Could not allocate variants");
+                destroy_rom_variants(variant_array, *number_of_variants);
+                free(line);
+                fclose(fp);
+                return context->error;
+            }
+            variant_array = resized;
+        }
+
+        rom_variant *variant = &variant_array[*number_of_variants];
+        memset(variant, 0, sizeof(rom_variant));
+        variant->out_file = strdup(out_file);
+        variant->patch_file = strdup(patch_file);
+        *number_of_variants += 1;
+
+        if (variant->out_file == NULL || variant->patch_file == NULL) {
+            report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                "load_rom_variants: Could not allocate variants");
+            destroy_rom_variants(variant_array, *number_of_variants);
+            free(line);
+            fclose(fp);
+            return context->error;
+        }
+
+        if (load_rom_patch_set(context, variant->patch_file,
+            &variant->patches, &variant->number_of_patches) != 0) {
+            chain_wdfw_error(context, "load_rom_variants: line %u of %s",
+                line_number, variant_file);
+            destroy_rom_variants(variant_array, *number_of_variants);
+            free(line);
+            fclose(fp);
+            return context->error;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (*number_of_variants == 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "load_rom_variants: %s does not list any variants",
+            variant_file);
+    }
+
+    *variants = variant_array;
+    return 0;
+}
+
+static void destroy_rom_variants(rom_variant *variants,
+    unsigned int number_of_variants)
+{
+    unsigned int i;
+    for (i = 0; i < number_of_variants; ++i) {
+        free(variants[i].out_file);
+        free(variants[i].patch_file);
+        free(variants[i].patches);
+    }
+
+    free(variants);
+}
+
+static void *build_rom_variant_worker(void *farm_pointer)
+{
+    rom_variant_farm *farm = farm_pointer;
+
+    /* Every worker records its failures in a context of its own. */
+    wdfw_context context = *farm->context;
+
+    while (1) {
+        pthread_mutex_lock(&farm->lock);
+        unsigned int index = farm->next_variant;
+        if (index < farm->number_of_variants) {
+            farm->next_variant += 1;
+        }
+        pthread_mutex_unlock(&farm->lock);
+
+        if (index >= farm->number_of_variants) {
+            break;
+        }
+
+        rom_variant *variant = &farm->variants[index];
+
+        clear_wdfw_error(&context);
+        if (build_rom_variant(&context, farm, variant) != 0) {
+            variant->error = context.error;
+            memcpy(variant->message, context.message, WDFW_MESSAGE_SIZE);
+        }
+    }
+
+    return NULL;
+}
+
+/* A patched checksum byte would silently be replaced by the recalculated
+ * checksum of its touched block. */
+static int check_rom_variant_patches(wdfw_context *context,
+    rom_variant_farm *farm, rom_variant *variant)
+{
+    unsigned int i;
+    for (i = 0; i < variant->number_of_patches; ++i) {
+        uint64_t address = variant->patches[i].address;
+        uint64_t end = address + variant->patches[i].size;
+
+        unsigned int block_index;
+        for (block_index = 0; block_index < farm->number_of_blocks;
+            ++block_index) {
+            rom_block *block = &farm->rom_block_table[block_index];
+            uint64_t line_checksum = (uint64_t) block_index *
+                sizeof(rom_block) + sizeof(rom_block) - 1;
+            uint64_t contents_checksum =
+                (uint64_t) le_32_to_be(block->start_address) +
+                le_32_to_be(block->size);
+
+            if ((address <= line_checksum && end > line_checksum) ||
+                (address <= contents_checksum && end > contents_checksum)) {
+                return report_wdfw_error(context, WDFW_ERROR_ADDRESS,
+                    "check_rom_variant_patches: Patch at %#x writes a " \
+                    "checksum of rom block %#x, which is recalculated",
+                    variant->patches[i].address, block->block_nr);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Only the pages written by the patches and checksums are copied, all
+ * others stay shared with the base image in the page cache. */
+static int build_rom_variant(wdfw_context *context, rom_variant_farm *farm,
+    rom_variant *variant)
+{
+    uint8_t *rom_memory = mmap(NULL, farm->image_size,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, farm->base_fd, 0);
+    if (rom_memory == MAP_FAILED) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "build_rom_variant: Could not map the base image");
+    }
+
+    unsigned int i;
+    for (i = 0; i < variant->number_of_patches; ++i) {
+        uint32_t value = be_32_to_le(variant->patches[i].value);
+        memcpy(rom_memory + variant->patches[i].address, &value,
+            variant->patches[i].size);
+    }
+
+    /* A block is touched by a patch of its contents or its header line. */
+    unsigned int fixed_blocks = 0;
+    unsigned int block_index;
+    for (block_index = 0; block_index < farm->number_of_blocks;
+        ++block_index) {
+        rom_block *block = &((rom_block *) rom_memory)[block_index];
+        uint32_t base_start = le_32_to_be(
+            farm->rom_block_table[block_index].start_address);
+        uint32_t base_size = le_32_to_be(
+            farm->rom_block_table[block_index].size);
+        uint32_t header_line = block_index * sizeof(rom_block);
+        int touched = 0;
+
+        for (i = 0; i < variant->number_of_patches && !touched; ++i) {
+            uint32_t address = variant->patches[i].address;
+            uint32_t end = address + variant->patches[i].size;
+
+            touched = (address < base_start + base_size &&
+                end > base_start) || (address < header_line +
+                sizeof(rom_block) && end > header_line);
+        }
+
+        if (!touched) {
+            continue;
+        }
+
+        if ((uint64_t) le_32_to_be(block->start_address) +
+            le_32_to_be(block->size) + 1 > farm->image_size) {
+            munmap(rom_memory, farm->image_size);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "build_rom_variant: rom block %#x of %s exceeds the image",
+                block->block_nr, variant->out_file);
+        }
+
+        update_rom_block_checksums(rom_memory, block);
+        ++fixed_blocks;
+    }
+
+    if (serialise_raw_data(context, context->directory_fd, variant->out_file,
+        rom_memory, farm->image_size) != 0) {
+        munmap(rom_memory, farm->image_size);
+        return chain_wdfw_error(context, "build_rom_variant");
+    }
+
+    munmap(rom_memory, farm->image_size);
+
+    print_wdfw_output(context, "Built %s: %u patches, %u blocks " \
+        "recalculated\n", variant->out_file, variant->number_of_patches,
+        fixed_blocks);
+    return 0;
+}
+
+/* Operations: */
+/* Build the rom block table and address map when a patch uses load addresses */
+/* Replace load addresses by file offsets */
+/* Check that every patch lies within the rom file */
+static int resolve_rom_patches(wdfw_context *context, uint8_t *rom_memory,
+    int file_size, rom_patch *patches, unsigned int number_of_patches)
+{
+    rom_block *rom_header_table = NULL;
+    rom_address_map *map = NULL;
+    unsigned int number_of_blocks = 0;
+    int result = 0;
+
+    unsigned int i;
+    for (i = 0; i < number_of_patches && result == 0; ++i) {
+        if (patches[i].space == ADDRESS_SPACE_LOAD) {
+            if (map == NULL) {
+                rom_header_table = create_rom_block_table(rom_memory,
+                    &number_of_blocks);
+                map = (rom_header_table == NULL) ? NULL :
+                    create_rom_address_map(rom_header_table,
+                    number_of_blocks);
+                if (map == NULL) {
+                    destroy_rom_block_table(rom_header_table);
+                    return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                        "resolve_rom_patches: Could not create rom " \
+                        "address map");
+                }
+            }
+
+            uint32_t file_offset;
+            result = load_address_to_file_offset(map, patches[i].address,
+                &file_offset);
+            if (result == WDFW_ERROR_ADDRESS) {
+                report_wdfw_error(context, result, "resolve_rom_patches: " \
+                    "Load address %#x is not part of a rom block",
+                    patches[i].address);
+                break;
+            } else if (result == WDFW_ERROR_COMPRESSED) {
+                report_wdfw_error(context, result, "resolve_rom_patches: " \
+                    "Load address %#x is part of a compressed rom block",
+                    patches[i].address);
+                break;
+            }
+
+            patches[i].space = ADDRESS_SPACE_FILE;
+            patches[i].address = file_offset;
+        }
+
+        if ((uint64_t) patches[i].address + patches[i].size >
+            (uint64_t) file_size) {
+            result = report_wdfw_error(context, WDFW_ERROR_ADDRESS,
+                "resolve_rom_patches: Patch at %#x exceeds the rom file",
+                patches[i].address);
+        }
+    }
+
+    destroy_rom_address_map(map);
+    destroy_rom_block_table(rom_header_table);
+
+    return result;
+}
+
+/* Operations: */
+/* Map rom_image using a shared writable mapping */
+/* Resolve the patch addresses to file offsets */
+/* Save the bytes that are about to be replaced in the undo journal */
+/* Write every patch into the mapping */
+/* Flush only the pages touched by the patches */
+static int apply_rom_patches(wdfw_context *context, char *rom_image,
+    rom_patch *patches, unsigned int number_of_patches)
+{
+    int file_size;
+    uint8_t *rom_mem;
+
+    rom_mem = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_WRITE);
+    if (rom_mem == NULL) {
+        return chain_wdfw_error(context, "apply_rom_patches: Could not " \
+            "memory map file");
+    }
+
+    if (resolve_rom_patches(context, rom_mem, file_size, patches,
+        number_of_patches) != 0) {
+        unmmap_rom_file(rom_mem, file_size);
+        return context->error;
+    }
+
+    if (journal_rom_patches(context, rom_image, rom_mem, patches,
+        number_of_patches) != 0) {
+        unmmap_rom_file(rom_mem, file_size);
+        return chain_wdfw_error(context, "apply_rom_patches: Could not " \
+            "write undo journal of %s", rom_image);
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_patches; ++i) {
+        uint32_t value = be_32_to_le(patches[i].value);
+        memcpy(rom_mem + patches[i].address, &value, patches[i].size);
+
+        if (sync_rom_range(context, rom_mem, patches[i].address,
+            patches[i].size) != 0) {
+            unmmap_rom_file(rom_mem, file_size);
+            return context->error;
+        }
+    }
+
+    unmmap_rom_file(rom_mem, file_size);
+    return 0;
+}
+
+static int open_rom_undo_journal(wdfw_context *context, char *rom_image,
+    int flags)
+{
+    size_t journal_name_size = strlen(rom_image) +
+        sizeof(ROM_UNDO_JOURNAL_EXTENSION);
+    char journal_name[journal_name_size];
+    snprintf(journal_name, journal_name_size, "%s%s", rom_image,
+        ROM_UNDO_JOURNAL_EXTENSION);
+
+    int journal = openat(context->directory_fd, journal_name,
+        flags | O_CLOEXEC, 0666);
+    if (journal == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_rom_undo_journal: Could not open %s", journal_name);
+    }
+
+    return journal;
+}
+
+/* Operations: */
+/* Open (or create) the undo journal */
+/* Determine the sequence number of this modification from the last record */
+/* Append one record with the original bytes per patch */
+/* Flush the journal before the rom file is touched */
+static int journal_rom_patches(wdfw_context *context, char *rom_image,
+    uint8_t *rom_memory, rom_patch *patches, unsigned int number_of_patches)
+{
+    rom_undo_record last_record = {0};
+    uint32_t sequence = 0;
+
+    int journal = open_rom_undo_journal(context, rom_image, O_RDWR | O_CREAT);
+    if (journal == -1) {
+        return context->error;
+    }
+
+    off_t journal_size = lseek(journal, 0, SEEK_END);
+    journal_size -= journal_size % sizeof(rom_undo_record);
+
+    if (journal_size > 0) {
+        if (pread(journal, &last_record, sizeof(last_record),
+            journal_size - sizeof(rom_undo_record)) != sizeof(last_record)) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "journal_rom_patches: pread");
+            close(journal);
+            return WDFW_ERROR_IO;
+        }
+        sequence = last_record.sequence + 1;
+    }
+
+    rom_undo_record *records = calloc(number_of_patches,
+        sizeof(rom_undo_record));
+    if (records == NULL) {
+        close(journal);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "journal_rom_patches: Could not allocate journal records");
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_patches; ++i) {
+        records[i].sequence = sequence;
+        records[i].offset = patches[i].address;
+        records[i].size = patches[i].size;
+        memcpy(records[i].original, rom_memory + patches[i].address,
+            patches[i].size);
+    }
+
+    size_t records_size = number_of_patches * sizeof(rom_undo_record);
+    if (pwrite(journal, records, records_size, journal_size) !=
+        (ssize_t) records_size || fdatasync(journal) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "journal_rom_patches: pwrite");
+        free(records);
+        close(journal);
+        return WDFW_ERROR_IO;
+    }
+
+    free(records);
+    close(journal);
+    return 0;
+}
+
+static int sync_rom_range(wdfw_context *context, uint8_t *rom_memory,
+    uint32_t offset, uint32_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint32_t page_start = offset - (offset % page_size);
+
+    if (msync(rom_memory + page_start, (offset + size) - page_start,
+        MS_SYNC) == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "sync_rom_range: msync");
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Open the undo journal and locate the records of the last modification */
+/* Map rom_image using a shared writable mapping */
+/* Restore the original bytes, newest record first */
+/* Flush the touched pages and drop the records from the journal */
+int revert_rom_modification(wdfw_context *context, char *rom_image)
+{
+    rom_undo_record record;
+    int file_size;
+    uint8_t *rom_mem;
+    uint32_t sequence;
+    unsigned int number_of_records = 0;
+
+    int journal = open_rom_undo_journal(context, rom_image, O_RDWR);
+    if (journal == -1) {
+        return chain_wdfw_error(context, "revert_rom_modification: No " \
+            "modifications to revert in %s", rom_image);
+    }
+
+    off_t journal_size = lseek(journal, 0, SEEK_END);
+    journal_size -= journal_size % sizeof(rom_undo_record);
+
+    if (journal_size == 0) {
+        close(journal);
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "revert_rom_modification: No modifications to revert in %s",
+            rom_image);
+    }
+
+    rom_mem = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_WRITE);
+    if (rom_mem == NULL) {
+        close(journal);
+        return chain_wdfw_error(context, "revert_rom_modification: Could " \
+            "not memory map file");
+    }
+
+    off_t record_offset = journal_size;
+    do {
+        record_offset -= sizeof(rom_undo_record);
+
+        if (pread(journal, &record, sizeof(record), record_offset) !=
+            sizeof(record)) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "revert_rom_modification: pread");
+            unmmap_rom_file(rom_mem, file_size);
+            close(journal);
+            return WDFW_ERROR_IO;
+        }
+
+        if (number_of_records == 0) {
+            sequence = record.sequence;
+        } else if (record.sequence != sequence) {
+            record_offset += sizeof(rom_undo_record);
+            break;
+        }
+
+        if (record.size > sizeof(record.original) ||
+            (uint64_t) record.offset + record.size > (uint64_t) file_size) {
+            unmmap_rom_file(rom_mem, file_size);
+            close(journal);
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "revert_rom_modification: Corrupted undo journal record");
+        }
+
+        memcpy(rom_mem + record.offset, record.original, record.size);
+        if (sync_rom_range(context, rom_mem, record.offset,
+            record.size) != 0) {
+            unmmap_rom_file(rom_mem, file_size);
+            close(journal);
+            return context->error;
+        }
+
+        number_of_records += 1;
+    } while (record_offset > 0);
+
+    unmmap_rom_file(rom_mem, file_size);
+
+    if (ftruncate(journal, record_offset) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "revert_rom_modification: ftruncate");
+        close(journal);
+        return WDFW_ERROR_IO;
+    }
+
+    close(journal);
+
+    print_wdfw_output(context, "Reverted %u patches in %s\n",
+        number_of_records, rom_image);
+    return 0;
+}
+
+/* Operations: */
+/* Convert hex_pattern to bytes */
+/* Map contents of rom_image to memory */
+/* Create array of rom header structures and an address map */
+/* Report each match of the pattern in both address spaces */
+int search_rom_image(wdfw_context *context, char *rom_image,
+    char *hex_pattern)
+{
+    uint8_t *rom_memory;
+    uint8_t *pattern;
+    size_t pattern_size;
+    rom_block *rom_header_table;
+    rom_address_map *map;
+    unsigned int number_of_blocks = 0;
+    unsigned int number_of_matches = 0;
+    int file_size;
+
+    if ((pattern = parse_hex_pattern(hex_pattern, &pattern_size)) == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "search_rom_image: Invalid search pattern %s", hex_pattern);
+    }
+
+    if ((rom_memory = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_READ_ONLY)) == NULL) {
+        free(pattern);
+        return chain_wdfw_error(context, "search_rom_image: Could not load " \
+            "rom image");
+    }
+
+    if ((rom_header_table =
+        create_rom_block_table(rom_memory, &number_of_blocks)) == NULL ||
+        (map = create_rom_address_map(rom_header_table,
+        number_of_blocks)) == NULL) {
+        destroy_rom_block_table(rom_header_table);
+        unmmap_rom_file(rom_memory, file_size);
+        free(pattern);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "search_rom_image: Could not create rom address map");
+    }
+
+    if (map->number_of_overlaps != 0) {
+        print_wdfw_output(context, "search_rom_image: WARNING: %u load " \
+            "ranges overlap a preceding block.\n", map->number_of_overlaps);
+    }
+
+    uint8_t *match = rom_memory;
+    uint8_t *end = rom_memory + file_size;
+
+    while ((size_t) (end - match) >= pattern_size &&
+        (match = memchr(match, pattern[0],
+        (end - match) - pattern_size + 1)) != NULL) {
+        if (memcmp(match, pattern, pattern_size) == 0) {
+            uint32_t file_offset = match - rom_memory;
+            rom_address_range *range = find_file_range(map, file_offset);
+
+            if (range == NULL) {
+                print_wdfw_output(context, "file %#08x\n", file_offset);
+            } else if (range->flag != FLAG_UNENCRYPTED) {
+                print_wdfw_output(context, "file %#08x block %#x " \
+                    "(compressed)\n", file_offset, range->block_nr);
+            } else {
+                print_wdfw_output(context, "file %#08x load %#08x block " \
+                    "%#x\n", file_offset, range->load_address +
+                    (file_offset - range->file_offset), range->block_nr);
+            }
+            number_of_matches += 1;
+        }
+        match += 1;
+    }
+
+    print_wdfw_output(context, "Found %u matches in %s\n", number_of_matches,
+        rom_image);
+
+    destroy_rom_address_map(map);
+    destroy_rom_block_table(rom_header_table);
+    unmmap_rom_file(rom_memory, file_size);
+    free(pattern);
+
+    return 0;
+}
+
+static uint8_t *parse_hex_pattern(char *hex_pattern, size_t *pattern_size)
+{
+    if (strncmp(hex_pattern, "0x", 2) == 0) {
+        hex_pattern += 2;
+    }
+
+    size_t length = strlen(hex_pattern);
+    if (length == 0 || (length % 2) != 0) {
+        return NULL;
+    }
+
+    uint8_t *pattern = malloc(length / 2);
+    if (pattern == NULL) {
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < length; i += 2) {
+        char byte[3] = { hex_pattern[i], hex_pattern[i + 1], '\0' };
+
+        if (!isxdigit(byte[0]) || !isxdigit(byte[1])) {
+            free(pattern);
+            return NULL;
+        }
+        pattern[i / 2] = strtol(byte, NULL, 16);
+    }
+
+    *pattern_size = length / 2;
+    return pattern;
+}
+
+/* Operations: */
+/* Open rom_file file relative to directory_fd */
+/* Read rom_block_size from rom_file file descriptor to block */
+/* Close rom_file */
+static int load_rom_block_from_file(wdfw_context *context, int directory_fd,
+    char *rom_file, uint8_t *rom_buffer, rom_block *block)
+{
+    FILE *file;
+    uint32_t size = le_32_to_be(block->size);
+    void *write_location = rom_buffer + le_32_to_be(block->start_address);
+
+    file = open_text_file(context, directory_fd, rom_file, "r");
+    if (file == NULL) {
+        return chain_wdfw_error(context, "load_rom_block_from_file");
+    }
+
+    if (size > 0 && fread(write_location, size, 1, file) != 1) {
+        fclose(file);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "load_rom_block_from_file: %s is shorter than %#x bytes",
+            rom_file, size);
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/* Operations: */
+/* Create rom memory buffer of the image size of the context geometry */
+/* Call desirialise_rom_table with as parameter the rom_block_format_file */
+/* Open the directory of the rom_block_format_file holding the block files */
+/* Call create_rom_image function to place the rom blocks into the rom
+    memory buffer. */
+/* Recalculate checksums for each block and table line */
+/* Write rom memory buffer to out_file */
+/* Free contents of rom memory buffer */
+int pack_rom_image(wdfw_context *context, char *rom_header_file,
+    char *out_file)
+{
+    size_t number_of_blocks;
+    uint32_t image_size = context->geometry.image_size;
+    rom_pack_manifest manifest = {0};
+    int cache_fd = -1;
+    int cached = 0;
+
+    uint8_t *rom_memory_buffer = malloc(image_size);
+    if (rom_memory_buffer == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "pack_rom_image: Could not allocate the rom image");
+    }
+
+    /* Unused flash reads as erased (0xff), which also terminates the rom
+     * block header table. */
+    memset(rom_memory_buffer, 0xff, image_size);
+
+    /* Files are recorded before they are read, so a file changed while
+     * packing is reloaded by the next incremental pack. */
+    manifest.valid = stat_rom_file(context->directory_fd, rom_header_file,
+        &manifest.header) == 0;
+
+    if (desirialise_rom_table(context, rom_header_file, rom_memory_buffer,
+        &number_of_blocks) != 0) {
+        free(rom_memory_buffer);
+        return chain_wdfw_error(context, "pack_rom_image: Could not " \
+            "desirialise rom table");
+    }
+
+    /* The cache key covers the table as written in the formatted header,
+     * before the checksums are recalculated. */
+    uint64_t table_hash = update_rom_hash(calculate_rom_hash(
+        rom_memory_buffer, number_of_blocks * sizeof(rom_block)),
+        (uint8_t *) &image_size, sizeof(image_size));
+
+    int block_directory_fd = open_block_directory(context, rom_header_file);
+    if (block_directory_fd < 0) {
+        free(rom_memory_buffer);
+        return chain_wdfw_error(context, "pack_rom_image");
+    }
+
+    if (context->pack_cache != NULL) {
+        rom_pack_manifest previous;
+
+        /* Block hashes of the previous pack are only valid for the same
+         * rom block table. */
+        if (read_pack_manifest(block_directory_fd, &previous) != 0 ||
+            !same_rom_file(&previous.header, &manifest.header)) {
+            previous.number_of_blocks = 0;
+        }
+
+        if ((cache_fd = open_pack_cache(context)) < 0 ||
+            hash_rom_block_files(context, rom_memory_buffer, image_size,
+            number_of_blocks, block_directory_fd, &previous, &manifest) != 0 ||
+            (manifest.valid && (cached = copy_cached_rom_image(context,
+            cache_fd, calculate_pack_key(table_hash, &manifest), out_file,
+            image_size)) < 0)) {
+            if (cache_fd >= 0) {
+                close(cache_fd);
+            }
+            close(block_directory_fd);
+            free(rom_memory_buffer);
+            return chain_wdfw_error(context, "pack_rom_image");
+        }
+    }
+
+    int result = 0;
+    if (context->pack_cache != NULL) {
+        WDFW_PROBE1(pack__cache, cached);
+    }
+
+    if (!cached) {
+        WDFW_PROBE1(pack__load__start, number_of_blocks);
+        result = create_rom_image(context, rom_memory_buffer, image_size,
+            number_of_blocks, block_directory_fd, &manifest);
+        WDFW_PROBE1(pack__load__done, result);
+    }
+
+    if (result != 0) {
+        if (cache_fd >= 0) {
+            close(cache_fd);
+        }
+        close(block_directory_fd);
+        free(rom_memory_buffer);
+        return chain_wdfw_error(context, "pack_rom_image: Could not create " \
+            "a rom image");
+    }
+
+    if (!cached) {
+        result = serialise_raw_data(context, context->directory_fd, out_file,
+            rom_memory_buffer, image_size);
+        WDFW_PROBE1(pack__write__done, result);
+    }
+
+    if (result != 0) {
+        if (cache_fd >= 0) {
+            close(cache_fd);
+        }
+        close(block_directory_fd);
+        free(rom_memory_buffer);
+        return chain_wdfw_error(context, "pack_rom_image: Could not write " \
+            "rom image to disk");
+    }
+
+    if (cached) {
+        print_wdfw_output(context, "Reused cached rom image %016llx\n",
+            (unsigned long long) calculate_pack_key(table_hash, &manifest));
+    } else if (cache_fd >= 0 && manifest.valid &&
+        store_cached_rom_image(context, cache_fd,
+        calculate_pack_key(table_hash, &manifest), rom_memory_buffer,
+        image_size) != 0) {
+        /* The image itself was packed, only later packs lose out. */
+        print_wdfw_output(context, "Could not add %s to the pack cache: %s\n",
+            out_file, context->message);
+        clear_wdfw_error(context);
+    }
+
+    if (cache_fd >= 0) {
+        close(cache_fd);
+    }
+    free(rom_memory_buffer);
+
+    manifest.image_size = image_size;
+    if (strlen(out_file) >= sizeof(manifest.output_name) ||
+        stat_rom_file(context->directory_fd, out_file,
+        &manifest.output) != 0) {
+        manifest.valid = 0;
+    }
+    strncpy(manifest.output_name, out_file, sizeof(manifest.output_name) - 1);
+
+    /* Without a manifest the next incremental pack packs everything. */
+    if (!manifest.valid) {
+        unlinkat(block_directory_fd, ROM_PACK_MANIFEST, 0);
+    } else if (write_pack_manifest(context, block_directory_fd,
+        &manifest) != 0) {
+        close(block_directory_fd);
+        return chain_wdfw_error(context, "pack_rom_image");
+    }
+
+    close(block_directory_fd);
+    return 0;
+}
+
+/* Operations: */
+/* Read the manifest of the last pack */
+/* Pack everything when the header, the output or the geometry changed */
+/* Map the output image writable */
+/* For each block file whose size, modification time or inode changed: */
+/* - Load the block into the image and hash it */
+/* - Recalculate the checksums of changed blocks and flush their pages */
+/* Record the new state of the files in the manifest */
+int repack_rom_image(wdfw_context *context, char *rom_header_file,
+    char *out_file)
+{
+    rom_pack_manifest manifest;
+    rom_file_state current;
+    uint8_t *rom_memory;
+    int file_size;
+    unsigned int reloaded = 0;
+    char rom_block_file_name[] = "block_xx"; /* Placeholder name */
+
+    int block_directory_fd = open_block_directory(context, rom_header_file);
+    if (block_directory_fd < 0) {
+        return chain_wdfw_error(context, "repack_rom_image");
     }
 
-    size_t header_name_size = sizeof("_block_header") + strlen(rom_image_dir);
-    char block_header_name[header_name_size];
-    snprintf(block_header_name, header_name_size, "%s_block_header", rom_image_dir);
+    if (read_pack_manifest(block_directory_fd, &manifest) != 0 ||
+        manifest.image_size != context->geometry.image_size ||
+        strcmp(manifest.output_name, out_file) != 0 ||
+        stat_rom_file(context->directory_fd, rom_header_file,
+        &current) != 0 || !same_rom_file(&manifest.header, &current) ||
+        stat_rom_file(context->directory_fd, out_file, &current) != 0 ||
+        !same_rom_file(&manifest.output, &current)) {
+        close(block_directory_fd);
+        print_wdfw_output(context, "Packing all rom blocks\n");
+        return pack_rom_image(context, rom_header_file, out_file);
+    }
 
-    if (serialise_raw_data(block_header_name, rom_memory,
-        number_of_blocks * sizeof(rom_block)) == -1) {
-        fprintf(stderr, "unpack_rom_image: Could not serialise rom block " \
-            "header.\n");
-        unmmap_rom_file(rom_memory, file_size);
-        destroy_rom_block_table(rom_header_table);
-        return -1;
+    if ((rom_memory = memory_map_rom_file(context, out_file, &file_size,
+        ROM_MAP_WRITE)) == NULL) {
+        close(block_directory_fd);
+        return chain_wdfw_error(context, "repack_rom_image");
     }
 
-    printf("Extracting and writing rom blocks to disk.\n");
-    int i;
-    for (i = 0; i < number_of_blocks; ++i) {
-        snprintf(rom_block_file_name + 6, 3, "%x",
-            rom_header_table[i].block_nr);
+    rom_block *rom_block_table = (rom_block *) rom_memory;
 
-        printf("Extracting rom block %#x from %s\n",
-            rom_header_table[i].block_nr, rom_image);
+    unsigned int i;
+    for (i = 0; i < manifest.number_of_blocks; ++i) {
+        rom_block *block = &rom_block_table[i];
+        uint32_t start_address = le_32_to_be(block->start_address);
+        uint32_t size = le_32_to_be(block->size);
 
-        temp_rom_block = (uint8_t *) malloc(rom_header_table[i].size);
-        memcpy(temp_rom_block, rom_memory + rom_header_table[i].start_address,
-            rom_header_table[i].size);
+        snprintf(rom_block_file_name + 6, 3, "%x", manifest.block_nr[i]);
+
+        if (stat_rom_file(block_directory_fd, rom_block_file_name,
+            &current) == 0 && same_rom_file(&manifest.blocks[i], &current)) {
+            continue;
+        }
 
-        printf("Writing %s to disk.\n", rom_block_file_name);
-        if ((serialise_raw_data(rom_block_file_name,
-            temp_rom_block, rom_header_table[i].size)) == -1) {
-            fprintf(stderr, "unpack_rom_image: Could not serialise rom " \
-                "block %#x\n", rom_header_table[i].block_nr);
-            free(temp_rom_block);
+        if (block->block_nr != manifest.block_nr[i] ||
+            (uint64_t) start_address + size + 1 > (uint64_t) file_size ||
+            load_rom_block_from_file(context, block_directory_fd,
+            rom_block_file_name, rom_memory, block) != 0) {
+            /* The image may be half updated, the next pack rebuilds it. */
+            unlinkat(block_directory_fd, ROM_PACK_MANIFEST, 0);
+            close(block_directory_fd);
             unmmap_rom_file(rom_memory, file_size);
-            destroy_rom_block_table(rom_header_table);
-            return -1;
+            if (context->error == WDFW_OK) {
+                report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                    "repack_rom_image: %s does not match %s",
+                    rom_block_file_name, out_file);
+            }
+            return chain_wdfw_error(context, "repack_rom_image");
         }
 
-        free(temp_rom_block);
+        current.hash = calculate_rom_hash(rom_memory + start_address, size);
+        if (current.hash != manifest.blocks[i].hash) {
+            print_wdfw_output(context, "Reloading %s\n",
+                rom_block_file_name);
+            update_rom_block_checksums(rom_memory, block);
+            ++reloaded;
+        }
+        manifest.blocks[i] = current;
     }
 
+    if (msync(rom_memory, file_size, MS_SYNC) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "repack_rom_image: msync %s", out_file);
+        unlinkat(block_directory_fd, ROM_PACK_MANIFEST, 0);
+        close(block_directory_fd);
+        unmmap_rom_file(rom_memory, file_size);
+        return context->error;
+    }
     unmmap_rom_file(rom_memory, file_size);
-    destroy_rom_block_table(rom_header_table);
 
+    if (stat_rom_file(context->directory_fd, out_file,
+        &manifest.output) != 0 ||
+        write_pack_manifest(context, block_directory_fd, &manifest) != 0) {
+        unlinkat(block_directory_fd, ROM_PACK_MANIFEST, 0);
+        close(block_directory_fd);
+        return chain_wdfw_error(context, "repack_rom_image: Could not " \
+            "update the pack manifest");
+    }
+
+    close(block_directory_fd);
+
+    print_wdfw_output(context, "Reloaded %u of %u rom blocks\n", reloaded,
+        manifest.number_of_blocks);
     return 0;
 }
 
-/* Should this be a ini like file or just a text version of the -i option? */
-static int serialise_formatted_rom_block_header(char *rom_header_output_file,
-    rom_block *rom_block_table, unsigned int number_of_blocks)
+/* The block files are stored next to the formatted header. */
+static int open_block_directory(wdfw_context *context, char *rom_header_file)
 {
-    FILE *output_file = fopen(rom_header_output_file, "w");
-    if (output_file == NULL) {
-        fprintf(stderr, "serialise_formatted_rom_block_header: Could not " \
-            " create %s.\n", rom_header_output_file);
-        return -1;
-    }
+    size_t directory_size = strlen(rom_header_file) + sizeof(".");
+    char block_directory[directory_size];
+    char *separator;
 
-    unsigned int i;
-    for (i = 0; i < number_of_blocks; ++i) {
-        output_rom_block_to_fd(&rom_block_table[i], output_file);
+    strcpy(block_directory, rom_header_file);
+    if ((separator = strrchr(block_directory, '/')) != NULL) {
+        *separator = '\0';
+    } else {
+        strcpy(block_directory, ".");
+    }
 
-        if (i + 1 != number_of_blocks) {
-            /* Line seperation used to identify new blocks */
-            fprintf(output_file, "\n");
-        }
+    int block_directory_fd = openat(context->directory_fd,
+        (block_directory[0] == '\0') ? "/" : block_directory,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (block_directory_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_block_directory: Could not open %s", block_directory);
     }
 
-    fclose(output_file);
-    return 0;
+    return block_directory_fd;
 }
 
-static int output_rom_block_to_fd(rom_block *block, FILE *fd)
+static int stat_rom_file(int directory_fd, char *file_name,
+    rom_file_state *state)
 {
-    fprintf(fd, "Block number:               %#x\n", block->block_nr);
-    fprintf(fd, "Encryption flag:            %#x\n", block->flag);
-    fprintf(fd, "Unkown 1:                   %#x\n", block->unk1);
-    fprintf(fd, "Unkown 2:                   %#x\n", block->unk2);
-    fprintf(fd, "Block length plus checksum: %#x\n",
-        le_32_to_be(block->length_plus_cs));
-    fprintf(fd, "Block size:                 %#x\n", le_32_to_be(block->size));
-    fprintf(fd, "Block start address:        %#x\n",
-        le_32_to_be(block->start_address));
-    fprintf(fd, "Block load address:         %#x\n",
-        le_32_to_be(block->load_address));
-    fprintf(fd, "Block execution address:    %#x\n",
-        le_32_to_be(block->execution_address));
-    fprintf(fd, "Unkown 3:                   %#x\n", block->unk3);
-    fprintf(fd, "Block checksum:             %#x\n", block->fstw_plus_cs);
+    struct stat file_stat;
+
+    memset(state, 0, sizeof(rom_file_state));
+    if (fstatat(directory_fd, file_name, &file_stat, 0) == -1) {
+        return -1;
+    }
+
+    state->size = file_stat.st_size;
+    state->mtime_sec = file_stat.st_mtim.tv_sec;
+    state->mtime_nsec = file_stat.st_mtim.tv_nsec;
+    state->inode = file_stat.st_ino;
     return 0;
 }
 
+static int same_rom_file(rom_file_state *state, rom_file_state *current)
+{
+    return state->size == current->size &&
+        state->mtime_sec == current->mtime_sec &&
+        state->mtime_nsec == current->mtime_nsec &&
+        state->inode == current->inode;
+}
 
-static int serialise_raw_data(char *output_file_name, uint8_t *data,
-    unsigned int size_in_bytes)
+static int open_pack_cache(wdfw_context *context)
 {
-    int output_file = open(output_file_name, O_CREAT | O_WRONLY |
-        O_TRUNC, 0777);
-    if (output_file == -1) {
-        fprintf(stderr, "serialise_raw_data: Could not create %s.\n",
-            output_file_name);
-        return -1;
+    if (mkdirat(context->directory_fd, context->pack_cache, 0777) == -1 &&
+        errno != EEXIST) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_pack_cache: Could not create %s", context->pack_cache);
     }
 
-    if(write(output_file, data, size_in_bytes) == -1) {
-        fprintf(stderr, "serialise_raw_data: Could not write to " \
-            "%s file\n", output_file_name);
-        close(output_file);
-        return -1;
+    int cache_fd = openat(context->directory_fd, context->pack_cache,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_pack_cache: Could not open %s", context->pack_cache);
     }
 
-    close(output_file);
-    return 0;
+    return cache_fd;
 }
 
-/* Operations: */
-/* Open rom_header_file */
-/* Itterate: */
-/* - Read contents of block header description */
-/* - Write block to rom_mom */
-/* - Increase number_of_blocks */
-/* Close rom_header_file */
-static uint32_t desirialise_rom_table(char *rom_header_file, uint8_t *rom_mem,
-    size_t *number_of_blocks)
+static int hash_rom_block_files(wdfw_context *context,
+    uint8_t *rom_image_buffer, uint32_t image_size, size_t number_of_blocks,
+    int block_directory_fd, rom_pack_manifest *previous,
+    rom_pack_manifest *manifest)
 {
-    *number_of_blocks = 0;
-    rom_block block = {0};
-    FILE *fp;
-    char *line = NULL;
-    size_t write_offset = 0;
+    rom_block *rom_block_table = (rom_block *) rom_image_buffer;
+    char rom_block_file_name[] = "block_xx"; /* Placeholder name */
 
-    fp = fopen(rom_header_file, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "desirialise_rom_table: Could not open formatted " \
-            "header\n");
-        return -1;
+    /* The manifest can not describe the image, so it can not be cached. */
+    if (number_of_blocks > ROM_STREAM_MAX_BLOCKS) {
+        manifest->valid = 0;
+        return 0;
     }
 
-    while (getline(&line, 0, fp) != -1) {
-        if (strncmp(line, "Block number:", sizeof("Block number:") - 1) == 0) {
-            block.block_nr  = strtol(line + 28, NULL, 16);
-        }else if (strncmp(line, "Encryption flag:",
-            sizeof("Encryption flag:") - 1) == 0) {
-            block.flag  = strtol(line + 28, NULL, 16);
-        }  else if (strncmp(line, "Unkown 1:", sizeof("Unkown 1:") - 1) == 0) {
-            block.unk1  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Unkown 2:",
-            sizeof("Unkown 2:") - 1) == 0) {
-            block.unk2  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block length plus checksum:",
-            sizeof("Block length plus checksum:") - 1) == 0) {
-            block.length_plus_cs  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block size:",
-            sizeof("Block size:") - 1) == 0) {
-            block.size  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block start address:",
-            sizeof("Block start address:") - 1) == 0) {
-            block.start_address  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block load address:",
-            sizeof("Block load address:") - 1) == 0) {
-            block.load_address  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block execution address:",
-            sizeof("Block execution address:") - 1) == 0) {
-            block.execution_address  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Unkown 3:", sizeof("Unkown 3:") - 1) == 0) {
-            block.unk3  = strtol(line + 28, NULL, 16);
-        } else if (strncmp(line, "Block checksum:",
-            sizeof("Block checksum:") - 1) == 0) {
-            block.fstw_plus_cs  = strtol(line + 28, NULL, 16);
+    unsigned int i;
+    for (i = 0; i < number_of_blocks; ++i) {
+        rom_block *block = &rom_block_table[i];
+        rom_file_state *state = &manifest->blocks[i];
+        uint32_t start_address = le_32_to_be(block->start_address);
+        uint32_t size = le_32_to_be(block->size);
+
+        snprintf(rom_block_file_name + 6, 3, "%x", block->block_nr);
+        manifest->block_nr[i] = block->block_nr;
+        manifest->number_of_blocks = i + 1;
+
+        if (stat_rom_file(block_directory_fd, rom_block_file_name,
+            state) != 0) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "hash_rom_block_files: Could not stat %s",
+                rom_block_file_name);
         }
 
-        if(line[0] == '\n') {
-            memcpy(rom_header_file + write_offset, &block, sizeof(rom_block));
-            memset(&block, 0, sizeof(block));
-            write_offset += sizeof(rom_block);
-            number_of_blocks += 1;
+        if (i < previous->number_of_blocks &&
+            previous->block_nr[i] == block->block_nr &&
+            same_rom_file(&previous->blocks[i], state)) {
+            state->hash = previous->blocks[i].hash;
+            manifest->loaded[i] = 0;
+            continue;
         }
-    }
 
-    memcpy(rom_header_file + write_offset, &block, sizeof(rom_block));
-    number_of_blocks += 1;
+        if (((uint64_t) start_address + size + 1) > image_size ||
+            start_address < number_of_blocks * sizeof(rom_block)) {
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "hash_rom_block_files: rom block %#x is too large",
+                block->block_nr);
+        }
 
-    fclose(fp);
-    if (line != NULL) {
-        free(line);
+        if (load_rom_block_from_file(context, block_directory_fd,
+            rom_block_file_name, rom_image_buffer, block) != 0) {
+            return chain_wdfw_error(context, "hash_rom_block_files");
+        }
+        state->hash = calculate_rom_hash(rom_image_buffer + start_address,
+            size);
+        manifest->loaded[i] = 1;
     }
 
     return 0;
 }
 
-int modify_instruction(char *rom_image, uint32_t memory_adress,
-	uint32_t new_instruction, uint32_t instruction_byte_size)
+static uint64_t calculate_pack_key(uint64_t table_hash,
+    rom_pack_manifest *manifest)
 {
-    int file_size;
-    uint8_t *rom_mem;
+    uint64_t pack_key = table_hash;
 
-    rom_mem = memory_map_rom_file(rom_image, &file_size);
+    unsigned int i;
+    for (i = 0; i < manifest->number_of_blocks; ++i) {
+        pack_key = update_rom_hash(pack_key,
+            (uint8_t *) &manifest->blocks[i].hash, sizeof(uint64_t));
+    }
 
-    if (rom_mem == NULL) {
-        fprintf(stderr, "modify_instruction: Could not memory map file.\n");
-        return -1;
+    return pack_key;
+}
+
+/* Cache entries are never modified in place, while rom images are (-m, -P,
+ * -I). The image is therefore copied instead of hard linked: copy_rom_data
+ * shares the extents on file systems with reflink support, so a hit costs
+ * no data copy there either. */
+static int copy_cached_rom_image(wdfw_context *context, int cache_fd,
+    uint64_t pack_key, char *out_file, uint32_t image_size)
+{
+    char cache_name[sizeof("0123456789abcdef")];
+    struct stat cache_stat;
+
+    snprintf(cache_name, sizeof(cache_name), "%016llx",
+        (unsigned long long) pack_key);
+
+    int source_fd = openat(cache_fd, cache_name, O_RDONLY | O_CLOEXEC);
+    if (source_fd == -1) {
+        return 0;
     }
 
-    if (memcpy(rom_mem + memory_adress, &new_instruction,
-        instruction_byte_size) != 0) {
-        perror("memcpy");
-        unmmap_rom_file(rom_mem, file_size);
-        return -1;
+    if (fstat(source_fd, &cache_stat) == -1 ||
+        cache_stat.st_size != image_size) {
+        close(source_fd);
+        return 0;
     }
 
-    /* Write rom_mem to file */
-    if (serialise_raw_data(rom_image, rom_mem, file_size) != 0) {
-        fprintf(stderr, "modify_instruction: Could not save modifications");
-        return -1;
+    /* Only read when the kernel can not copy the data itself. */
+    uint8_t *data = mmap(NULL, image_size, PROT_READ, MAP_PRIVATE, source_fd,
+        0);
+    if (data == MAP_FAILED) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "copy_cached_rom_image: Could not map %s", cache_name);
+        close(source_fd);
+        return WDFW_ERROR_IO;
     }
 
-    /* Unnmap rom_mem buffer once done */
-    unmmap_rom_file(rom_mem, file_size);
+    if (copy_rom_data(context, source_fd, 0, context->directory_fd, out_file,
+        data, image_size) != 0) {
+        munmap(data, image_size);
+        close(source_fd);
+        return chain_wdfw_error(context, "copy_cached_rom_image");
+    }
+
+    munmap(data, image_size);
+    close(source_fd);
+    return 1;
+}
+
+/* Entries appear through a rename, concurrent packs of the same image never
+ * see a partial entry. */
+static int store_cached_rom_image(wdfw_context *context, int cache_fd,
+    uint64_t pack_key, uint8_t *rom_image, uint32_t image_size)
+{
+    char cache_name[sizeof("0123456789abcdef")];
+    char temporary_name[sizeof(cache_name) + 16];
+
+    snprintf(cache_name, sizeof(cache_name), "%016llx",
+        (unsigned long long) pack_key);
+    snprintf(temporary_name, sizeof(temporary_name), "%s.%d", cache_name,
+        (int) getpid());
+
+    if (serialise_raw_data(context, cache_fd, temporary_name, rom_image,
+        image_size) != 0) {
+        unlinkat(cache_fd, temporary_name, 0);
+        return chain_wdfw_error(context, "store_cached_rom_image");
+    }
+
+    if (renameat(cache_fd, temporary_name, cache_fd, cache_name) == -1) {
+        unlinkat(cache_fd, temporary_name, 0);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "store_cached_rom_image: Could not add %s", cache_name);
+    }
 
     return 0;
 }
 
-/* Operations: */
-/* Open rom_file file */
-/* Read rom_block_size from rom_file file descriptor to block */
-/* Close rom_file */
-static uint32_t load_rom_block_from_file(char *rom_file, uint8_t *rom_buffer,
-    rom_block *block)
+/* Manifest lines:
+ *   image <image size> <size> <mtime s> <mtime ns> <inode> <output file>
+ *   header <size> <mtime s> <mtime ns> <inode>
+ *   block_<nr> <size> <mtime s> <mtime ns> <inode> <contents hash>
+ */
+static int read_pack_manifest(int directory_fd, rom_pack_manifest *manifest)
 {
-    FILE *file;
-    void *write_location = rom_buffer + block->start_address;
+    char line[512];
+    int image_found = 0;
+    int header_found = 0;
 
-    file = fopen(rom_file, "r");
-    if (rom_file == NULL) {
-        perror("load_rom_block_from_file: fopen");
+    int manifest_fd = openat(directory_fd, ROM_PACK_MANIFEST,
+        O_RDONLY | O_CLOEXEC);
+    if (manifest_fd == -1) {
         return -1;
     }
 
-    if (fread(write_location, block->length_plus_cs, 1, file) != 0) {
-        perror("load_rom_block_from_file: fread");
-        fclose(file);
+    FILE *fp = fdopen(manifest_fd, "r");
+    if (fp == NULL) {
+        close(manifest_fd);
         return -1;
     }
 
-    fclose(file);
+    memset(manifest, 0, sizeof(rom_pack_manifest));
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        rom_file_state *state;
+        unsigned long long size, inode, hash;
+        long long mtime_sec;
+        long mtime_nsec;
+        unsigned int block_nr;
+        int name_offset;
+
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "image %u %llu %lld %ld %llu %n",
+            &manifest->image_size, &size, &mtime_sec, &mtime_nsec, &inode,
+            &name_offset) == 5 &&
+            strlen(line + name_offset) < sizeof(manifest->output_name)) {
+            strcpy(manifest->output_name, line + name_offset);
+            state = &manifest->output;
+            image_found = 1;
+        } else if (sscanf(line, "header %llu %lld %ld %llu", &size,
+            &mtime_sec, &mtime_nsec, &inode) == 4) {
+            state = &manifest->header;
+            header_found = 1;
+        } else if (sscanf(line, "block_%x %llu %lld %ld %llu %llx",
+            &block_nr, &size, &mtime_sec, &mtime_nsec, &inode, &hash) == 6 &&
+            block_nr <= 0xff &&
+            manifest->number_of_blocks < ROM_STREAM_MAX_BLOCKS) {
+            manifest->block_nr[manifest->number_of_blocks] = block_nr;
+            state = &manifest->blocks[manifest->number_of_blocks++];
+            state->hash = hash;
+        } else {
+            fclose(fp);
+            return -1;
+        }
 
-    return 0;
+        state->size = size;
+        state->mtime_sec = mtime_sec;
+        state->mtime_nsec = mtime_nsec;
+        state->inode = inode;
+    }
+
+    fclose(fp);
+    manifest->valid = image_found && header_found;
+    return manifest->valid ? 0 : -1;
 }
 
-/* Operations: */
-/* Create rom memory buffer of size ROM_IMAGE_SIZE */
-/* Call desirialise_rom_table with as parameter the rom_block_format_file */
-/* Call create_rom_image function to place the rom blocks into the rom
-    memory buffer. */
-/* Recalculate checksums for each block and table line */
-/* Create out_file */
-/* Write rom memory buffer to out_file */
-/* Close out_file */
-/* Free contents of rom memory buffer */
-int pack_rom_image(char *rom_header_file, char *out_file)
+/* The manifest is replaced through a rename, a crash leaves either the old
+ * or the new manifest. */
+static int write_pack_manifest(wdfw_context *context, int directory_fd,
+    rom_pack_manifest *manifest)
 {
-    size_t number_of_blocks;
+    char temporary_name[] = ROM_PACK_MANIFEST ".tmp";
 
-    uint8_t *rom_memory_buffer = calloc(ROM_IMAGE_SIZE, 1);
-    if (rom_memory_buffer == NULL) {
-        perror("pack_rom_image: calloc");
-        return -1;
+    FILE *output_file = open_text_file(context, directory_fd, temporary_name,
+        "w");
+    if (output_file == NULL) {
+        return chain_wdfw_error(context, "write_pack_manifest");
     }
 
-    if (desirialise_rom_table(rom_header_file, rom_memory_buffer,
-        &number_of_blocks) != 0) {
-        fprintf(stderr, "pack_rom_image: Could not desirialise rom table\n");
-        free(rom_memory_buffer);
-        return -1;
-    }
+    fprintf(output_file, "image %u %llu %lld %ld %llu %s\n",
+        manifest->image_size, (unsigned long long) manifest->output.size,
+        (long long) manifest->output.mtime_sec, manifest->output.mtime_nsec,
+        (unsigned long long) manifest->output.inode, manifest->output_name);
+    fprintf(output_file, "header %llu %lld %ld %llu\n",
+        (unsigned long long) manifest->header.size,
+        (long long) manifest->header.mtime_sec, manifest->header.mtime_nsec,
+        (unsigned long long) manifest->header.inode);
 
-    if(create_rom_image(rom_memory_buffer, number_of_blocks) != 0) {
-        fprintf(stderr, "pack_rom_image: Could not create a rom image.\n");
-        free(rom_memory_buffer);
-        return -1;
+    unsigned int i;
+    for (i = 0; i < manifest->number_of_blocks; ++i) {
+        rom_file_state *state = &manifest->blocks[i];
+
+        fprintf(output_file, "block_%x %llu %lld %ld %llu %016llx\n",
+            manifest->block_nr[i], (unsigned long long) state->size,
+            (long long) state->mtime_sec, state->mtime_nsec,
+            (unsigned long long) state->inode,
+            (unsigned long long) state->hash);
     }
 
-    if(serialise_raw_data(out_file, rom_memory_buffer, ROM_IMAGE_SIZE) != 0) {
-        fprintf(stderr, "pack_rom_image: Could not write rom image to disk\n");
-        free(rom_memory_buffer);
-        return -1;
+    if (fclose(output_file) != 0) {
+        unlinkat(directory_fd, temporary_name, 0);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_pack_manifest: Could not write %s", temporary_name);
     }
 
-    unmmap_rom_file(rom_memory_buffer, ROM_IMAGE_SIZE);
+    if (renameat(directory_fd, temporary_name, directory_fd,
+        ROM_PACK_MANIFEST) == -1) {
+        unlinkat(directory_fd, temporary_name, 0);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_pack_manifest: Could not replace %s", ROM_PACK_MANIFEST);
+    }
 
-    free(rom_memory_buffer);
     return 0;
 }
 
-
-/* Operations: */
-/* Create rom_image_buffer of size ROM_IMAGE_SIZE */
-/* For each block in rom_block_table: */
-    /* Lookup size of block */
-    /* Lookup offset of block */
-    /* Open file with name 'block_' + block_id */
-    /* Write block to rom_image_buffer at correct offset */
-    /* Close block file */
-static uint32_t create_rom_image(uint8_t *rom_image_buffer,
-    size_t number_of_blocks)
+static int create_rom_image(wdfw_context *context, uint8_t *rom_image_buffer,
+    uint32_t image_size, size_t number_of_blocks, int block_directory_fd,
+    rom_pack_manifest *manifest)
 {
-    if (rom_image_buffer == NULL) {
-        perror("calloc");
-        return -1;
-    }
-
     rom_block *rom_block_table = (rom_block *) rom_image_buffer;
 
     char rom_block_file_name[] = "block_xx"; /* Placeholder name */
 
-    int i;
+    unsigned int i;
     for (i = 0; i < number_of_blocks; ++i) {
+        uint32_t start_address = le_32_to_be(rom_block_table[i].start_address);
+        uint32_t size = le_32_to_be(rom_block_table[i].size);
 
-        if ((rom_block_table[i].start_address +
-            rom_block_table[i].length_plus_cs) > ROM_IMAGE_SIZE) {
-            fprintf(stderr, "create_rom_image: rom block %#x is to large\n",
+        if (((uint64_t) start_address + size + 1) > image_size ||
+            start_address < number_of_blocks * sizeof(rom_block)) {
+            return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "create_rom_image: rom block %#x is to large",
                 rom_block_table[i].block_nr);
-            return -1;
         }
 
         /* Construct character string name of the block to append to the
@@ -720,39 +3066,92 @@ static uint32_t create_rom_image(uint8_t *rom_image_buffer,
         snprintf(rom_block_file_name + 6, 3, "%x",
             rom_block_table[i].block_nr);
 
-        if (load_rom_block_from_file(rom_block_file_name, rom_image_buffer,
+        /* Hashed for the pack cache, which recorded the file as well. */
+        if (manifest != NULL && i < ROM_STREAM_MAX_BLOCKS &&
+            manifest->loaded[i]) {
+            update_rom_block_checksums(rom_image_buffer, &rom_block_table[i]);
+            continue;
+        }
+
+        rom_file_state *state = NULL;
+        if (manifest != NULL && i < ROM_STREAM_MAX_BLOCKS) {
+            state = &manifest->blocks[i];
+            manifest->block_nr[i] = rom_block_table[i].block_nr;
+            manifest->number_of_blocks = i + 1;
+            if (stat_rom_file(block_directory_fd, rom_block_file_name,
+                state) != 0) {
+                manifest->valid = 0;
+            }
+        } else if (manifest != NULL) {
+            manifest->valid = 0;
+        }
+
+        if (load_rom_block_from_file(context, block_directory_fd,
+            rom_block_file_name, rom_image_buffer,
             &rom_block_table[i]) != 0) {
-            fprintf(stderr, "Could not copy %s to rom_image_buffer\n",
-                rom_block_file_name);
-            return -1;
+            return chain_wdfw_error(context, "create_rom_image: Could not " \
+                "copy %s to rom_image_buffer", rom_block_file_name);
+        }
+
+        if (state != NULL) {
+            state->hash = calculate_rom_hash(rom_image_buffer + start_address,
+                size);
         }
+
+        update_rom_block_checksums(rom_image_buffer, &rom_block_table[i]);
     }
 
     return 0;
 }
 
+void update_rom_block_checksums(uint8_t *rom, rom_block *block)
+{
+    uint32_t start_address = le_32_to_be(block->start_address);
+    uint32_t size = le_32_to_be(block->size);
+
+    block->length_plus_cs = be_32_to_le(size + 1);
+    rom[start_address + size] = calculate_rom_block_checksum_8(
+        &rom[start_address], size);
+
+    ((uint8_t *) block)[sizeof(rom_block) - 1] =
+        calculate_line_checksum((uint8_t *) block);
+}
+
 /* Operations: */
 /* Open provided file_location */
 /* Map contents of file_location to memory map */
 /* Close file_location */
 /* Return memory mapped rom image */
-static uint8_t *memory_map_rom_file(char *file_location, int *file_size)
+static uint8_t *memory_map_rom_file(wdfw_context *context,
+    char *file_location, int *file_size, int map_mode)
 {
     uint8_t *rom_memory;
-    int fd = open(file_location, O_RDONLY);
+    int fd = openat(context->directory_fd, file_location,
+        ((map_mode == ROM_MAP_WRITE) ? O_RDWR : O_RDONLY) | O_CLOEXEC);
 
-    if (fd < 1) {
-        perror("open");
+    if (fd < 0) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "memory_map_rom_file: Could not open %s", file_location);
         return NULL;
     }
 
     *file_size = lseek(fd, 0, SEEK_END);
 
-    rom_memory = mmap(NULL, *file_size, PROT_READ,
-        MAP_SHARED, fd, 0);
+    if (map_mode == ROM_MAP_PRIVATE) {
+        rom_memory = mmap(NULL, *file_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, fd, 0);
+    } else if (map_mode == ROM_MAP_WRITE) {
+        rom_memory = mmap(NULL, *file_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    } else {
+        rom_memory = mmap(NULL, *file_size, PROT_READ,
+            MAP_SHARED, fd, 0);
+    }
 
-    if (rom_memory == NULL) {
-        perror("mmap");
+    if (rom_memory == MAP_FAILED) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "memory_map_rom_file: Could not map %s", file_location);
+        rom_memory = NULL;
     }
 
     close(fd);
@@ -772,108 +3171,244 @@ static inline void unmmap_rom_file(uint8_t *rom_file, unsigned int rom_size)
 /* Create array of rom header structures */
 /* Display array of rom header structures (NUMBER_OF_HEADERS times) */
 /* Destroy array of rom header structures */
-int display_rom_info(char *rom_image)
+int display_rom_info(wdfw_context *context, char *rom_image)
 {
     uint8_t *rom_memory;
     rom_block *rom_header_table;
     int file_size;
     unsigned int number_of_headers = 0;
+    struct stat st;
 
-    if ((rom_memory = memory_map_rom_file(rom_image, &file_size)) == NULL) {
-        fprintf(stderr, "display_rom_info: Could not load rom " \
-            "image: %s\n", rom_image);
-        return -1;
+    /* Pipes and other unseekable files can not be memory mapped. */
+    if (strcmp(rom_image, "-") == 0) {
+        return display_rom_stream_info(context, STDIN_FILENO, NULL);
+    }
+
+    if (fstatat(context->directory_fd, rom_image, &st, 0) == 0 &&
+        !S_ISREG(st.st_mode)) {
+        int input_file = openat(context->directory_fd, rom_image,
+            O_RDONLY | O_CLOEXEC);
+        if (input_file == -1) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "display_rom_info: Could not open %s", rom_image);
+        }
+
+        int result = display_rom_stream_info(context, input_file, NULL);
+        close(input_file);
+        return result;
+    }
+
+    if ((rom_memory = memory_map_rom_file(context, rom_image, &file_size,
+        ROM_MAP_READ_ONLY)) == NULL) {
+        return chain_wdfw_error(context, "display_rom_info: Could not load " \
+            "rom image");
     }
 
     if ((rom_header_table =
         create_rom_block_table(rom_memory, &number_of_headers)) == NULL) {
-        fprintf(stderr, "display_rom_info: Could not create rom header " \
-            "table.\n");
         unmmap_rom_file(rom_memory, file_size);
-        return -1;
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "display_rom_info: Could not create rom header table");
     }
 
-    int i;
+    unsigned int i;
     for (i = 0; i < number_of_headers; ++i) {
-        display_rom_block(&rom_header_table[i]);
-        verify_rom_block_header(&rom_header_table[i]);
-        verify_rom_block_contents(rom_memory, &rom_header_table[i]);
-        printf("\n");
+        display_rom_block(context, &rom_header_table[i]);
+        verify_rom_block_header(context, &rom_header_table[i]);
+        verify_rom_block_contents(context, rom_memory, &rom_header_table[i]);
+        print_wdfw_output(context, "\n");
     }
 
-    printf("End of the rom block header: %#lx\n",
+    print_wdfw_output(context, "End of the rom block header: %#lx\n",
         (number_of_headers * sizeof(rom_block)));
 
+    /* Fingerprint of the image, as stored by unpack_rom_image. */
+    print_wdfw_output(context, "Image hash: %016llx\n",
+        (unsigned long long) calculate_rom_hash(rom_memory, file_size));
+
     destroy_rom_block_table(rom_header_table);
     unmmap_rom_file(rom_memory, file_size);
 
     return 0;
 }
 
-/* Little endian to big endian.
- * Source:
- * https://stackoverflow.com/questions/19275955/convert-little-endian-to-big-endian/19276193 */
-static inline uint32_t le_32_to_be(uint32_t integer)
+/* Operations: */
+/* Create copy_file when the image should be archived */
+/* Itterate until the end of input_fd: */
+/* - Read the next chunk of the image */
+/* - Feed the chunk to the rom stream parser */
+/* - Append the chunk to copy_file */
+/* Display the parsed rom block headers and their verification results */
+int display_rom_stream_info(wdfw_context *context, int input_fd,
+    char *copy_file)
 {
-	unsigned char *p=(unsigned char*)&integer;
-	return p[0]+(p[1]<<8)+(p[2]<<16)+(p[3]<<24);
+    rom_stream stream;
+    int copy_fd = -1;
+    ssize_t read_size;
+
+    uint8_t *chunk = malloc(ROM_IMAGE_BLOCK_SIZE);
+    if (chunk == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "display_rom_stream_info: Could not allocate a chunk");
+    }
+
+    if (copy_file != NULL) {
+        copy_fd = openat(context->directory_fd, copy_file,
+            O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
+        if (copy_fd == -1) {
+            free(chunk);
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "display_rom_stream_info: Could not create %s", copy_file);
+        }
+    }
+
+    init_rom_stream(&stream);
+    stream.hash_contents = 1;
+
+    while ((read_size = read(input_fd, chunk, ROM_IMAGE_BLOCK_SIZE)) != 0) {
+        if (read_size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "display_rom_stream_info: read");
+            break;
+        }
+
+        feed_rom_stream(&stream, chunk, read_size);
+
+        ssize_t written = 0;
+        while (copy_fd != -1 && written < read_size) {
+            ssize_t result = write(copy_fd, chunk + written,
+                read_size - written);
+            if (result == -1) {
+                report_wdfw_system_error(context, WDFW_ERROR_IO,
+                    "display_rom_stream_info: Could not write to %s",
+                    copy_file);
+                close(copy_fd);
+                copy_fd = -1;
+                read_size = -1;
+                break;
+            }
+            written += result;
+        }
+
+        if (read_size == -1) {
+            break;
+        }
+    }
+
+    free(chunk);
+    if (copy_fd != -1) {
+        close(copy_fd);
+    }
+
+    if (read_size == -1) {
+        return context->error;
+    }
+
+    finish_rom_stream(&stream);
+
+    unsigned int i;
+    for (i = 0; i < stream.number_of_blocks; ++i) {
+        display_rom_stream_block(context, &stream, i);
+        print_wdfw_output(context, "\n");
+    }
+
+    print_wdfw_output(context, "End of the rom block header: %#lx\n",
+        (stream.number_of_blocks * sizeof(rom_block)));
+    print_wdfw_output(context, "Read %llu bytes from the stream\n",
+        (unsigned long long) stream.offset);
+    print_wdfw_output(context, "Image hash: %016llx\n",
+        (unsigned long long) stream.image_hash);
+
+    return 0;
 }
 
-/* Big endian to little endian.
- * Source:
- * https://stackoverflow.com/questions/2182002/convert-big-endian-to-little-endian-in-c-without-using-provided-func
- */
-static uint32_t be_32_to_le(uint32_t integer)
+static void display_rom_stream_block(wdfw_context *context,
+    rom_stream *stream, unsigned int block_index)
 {
-	uint32_t ret;
-	unsigned char *p=(unsigned char *)&ret;
-	p[0]=(integer)&0xff;
-	p[1]=(integer>>8)&0xff;
-	p[2]=(integer>>16)&0xff;
-	p[3]=(integer>>24)&0xff;
-	return ret;
+    uint8_t stored_header_checksum =
+        ((uint8_t *) &stream->table[block_index])[sizeof(rom_block) - 1];
+
+    display_rom_block(context, &stream->table[block_index]);
+
+    if (stream->header_state[block_index] == ROM_CHECK_OK) {
+        print_wdfw_output(context, "Rom block header checksum OK:   %#x\n",
+            stream->header_checksum[block_index]);
+    } else {
+        print_wdfw_output(context, "Rom block checksum FAIL: %#x != %#x\n",
+            stream->header_checksum[block_index], stored_header_checksum);
+        print_wdfw_output(context, "Rom block memory is corrupted.\n");
+    }
+
+    switch (stream->contents_state[block_index]) {
+    case ROM_CHECK_OK:
+        print_wdfw_output(context, "Rom block contents checksum OK: %#x\n",
+            stream->contents_checksum[block_index]);
+        break;
+    case ROM_CHECK_FAIL:
+        print_wdfw_output(context, "verify_rom_block_contents: Checksum " \
+            "fail: %#x != %#x.\n", stream->contents_checksum[block_index],
+            stream->stored_checksum[block_index]);
+        break;
+    default:
+        print_wdfw_output(context, "verify_rom_block_contents: Detected " \
+            "irregular checksum size.\n");
+        break;
+    }
 }
-static void display_rom_block(rom_block *block)
+
+static void display_rom_block(wdfw_context *context, rom_block *block)
 {
-    printf("Block number:               %#x\n", block->block_nr);
-    printf("Encryption flag:            %#x\n", block->flag);
+    print_wdfw_output(context, "Block number:               %#x\n",
+        block->block_nr);
+    print_wdfw_output(context, "Encryption flag:            %#x\n",
+        block->flag);
 
-    printf("Block encrypted:            %s\n",
+    print_wdfw_output(context, "Block encrypted:            %s\n",
         (block->flag == FLAG_UNENCRYPTED) ? "no" : "yes");
 
-    printf("Unkown 1:                   %#x\n", block->unk1);
-    printf("Unkown 2:                   %#x\n", block->unk2);
-    printf("Block length plus checksum: %#x\n",
+    print_wdfw_output(context, "Unkown 1:                   %#x\n",
+        block->unk1);
+    print_wdfw_output(context, "Unkown 2:                   %#x\n",
+        block->unk2);
+    print_wdfw_output(context, "Block length plus checksum: %#x\n",
         le_32_to_be(block->length_plus_cs));
-    printf("Block size:                 %#x\n", le_32_to_be(block->size));
-    printf("Block start address:        %#x\n",
+    print_wdfw_output(context, "Block size:                 %#x\n",
+        le_32_to_be(block->size));
+    print_wdfw_output(context, "Block start address:        %#x\n",
         le_32_to_be(block->start_address));
-    printf("Block load address:         %#x\n",
+    print_wdfw_output(context, "Block load address:         %#x\n",
         le_32_to_be(block->load_address));
-    printf("Block execution address:    %#x\n",
+    print_wdfw_output(context, "Block execution address:    %#x\n",
         le_32_to_be(block->execution_address));
-    printf("Unkown 3:                   %#x\n", block->unk3);
-    printf("Block checksum:             %#x\n", block->fstw_plus_cs);
+    print_wdfw_output(context, "Unkown 3:                   %#x\n",
+        block->unk3);
+    print_wdfw_output(context, "Block checksum:             %#x\n",
+        block->fstw_plus_cs);
 }
 
-static int verify_rom_block_header(rom_block *block)
+static int verify_rom_block_header(wdfw_context *context, rom_block *block)
 {
     uint8_t checksum = calculate_line_checksum((uint8_t *) block);
 
     if (checksum != ((uint8_t *) block)[31]) {
-        fprintf(stderr, "Rom block checksum FAIL: %#x != %#x\n",
+        print_wdfw_output(context, "Rom block checksum FAIL: %#x != %#x\n",
             checksum, ((uint8_t *) block)[31]);
-        fprintf(stderr, "Rom block memory is corrupted.\n");
-        return -1;
+        print_wdfw_output(context, "Rom block memory is corrupted.\n");
+        return WDFW_ERROR_FORMAT;
     } else {
-        printf("Rom block header checksum OK:   %#x\n", checksum);
+        print_wdfw_output(context, "Rom block header checksum OK:   %#x\n",
+            checksum);
         return 0;
     }
 }
 
 /* Check performed to verfiry the integrity of each rom block for memory
  * corruption. */
-static int verify_rom_block_contents(uint8_t *rom, rom_block *rom_block)
+static int verify_rom_block_contents(wdfw_context *context, uint8_t *rom,
+    rom_block *rom_block)
 {
     int checksum;
     int rom_contents;
@@ -885,22 +3420,23 @@ static int verify_rom_block_contents(uint8_t *rom, rom_block *rom_block)
         rom_contents = rom[rom_block->start_address +
             rom_block->size];
     } else {
-        fprintf(stderr, "verify_rom_block_contents: Detected irregular " \
-            "checksum size.\n");
-        return -1;
+        print_wdfw_output(context, "verify_rom_block_contents: Detected " \
+            "irregular checksum size.\n");
+        return WDFW_ERROR_FORMAT;
     }
 
     if (checksum != rom_contents) {
-        fprintf(stderr, "verify_rom_block_contents: Checksum fail: "\
-            "%#x != %#x.\n", checksum, rom_contents);
+        print_wdfw_output(context, "verify_rom_block_contents: Checksum " \
+            "fail: %#x != %#x.\n", checksum, rom_contents);
     } else {
-        printf("Rom block contents checksum OK: %#x\n", checksum);
+        print_wdfw_output(context, "Rom block contents checksum OK: %#x\n",
+            checksum);
     }
 
     return 0;
 }
 
-static unsigned int calculate_line_checksum(uint8_t *block)
+unsigned int calculate_line_checksum(uint8_t *block)
 {
     uint8_t checksum = 0;
 
@@ -912,7 +3448,7 @@ static unsigned int calculate_line_checksum(uint8_t *block)
     return checksum;
 }
 
-static rom_block *create_rom_block_table(uint8_t *rom_file,
+rom_block *create_rom_block_table(uint8_t *rom_file,
     unsigned int *number_of_blocks)
 {
     unsigned int table_size;
@@ -929,7 +3465,6 @@ static rom_block *create_rom_block_table(uint8_t *rom_file,
     rom_block *rom_block_table = (rom_block *) malloc(table_size);
 
     if (rom_block_table == NULL) {
-        perror("create_rom_block_table: malloc");
         return NULL;
     }
 
@@ -937,7 +3472,7 @@ static rom_block *create_rom_block_table(uint8_t *rom_file,
     return rom_block_table;
 }
 
-static inline void destroy_rom_block_table(rom_block *rom_block_table)
+void destroy_rom_block_table(rom_block *rom_block_table)
 {
     if (rom_block_table != NULL) {
         free(rom_block_table);
@@ -947,11 +3482,11 @@ static inline void destroy_rom_block_table(rom_block *rom_block_table)
 
 /* https://forum.arduino.cc/index.php?topic=486751.0 */
 /* https://reverseengineering.stackexchange.com/questions/15484/simple-8bit-checksum */
-static unsigned int calculate_rom_block_checksum_8(uint8_t *block,
+unsigned int calculate_rom_block_checksum_8(uint8_t *block,
     unsigned int size)
 {
     uint8_t checksum = 0;
-    int i;
+    unsigned int i;
 
     for (i = 0; i < size; ++i) {
         checksum += block[i];
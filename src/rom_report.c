@@ -0,0 +1,333 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "includes/rom_report.h"
+#include "includes/rom_management.h"
+#include "includes/rom_stream.h"
+
+/* Append formatted text to the report. */
+static int print_report(report_writer *writer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Append a string to the report as quoted JSON string. */
+static int write_json_string(report_writer *writer, const char *string);
+
+/* Append the JSON Lines record of a rom image. */
+static int write_rom_report_json(report_writer *writer, uint32_t image_id,
+    char *rom_image, rom_stream *stream);
+
+/* Append the binary records of a rom image. */
+static int write_rom_report_binary(report_writer *writer, uint32_t image_id,
+    char *rom_image, rom_stream *stream);
+
+/* Parse and report a single rom image. */
+static int report_rom_image(wdfw_context *context, report_writer *writer,
+    int format, uint32_t image_id, char *rom_image, uint8_t *chunk);
+
+/* Names of the ROM_CHECK_* verification states. */
+static const char *check_state_names[] = {
+    "pending", "ok", "fail", "irregular"
+};
+
+void init_report_writer(report_writer *writer, int fd)
+{
+    writer->fd = fd;
+    writer->fill = 0;
+    writer->failed = 0;
+}
+
+int write_report(report_writer *writer, const void *data, size_t size)
+{
+    if (writer->fill + size > REPORT_BUFFER_SIZE &&
+        flush_report_writer(writer) != 0) {
+        return -1;
+    }
+
+    /* Records larger than the buffer bypass it. */
+    if (size > REPORT_BUFFER_SIZE) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t result = write(writer->fd, (uint8_t *) data + written,
+                size - written);
+            if (result == -1 && errno != EINTR) {
+                writer->failed = errno;
+                return -1;
+            }
+            written += (result > 0) ? result : 0;
+        }
+        return 0;
+    }
+
+    memcpy(writer->buffer + writer->fill, data, size);
+    writer->fill += size;
+    return 0;
+}
+
+int flush_report_writer(report_writer *writer)
+{
+    size_t written = 0;
+
+    while (written < writer->fill) {
+        ssize_t result = write(writer->fd, writer->buffer + written,
+            writer->fill - written);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            writer->failed = errno;
+            return -1;
+        }
+        written += result;
+    }
+
+    writer->fill = 0;
+    return 0;
+}
+
+static int print_report(report_writer *writer, const char *format, ...)
+{
+    va_list arguments;
+    int length;
+
+    va_start(arguments, format);
+    length = vsnprintf((char *) writer->buffer + writer->fill,
+        REPORT_BUFFER_SIZE - writer->fill, format, arguments);
+    va_end(arguments);
+
+    if (length < 0) {
+        return -1;
+    }
+
+    /* Did not fit: make room and format again. */
+    if ((size_t) length >= REPORT_BUFFER_SIZE - writer->fill) {
+        if (flush_report_writer(writer) != 0 ||
+            (size_t) length >= REPORT_BUFFER_SIZE) {
+            return -1;
+        }
+
+        va_start(arguments, format);
+        vsnprintf((char *) writer->buffer, REPORT_BUFFER_SIZE, format,
+            arguments);
+        va_end(arguments);
+    }
+
+    writer->fill += length;
+    return 0;
+}
+
+static int write_json_string(report_writer *writer, const char *string)
+{
+    if (write_report(writer, "\"", 1) != 0) {
+        return -1;
+    }
+
+    for (; *string != '\0'; ++string) {
+        unsigned char character = *string;
+
+        if (character == '"' || character == '\\') {
+            print_report(writer, "\\%c", character);
+        } else if (character < 0x20) {
+            print_report(writer, "\\u%04x", character);
+        } else {
+            write_report(writer, &character, 1);
+        }
+    }
+
+    return write_report(writer, "\"", 1);
+}
+
+int write_rom_report(report_writer *writer, int format, uint32_t image_id,
+    char *rom_image, rom_stream *stream)
+{
+    if (format == REPORT_FORMAT_BINARY) {
+        return write_rom_report_binary(writer, image_id, rom_image, stream);
+    }
+
+    return write_rom_report_json(writer, image_id, rom_image, stream);
+}
+
+static int write_rom_report_json(report_writer *writer, uint32_t image_id,
+    char *rom_image, rom_stream *stream)
+{
+    print_report(writer, "{\"id\":%u,\"image\":", image_id);
+    write_json_string(writer, rom_image);
+
+    if (stream == NULL) {
+        return print_report(writer, ",\"status\":\"error\"}\n");
+    }
+
+    int number_of_failures = finish_rom_stream(stream);
+
+    print_report(writer, ",\"status\":\"%s\",\"size\":%llu," \
+        "\"header_end\":%lu,\"failures\":%d,\"blocks\":[",
+        (number_of_failures == 0) ? "ok" : "corrupt",
+        (unsigned long long) stream->offset,
+        stream->number_of_blocks * sizeof(rom_block), number_of_failures);
+
+    unsigned int i;
+    for (i = 0; i < stream->number_of_blocks; ++i) {
+        rom_block *block = &stream->table[i];
+
+        print_report(writer, "%s{\"block_nr\":%u,\"flag\":%u," \
+            "\"encrypted\":%s,\"unk1\":%u,\"unk2\":%u," \
+            "\"length_plus_cs\":%u,\"size\":%u,\"start_address\":%u," \
+            "\"load_address\":%u,\"execution_address\":%u,\"unk3\":%u," \
+            "\"fstw_plus_cs\":%u,\"header_checksum\":%u," \
+            "\"header_check\":\"%s\",\"contents_checksum\":%u," \
+            "\"stored_contents_checksum\":%u,\"contents_check\":\"%s\"}",
+            (i == 0) ? "" : ",", block->block_nr, block->flag,
+            (block->flag == FLAG_UNENCRYPTED) ? "false" : "true",
+            block->unk1, block->unk2, le_32_to_be(block->length_plus_cs),
+            le_32_to_be(block->size), le_32_to_be(block->start_address),
+            le_32_to_be(block->load_address),
+            le_32_to_be(block->execution_address), le_32_to_be(block->unk3),
+            le_32_to_be(block->fstw_plus_cs), stream->header_checksum[i],
+            check_state_names[stream->header_state[i]],
+            stream->contents_checksum[i], stream->stored_checksum[i],
+            check_state_names[stream->contents_state[i]]);
+    }
+
+    return print_report(writer, "]}\n");
+}
+
+static int write_rom_report_binary(report_writer *writer, uint32_t image_id,
+    char *rom_image, rom_stream *stream)
+{
+    rom_info_image image = {0};
+    size_t name_length = strlen(rom_image);
+
+    image.magic = REPORT_IMAGE_MAGIC;
+    image.image_id = image_id;
+    image.name_length = (name_length > UINT16_MAX) ? UINT16_MAX : name_length;
+    image.status = REPORT_STATUS_ERROR;
+
+    if (stream != NULL) {
+        image.number_of_failures = finish_rom_stream(stream);
+        image.status = (image.number_of_failures == 0) ?
+            REPORT_STATUS_OK : REPORT_STATUS_CORRUPT;
+        image.image_size = stream->offset;
+        image.number_of_blocks = stream->number_of_blocks;
+    }
+
+    write_report(writer, &image, sizeof(image));
+    write_report(writer, rom_image, image.name_length);
+
+    unsigned int i;
+    for (i = 0; i < image.number_of_blocks; ++i) {
+        rom_block *block = &stream->table[i];
+        rom_info_block record = {0};
+
+        record.magic = REPORT_BLOCK_MAGIC;
+        record.block_nr = block->block_nr;
+        record.flag = block->flag;
+        record.unk1 = block->unk1;
+        record.unk2 = block->unk2;
+        record.length_plus_cs = le_32_to_be(block->length_plus_cs);
+        record.size = le_32_to_be(block->size);
+        record.start_address = le_32_to_be(block->start_address);
+        record.load_address = le_32_to_be(block->load_address);
+        record.execution_address = le_32_to_be(block->execution_address);
+        record.unk3 = le_32_to_be(block->unk3);
+        record.fstw_plus_cs = le_32_to_be(block->fstw_plus_cs);
+        record.header_checksum = stream->header_checksum[i];
+        record.header_state = stream->header_state[i];
+        record.contents_checksum = stream->contents_checksum[i];
+        record.stored_contents_checksum = stream->stored_checksum[i];
+        record.contents_state = stream->contents_state[i];
+
+        write_report(writer, &record, sizeof(record));
+    }
+
+    return writer->failed ? -1 : 0;
+}
+
+static int report_rom_image(wdfw_context *context, report_writer *writer,
+    int format, uint32_t image_id, char *rom_image, uint8_t *chunk)
+{
+    rom_stream stream;
+
+    int input_file = openat(context->directory_fd, rom_image,
+        O_RDONLY | O_CLOEXEC);
+    if (input_file == -1) {
+        return write_rom_report(writer, format, image_id, rom_image, NULL);
+    }
+
+    init_rom_stream(&stream);
+    int result = read_rom_stream(&stream, input_file, chunk,
+        ROM_IMAGE_BLOCK_SIZE);
+    close(input_file);
+
+    return write_rom_report(writer, format, image_id, rom_image,
+        (result == 0) ? &stream : NULL);
+}
+
+/* Operations: */
+/* Allocate one report writer and read buffer for the whole batch */
+/* For each rom image (from the argument list or stdin): */
+/* - Parse the image with the rom stream parser */
+/* - Append its record to the report */
+/* Flush the report */
+int report_rom_info(wdfw_context *context, int format, char **rom_images,
+    unsigned int number_of_images, int output_fd)
+{
+    uint32_t image_id = 0;
+    int result = 0;
+
+    report_writer *writer = malloc(sizeof(report_writer));
+    uint8_t *chunk = malloc(ROM_IMAGE_BLOCK_SIZE);
+    if (writer == NULL || chunk == NULL) {
+        free(writer);
+        free(chunk);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "report_rom_info: Could not allocate the report writer");
+    }
+
+    init_report_writer(writer, output_fd);
+
+    if (number_of_images == 1 && strcmp(rom_images[0], "-") == 0) {
+        char *line = NULL;
+        size_t line_size = 0;
+        ssize_t line_length;
+
+        while ((line_length = getline(&line, &line_size, stdin)) != -1 &&
+            result == 0) {
+            if (line_length > 0 && line[line_length - 1] == '\n') {
+                line[line_length - 1] = '\0';
+            }
+
+            if (line[0] != '\0') {
+                result = report_rom_image(context, writer, format,
+                    image_id++, line, chunk);
+            }
+        }
+        free(line);
+    } else {
+        unsigned int i;
+        for (i = 0; i < number_of_images && result == 0; ++i) {
+            result = report_rom_image(context, writer, format, image_id++,
+                rom_images[i], chunk);
+        }
+    }
+
+    if (flush_report_writer(writer) != 0) {
+        result = -1;
+    }
+
+    if (result != 0) {
+        errno = writer->failed;
+        result = report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "report_rom_info: Could not write the report");
+    }
+
+    free(chunk);
+    free(writer);
+    return result;
+}
@@ -0,0 +1,244 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "includes/rom_stream.h"
+#include "includes/rom_management.h"
+#include "includes/rom_hash.h"
+
+/* Consume bytes of the header table. Returns the number of bytes used. */
+static size_t feed_rom_stream_table(rom_stream *stream, const uint8_t *data,
+    size_t size);
+
+/* Accumulate the contents checksums of all blocks overlapping a chunk. */
+static void feed_rom_stream_contents(rom_stream *stream, const uint8_t *data,
+    size_t size);
+
+/* Sum a range of bytes into an 8-bit checksum. */
+static uint8_t sum_bytes(uint8_t checksum, const uint8_t *data, size_t size);
+
+/* Sum a range of bytes into an 8-bit checksum and a 64-bit hash at once. */
+static uint8_t sum_and_hash_bytes(uint8_t checksum, uint64_t *hash,
+    const uint8_t *data, size_t size);
+
+void init_rom_stream(rom_stream *stream)
+{
+    memset(stream, 0, sizeof(rom_stream));
+
+    unsigned int i;
+    for (i = 0; i < ROM_STREAM_MAX_BLOCKS; ++i) {
+        stream->contents_hash[i] = ROM_HASH_INIT;
+    }
+    stream->image_hash = ROM_HASH_INIT;
+}
+
+int feed_rom_stream(rom_stream *stream, const uint8_t *data, size_t size)
+{
+    if (stream->hash_contents) {
+        stream->image_hash = update_rom_hash(stream->image_hash, data, size);
+    }
+
+    if (!stream->table_complete) {
+        size_t used = feed_rom_stream_table(stream, data, size);
+
+        stream->offset += used;
+        data += used;
+        size -= used;
+    }
+
+    if (size > 0) {
+        feed_rom_stream_contents(stream, data, size);
+        stream->offset += size;
+    }
+
+    return 0;
+}
+
+int read_rom_stream(rom_stream *stream, int input_fd, uint8_t *chunk,
+    size_t chunk_size)
+{
+    ssize_t read_size;
+
+    while ((read_size = read(input_fd, chunk, chunk_size)) != 0) {
+        if (read_size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        feed_rom_stream(stream, chunk, read_size);
+    }
+
+    return 0;
+}
+
+int finish_rom_stream(rom_stream *stream)
+{
+    int number_of_failures = 0;
+
+    unsigned int i;
+    for (i = 0; i < stream->number_of_blocks; ++i) {
+        if (stream->contents_state[i] == ROM_CHECK_PENDING) {
+            stream->contents_state[i] = ROM_CHECK_IRREGULAR;
+        }
+
+        if (stream->header_state[i] != ROM_CHECK_OK ||
+            stream->contents_state[i] != ROM_CHECK_OK) {
+            number_of_failures += 1;
+        }
+    }
+
+    if (!stream->table_complete) {
+        number_of_failures += 1;
+    }
+
+    return number_of_failures;
+}
+
+/* Operations: */
+/* Itterate: */
+/* - Inspect the block number as soon as the first byte of a line arrives */
+/* - Stop when it is not a block number observed in rom images */
+/* - Complete the line and verify its checksum */
+/* - Check if the block layout allows verifying its contents */
+static size_t feed_rom_stream_table(rom_stream *stream, const uint8_t *data,
+    size_t size)
+{
+    size_t used = 0;
+
+    while (used < size && !stream->table_complete) {
+        if (stream->line_fill == 0) {
+            /* Observed block numbers in the extracted (rom) firmware
+             * images. */
+            if ((data[used] > 0x0a && data[used] != 0x5a) ||
+                stream->number_of_blocks == ROM_STREAM_MAX_BLOCKS) {
+                stream->table_complete = 1;
+                break;
+            }
+        }
+
+        size_t line_rest = sizeof(rom_block) - stream->line_fill;
+        size_t copy_size = (size - used < line_rest) ? size - used : line_rest;
+
+        memcpy(stream->line + stream->line_fill, data + used, copy_size);
+        stream->line_fill += copy_size;
+        used += copy_size;
+
+        if (stream->line_fill < sizeof(rom_block)) {
+            continue;
+        }
+
+        unsigned int index = stream->number_of_blocks;
+        rom_block *block = &stream->table[index];
+
+        memcpy(block, stream->line, sizeof(rom_block));
+        stream->line_fill = 0;
+        stream->number_of_blocks += 1;
+
+        stream->header_checksum[index] = sum_bytes(0, stream->line,
+            sizeof(rom_block) - 1);
+        stream->header_state[index] =
+            (stream->header_checksum[index] ==
+            stream->line[sizeof(rom_block) - 1]) ?
+            ROM_CHECK_OK : ROM_CHECK_FAIL;
+
+        /* The contents of a block is only seen after the table, and the
+         * checksum is expected directly after the block. */
+        if (le_32_to_be(block->length_plus_cs) -
+            le_32_to_be(block->size) != 1) {
+            stream->contents_state[index] = ROM_CHECK_IRREGULAR;
+        }
+    }
+
+    if (stream->table_complete) {
+        unsigned int i;
+        for (i = 0; i < stream->number_of_blocks; ++i) {
+            if (le_32_to_be(stream->table[i].start_address) <
+                stream->offset + used) {
+                stream->contents_state[i] = ROM_CHECK_IRREGULAR;
+            }
+        }
+    }
+
+    return used;
+}
+
+static void feed_rom_stream_contents(rom_stream *stream, const uint8_t *data,
+    size_t size)
+{
+    uint64_t chunk_start = stream->offset;
+    uint64_t chunk_end = stream->offset + size;
+
+    unsigned int i;
+    for (i = 0; i < stream->number_of_blocks; ++i) {
+        if (stream->contents_state[i] != ROM_CHECK_PENDING) {
+            continue;
+        }
+
+        uint64_t block_start = le_32_to_be(stream->table[i].start_address);
+        uint64_t block_end = block_start + le_32_to_be(stream->table[i].size);
+
+        /* Skip blocks of which neither the contents nor the checksum byte
+         * are part of this chunk. */
+        if (block_end < chunk_start || block_start >= chunk_end) {
+            continue;
+        }
+
+        uint64_t sum_start = (block_start > chunk_start) ?
+            block_start : chunk_start;
+        uint64_t sum_end = (block_end < chunk_end) ? block_end : chunk_end;
+
+        if (sum_end > sum_start && stream->hash_contents) {
+            stream->contents_checksum[i] = sum_and_hash_bytes(
+                stream->contents_checksum[i], &stream->contents_hash[i],
+                data + (sum_start - chunk_start), sum_end - sum_start);
+        } else if (sum_end > sum_start) {
+            stream->contents_checksum[i] = sum_bytes(
+                stream->contents_checksum[i], data + (sum_start - chunk_start),
+                sum_end - sum_start);
+        }
+
+        /* The checksum byte directly follows the block. */
+        if (block_end >= chunk_start && block_end < chunk_end) {
+            stream->stored_checksum[i] = data[block_end - chunk_start];
+            stream->contents_state[i] = (stream->contents_checksum[i] ==
+                stream->stored_checksum[i]) ? ROM_CHECK_OK : ROM_CHECK_FAIL;
+
+            if (stream->block_verified != NULL) {
+                stream->block_verified(stream->context, i);
+            }
+        }
+    }
+}
+
+static uint8_t sum_bytes(uint8_t checksum, const uint8_t *data, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        checksum += data[i];
+    }
+
+    return checksum;
+}
+
+static uint8_t sum_and_hash_bytes(uint8_t checksum, uint64_t *hash,
+    const uint8_t *data, size_t size)
+{
+    uint64_t running_hash = *hash;
+
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        checksum += data[i];
+        running_hash ^= data[i];
+        running_hash *= ROM_HASH_PRIME;
+    }
+
+    *hash = running_hash;
+    return checksum;
+}
@@ -0,0 +1,705 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Linux specific */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "includes/service_area.h"
+#include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/rom_hash.h"
+#include "includes/wdfw_context.h"
+
+/* State shared between the device reader thread and the host thread of a
+ * bulk module dump. */
+typedef struct {
+    wdfw_context context; /* Context of the reader thread */
+    int hdd_fd;
+    sa_directory_entry *modules; /* Modules to read, in order */
+    unsigned int number_of_modules;
+    uint8_t *module_buffer; /* Modules back to back, in order */
+    int *unreadable; /* Set for the modules the drive did not return */
+    unsigned int modules_read; /* Number of modules handled by the reader */
+    pthread_mutex_t lock;
+    pthread_cond_t module_ready;
+} sa_dump_pipeline;
+
+/* Open and check the drive and enable vendor specific commands. */
+static int open_service_area(wdfw_context *context, char *hard_disk_dev_file);
+
+/* Disable vendor specific commands and close the drive. */
+static int close_service_area(wdfw_context *context, int hdd_fd);
+
+/* Select the modules of a bulk dump from the module directory. */
+static int select_sa_modules(wdfw_context *context,
+    sa_directory_entry *directory, unsigned int number_of_entries,
+    uint16_t *module_ids, unsigned int number_of_modules,
+    sa_directory_entry **modules);
+
+/* Reader thread of a bulk dump, reads the modules one after the other. */
+static void *read_sa_modules(void *pipeline);
+
+/* Write size bytes of data at offset of an archive. */
+static int write_sa_archive_data(wdfw_context *context, int archive_fd,
+    const void *data, size_t size, off_t offset);
+
+/* Map an archive and check its header and index. */
+static uint8_t *map_sa_archive(wdfw_context *context, char *archive_file,
+    size_t *archive_size);
+
+uint32_t calculate_sa_module_checksum(const uint8_t *module, size_t size)
+{
+    uint32_t checksum = 0;
+
+    size_t i;
+    for (i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, module + i, sizeof(word));
+        checksum += word;
+    }
+
+    return checksum;
+}
+
+int verify_sa_module(const uint8_t *module, size_t size, uint16_t module_id)
+{
+    const sa_module_header *header = (const sa_module_header *) module;
+
+    if (size < sizeof(sa_module_header) ||
+        memcmp(header->signature, SA_MODULE_SIGNATURE,
+        sizeof(header->signature)) != 0 ||
+        header->module_id != module_id || header->size == 0 ||
+        (size_t) header->size * SA_SECTOR_SIZE > size) {
+        return -1;
+    }
+
+    if (calculate_sa_module_checksum(module,
+        header->size * SA_SECTOR_SIZE) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Module data is returned through the vendor data log used for the rom, in
+ * transfers of at most the rom chunk size. */
+int read_sa_module(wdfw_context *context, int hard_disk_file_descriptor,
+    uint16_t module_id, uint8_t *module, size_t size)
+{
+    uint8_t key_sector[512] = {0};
+    uint32_t chunk_size = context->geometry.chunk_size;
+
+    if (size == 0 || (size % SA_SECTOR_SIZE) != 0) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "read_sa_module: Invalid module size %zu", size);
+    }
+
+    key_sector[0] = SA_KEY_MODULE_ACCESS & 0xff; /* Command */
+    key_sector[1] = SA_KEY_MODULE_ACCESS >> 8;
+    key_sector[2] = SA_KEY_MODULE_READ & 0xff; /* Action */
+    key_sector[3] = SA_KEY_MODULE_READ >> 8;
+    key_sector[4] = module_id & 0xff; /* Module */
+    key_sector[5] = module_id >> 8;
+
+    if (send_vendor_specific_key(context, hard_disk_file_descriptor,
+        key_sector) != 0) {
+        return chain_wdfw_error(context, "read_sa_module: Could not select " \
+            "module 0x%04x", module_id);
+    }
+
+    size_t offset;
+    for (offset = 0; offset < size; offset += chunk_size) {
+        size_t transfer_size = size - offset;
+
+        if (transfer_size > chunk_size) {
+            transfer_size = chunk_size;
+        }
+
+        if (read_rom_block(context, hard_disk_file_descriptor,
+            module + offset, transfer_size) != 0) {
+            return chain_wdfw_error(context, "read_sa_module: Could not " \
+                "read module 0x%04x", module_id);
+        }
+    }
+
+    return 0;
+}
+
+/* Operations: */
+/* Read the first sector of the directory to learn its size */
+/* Read and verify the complete directory */
+/* Copy the entries, which may be larger than sa_directory_entry */
+int read_sa_directory(wdfw_context *context, int hard_disk_file_descriptor,
+    sa_directory_entry **entries, unsigned int *number_of_entries)
+{
+    uint8_t probe[SA_DIRECTORY_PROBE_SECTORS * SA_SECTOR_SIZE];
+    sa_directory_header *header = (sa_directory_header *) probe;
+
+    if (read_sa_module(context, hard_disk_file_descriptor,
+        SA_DIRECTORY_MODULE, probe, sizeof(probe)) != 0) {
+        return chain_wdfw_error(context, "read_sa_directory");
+    }
+
+    if (memcmp(header->module.signature, SA_MODULE_SIGNATURE,
+        sizeof(header->module.signature)) != 0 ||
+        header->module.module_id != SA_DIRECTORY_MODULE ||
+        header->module.size == 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "read_sa_directory: Invalid module directory header");
+    }
+
+    size_t size = header->module.size * SA_SECTOR_SIZE;
+    uint8_t *directory = malloc(size);
+    if (directory == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "read_sa_directory: Could not allocate the module directory");
+    }
+
+    if (read_sa_module(context, hard_disk_file_descriptor,
+        SA_DIRECTORY_MODULE, directory, size) != 0) {
+        free(directory);
+        return chain_wdfw_error(context, "read_sa_directory");
+    }
+
+    header = (sa_directory_header *) directory;
+    if (verify_sa_module(directory, size, SA_DIRECTORY_MODULE) != 0 ||
+        header->entry_size < sizeof(sa_directory_entry) ||
+        sizeof(sa_directory_header) + (size_t) header->number_of_entries *
+        header->entry_size > size) {
+        free(directory);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "read_sa_directory: Module directory is corrupt");
+    }
+
+    *number_of_entries = header->number_of_entries;
+    *entries = calloc(*number_of_entries + 1, sizeof(sa_directory_entry));
+    if (*entries == NULL) {
+        free(directory);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "read_sa_directory: Could not allocate the directory entries");
+    }
+
+    unsigned int i;
+    for (i = 0; i < *number_of_entries; ++i) {
+        memcpy(&(*entries)[i], directory + sizeof(sa_directory_header) +
+            i * header->entry_size, sizeof(sa_directory_entry));
+    }
+
+    free(directory);
+    return 0;
+}
+
+int display_sa_directory(wdfw_context *context, char *hard_disk_dev_file)
+{
+    sa_directory_entry *entries;
+    unsigned int number_of_entries;
+
+    int hdd_fd = open_service_area(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "display_sa_directory");
+    }
+
+    if (read_sa_directory(context, hdd_fd, &entries,
+        &number_of_entries) != 0) {
+        chain_wdfw_error(context, "display_sa_directory");
+        close_service_area(context, hdd_fd);
+        return context->error;
+    }
+
+    if (close_service_area(context, hdd_fd) != 0) {
+        free(entries);
+        return chain_wdfw_error(context, "display_sa_directory");
+    }
+
+    print_wdfw_output(context, "Module directory: %u modules\n",
+        number_of_entries);
+
+    unsigned int i;
+    for (i = 0; i < number_of_entries; ++i) {
+        print_wdfw_output(context, "Module 0x%04x: %u sectors, location " \
+            "0x%08x, %u copies, flags 0x%02x\n", entries[i].module_id,
+            entries[i].size, entries[i].location, entries[i].copies,
+            entries[i].flags);
+    }
+
+    free(entries);
+    return 0;
+}
+
+/* Operations: */
+/* Open the drive, enable vendor specific commands and read the directory */
+/* Select the modules to dump and lay them out in one buffer */
+/* Start a thread that reads the modules from the drive */
+/* For each module that arrives: */
+/* - Verify its header and checksum and hash it */
+/* - Write it to the archive while the drive transfers the next module */
+/* Wait for the reader and disable vendor specific commands */
+/* Write the index and the archive header */
+int dump_sa_modules(wdfw_context *context, char *hard_disk_dev_file,
+    char *archive_file, uint16_t *module_ids, unsigned int number_of_modules)
+{
+    sa_dump_pipeline pipeline = {0};
+    sa_directory_entry *directory;
+    unsigned int number_of_entries;
+    pthread_t reader;
+
+    pipeline.hdd_fd = open_service_area(context, hard_disk_dev_file);
+    if (pipeline.hdd_fd < 0) {
+        return chain_wdfw_error(context, "dump_sa_modules");
+    }
+
+    if (read_sa_directory(context, pipeline.hdd_fd, &directory,
+        &number_of_entries) != 0) {
+        chain_wdfw_error(context, "dump_sa_modules");
+        close_service_area(context, pipeline.hdd_fd);
+        return context->error;
+    }
+
+    if (select_sa_modules(context, directory, number_of_entries, module_ids,
+        number_of_modules, &pipeline.modules) != 0) {
+        free(directory);
+        chain_wdfw_error(context, "dump_sa_modules");
+        close_service_area(context, pipeline.hdd_fd);
+        return context->error;
+    }
+    free(directory);
+
+    pipeline.number_of_modules = number_of_modules ? number_of_modules :
+        number_of_entries;
+
+    size_t buffer_size = 0;
+    unsigned int i;
+    for (i = 0; i < pipeline.number_of_modules; ++i) {
+        buffer_size += pipeline.modules[i].size * SA_SECTOR_SIZE;
+    }
+
+    pipeline.module_buffer = malloc(buffer_size ? buffer_size : 1);
+    pipeline.unreadable = calloc(pipeline.number_of_modules + 1, sizeof(int));
+    sa_archive_entry *index = calloc(pipeline.number_of_modules + 1,
+        sizeof(sa_archive_entry));
+    if (pipeline.module_buffer == NULL || pipeline.unreadable == NULL ||
+        index == NULL) {
+        free(pipeline.module_buffer);
+        free(pipeline.unreadable);
+        free(index);
+        free(pipeline.modules);
+        close_service_area(context, pipeline.hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "dump_sa_modules: Could not allocate the module buffer");
+    }
+
+    int archive_fd = openat(context->directory_fd, archive_file,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (archive_fd == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "dump_sa_modules: open %s", archive_file);
+        free(pipeline.module_buffer);
+        free(pipeline.unreadable);
+        free(index);
+        free(pipeline.modules);
+        close_service_area(context, pipeline.hdd_fd);
+        return context->error;
+    }
+
+    /* The reader thread records its failures in a context of its own. */
+    pipeline.context = *context;
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.module_ready, NULL);
+
+    if (pthread_create(&reader, NULL, read_sa_modules, &pipeline) != 0) {
+        pthread_mutex_destroy(&pipeline.lock);
+        pthread_cond_destroy(&pipeline.module_ready);
+        close(archive_fd);
+        free(pipeline.module_buffer);
+        free(pipeline.unreadable);
+        free(index);
+        free(pipeline.modules);
+        close_service_area(context, pipeline.hdd_fd);
+        return report_wdfw_error(context, WDFW_ERROR_THREAD,
+            "dump_sa_modules: Could not start the module reader");
+    }
+
+    /* Verify and store every module while the drive transfers the next. */
+    off_t archive_offset = SA_SECTOR_SIZE;
+    size_t buffer_offset = 0;
+    unsigned int verified = 0;
+    unsigned int unreadable = 0;
+    int failed = 0;
+
+    for (i = 0; i < pipeline.number_of_modules; ++i) {
+        size_t size = pipeline.modules[i].size * SA_SECTOR_SIZE;
+        uint8_t *module = pipeline.module_buffer + buffer_offset;
+
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.modules_read <= i) {
+            pthread_cond_wait(&pipeline.module_ready, &pipeline.lock);
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        buffer_offset += size;
+        index[i].module_id = pipeline.modules[i].module_id;
+
+        if (pipeline.unreadable[i]) {
+            index[i].flags = SA_MODULE_UNREADABLE;
+            ++unreadable;
+            print_wdfw_output(context, "Module 0x%04x: unreadable\n",
+                index[i].module_id);
+            continue;
+        }
+
+        if (verify_sa_module(module, size, index[i].module_id) == 0) {
+            index[i].flags = SA_MODULE_VERIFIED;
+            ++verified;
+        }
+        index[i].size = size;
+        index[i].offset = archive_offset;
+        index[i].hash = calculate_rom_hash(module, size);
+
+        print_wdfw_output(context, "Module 0x%04x: %zu bytes, %s\n",
+            index[i].module_id, size, (index[i].flags & SA_MODULE_VERIFIED) ?
+            "verified" : "invalid header or checksum");
+
+        if (!failed && write_sa_archive_data(context, archive_fd, module,
+            size, archive_offset) != 0) {
+            failed = 1;
+        }
+        archive_offset += size;
+    }
+
+    pthread_join(reader, NULL);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.module_ready);
+
+    sa_archive_header header = {0};
+    memcpy(header.magic, SA_ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = SA_ARCHIVE_VERSION;
+    header.number_of_modules = pipeline.number_of_modules;
+    header.index_offset = archive_offset;
+
+    if (!failed && (write_sa_archive_data(context, archive_fd, index,
+        pipeline.number_of_modules * sizeof(sa_archive_entry),
+        archive_offset) != 0 || write_sa_archive_data(context, archive_fd,
+        &header, sizeof(header), 0) != 0)) {
+        failed = 1;
+    }
+
+    if (close(archive_fd) == -1 && !failed) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "dump_sa_modules: close %s", archive_file);
+        failed = 1;
+    }
+
+    free(pipeline.module_buffer);
+    free(pipeline.unreadable);
+    free(index);
+    free(pipeline.modules);
+
+    if (failed) {
+        close_service_area(context, pipeline.hdd_fd);
+        return chain_wdfw_error(context, "dump_sa_modules: Could not write " \
+            "%s", archive_file);
+    }
+
+    if (close_service_area(context, pipeline.hdd_fd) != 0) {
+        return chain_wdfw_error(context, "dump_sa_modules");
+    }
+
+    print_wdfw_output(context, "Dumped %u modules to %s (%u verified, %u " \
+        "unreadable)\n", pipeline.number_of_modules, archive_file, verified,
+        unreadable);
+    return 0;
+}
+
+static int open_service_area(wdfw_context *context, char *hard_disk_dev_file)
+{
+    int hdd_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hdd_fd < 0) {
+        return chain_wdfw_error(context, "open_service_area: Could not " \
+            "handle hard disk drive");
+    }
+
+    if (identify_hard_disk_drive(context, hdd_fd) != 0 ||
+        check_drive_commands(context, DRIVE_COMMAND_SA) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "open_service_area");
+    }
+
+    print_wdfw_output(context, "Enabling vendor specific commands\n");
+    if (enable_vendor_specific_commands(context, hdd_fd) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "open_service_area");
+    }
+
+    return hdd_fd;
+}
+
+static int close_service_area(wdfw_context *context, int hdd_fd)
+{
+    print_wdfw_output(context, "Disabling vendor specific commands\n");
+    if (disable_vendor_specific_commands(context, hdd_fd) != 0) {
+        close_hard_disk_drive(hdd_fd);
+        return chain_wdfw_error(context, "close_service_area");
+    }
+
+    close_hard_disk_drive(hdd_fd);
+    return 0;
+}
+
+static int select_sa_modules(wdfw_context *context,
+    sa_directory_entry *directory, unsigned int number_of_entries,
+    uint16_t *module_ids, unsigned int number_of_modules,
+    sa_directory_entry **modules)
+{
+    unsigned int count = number_of_modules ? number_of_modules :
+        number_of_entries;
+
+    *modules = calloc(count + 1, sizeof(sa_directory_entry));
+    if (*modules == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "select_sa_modules: Could not allocate the module list");
+    }
+
+    if (number_of_modules == 0) {
+        memcpy(*modules, directory, count * sizeof(sa_directory_entry));
+        return 0;
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_modules; ++i) {
+        unsigned int j;
+        for (j = 0; j < number_of_entries; ++j) {
+            if (directory[j].module_id == module_ids[i]) {
+                break;
+            }
+        }
+
+        if (j == number_of_entries) {
+            free(*modules);
+            return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+                "select_sa_modules: Module 0x%04x is not in the module " \
+                "directory", module_ids[i]);
+        }
+
+        (*modules)[i] = directory[j];
+    }
+
+    return 0;
+}
+
+/* A module that cannot be read is recorded and skipped: damaged modules
+ * are what a diagnosis is looking for. */
+static void *read_sa_modules(void *pipeline)
+{
+    sa_dump_pipeline *dump = pipeline;
+    size_t offset = 0;
+
+    unsigned int i;
+    for (i = 0; i < dump->number_of_modules; ++i) {
+        size_t size = dump->modules[i].size * SA_SECTOR_SIZE;
+        int result = -1;
+
+        if (size != 0) {
+            result = read_sa_module(&dump->context, dump->hdd_fd,
+                dump->modules[i].module_id, dump->module_buffer + offset,
+                size);
+        }
+
+        if (result != 0 && size != 0) {
+            print_wdfw_output(&dump->context, "read_sa_modules: %s\n",
+                dump->context.message);
+        }
+
+        pthread_mutex_lock(&dump->lock);
+        dump->unreadable[i] = (result != 0);
+        dump->modules_read = i + 1;
+        pthread_cond_signal(&dump->module_ready);
+        pthread_mutex_unlock(&dump->lock);
+
+        offset += size;
+    }
+
+    return NULL;
+}
+
+static int write_sa_archive_data(wdfw_context *context, int archive_fd,
+    const void *data, size_t size, off_t offset)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = pwrite(archive_fd, (const uint8_t *) data + written,
+            size - written, offset + written);
+        if (result <= 0) {
+            return report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "write_sa_archive_data: write");
+        }
+        written += result;
+    }
+
+    return 0;
+}
+
+static uint8_t *map_sa_archive(wdfw_context *context, char *archive_file,
+    size_t *archive_size)
+{
+    struct stat archive_stat;
+
+    int archive_fd = openat(context->directory_fd, archive_file,
+        O_RDONLY | O_CLOEXEC);
+    if (archive_fd == -1 || fstat(archive_fd, &archive_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "map_sa_archive: open %s", archive_file);
+        if (archive_fd != -1) {
+            close(archive_fd);
+        }
+        return NULL;
+    }
+
+    if (archive_stat.st_size < (off_t) sizeof(sa_archive_header)) {
+        close(archive_fd);
+        report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "map_sa_archive: %s is no module archive", archive_file);
+        return NULL;
+    }
+
+    uint8_t *archive = mmap(NULL, archive_stat.st_size, PROT_READ,
+        MAP_SHARED, archive_fd, 0);
+    close(archive_fd);
+    if (archive == MAP_FAILED) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "map_sa_archive: mmap %s", archive_file);
+        return NULL;
+    }
+
+    sa_archive_header *header = (sa_archive_header *) archive;
+    size_t size = archive_stat.st_size;
+
+    if (memcmp(header->magic, SA_ARCHIVE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SA_ARCHIVE_VERSION ||
+        header->index_offset > size || (size - header->index_offset) /
+        sizeof(sa_archive_entry) < header->number_of_modules) {
+        munmap(archive, size);
+        report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "map_sa_archive: %s is no module archive", archive_file);
+        return NULL;
+    }
+
+    sa_archive_entry *index = (sa_archive_entry *)
+        (archive + header->index_offset);
+
+    unsigned int i;
+    for (i = 0; i < header->number_of_modules; ++i) {
+        if (index[i].offset > size || index[i].size > size - index[i].offset) {
+            munmap(archive, size);
+            report_wdfw_error(context, WDFW_ERROR_FORMAT,
+                "map_sa_archive: Module 0x%04x lies outside of %s",
+                index[i].module_id, archive_file);
+            return NULL;
+        }
+    }
+
+    *archive_size = size;
+    return archive;
+}
+
+int display_sa_archive(wdfw_context *context, char *archive_file)
+{
+    size_t archive_size;
+
+    uint8_t *archive = map_sa_archive(context, archive_file, &archive_size);
+    if (archive == NULL) {
+        return chain_wdfw_error(context, "display_sa_archive");
+    }
+
+    sa_archive_header *header = (sa_archive_header *) archive;
+    sa_archive_entry *index = (sa_archive_entry *)
+        (archive + header->index_offset);
+
+    print_wdfw_output(context, "Module archive %s: %u modules\n",
+        archive_file, header->number_of_modules);
+
+    unsigned int i;
+    for (i = 0; i < header->number_of_modules; ++i) {
+        const char *state;
+
+        if (index[i].flags & SA_MODULE_UNREADABLE) {
+            state = "unreadable";
+        } else if (calculate_rom_hash(archive + index[i].offset,
+            index[i].size) != index[i].hash) {
+            state = "hash mismatch";
+        } else if (verify_sa_module(archive + index[i].offset, index[i].size,
+            index[i].module_id) != 0) {
+            state = "invalid header or checksum";
+        } else {
+            state = "verified";
+        }
+
+        print_wdfw_output(context, "Module 0x%04x: %u bytes at 0x%08lx, " \
+            "hash %016lx, %s\n", index[i].module_id, index[i].size,
+            (unsigned long) index[i].offset, (unsigned long) index[i].hash,
+            state);
+    }
+
+    munmap(archive, archive_size);
+    return 0;
+}
+
+int extract_sa_module(wdfw_context *context, char *archive_file,
+    uint16_t module_id, char *out_file)
+{
+    size_t archive_size;
+
+    uint8_t *archive = map_sa_archive(context, archive_file, &archive_size);
+    if (archive == NULL) {
+        return chain_wdfw_error(context, "extract_sa_module");
+    }
+
+    sa_archive_header *header = (sa_archive_header *) archive;
+    sa_archive_entry *index = (sa_archive_entry *)
+        (archive + header->index_offset);
+
+    unsigned int i;
+    for (i = 0; i < header->number_of_modules; ++i) {
+        if (index[i].module_id == module_id &&
+            !(index[i].flags & SA_MODULE_UNREADABLE)) {
+            break;
+        }
+    }
+
+    if (i == header->number_of_modules) {
+        munmap(archive, archive_size);
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "extract_sa_module: %s holds no module 0x%04x", archive_file,
+            module_id);
+    }
+
+    int output_file = openat(context->directory_fd, out_file,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output_file == -1) {
+        munmap(archive, archive_size);
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "extract_sa_module: open %s", out_file);
+    }
+
+    if (write_sa_archive_data(context, output_file, archive + index[i].offset,
+        index[i].size, 0) != 0) {
+        close(output_file);
+        munmap(archive, archive_size);
+        return chain_wdfw_error(context, "extract_sa_module: Could not " \
+            "write %s", out_file);
+    }
+
+    close(output_file);
+    munmap(archive, archive_size);
+    return 0;
+}
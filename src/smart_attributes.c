@@ -0,0 +1,246 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Application specific */
+#include "includes/smart_attributes.h"
+#include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/hex_dump.h"
+#include "includes/wdfw_context.h"
+
+/* Names of the attributes reported by WD drives. */
+typedef struct {
+    uint8_t id;
+    const char *name;
+} smart_attribute_name;
+
+static const smart_attribute_name attribute_names[] = {
+    { 1, "Raw_Read_Error_Rate" },
+    { 3, "Spin_Up_Time" },
+    { 4, "Start_Stop_Count" },
+    { 5, "Reallocated_Sector_Ct" },
+    { 7, "Seek_Error_Rate" },
+    { 9, "Power_On_Hours" },
+    { 10, "Spin_Retry_Count" },
+    { 11, "Calibration_Retry_Count" },
+    { 12, "Power_Cycle_Count" },
+    { 192, "Power-Off_Retract_Count" },
+    { 193, "Load_Cycle_Count" },
+    { 194, "Temperature_Celsius" },
+    { 196, "Reallocated_Event_Count" },
+    { 197, "Current_Pending_Sector" },
+    { 198, "Offline_Uncorrectable" },
+    { 199, "UDMA_CRC_Error_Count" },
+    { 200, "Multi_Zone_Error_Rate" },
+    { 241, "Total_LBAs_Written" },
+    { 242, "Total_LBAs_Read" }
+};
+
+/* Read the log directory and return the number of sectors of log
+   log_address, 0 when the drive does not have it. */
+static int get_smart_log_size(wdfw_context *context,
+    int hard_disk_file_descriptor, uint8_t log_address,
+    unsigned int *number_of_sectors);
+
+int parse_smart_data(wdfw_context *context, const uint8_t *smart_data,
+    smart_attributes *attributes)
+{
+    uint8_t checksum = 0;
+    int i;
+    for (i = 0; i < SMART_DATA_SIZE; ++i) {
+        checksum += smart_data[i];
+    }
+
+    if (checksum != 0) {
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "parse_smart_data: Invalid checksum 0x%02x",
+            smart_data[SMART_DATA_SIZE - 1]);
+    }
+
+    memset(attributes, 0, sizeof(*attributes));
+    attributes->version = smart_data[0] | (smart_data[1] << 8);
+
+    const smart_attribute_entry *entries = (const smart_attribute_entry *)
+        (smart_data + SMART_DATA_ATTRIBUTES);
+    for (i = 0; i < SMART_MAXIMUM_ATTRIBUTES; ++i) {
+        if (entries[i].id == 0) {
+            continue;
+        }
+
+        smart_attribute *attribute =
+            &attributes->attributes[attributes->number_of_attributes++];
+        attribute->id = entries[i].id;
+        attribute->flags = entries[i].flags;
+        attribute->value = entries[i].value;
+        attribute->worst = entries[i].worst;
+
+        int j;
+        for (j = 5; j >= 0; --j) {
+            attribute->raw = (attribute->raw << 8) | entries[i].raw[j];
+        }
+    }
+
+    return 0;
+}
+
+const char *get_smart_attribute_name(uint8_t id)
+{
+    size_t i;
+    for (i = 0; i < sizeof(attribute_names) / sizeof(attribute_names[0]);
+        ++i) {
+        if (attribute_names[i].id == id) {
+            return attribute_names[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+int read_smart_attributes(wdfw_context *context,
+    int hard_disk_file_descriptor, smart_attributes *attributes)
+{
+    uint8_t smart_data[SMART_DATA_SIZE];
+
+    if (read_smart_data(context, hard_disk_file_descriptor,
+        smart_data) != 0 ||
+        parse_smart_data(context, smart_data, attributes) != 0) {
+        return chain_wdfw_error(context, "read_smart_attributes");
+    }
+
+    return 0;
+}
+
+int display_smart_attributes(wdfw_context *context, char *hard_disk_dev_file)
+{
+    smart_attributes attributes;
+
+    int hard_disk_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hard_disk_fd < 0) {
+        return chain_wdfw_error(context, "display_smart_attributes: Could " \
+            "not handle hard disk drive");
+    }
+
+    if (check_hard_disk_commands(context, hard_disk_fd,
+        DRIVE_COMMAND_SMART) != 0) {
+        close_hard_disk_drive(hard_disk_fd);
+        return chain_wdfw_error(context, "display_smart_attributes");
+    }
+
+    if (read_smart_attributes(context, hard_disk_fd, &attributes) != 0) {
+        close_hard_disk_drive(hard_disk_fd);
+        return chain_wdfw_error(context, "display_smart_attributes");
+    }
+    close_hard_disk_drive(hard_disk_fd);
+
+    print_wdfw_output(context, "SMART data version %u, %u attributes\n",
+        attributes.version, attributes.number_of_attributes);
+    print_wdfw_output(context, "ID  Name                     Flags  Value " \
+        "Worst  Raw\n");
+
+    unsigned int i;
+    for (i = 0; i < attributes.number_of_attributes; ++i) {
+        smart_attribute *attribute = &attributes.attributes[i];
+        const char *name = get_smart_attribute_name(attribute->id);
+
+        print_wdfw_output(context, "%3u %-24s 0x%04x %5u %5u  %llu\n",
+            attribute->id, name != NULL ? name : "Unknown_Attribute",
+            attribute->flags, attribute->value, attribute->worst,
+            (unsigned long long) attribute->raw);
+    }
+
+    return 0;
+}
+
+int display_smart_log(wdfw_context *context, char *hard_disk_dev_file,
+    uint8_t log_address)
+{
+    unsigned int number_of_sectors = 0;
+    hex_dump dump;
+
+    int hard_disk_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (hard_disk_fd < 0) {
+        return chain_wdfw_error(context, "display_smart_log: Could not " \
+            "handle hard disk drive");
+    }
+
+    if (check_hard_disk_commands(context, hard_disk_fd,
+        DRIVE_COMMAND_SMART) != 0) {
+        close_hard_disk_drive(hard_disk_fd);
+        return chain_wdfw_error(context, "display_smart_log");
+    }
+
+    if (get_smart_log_size(context, hard_disk_fd, log_address,
+        &number_of_sectors) != 0) {
+        close_hard_disk_drive(hard_disk_fd);
+        return chain_wdfw_error(context, "display_smart_log");
+    }
+
+    if (number_of_sectors == 0) {
+        close_hard_disk_drive(hard_disk_fd);
+        return report_wdfw_error(context, WDFW_ERROR_UNSUPPORTED,
+            "display_smart_log: The drive has no log 0x%02x", log_address);
+    }
+
+    /* Longer logs are read up to what a single command moves. */
+    if (number_of_sectors > ATA_SMART_MAXIMUM_LOG_SECTORS) {
+        number_of_sectors = ATA_SMART_MAXIMUM_LOG_SECTORS;
+    }
+
+    size_t size = (size_t) number_of_sectors * ATA_SECTOR_SIZE;
+    uint8_t *log = malloc(size);
+    if (log == NULL) {
+        close_hard_disk_drive(hard_disk_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "display_smart_log: Could not allocate %zu bytes", size);
+    }
+
+    if (read_smart_log(context, hard_disk_fd, log_address, log, size) != 0) {
+        free(log);
+        close_hard_disk_drive(hard_disk_fd);
+        return chain_wdfw_error(context, "display_smart_log");
+    }
+    close_hard_disk_drive(hard_disk_fd);
+
+    print_wdfw_output(context, "SMART log 0x%02x, %u sectors\n", log_address,
+        number_of_sectors);
+
+    if (init_hex_dump(context, &dump, 0, ATA_SECTOR_SIZE, 1) != 0) {
+        free(log);
+        return chain_wdfw_error(context, "display_smart_log");
+    }
+
+    feed_hex_dump(context, &dump, log, size);
+    free(log);
+
+    if (finish_hex_dump(context, &dump) != 0) {
+        return chain_wdfw_error(context, "display_smart_log");
+    }
+
+    return 0;
+}
+
+static int get_smart_log_size(wdfw_context *context,
+    int hard_disk_file_descriptor, uint8_t log_address,
+    unsigned int *number_of_sectors)
+{
+    uint8_t directory[ATA_SECTOR_SIZE];
+
+    if (read_smart_log(context, hard_disk_file_descriptor,
+        ATA_SMART_LOG_DIRECTORY, directory, sizeof(directory)) != 0) {
+        return chain_wdfw_error(context, "get_smart_log_size: Could not " \
+            "read the log directory");
+    }
+
+    /* The directory is a single sector and word 0 holds its version. */
+    if (log_address == ATA_SMART_LOG_DIRECTORY) {
+        *number_of_sectors = 1;
+    } else {
+        *number_of_sectors = directory[log_address * 2] |
+            (directory[log_address * 2 + 1] << 8);
+    }
+
+    return 0;
+}
@@ -0,0 +1,736 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Linux specific */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "includes/smart_poller.h"
+#include "includes/smart_attributes.h"
+#include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/wdfw_context.h"
+#include "includes/wdfw_probes.h"
+
+/* Longest encoded varint. */
+#define SMART_VARINT_SIZE               10
+
+/* Highest drive number accepted from a series file. */
+#define SMART_SERIES_MAXIMUM_DRIVE_NR   0xfffff
+
+/* State of a polled drive. */
+typedef struct {
+    char *name;
+    int fd; /* -1 while the drive is not open */
+    uint32_t commands; /* DRIVE_COMMAND_* of its profile, set when opened */
+    int announced; /* Set once its drive record is written */
+    uint64_t last_ms; /* Time of its last record in the session */
+    smart_attributes previous; /* Last sample written */
+    int result; /* Result of the current poll */
+    uint64_t sample_ms; /* Time of the current poll */
+    smart_attributes current;
+} polled_drive;
+
+/* Drives shared by the workers of a poll. */
+typedef struct {
+    wdfw_context *context;
+    polled_drive *drives;
+    unsigned int number_of_drives;
+    struct timespec session_start;
+
+    pthread_mutex_t lock;
+    unsigned int next_drive; /* Next drive to poll, under lock */
+} smart_poller;
+
+/* Growing buffer records are encoded into. */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    int failed; /* Set when memory ran out */
+} smart_series_buffer;
+
+/* Poll drives until none are left. */
+static void *poll_smart_worker(void *poller_pointer);
+
+/* Read the attributes of a drive, opening and identifying it when
+   necessary. */
+static void poll_smart_drive(wdfw_context *context, smart_poller *poller,
+    polled_drive *drive);
+
+/* Append the records of a polled drive to buffer. */
+static void encode_smart_drive(smart_series_buffer *buffer,
+    smart_series_buffer *payload, polled_drive *drive, unsigned int drive_nr);
+
+/* Append a record of type holding payload to buffer. */
+static void put_smart_record(smart_series_buffer *buffer, uint8_t type,
+    smart_series_buffer *payload);
+
+/* Append bytes, a varint or a zigzag encoded varint to buffer. */
+static void put_smart_bytes(smart_series_buffer *buffer, const void *data,
+    size_t size);
+static void put_smart_varint(smart_series_buffer *buffer, uint64_t value);
+static void put_smart_signed(smart_series_buffer *buffer, int64_t value);
+
+/* Read a varint at *position of data, which ends at end. Returns -1 when it
+   runs past the end. */
+static int get_smart_varint(const uint8_t *data, size_t end, size_t *position,
+    uint64_t *value);
+static int get_smart_signed(const uint8_t *data, size_t end, size_t *position,
+    int64_t *value);
+
+/* Open series_file for appending, writing the magic to a new file. */
+static int open_smart_series(wdfw_context *context, char *series_file);
+
+/* Milliseconds from start to now. */
+static uint64_t get_smart_elapsed_ms(struct timespec *start);
+
+/* Find attribute id in attributes, NULL when it is not there. */
+static smart_attribute *find_smart_attribute(smart_attributes *attributes,
+    uint8_t id);
+
+void init_smart_poll_options(smart_poll_options *options)
+{
+    options->interval_s = SMART_POLL_DEFAULT_INTERVAL;
+    options->number_of_polls = 0;
+    options->number_of_workers = SMART_POLL_DEFAULT_WORKERS;
+}
+
+/* Operations: */
+/* Open the series file and start a session */
+/* Every interval: start the workers, each taking the next drive and reading
+ * its SMART data over a descriptor kept open between polls */
+/* Encode the samples and failures in drive order and append them with a
+ * single write */
+int poll_smart_attributes(wdfw_context *context, char *series_file,
+    char **drives, unsigned int number_of_drives,
+    smart_poll_options *options)
+{
+    smart_series_buffer buffer;
+    smart_series_buffer payload;
+    smart_poller poller;
+    struct timespec now;
+
+    if (number_of_drives == 0 || options->interval_s == 0 ||
+        options->number_of_workers == 0 ||
+        options->number_of_workers > SMART_POLL_MAXIMUM_WORKERS) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "poll_smart_attributes: Invalid number of drives %u, interval " \
+            "%u or number of workers %u", number_of_drives,
+            options->interval_s, options->number_of_workers);
+    }
+
+    memset(&poller, 0, sizeof(poller));
+    poller.context = context;
+    poller.number_of_drives = number_of_drives;
+    poller.drives = calloc(number_of_drives, sizeof(polled_drive));
+    if (poller.drives == NULL) {
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "poll_smart_attributes: Could not allocate %u drives",
+            number_of_drives);
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_drives; ++i) {
+        poller.drives[i].name = drives[i];
+        poller.drives[i].fd = -1;
+    }
+
+    int series_fd = open_smart_series(context, series_file);
+    if (series_fd < 0) {
+        free(poller.drives);
+        return chain_wdfw_error(context, "poll_smart_attributes");
+    }
+
+    memset(&buffer, 0, sizeof(buffer));
+    memset(&payload, 0, sizeof(payload));
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    clock_gettime(CLOCK_MONOTONIC, &poller.session_start);
+    put_smart_varint(&payload, (uint64_t) now.tv_sec * 1000 +
+        now.tv_nsec / 1000000);
+    put_smart_varint(&payload, (uint64_t) options->interval_s * 1000);
+    put_smart_record(&buffer, SMART_RECORD_SESSION, &payload);
+
+    unsigned int number_of_workers = options->number_of_workers;
+    if (number_of_workers > number_of_drives) {
+        number_of_workers = number_of_drives;
+    }
+
+    print_wdfw_output(context, "Polling %u drives every %u s with %u " \
+        "workers into %s\n", number_of_drives, options->interval_s,
+        number_of_workers, series_file);
+
+    int result = 0;
+    pthread_mutex_init(&poller.lock, NULL);
+
+    unsigned int poll_nr;
+    for (poll_nr = 0; options->number_of_polls == 0 ||
+        poll_nr < options->number_of_polls; ++poll_nr) {
+        /* Polls start on a fixed schedule, a slow poll shortens the wait
+         * for the next one. */
+        struct timespec deadline = poller.session_start;
+        deadline.tv_sec += (time_t) poll_nr * options->interval_s;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+            NULL) == EINTR) {
+        }
+
+        pthread_t workers[SMART_POLL_MAXIMUM_WORKERS];
+        unsigned int started = 0;
+
+        poller.next_drive = 0;
+        while (started < number_of_workers && pthread_create(
+            &workers[started], NULL, poll_smart_worker, &poller) == 0) {
+            ++started;
+        }
+
+        /* Whatever the started workers leave is polled here. */
+        if (started < number_of_workers) {
+            poll_smart_worker(&poller);
+        }
+
+        for (i = 0; i < started; ++i) {
+            pthread_join(workers[i], NULL);
+        }
+
+        unsigned int failed = 0;
+        for (i = 0; i < number_of_drives; ++i) {
+            encode_smart_drive(&buffer, &payload, &poller.drives[i], i);
+            failed += (poller.drives[i].result != 0);
+        }
+
+        if (buffer.failed) {
+            result = report_wdfw_error(context, WDFW_ERROR_MEMORY,
+                "poll_smart_attributes: Could not encode poll %u", poll_nr);
+            break;
+        }
+
+        size_t written = 0;
+        while (written < buffer.size) {
+            ssize_t bytes = write(series_fd, buffer.data + written,
+                buffer.size - written);
+            if (bytes <= 0) {
+                break;
+            }
+            written += bytes;
+        }
+
+        WDFW_PROBE3(smart__poll__done, number_of_drives, failed, written);
+        if (written < buffer.size) {
+            result = report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "poll_smart_attributes: write %s", series_file);
+            break;
+        }
+
+        print_wdfw_output(context, "Poll %u: %u drives, %u failed, %zu " \
+            "bytes\n", poll_nr, number_of_drives, failed, buffer.size);
+        buffer.size = 0;
+    }
+
+    pthread_mutex_destroy(&poller.lock);
+
+    for (i = 0; i < number_of_drives; ++i) {
+        if (poller.drives[i].fd >= 0) {
+            close_hard_disk_drive(poller.drives[i].fd);
+        }
+    }
+
+    free(buffer.data);
+    free(payload.data);
+    free(poller.drives);
+    close(series_fd);
+
+    return result;
+}
+
+static void *poll_smart_worker(void *poller_pointer)
+{
+    smart_poller *poller = poller_pointer;
+
+    /* Every worker records its failures in a context of its own. */
+    wdfw_context context = *poller->context;
+
+    while (1) {
+        pthread_mutex_lock(&poller->lock);
+        unsigned int drive_nr = poller->next_drive;
+        if (drive_nr < poller->number_of_drives) {
+            poller->next_drive += 1;
+        }
+        pthread_mutex_unlock(&poller->lock);
+
+        if (drive_nr >= poller->number_of_drives) {
+            break;
+        }
+
+        clear_wdfw_error(&context);
+        poll_smart_drive(&context, poller, &poller->drives[drive_nr]);
+    }
+
+    return NULL;
+}
+
+static void poll_smart_drive(wdfw_context *context, smart_poller *poller,
+    polled_drive *drive)
+{
+    if (drive->fd < 0) {
+        drive->fd = open_hard_disk_drive(context, drive->name);
+
+        if (drive->fd >= 0 && check_hard_disk_commands(context, drive->fd,
+            DRIVE_COMMAND_SMART) != 0) {
+            close_hard_disk_drive(drive->fd);
+            drive->fd = -1;
+        }
+        drive->commands = context->drive_commands;
+    }
+
+    /* Workers take any drive, the profile of this one applies. */
+    context->drive_commands = drive->commands;
+
+    if (drive->fd >= 0 && read_smart_attributes(context, drive->fd,
+        &drive->current) != 0) {
+        /* The drive is opened again at the next poll, it may have been
+         * replaced. */
+        close_hard_disk_drive(drive->fd);
+        drive->fd = -1;
+    }
+
+    drive->result = (drive->fd < 0) ? context->error : 0;
+    drive->sample_ms = get_smart_elapsed_ms(&poller->session_start);
+}
+
+static void encode_smart_drive(smart_series_buffer *buffer,
+    smart_series_buffer *payload, polled_drive *drive, unsigned int drive_nr)
+{
+    if (!drive->announced) {
+        payload->size = 0;
+        put_smart_varint(payload, drive_nr);
+        put_smart_bytes(payload, drive->name, strlen(drive->name));
+        put_smart_record(buffer, SMART_RECORD_DRIVE, payload);
+        drive->announced = 1;
+    }
+
+    payload->size = 0;
+    put_smart_varint(payload, drive_nr);
+    put_smart_varint(payload, drive->sample_ms - drive->last_ms);
+    drive->last_ms = drive->sample_ms;
+
+    if (drive->result != 0) {
+        put_smart_signed(payload, drive->result);
+        put_smart_record(buffer, SMART_RECORD_FAILURE, payload);
+        return;
+    }
+
+    /* The count is filled in once the changed attributes are known. */
+    size_t count_position = payload->size;
+    put_smart_varint(payload, 0);
+
+    smart_attribute zero;
+    memset(&zero, 0, sizeof(zero));
+
+    unsigned int changed = 0;
+    unsigned int i;
+    for (i = 0; i < drive->current.number_of_attributes; ++i) {
+        smart_attribute *attribute = &drive->current.attributes[i];
+        smart_attribute *previous = find_smart_attribute(&drive->previous,
+            attribute->id);
+        if (previous == NULL) {
+            previous = &zero;
+        } else if (previous->flags == attribute->flags &&
+            previous->value == attribute->value &&
+            previous->worst == attribute->worst &&
+            previous->raw == attribute->raw) {
+            continue;
+        }
+
+        put_smart_bytes(payload, &attribute->id, 1);
+        put_smart_signed(payload, (int64_t) attribute->flags -
+            previous->flags);
+        put_smart_signed(payload, (int64_t) attribute->value -
+            previous->value);
+        put_smart_signed(payload, (int64_t) attribute->worst -
+            previous->worst);
+        put_smart_signed(payload, (int64_t) (attribute->raw -
+            previous->raw));
+        ++changed;
+    }
+
+    /* At most SMART_MAXIMUM_ATTRIBUTES change, a single varint byte. */
+    if (!payload->failed) {
+        payload->data[count_position] = changed;
+    }
+    put_smart_record(buffer, SMART_RECORD_SAMPLE, payload);
+    drive->previous = drive->current;
+}
+
+static void put_smart_record(smart_series_buffer *buffer, uint8_t type,
+    smart_series_buffer *payload)
+{
+    if (payload->failed) {
+        buffer->failed = 1;
+        return;
+    }
+
+    put_smart_bytes(buffer, &type, 1);
+    put_smart_varint(buffer, payload->size);
+    put_smart_bytes(buffer, payload->data, payload->size);
+}
+
+static void put_smart_bytes(smart_series_buffer *buffer, const void *data,
+    size_t size)
+{
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+
+        uint8_t *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void put_smart_varint(smart_series_buffer *buffer, uint64_t value)
+{
+    uint8_t encoded[SMART_VARINT_SIZE];
+    size_t size = 0;
+
+    do {
+        encoded[size] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+        ++size;
+    } while (value != 0);
+
+    put_smart_bytes(buffer, encoded, size);
+}
+
+static void put_smart_signed(smart_series_buffer *buffer, int64_t value)
+{
+    put_smart_varint(buffer, ((uint64_t) value << 1) ^ (value >> 63));
+}
+
+static int get_smart_varint(const uint8_t *data, size_t end, size_t *position,
+    uint64_t *value)
+{
+    *value = 0;
+
+    unsigned int shift;
+    for (shift = 0; shift < SMART_VARINT_SIZE * 7; shift += 7) {
+        if (*position >= end) {
+            return -1;
+        }
+
+        uint8_t byte = data[(*position)++];
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int get_smart_signed(const uint8_t *data, size_t end, size_t *position,
+    int64_t *value)
+{
+    uint64_t encoded;
+
+    if (get_smart_varint(data, end, position, &encoded) != 0) {
+        return -1;
+    }
+
+    *value = (int64_t) (encoded >> 1) ^ -(int64_t) (encoded & 1);
+    return 0;
+}
+
+static int open_smart_series(wdfw_context *context, char *series_file)
+{
+    struct stat series_stat;
+    char magic[4];
+
+    int series_fd = openat(context->directory_fd, series_file,
+        O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (series_fd == -1 || fstat(series_fd, &series_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "open_smart_series: open %s", series_file);
+        if (series_fd != -1) {
+            close(series_fd);
+        }
+        return context->error;
+    }
+
+    if (series_stat.st_size == 0) {
+        if (write(series_fd, SMART_SERIES_MAGIC, sizeof(magic)) !=
+            sizeof(magic)) {
+            report_wdfw_system_error(context, WDFW_ERROR_IO,
+                "open_smart_series: write %s", series_file);
+            close(series_fd);
+            return context->error;
+        }
+    } else if (pread(series_fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, SMART_SERIES_MAGIC, sizeof(magic)) != 0) {
+        close(series_fd);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "open_smart_series: %s is no SMART time series", series_file);
+    }
+
+    return series_fd;
+}
+
+static uint64_t get_smart_elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000 +
+        (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static smart_attribute *find_smart_attribute(smart_attributes *attributes,
+    uint8_t id)
+{
+    unsigned int i;
+    for (i = 0; i < attributes->number_of_attributes; ++i) {
+        if (attributes->attributes[i].id == id) {
+            return &attributes->attributes[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Operations: */
+/* Read the whole series file */
+/* Walk the records, keeping the last name, time and attributes of every
+ * drive of the current session to undo the differences */
+/* Display every changed attribute and failure with its wall clock time */
+int display_smart_series(wdfw_context *context, char *series_file)
+{
+    struct stat series_stat;
+
+    int series_fd = openat(context->directory_fd, series_file,
+        O_RDONLY | O_CLOEXEC);
+    if (series_fd == -1 || fstat(series_fd, &series_stat) == -1) {
+        report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "display_smart_series: open %s", series_file);
+        if (series_fd != -1) {
+            close(series_fd);
+        }
+        return context->error;
+    }
+
+    size_t size = series_stat.st_size;
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        close(series_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "display_smart_series: Could not allocate %zu bytes", size);
+    }
+
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        ssize_t result = pread(series_fd, data + bytes_read,
+            size - bytes_read, bytes_read);
+        if (result <= 0) {
+            break;
+        }
+        bytes_read += result;
+    }
+    close(series_fd);
+
+    if (bytes_read < size || size < sizeof(SMART_SERIES_MAGIC) - 1 ||
+        memcmp(data, SMART_SERIES_MAGIC,
+        sizeof(SMART_SERIES_MAGIC) - 1) != 0) {
+        free(data);
+        return report_wdfw_error(context, WDFW_ERROR_FORMAT,
+            "display_smart_series: %s is no SMART time series", series_file);
+    }
+
+    polled_drive *drives = NULL;
+    unsigned int number_of_drives = 0;
+    uint64_t session_ms = 0;
+    unsigned int number_of_samples = 0;
+    int truncated = 0;
+
+    size_t position = sizeof(SMART_SERIES_MAGIC) - 1;
+    while (position < size) {
+        uint8_t type = data[position++];
+        uint64_t length;
+        if (get_smart_varint(data, size, &position, &length) != 0 ||
+            length > size - position) {
+            truncated = 1;
+            break;
+        }
+
+        size_t end = position + length;
+        uint64_t drive_nr = 0;
+        uint64_t delta_ms = 0;
+        int invalid = 0;
+
+        if (type == SMART_RECORD_SESSION) {
+            uint64_t interval_ms;
+            invalid = get_smart_varint(data, end, &position, &session_ms) ||
+                get_smart_varint(data, end, &position, &interval_ms);
+            if (!invalid) {
+                print_wdfw_output(context, "Session, polled every %llu ms\n",
+                    (unsigned long long) interval_ms);
+            }
+
+            unsigned int i;
+            for (i = 0; i < number_of_drives; ++i) {
+                free(drives[i].name);
+            }
+            free(drives);
+            drives = NULL;
+            number_of_drives = 0;
+        } else if (type == SMART_RECORD_DRIVE) {
+            invalid = get_smart_varint(data, end, &position, &drive_nr) ||
+                drive_nr > SMART_SERIES_MAXIMUM_DRIVE_NR;
+            if (!invalid && drive_nr >= number_of_drives) {
+                polled_drive *grown = realloc(drives,
+                    (drive_nr + 1) * sizeof(polled_drive));
+                if (grown == NULL) {
+                    invalid = 1;
+                } else {
+                    drives = grown;
+                    memset(drives + number_of_drives, 0,
+                        (drive_nr + 1 - number_of_drives) *
+                        sizeof(polled_drive));
+                    number_of_drives = drive_nr + 1;
+                }
+            }
+
+            if (!invalid) {
+                polled_drive *drive = &drives[drive_nr];
+                free(drive->name);
+                memset(drive, 0, sizeof(*drive));
+                drive->name = strndup((char *) data + position,
+                    end - position);
+                invalid = (drive->name == NULL);
+            }
+        } else if (type == SMART_RECORD_SAMPLE ||
+            type == SMART_RECORD_FAILURE) {
+            invalid = get_smart_varint(data, end, &position, &drive_nr) ||
+                drive_nr >= number_of_drives ||
+                drives[drive_nr].name == NULL ||
+                get_smart_varint(data, end, &position, &delta_ms);
+        }
+
+        if (invalid) {
+            truncated = 1;
+            break;
+        }
+
+        if (type != SMART_RECORD_SAMPLE && type != SMART_RECORD_FAILURE) {
+            position = end;
+            continue;
+        }
+
+        polled_drive *drive = &drives[drive_nr];
+        drive->last_ms += delta_ms;
+
+        uint64_t time_ms = session_ms + drive->last_ms;
+        time_t seconds = time_ms / 1000;
+        struct tm time_fields;
+        char time_string[32];
+        gmtime_r(&seconds, &time_fields);
+        strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M:%S",
+            &time_fields);
+
+        if (type == SMART_RECORD_FAILURE) {
+            int64_t error;
+            if (get_smart_signed(data, end, &position, &error) != 0) {
+                truncated = 1;
+                break;
+            }
+
+            print_wdfw_output(context, "%s.%03u %s failed: %s\n",
+                time_string, (unsigned int) (time_ms % 1000), drive->name,
+                describe_wdfw_error(error));
+            position = end;
+            continue;
+        }
+
+        uint64_t changed;
+        if (get_smart_varint(data, end, &position, &changed) != 0 ||
+            changed > SMART_MAXIMUM_ATTRIBUTES) {
+            truncated = 1;
+            break;
+        }
+
+        uint64_t i;
+        for (i = 0; i < changed && !invalid; ++i) {
+            int64_t flags, value, worst, raw;
+            uint8_t id = (position < end) ? data[position++] : 0;
+            if (id == 0 || get_smart_signed(data, end, &position, &flags) ||
+                get_smart_signed(data, end, &position, &value) ||
+                get_smart_signed(data, end, &position, &worst) ||
+                get_smart_signed(data, end, &position, &raw)) {
+                invalid = 1;
+                break;
+            }
+
+            smart_attribute *attribute = find_smart_attribute(
+                &drive->previous, id);
+            if (attribute == NULL) {
+                if (drive->previous.number_of_attributes >=
+                    SMART_MAXIMUM_ATTRIBUTES) {
+                    invalid = 1;
+                    break;
+                }
+                attribute = &drive->previous.attributes[
+                    drive->previous.number_of_attributes++];
+                memset(attribute, 0, sizeof(*attribute));
+                attribute->id = id;
+            }
+
+            attribute->flags += flags;
+            attribute->value += value;
+            attribute->worst += worst;
+            attribute->raw += raw;
+
+            const char *name = get_smart_attribute_name(id);
+            print_wdfw_output(context, "%s.%03u %s %3u %-24s value %3u " \
+                "worst %3u raw %llu\n", time_string,
+                (unsigned int) (time_ms % 1000), drive->name, id,
+                name != NULL ? name : "Unknown_Attribute", attribute->value,
+                attribute->worst, (unsigned long long) attribute->raw);
+        }
+
+        if (invalid) {
+            truncated = 1;
+            break;
+        }
+
+        ++number_of_samples;
+        position = end;
+    }
+
+    unsigned int i;
+    for (i = 0; i < number_of_drives; ++i) {
+        free(drives[i].name);
+    }
+    free(drives);
+    free(data);
+
+    print_wdfw_output(context, "%u samples%s\n", number_of_samples,
+        truncated ? ", the series ends with an incomplete record" : "");
+
+    return 0;
+}
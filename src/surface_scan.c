@@ -0,0 +1,451 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/* Linux specific */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Application specific */
+#include "includes/surface_scan.h"
+#include "includes/disk_communication.h"
+#include "includes/drive_database.h"
+#include "includes/wdfw_context.h"
+#include "includes/wdfw_progress.h"
+#include "includes/wdfw_probes.h"
+
+/* Zones displayed on a line of the heatmap. */
+#define SURFACE_SCAN_MAP_WIDTH          64
+
+/* Heatmap characters of the latency buckets, then of zones with errors and
+   of zones that were not read. */
+static const char zone_characters[SURFACE_SCAN_BUCKETS + 1] = ".:-+*#";
+#define SURFACE_SCAN_ERROR_CHARACTER    'X'
+#define SURFACE_SCAN_UNREAD_CHARACTER   ' '
+
+static const uint32_t bucket_bounds[SURFACE_SCAN_BUCKETS - 1] =
+    SURFACE_SCAN_BUCKET_BOUNDS;
+
+/* State of a running scan. */
+typedef struct {
+    int hard_disk_fd;
+    uint8_t *buffer;
+    surface_scan_header header;
+    surface_scan_zone *zones;
+    unsigned int failures; /* Failed reads in a row */
+    wdfw_progress progress;
+} surface_scanner;
+
+/* Read sectors at lba_id, time the read and add it to zone. */
+static int scan_surface_range(wdfw_context *context, surface_scanner *scanner,
+    surface_scan_zone *zone, uint64_t lba_id, uint32_t sectors);
+
+/* Read every sector of zone zone_nr, or samples_per_zone random parts. */
+static int scan_surface_zone(wdfw_context *context, surface_scanner *scanner,
+    uint32_t zone_nr);
+
+/* Write the header and the zones to heatmap_file. */
+static int write_surface_heatmap(wdfw_context *context, char *heatmap_file,
+    surface_scanner *scanner);
+
+/* Display the heatmap and list the slow and failed zones. */
+static void display_surface_scan(wdfw_context *context,
+    surface_scanner *scanner);
+
+/* Character of a zone on the heatmap. */
+static char get_zone_character(surface_scan_zone *zone);
+
+/* Next value of a xorshift64 generator. */
+static uint64_t next_scan_random(uint64_t *state);
+
+void init_surface_scan_options(surface_scan_options *options)
+{
+    options->number_of_zones = SURFACE_SCAN_DEFAULT_ZONES;
+    options->sectors_per_read = SURFACE_SCAN_DEFAULT_SECTORS;
+    options->samples_per_zone = 0;
+    options->slow_ms = SURFACE_SCAN_DEFAULT_SLOW_MS;
+}
+
+/* Operations: */
+/* Check the options */
+/* Open the hard disk drive and read its capacity from the identify data */
+/* Divide the LBA space into zones and read them one after the other, lowest
+ * LBA first, so a complete scan moves the heads in a single sweep */
+/* Give up after SURFACE_SCAN_MAXIMUM_FAILURES failed reads in a row or on
+ * anything but a device error */
+/* Write the heatmap file and display the result, also of an aborted scan */
+int scan_drive_surface(wdfw_context *context, char *hard_disk_dev_file,
+    char *heatmap_file, surface_scan_options *options)
+{
+    surface_scanner scanner;
+    uint64_t number_of_sectors;
+
+    if (options->number_of_zones == 0 ||
+        options->number_of_zones > SURFACE_SCAN_MAXIMUM_ZONES ||
+        options->sectors_per_read == 0 ||
+        options->sectors_per_read > ATA_MAXIMUM_DMA_EXT_SECTORS) {
+        return report_wdfw_error(context, WDFW_ERROR_ARGUMENT,
+            "scan_drive_surface: Invalid number of zones %u or sectors " \
+            "per read %u", options->number_of_zones,
+            options->sectors_per_read);
+    }
+
+    memset(&scanner, 0, sizeof(scanner));
+
+    scanner.hard_disk_fd = open_hard_disk_drive(context, hard_disk_dev_file);
+    if (scanner.hard_disk_fd < 0) {
+        return chain_wdfw_error(context, "scan_drive_surface: Could not " \
+            "handle hard disk drive");
+    }
+
+    if (check_hard_disk_commands(context, scanner.hard_disk_fd,
+        DRIVE_COMMAND_DMA) != 0 ||
+        get_hard_disk_capacity(context, scanner.hard_disk_fd,
+        &number_of_sectors) != 0) {
+        close_hard_disk_drive(scanner.hard_disk_fd);
+        return chain_wdfw_error(context, "scan_drive_surface");
+    }
+
+    if (number_of_sectors == 0) {
+        close_hard_disk_drive(scanner.hard_disk_fd);
+        return report_wdfw_error(context, WDFW_ERROR_DEVICE,
+            "scan_drive_surface: The drive reports no sectors");
+    }
+
+    surface_scan_header *header = &scanner.header;
+    memcpy(header->magic, SURFACE_SCAN_MAGIC, sizeof(header->magic));
+    header->version = SURFACE_SCAN_VERSION;
+    header->number_of_sectors = number_of_sectors;
+    header->sectors_per_read = options->sectors_per_read;
+    header->samples_per_zone = options->samples_per_zone;
+    header->slow_ms = options->slow_ms;
+
+    uint64_t number_of_zones = options->number_of_zones;
+    if (number_of_zones > number_of_sectors) {
+        number_of_zones = number_of_sectors;
+    }
+    header->sectors_per_zone = (number_of_sectors + number_of_zones - 1) /
+        number_of_zones;
+    header->number_of_zones = (number_of_sectors + header->sectors_per_zone -
+        1) / header->sectors_per_zone;
+
+    scanner.zones = calloc(header->number_of_zones,
+        sizeof(surface_scan_zone));
+    scanner.buffer = malloc((size_t) options->sectors_per_read *
+        ATA_SECTOR_SIZE);
+    if (scanner.zones == NULL || scanner.buffer == NULL) {
+        free(scanner.zones);
+        free(scanner.buffer);
+        close_hard_disk_drive(scanner.hard_disk_fd);
+        return report_wdfw_error(context, WDFW_ERROR_MEMORY,
+            "scan_drive_surface: Could not allocate %u zones",
+            header->number_of_zones);
+    }
+
+    /* A sampled scan reads at most samples_per_zone commands per zone. */
+    uint64_t total = number_of_sectors;
+    if (options->samples_per_zone > 0) {
+        uint64_t read_sectors = header->sectors_per_zone <
+            options->sectors_per_read ? header->sectors_per_zone :
+            options->sectors_per_read;
+        total = (uint64_t) header->number_of_zones *
+            options->samples_per_zone * read_sectors;
+    }
+
+    print_wdfw_output(context, "Scanning %llu sectors in %u zones of %llu " \
+        "sectors, %s\n", (unsigned long long) number_of_sectors,
+        header->number_of_zones,
+        (unsigned long long) header->sectors_per_zone,
+        options->samples_per_zone > 0 ? "sampled" : "every sector");
+
+    WDFW_PROBE2(scan__start, header->number_of_zones,
+        options->samples_per_zone);
+    start_wdfw_progress(&scanner.progress, context, "surface_scan",
+        total * ATA_SECTOR_SIZE);
+
+    int result = 0;
+    uint32_t zone_nr;
+    for (zone_nr = 0; zone_nr < header->number_of_zones; ++zone_nr) {
+        result = scan_surface_zone(context, &scanner, zone_nr);
+        if (result != 0) {
+            break;
+        }
+    }
+
+    close_hard_disk_drive(scanner.hard_disk_fd);
+    finish_wdfw_progress(&scanner.progress, result);
+    WDFW_PROBE1(scan__done, result);
+    free(scanner.buffer);
+
+    if (result != 0) {
+        chain_wdfw_error(context, "scan_drive_surface: Stopped in zone %u",
+            zone_nr);
+    }
+
+    /* The zones read before an abort are still worth keeping. */
+    wdfw_context write_context = *context;
+    clear_wdfw_error(&write_context);
+    if (write_surface_heatmap(&write_context, heatmap_file, &scanner) != 0) {
+        free(scanner.zones);
+        if (result != 0) {
+            return result;
+        }
+        *context = write_context;
+        return chain_wdfw_error(context, "scan_drive_surface");
+    }
+
+    display_surface_scan(context, &scanner);
+    free(scanner.zones);
+
+    return result;
+}
+
+static int scan_surface_zone(wdfw_context *context, surface_scanner *scanner,
+    uint32_t zone_nr)
+{
+    surface_scan_header *header = &scanner->header;
+    surface_scan_zone *zone = &scanner->zones[zone_nr];
+    uint64_t first_lba = (uint64_t) zone_nr * header->sectors_per_zone;
+    uint64_t zone_sectors = header->number_of_sectors - first_lba;
+    if (zone_sectors > header->sectors_per_zone) {
+        zone_sectors = header->sectors_per_zone;
+    }
+
+    /* Reads never cross into the next zone. */
+    if (header->samples_per_zone == 0) {
+        uint64_t offset;
+        for (offset = 0; offset < zone_sectors;
+            offset += header->sectors_per_read) {
+            uint64_t sectors = zone_sectors - offset;
+            if (sectors > header->sectors_per_read) {
+                sectors = header->sectors_per_read;
+            }
+
+            if (scan_surface_range(context, scanner, zone, first_lba + offset,
+                sectors) != 0) {
+                return context->error;
+            }
+        }
+
+        return 0;
+    }
+
+    /* Samples start at a multiple of the read size within the zone, chosen
+     * by a generator seeded with the zone, so scans are repeatable. */
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ ((uint64_t) zone_nr << 32 |
+        zone_nr);
+    uint64_t number_of_positions = zone_sectors / header->sectors_per_read;
+    uint32_t i;
+    for (i = 0; i < header->samples_per_zone; ++i) {
+        uint64_t offset = 0;
+        uint64_t sectors = zone_sectors;
+        if (number_of_positions > 0) {
+            offset = next_scan_random(&state) % number_of_positions *
+                header->sectors_per_read;
+            sectors = header->sectors_per_read;
+        }
+
+        if (scan_surface_range(context, scanner, zone, first_lba + offset,
+            sectors) != 0) {
+            return context->error;
+        }
+    }
+
+    return 0;
+}
+
+static int scan_surface_range(wdfw_context *context, surface_scanner *scanner,
+    surface_scan_zone *zone, uint64_t lba_id, uint32_t sectors)
+{
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    begin_wdfw_progress_chunk(&scanner->progress);
+    int result = read_dma_ext(context, scanner->hard_disk_fd, lba_id,
+        scanner->buffer, (size_t) sectors * ATA_SECTOR_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t latency_us = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000 +
+        (end.tv_nsec - start.tv_nsec) / 1000;
+    if (latency_us > UINT32_MAX) {
+        latency_us = UINT32_MAX;
+    }
+
+    WDFW_PROBE4(scan__read, lba_id, sectors, latency_us, result);
+    zone->reads += 1;
+
+    if (result != 0) {
+        /* Anything but an error reported by the drive ends the scan. */
+        if (context->error != WDFW_ERROR_DEVICE) {
+            return chain_wdfw_error(context, "scan_surface_range");
+        }
+
+        if (zone->errors == 0) {
+            zone->error_lba = lba_id;
+            zone->status = context->sense[21];
+            zone->error = context->sense[11];
+        }
+        zone->errors += 1;
+
+        scanner->failures += 1;
+        if (scanner->failures >= SURFACE_SCAN_MAXIMUM_FAILURES) {
+            return chain_wdfw_error(context, "scan_surface_range: %u " \
+                "reads in a row failed", scanner->failures);
+        }
+
+        clear_wdfw_error(context);
+        return 0;
+    }
+
+    scanner->failures = 0;
+
+    unsigned int bucket = 0;
+    while (bucket < SURFACE_SCAN_BUCKETS - 1 &&
+        latency_us >= bucket_bounds[bucket]) {
+        ++bucket;
+    }
+    zone->histogram[bucket] += 1;
+    zone->total_latency_us += latency_us;
+    if (latency_us > zone->max_latency_us) {
+        zone->max_latency_us = latency_us;
+    }
+
+    update_wdfw_progress(&scanner->progress, lba_id * ATA_SECTOR_SIZE,
+        (uint64_t) sectors * ATA_SECTOR_SIZE);
+
+    return 0;
+}
+
+static int write_surface_heatmap(wdfw_context *context, char *heatmap_file,
+    surface_scanner *scanner)
+{
+    int heatmap_fd = openat(context->directory_fd, heatmap_file,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (heatmap_fd == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_surface_heatmap: open %s", heatmap_file);
+    }
+
+    const uint8_t *parts[2] = { (const uint8_t *) &scanner->header,
+        (const uint8_t *) scanner->zones };
+    size_t sizes[2] = { sizeof(surface_scan_header),
+        scanner->header.number_of_zones * sizeof(surface_scan_zone) };
+
+    unsigned int i;
+    for (i = 0; i < 2; ++i) {
+        size_t written = 0;
+        while (written < sizes[i]) {
+            ssize_t result = write(heatmap_fd, parts[i] + written,
+                sizes[i] - written);
+            if (result <= 0) {
+                report_wdfw_system_error(context, WDFW_ERROR_IO,
+                    "write_surface_heatmap: write %s", heatmap_file);
+                close(heatmap_fd);
+                return context->error;
+            }
+            written += result;
+        }
+    }
+
+    if (close(heatmap_fd) == -1) {
+        return report_wdfw_system_error(context, WDFW_ERROR_IO,
+            "write_surface_heatmap: close %s", heatmap_file);
+    }
+
+    return 0;
+}
+
+static void display_surface_scan(wdfw_context *context,
+    surface_scanner *scanner)
+{
+    surface_scan_header *header = &scanner->header;
+    char line[SURFACE_SCAN_MAP_WIDTH + 1];
+    uint32_t zone_nr;
+
+    print_wdfw_output(context, "Heatmap, %llu sectors per character " \
+        "(%c <5 ms %c <20 ms %c <50 ms %c <200 ms %c <600 ms %c slower " \
+        "%c errors):\n", (unsigned long long) header->sectors_per_zone,
+        zone_characters[0], zone_characters[1], zone_characters[2],
+        zone_characters[3], zone_characters[4], zone_characters[5],
+        SURFACE_SCAN_ERROR_CHARACTER);
+
+    for (zone_nr = 0; zone_nr < header->number_of_zones;
+        zone_nr += SURFACE_SCAN_MAP_WIDTH) {
+        unsigned int i;
+        for (i = 0; i < SURFACE_SCAN_MAP_WIDTH &&
+            zone_nr + i < header->number_of_zones; ++i) {
+            line[i] = get_zone_character(&scanner->zones[zone_nr + i]);
+        }
+        line[i] = '\0';
+
+        print_wdfw_output(context, "%12llu |%s|\n",
+            (unsigned long long) (zone_nr * header->sectors_per_zone), line);
+    }
+
+    uint64_t slow_us = (uint64_t) header->slow_ms * 1000;
+    unsigned int reported = 0;
+    for (zone_nr = 0; zone_nr < header->number_of_zones; ++zone_nr) {
+        surface_scan_zone *zone = &scanner->zones[zone_nr];
+        if (zone->errors == 0 && zone->max_latency_us < slow_us) {
+            continue;
+        }
+
+        uint64_t first_lba = zone_nr * header->sectors_per_zone;
+        uint64_t last_lba = first_lba + header->sectors_per_zone - 1;
+        if (last_lba >= header->number_of_sectors) {
+            last_lba = header->number_of_sectors - 1;
+        }
+        uint32_t successful = zone->reads - zone->errors;
+        print_wdfw_output(context, "Zone %u LBA %llu - %llu: %u reads, " \
+            "average %.1f ms, maximum %.1f ms",
+            zone_nr, (unsigned long long) first_lba,
+            (unsigned long long) last_lba,
+            zone->reads, successful > 0 ?
+            zone->total_latency_us / 1000.0 / successful : 0.0,
+            zone->max_latency_us / 1000.0);
+
+        if (zone->errors > 0) {
+            print_wdfw_output(context, ", %u failed, first at LBA %llu " \
+                "(ata status: 0x%02x ata error: 0x%02x)", zone->errors,
+                (unsigned long long) zone->error_lba, zone->status,
+                zone->error);
+        }
+        print_wdfw_output(context, "\n");
+        ++reported;
+    }
+
+    print_wdfw_output(context, "%u of %u zones slow or failed\n", reported,
+        header->number_of_zones);
+}
+
+static char get_zone_character(surface_scan_zone *zone)
+{
+    if (zone->errors > 0) {
+        return SURFACE_SCAN_ERROR_CHARACTER;
+    }
+
+    /* A zone shows its slowest read. */
+    int bucket;
+    for (bucket = SURFACE_SCAN_BUCKETS - 1; bucket >= 0; --bucket) {
+        if (zone->histogram[bucket] > 0) {
+            return zone_characters[bucket];
+        }
+    }
+
+    return SURFACE_SCAN_UNREAD_CHARACTER;
+}
+
+static uint64_t next_scan_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
@@ -0,0 +1,117 @@
+/* mkdtemp */
+#define _XOPEN_SOURCE 700
+
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "../includes/rom_fingerprint.h"
+#include "../includes/wdfw_context.h"
+
+/* Builds in the database, more than a rom has blocks. */
+#define TEST_BUILDS             70
+
+/* Hash of block_nr of build, the same for every build when shared. */
+#define TEST_BLOCK_HASH(build, block_nr, shared) \
+	(((shared) ? 0xb007ULL : (uint64_t) (build) + 1) << 16 | (block_nr))
+
+/* Write a block_hashes file of three blocks, block 0 shared by every build. */
+static int write_test_hashes(int directory_fd, const char *name,
+    uint64_t image_hash, unsigned int build);
+
+/* Operations: */
+/* Add TEST_BUILDS builds sharing block 0 to a new database */
+/* Look up an image holding all blocks of the last build under a new image
+ * hash, which has to pick the last build with every block matching */
+int main(void)
+{
+    wdfw_context context;
+    rom_fingerprint fingerprint;
+    rom_fingerprint_match match;
+    rom_fingerprint_db db;
+    char work_template[] = "/tmp/wd_firmware_test_XXXXXX";
+    char name[FINGERPRINT_NAME_SIZE];
+    int failed = 0;
+
+    init_wdfw_context(&context);
+    context.output = NULL;
+
+    if (mkdtemp(work_template) == NULL ||
+        (context.directory_fd = open(work_template,
+        O_RDONLY | O_DIRECTORY)) == -1) {
+        perror("main: mkdtemp");
+        exit(1);
+    }
+
+    unsigned int build;
+    for (build = 0; build < TEST_BUILDS; ++build) {
+        snprintf(name, sizeof(name), "build%u", build);
+        if (write_test_hashes(context.directory_fd, "hashes", build + 1,
+            build) != 0 ||
+            add_rom_fingerprint(&context, "fingerprints", name,
+            "hashes") != 0) {
+            fprintf(stderr, "main: Could not add %s: %s\n", name,
+                context.message);
+            exit(1);
+        }
+    }
+
+    if (write_test_hashes(context.directory_fd, "query", 0xffff,
+        TEST_BUILDS - 1) != 0 ||
+        load_rom_fingerprint(&context, "query", &fingerprint) != 0 ||
+        open_rom_fingerprint_db(&context, "fingerprints", &db) != 0 ||
+        match_rom_fingerprint(&context, &db, &fingerprint, &match) != 0) {
+        fprintf(stderr, "main: Could not match the query: %s\n",
+            context.message);
+        exit(1);
+    }
+
+    if (!match.found || match.exact || match.build != TEST_BUILDS - 1 ||
+        match.matching_blocks != 3) {
+        fprintf(stderr, "FAIL match_rom_fingerprint: build%u with %u of 3 " \
+            "blocks, expected build%u with 3\n", match.build,
+            match.matching_blocks, TEST_BUILDS - 1);
+        failed = 1;
+    } else {
+        printf("PASS match_rom_fingerprint: %u builds sharing a block\n",
+            TEST_BUILDS);
+    }
+
+    close_rom_fingerprint_db(&db);
+    unlinkat(context.directory_fd, "hashes", 0);
+    unlinkat(context.directory_fd, "query", 0);
+    unlinkat(context.directory_fd, "fingerprints", 0);
+    close(context.directory_fd);
+    rmdir(work_template);
+
+    return failed;
+}
+
+static int write_test_hashes(int directory_fd, const char *name,
+    uint64_t image_hash, unsigned int build)
+{
+    int fd = openat(directory_fd, name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    FILE *file = (fd == -1) ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    fprintf(file, "image %016llx\n", (unsigned long long) image_hash);
+
+    unsigned int block_nr;
+    for (block_nr = 0; block_nr < 3; ++block_nr) {
+        fprintf(file, "block_%02x %016llx\n", block_nr,
+            (unsigned long long) TEST_BLOCK_HASH(build, block_nr,
+            block_nr == 0));
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
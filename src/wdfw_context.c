@@ -0,0 +1,142 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/* Application specific */
+#include "includes/wdfw_context.h"
+#include "includes/drive_database.h"
+#include "includes/wd_info.h"
+
+/* Descriptions of the WDFW_ERROR_* codes, indexed by the negated code. */
+static const char *error_descriptions[] = {
+    "Success",
+    "Input/output error",
+    "Out of memory",
+    "Invalid file format",
+    "Invalid argument",
+    "Address is not part of a rom block",
+    "Address is part of a compressed rom block",
+    "Hard disk drive command failed",
+    "Hard disk drive is not supported",
+    "Could not start a thread",
+    "Verification failed"
+};
+
+void init_wdfw_context(wdfw_context *context)
+{
+    memset(context, 0, sizeof(wdfw_context));
+    context->directory_fd = AT_FDCWD;
+    context->output = stdout;
+    context->geometry = *default_rom_geometry();
+    context->detect_geometry = 1;
+    context->progress_fd = -1;
+    context->drive_commands = DRIVE_COMMAND_ALL;
+    context->drive_rom_type = ROMTYPE_SPI;
+}
+
+void clear_wdfw_error(wdfw_context *context)
+{
+    context->error = WDFW_OK;
+    context->system_error = 0;
+    context->message[0] = '\0';
+}
+
+int report_wdfw_error(wdfw_context *context, int error,
+    const char *format, ...)
+{
+    va_list arguments;
+
+    va_start(arguments, format);
+    vsnprintf(context->message, sizeof(context->message), format, arguments);
+    va_end(arguments);
+
+    context->error = error;
+    context->system_error = 0;
+    return error;
+}
+
+int report_wdfw_system_error(wdfw_context *context, int error,
+    const char *format, ...)
+{
+    int system_error = errno;
+    char description[128] = {0};
+    va_list arguments;
+
+    va_start(arguments, format);
+    int length = vsnprintf(context->message, sizeof(context->message), format,
+        arguments);
+    va_end(arguments);
+
+    /* strerror is not thread safe. */
+    if (strerror_r(system_error, description, sizeof(description)) != 0) {
+        snprintf(description, sizeof(description), "error %d", system_error);
+    }
+
+    if (length >= 0 && (size_t) length < sizeof(context->message)) {
+        snprintf(context->message + length, sizeof(context->message) - length,
+            ": %s", description);
+    }
+
+    context->error = error;
+    context->system_error = system_error;
+    return error;
+}
+
+int chain_wdfw_error(wdfw_context *context, const char *format, ...)
+{
+    char cause[WDFW_MESSAGE_SIZE];
+    va_list arguments;
+
+    memcpy(cause, context->message, sizeof(cause));
+
+    va_start(arguments, format);
+    int length = vsnprintf(context->message, sizeof(context->message), format,
+        arguments);
+    va_end(arguments);
+
+    /* Long chains are cut off, keeping the outermost descriptions. */
+    if (cause[0] != '\0' && length >= 0 &&
+        (size_t) length + sizeof(": ") < sizeof(context->message)) {
+        size_t remaining = sizeof(context->message) - length - sizeof(": ");
+
+        memcpy(context->message + length, ": ", sizeof(": ") - 1);
+        strncpy(context->message + length + sizeof(": ") - 1, cause,
+            remaining);
+        context->message[sizeof(context->message) - 1] = '\0';
+    }
+
+    /* An outer operation failing without a recorded cause. */
+    if (context->error == WDFW_OK) {
+        context->error = WDFW_ERROR_IO;
+    }
+
+    return context->error;
+}
+
+void print_wdfw_output(wdfw_context *context, const char *format, ...)
+{
+    va_list arguments;
+
+    if (context->output == NULL) {
+        return;
+    }
+
+    va_start(arguments, format);
+    vfprintf(context->output, format, arguments);
+    va_end(arguments);
+}
+
+const char *describe_wdfw_error(int error)
+{
+    if (error > 0 || -error >= (int) (sizeof(error_descriptions) /
+        sizeof(error_descriptions[0]))) {
+        return "Unknown error";
+    }
+
+    return error_descriptions[-error];
+}
@@ -0,0 +1,130 @@
+/* Generic libraries */
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Application specific */
+#include "includes/wdfw_progress.h"
+#include "includes/wdfw_context.h"
+
+/* Seconds elapsed from start to end. */
+static double elapsed_seconds(struct timespec *start, struct timespec *end);
+
+/* Write a complete record, disabling the channel when the reader is gone. */
+static void write_progress_record(wdfw_progress *progress, char *record,
+    int size);
+
+void start_wdfw_progress(wdfw_progress *progress, wdfw_context *context,
+    const char *operation, uint64_t total)
+{
+    char record[WDFW_PROGRESS_RECORD_SIZE];
+
+    progress->fd = context->progress_fd;
+    progress->operation = operation;
+    progress->total = total;
+    progress->done = 0;
+
+    if (progress->fd < 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &progress->start);
+    progress->chunk_start = progress->start;
+
+    int size = snprintf(record, sizeof(record),
+        "{\"op\":\"%s\",\"event\":\"start\",\"total\":%llu}\n", operation,
+        (unsigned long long) total);
+    write_progress_record(progress, record, size);
+}
+
+void begin_wdfw_progress_chunk(wdfw_progress *progress)
+{
+    if (progress->fd >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &progress->chunk_start);
+    }
+}
+
+void update_wdfw_progress(wdfw_progress *progress, uint64_t offset,
+    uint64_t bytes)
+{
+    char record[WDFW_PROGRESS_RECORD_SIZE];
+    struct timespec now;
+
+    progress->done += bytes;
+
+    if (progress->fd < 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double latency = elapsed_seconds(&progress->chunk_start, &now);
+    double elapsed = elapsed_seconds(&progress->start, &now);
+    double rate = (latency > 0) ? bytes / latency : 0;
+    double average_rate = (elapsed > 0) ? progress->done / elapsed : 0;
+    double eta = (average_rate > 0 && progress->total > progress->done) ?
+        (progress->total - progress->done) / average_rate : 0;
+
+    /* The next chunk starts where this one was reported. */
+    progress->chunk_start = now;
+
+    int size = snprintf(record, sizeof(record),
+        "{\"op\":\"%s\",\"event\":\"chunk\",\"offset\":%llu,\"bytes\":%llu," \
+        "\"done\":%llu,\"total\":%llu,\"latency_us\":%llu,\"mbps\":%.3f," \
+        "\"avg_mbps\":%.3f,\"eta_s\":%.3f}\n", progress->operation,
+        (unsigned long long) offset, (unsigned long long) bytes,
+        (unsigned long long) progress->done,
+        (unsigned long long) progress->total,
+        (unsigned long long) (latency * 1e6), rate / 1e6, average_rate / 1e6,
+        eta);
+    write_progress_record(progress, record, size);
+}
+
+void finish_wdfw_progress(wdfw_progress *progress, int result)
+{
+    char record[WDFW_PROGRESS_RECORD_SIZE];
+    struct timespec now;
+
+    if (progress->fd < 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double elapsed = elapsed_seconds(&progress->start, &now);
+
+    int size = snprintf(record, sizeof(record),
+        "{\"op\":\"%s\",\"event\":\"end\",\"result\":%d,\"done\":%llu," \
+        "\"elapsed_s\":%.3f,\"avg_mbps\":%.3f}\n", progress->operation,
+        result, (unsigned long long) progress->done, elapsed,
+        (elapsed > 0) ? progress->done / elapsed / 1e6 : 0);
+    write_progress_record(progress, record, size);
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* A record is written with a single write, so readers of a pipe never see
+ * records of concurrent operations interleave. With SIGPIPE ignored a reader
+ * that is gone fails the write with EPIPE and ends the records. */
+static void write_progress_record(wdfw_progress *progress, char *record,
+    int size)
+{
+    if (size <= 0 || size >= WDFW_PROGRESS_RECORD_SIZE) {
+        return;
+    }
+
+    ssize_t result;
+    do {
+        result = write(progress->fd, record, size);
+    } while (result == -1 && errno == EINTR);
+
+    if (result == -1) {
+        progress->fd = -1;
+    }
+}